@@ -26,7 +26,7 @@ va_is_dirty(void *va)
 
 // Fault any disk block that is read or written in to memory by
 // loading it from disk.
-// Hint: Use ide_read and BLKSECTS.
+// Hint: Use disk_read and BLKSECTS.
 static void
 bc_pgfault(struct UTrapframe *utf)
 {
@@ -46,8 +46,9 @@ bc_pgfault(struct UTrapframe *utf)
     addr = ROUNDDOWN(addr, PGSIZE);
     if (0 != (r = sys_page_alloc(env->env_id, addr, PTE_W | PTE_U | PTE_P)))
         panic("pgfault: %e!\n", r);
-    if (0 != (r = ide_read(blockno * BLKSECTS, addr, BLKSECTS)))
+    if (0 != (r = disk_read(blockno * BLKSECTS, addr, BLKSECTS)))
         panic("pgfault: %e!\n", r);
+    fsstats.fs_blocks_read++;
 
 	// Sanity check the block number. (exercise for the reader:
 	// why do we do this *after* reading the block in?)
@@ -63,11 +64,24 @@ bc_pgfault(struct UTrapframe *utf)
 // necessary, then clear the PTE_D bit using sys_page_map.
 // If the block is not in the block cache or is not dirty, does
 // nothing.
-// Hint: Use va_is_mapped, va_is_dirty, and ide_write.
+// Hint: Use va_is_mapped, va_is_dirty, and disk_write.
 // Hint: Use the PTE_USER constant when calling sys_page_map.
 // Hint: Don't forget to round addr down.
 void
 flush_block(void *addr)
+{
+	int r;
+
+	flush_block_async(addr);
+	if ((r = disk_drain()) < 0)
+		panic("flush_block: %e!\n", r);
+}
+
+// Like flush_block, but only start the write.  The block must not be
+// modified until disk_drain returns; callers flushing many blocks
+// queue them all and then drain once, so the disk sees them together.
+void
+flush_block_async(void *addr)
 {
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
 
@@ -81,11 +95,29 @@ flush_block(void *addr)
 
     static_assert(UTOP > (DISKMAP + DISKSIZE));
     addr = ROUNDDOWN(addr, PGSIZE);
-    if (0 != (r = ide_write(blockno * BLKSECTS, addr, BLKSECTS)))
+    // Clear PTE_D first: the write covers whatever the block holds when
+    // the device reads it, and a later store marks the block dirty again.
+    if (0 != (r = sys_page_map(env->env_id, addr, env->env_id, addr, PTE_USER)))
         panic("flush_block: %e!\n", r);
 
-    if (0 != (r = sys_page_map(env->env_id, addr, env->env_id, addr, PTE_USER)))
+    if (0 != (r = disk_write_async(blockno * BLKSECTS, addr, BLKSECTS)))
         panic("flush_block: %e!\n", r);
+    fsstats.fs_blocks_written++;
+}
+
+// Write back and evict every cached block past the bitmap.  The
+// superblock and bitmap stay: the fault handler itself reads them.
+void
+bc_drop(void)
+{
+	uint32_t i, first = 2 + (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+	int r;
+
+	fs_sync();
+	for (i = first; i < super->s_nblocks; i++)
+		if (va_is_mapped(diskaddr(i))
+		    && (r = sys_page_unmap(0, diskaddr(i))) < 0)
+			panic("bc_drop: %e", r);
 }
 
 // Test that the block cache works, by smashing the superblock and
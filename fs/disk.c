@@ -0,0 +1,134 @@
+/*
+ * Block device layer.
+ *
+ * When the kernel has a DMA disk driver attached (AHCI or virtio-blk),
+ * requests go through sys_disk_submit and sys_disk_reap, and up to
+ * DISK_NTAGS writes may be in flight while the file system flushes the
+ * block cache.  Those writes are submitted with DISK_DEFER, so the
+ * device is started once per batch rather than once per block.
+ * Otherwise we fall back on the PIO IDE driver in ide.c.
+ */
+
+#include "fs.h"
+
+static bool use_dma;
+static uint32_t inflight;	// tags submitted but not yet reaped
+
+void
+disk_init(void)
+{
+	uint32_t done;
+
+	if (sys_disk_reap(&done) == 0) {
+		use_dma = 1;
+		cprintf("FS: using DMA disk\n");
+		return;
+	}
+
+	// Find a JOS disk.  Use the second IDE disk (number 1) if available.
+	if (ide_probe_disk1())
+		ide_set_disk(1);
+	else
+		ide_set_disk(0);
+}
+
+// Reap completed requests, yielding while any tag in mask is busy.
+static int
+disk_wait(uint32_t mask)
+{
+	uint32_t done;
+	int r;
+
+	while (inflight & mask) {
+		r = sys_disk_reap(&done);
+		inflight &= ~done;
+		if (r < 0)
+			return r;
+		if (inflight & mask)
+			sys_yield();
+	}
+	return 0;
+}
+
+// Submit one request, reaping while every tag is busy.
+static int
+disk_submit(uint32_t secno, const void *va, size_t nsecs, int flags)
+{
+	uint32_t done;
+	int r;
+
+	while ((r = sys_disk_submit(secno, (void *) va, nsecs, flags))
+	       == -E_RETRY) {
+		if ((r = sys_disk_reap(&done)) < 0)
+			return r;
+		if (!(inflight & done))
+			sys_yield();
+		inflight &= ~done;
+	}
+	if (r >= 0)
+		inflight |= 1 << r;
+	return r;
+}
+
+// Start writing nsecs sectors from src and return without waiting for
+// the disk.  src must be page-aligned and must not be modified until
+// disk_drain returns.  Without DMA the write is synchronous.
+int
+disk_write_async(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	fsstats.fs_disk_writes++;
+	fsstats.fs_sectors_written += nsecs;
+	if (!use_dma)
+		return ide_write(secno, src, nsecs);
+
+	while (nsecs > 0) {
+		size_t n = MIN(nsecs, DISK_MAXSECTS);
+		if ((r = disk_submit(secno, src, n, DISK_WRITE | DISK_DEFER)) < 0)
+			return r;
+		secno += n;
+		src = (const char *) src + n * SECTSIZE;
+		nsecs -= n;
+	}
+	return 0;
+}
+
+// Wait for all outstanding requests to finish.
+int
+disk_drain(void)
+{
+	return use_dma ? disk_wait(inflight) : 0;
+}
+
+int
+disk_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	fsstats.fs_disk_reads++;
+	fsstats.fs_sectors_read += nsecs;
+	if (!use_dma)
+		return ide_read(secno, dst, nsecs);
+
+	while (nsecs > 0) {
+		size_t n = MIN(nsecs, DISK_MAXSECTS);
+		if ((r = disk_submit(secno, dst, n, 0)) < 0
+		    || (r = disk_wait(1 << r)) < 0)
+			return r;
+		secno += n;
+		dst = (char *) dst + n * SECTSIZE;
+		nsecs -= n;
+	}
+	return 0;
+}
+
+int
+disk_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	if ((r = disk_write_async(secno, src, nsecs)) < 0)
+		return r;
+	return disk_drain();
+}
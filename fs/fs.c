@@ -102,11 +102,8 @@ fs_init(void)
 {
 	static_assert(sizeof(struct File) == 256);
 
-	// Find a JOS disk.  Use the second IDE disk (number 1) if available.
-	if (ide_probe_disk1())
-		ide_set_disk(1);
-	else
-		ide_set_disk(0);
+	// Find a JOS disk: the DMA disk if the kernel has one, else IDE.
+	disk_init();
 	
 	bc_init();
 
@@ -193,12 +190,35 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
             return -E_NO_DISK;
         *pdiskbno = r;
     }
+    if (va_is_mapped(diskaddr(*pdiskbno)))
+        fsstats.fs_bc_hits++;
+    else
+        fsstats.fs_bc_misses++;
     if (NULL != blk)
         *blk = (char *)(DISKMAP + BLKSIZE * (*pdiskbno));
 
     return 0;
 }
 
+// Set *diskbno to the disk block holding the filebno'th block of f,
+// or to 0 if that block is not allocated.  Never allocates.
+//
+// Returns 0 on success, -E_INVAL if filebno is out of range.
+int
+file_bmap(struct File *f, uint32_t filebno, uint32_t *diskbno)
+{
+	uint32_t *pdiskbno;
+	int r;
+
+	*diskbno = 0;
+	if ((r = file_block_walk(f, filebno, &pdiskbno, 0)) == -E_NOT_FOUND)
+		return 0;
+	if (r < 0)
+		return r;
+	*diskbno = *pdiskbno;
+	return 0;
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 //
 // Returns 0 and sets *file on success, < 0 on error.  Errors are:
@@ -474,18 +494,20 @@ file_set_size(struct File *f, off_t newsize)
 void
 file_flush(struct File *f)
 {
-	int i;
+	int i, r;
 	uint32_t *pdiskbno;
 
 	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
 		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
 		    pdiskbno == NULL || *pdiskbno == 0)
 			continue;
-		flush_block(diskaddr(*pdiskbno));
+		flush_block_async(diskaddr(*pdiskbno));
 	}
-	flush_block(f);
+	flush_block_async(f);
 	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+		flush_block_async(diskaddr(f->f_indirect));
+	if ((r = disk_drain()) < 0)
+		panic("file_flush: %e", r);
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -510,8 +532,10 @@ file_remove(const char *path)
 void
 fs_sync(void)
 {
-	int i;
+	int i, r;
 	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+		flush_block_async(diskaddr(i));
+	if ((r = disk_drain()) < 0)
+		panic("fs_sync: %e", r);
 }
 
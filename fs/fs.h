@@ -13,6 +13,7 @@
 
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
+extern struct Fsstats fsstats;	// counters served by FSREQ_STATS
 
 /* ide.c */
 bool	ide_probe_disk1(void);
@@ -20,16 +21,26 @@ void	ide_set_disk(int diskno);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
 
+/* disk.c */
+void	disk_init(void);
+int	disk_read(uint32_t secno, void *dst, size_t nsecs);
+int	disk_write(uint32_t secno, const void *src, size_t nsecs);
+int	disk_write_async(uint32_t secno, const void *src, size_t nsecs);
+int	disk_drain(void);
+
 /* bc.c */
 void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	flush_block_async(void *addr);
+void	bc_drop(void);
 void	bc_init(void);
 
 /* fs.c */
 void	fs_init(void);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+int	file_bmap(struct File *f, uint32_t filebno, uint32_t *diskbno);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset);
@@ -0,0 +1,348 @@
+/*
+ * JOS file system defragmenter
+ *
+ * 'fsdefrag fs.img' reports how fragmented each file of a JOS disk
+ * image is and how the free space is distributed.  With -w it also
+ * rewrites the image in place.  The rewritten layout puts each
+ * directory first, then the blocks of its regular files in
+ * directory-entry order, then its subdirectories, laid out the same way.
+ * Each file's indirect block sits just before the data it maps, and its
+ * data blocks are consecutive, so reading a file sequentially reads
+ * consecutive sectors.  Empty directory entries are squeezed out, and
+ * all free space ends up as a single run at the end of the disk.
+ *
+ * The image must not be in use by a running JOS.
+ */
+
+// We don't actually want to define off_t!
+#define off_t xxx_off_t
+#define bool xxx_bool
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#undef off_t
+#undef bool
+
+// Prevent inc/types.h, included from inc/fs.h,
+// from attempting to redefine types defined in the host's inttypes.h.
+#define JOS_INC_TYPES_H
+// Typedef the types that inc/mmu.h needs.
+typedef uint32_t physaddr_t;
+typedef uint32_t off_t;
+typedef int bool;
+
+#include <inc/mmu.h>
+#include <inc/fs.h>
+
+#define ROUNDUP(n, v) ((n) - 1 + (v) - ((n) - 1) % (v))
+
+uint32_t nblocks, nbitblocks;
+char *diskmap;			// the image
+char *newmap;			// the rewritten image, built in memory
+uint32_t nextblock;		// next free block in newmap
+struct Super *super;
+uint32_t *bitmap;
+
+// Fragmentation totals
+int nfiles, nfragmented, nextents;
+
+void
+panic(const char *fmt, ...)
+{
+        va_list ap;
+
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+	abort();
+}
+
+void *
+diskblock(char *map, uint32_t blockno)
+{
+	if (blockno == 0 || blockno >= nblocks)
+		panic("bad block number %u", blockno);
+	return map + blockno * BLKSIZE;
+}
+
+uint32_t
+nfileblocks(struct File *f)
+{
+	return ROUNDUP(f->f_size, BLKSIZE) / BLKSIZE;
+}
+
+// Return the disk block holding block i of f in 'map', 0 if none.
+uint32_t
+filebno(char *map, struct File *f, uint32_t i)
+{
+	if (i < NDIRECT)
+		return f->f_direct[i];
+	if (f->f_indirect == 0)
+		return 0;
+	return ((uint32_t *) diskblock(map, f->f_indirect))[i - NDIRECT];
+}
+
+// Call fn on each entry of directory 'dir' in the original image,
+// and recursively on the entries of its subdirectories.
+void
+walkdir(const char *path, struct File *dir,
+	void (*fn)(const char *path, struct File *f))
+{
+	char child[MAXPATHLEN];
+	struct File *ents;
+	uint32_t i, j, bno;
+
+	for (i = 0; i < nfileblocks(dir); i++) {
+		if ((bno = filebno(diskmap, dir, i)) == 0)
+			continue;
+		ents = diskblock(diskmap, bno);
+		for (j = 0; j < BLKFILES; j++) {
+			if (!ents[j].f_name[0])
+				continue;
+			snprintf(child, sizeof child, "%s%s%s", path,
+				 strcmp(path, "/") ? "/" : "", ents[j].f_name);
+			fn(child, &ents[j]);
+			if (ents[j].f_type == FTYPE_DIR)
+				walkdir(child, &ents[j], fn);
+		}
+	}
+}
+
+// Count the extents of f: runs of blocks that are consecutive both in
+// the file and on disk.
+void
+reportfile(const char *path, struct File *f)
+{
+	uint32_t i, bno, prev = 0;
+	int extents = 0;
+
+	for (i = 0; i < nfileblocks(f); i++) {
+		if ((bno = filebno(diskmap, f, i)) == 0)
+			continue;
+		if (extents == 0 || bno != prev + 1)
+			extents++;
+		prev = bno;
+	}
+
+	nfiles++;
+	nextents += extents;
+	if (extents > 1) {
+		nfragmented++;
+		printf("%6u blocks %4d extents  %s%s\n", nfileblocks(f),
+		       extents, path, f->f_type == FTYPE_DIR ? "/" : "");
+	}
+}
+
+void
+report(void)
+{
+	uint32_t b, run = 0, nfree = 0, nruns = 0, largest = 0;
+	int hist[32], i;
+
+	nfiles = nfragmented = nextents = 0;
+	reportfile("/", &super->s_root);
+	walkdir("/", &super->s_root, reportfile);
+	if (nfiles)
+		printf("%d of %d files fragmented, %.2f extents per file\n",
+		       nfragmented, nfiles, (double) nextents / nfiles);
+
+	memset(hist, 0, sizeof hist);
+	for (b = 2 + nbitblocks; b <= nblocks; b++) {
+		if (b < nblocks && (bitmap[b / 32] & (1 << (b % 32)))) {
+			run++;
+			continue;
+		}
+		if (run) {
+			for (i = 0; (2u << i) <= run; i++)
+				;
+			hist[i]++;
+			nruns++;
+			nfree += run;
+			if (run > largest)
+				largest = run;
+		}
+		run = 0;
+	}
+	printf("free: %u blocks in %u extents, largest %u\n",
+	       nfree, nruns, largest);
+	for (i = 0; i < 32; i++)
+		if (hist[i])
+			printf("  %6u..%u: %d\n", 1u << i, (2u << i) - 1, hist[i]);
+}
+
+uint32_t
+newblock(void)
+{
+	if (nextblock >= nblocks)
+		panic("out of disk blocks");
+	return nextblock++;
+}
+
+// Give f consecutive blocks in the new image and point f at them.
+// The contents come from 'data' if it is not NULL, else from f's
+// current blocks in the original image.  Holes stay holes.
+void
+movefile(struct File *f, const char *data)
+{
+	uint32_t i, n = nfileblocks(f), bno, *ind = NULL;
+	uint32_t old[NDIRECT + NINDIRECT];
+
+	if (n > NDIRECT + NINDIRECT)
+		panic("%s: bad size %u", f->f_name, f->f_size);
+	// Remember the old blocks before f is pointed at new ones; with
+	// 'data' every block is present.
+	for (i = 0; i < n; i++)
+		old[i] = data ? ~0 : filebno(diskmap, f, i);
+
+	memset(f->f_direct, 0, sizeof f->f_direct);
+	f->f_indirect = 0;
+	if (n > NDIRECT) {
+		f->f_indirect = newblock();
+		ind = diskblock(newmap, f->f_indirect);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (old[i] == 0)
+			continue;
+		bno = newblock();
+		memcpy(diskblock(newmap, bno),
+		       data ? data + i * BLKSIZE : diskblock(diskmap, old[i]),
+		       BLKSIZE);
+		if (i < NDIRECT)
+			f->f_direct[i] = bno;
+		else
+			ind[i - NDIRECT] = bno;
+	}
+}
+
+// Lay out directory 'dir' followed by its files and subdirectories.
+void
+movedir(struct File *dir)
+{
+	uint32_t i, j, n = 0, bno, size;
+	struct File *ents, *old;
+
+	// Collect the live entries
+	size = nfileblocks(dir) * BLKSIZE;
+	if ((ents = calloc(1, size ? size : 1)) == NULL)
+		panic("out of memory");
+	for (i = 0; i < nfileblocks(dir); i++) {
+		if ((bno = filebno(diskmap, dir, i)) == 0)
+			continue;
+		old = diskblock(diskmap, bno);
+		for (j = 0; j < BLKFILES; j++)
+			if (old[j].f_name[0])
+				ents[n++] = old[j];
+	}
+
+	// Place the directory itself first, then its contents; the
+	// entries are copied into place again once they are final.
+	dir->f_size = ROUNDUP(n * sizeof(struct File), BLKSIZE);
+	movefile(dir, (char *) ents);
+	for (i = 0; i < n; i++)
+		if (ents[i].f_type != FTYPE_DIR)
+			movefile(&ents[i], NULL);
+	for (i = 0; i < n; i++)
+		if (ents[i].f_type == FTYPE_DIR)
+			movedir(&ents[i]);
+	for (i = 0; i < nfileblocks(dir); i++)
+		memcpy(diskblock(newmap, filebno(newmap, dir, i)),
+		       (char *) ents + i * BLKSIZE, BLKSIZE);
+	free(ents);
+}
+
+void
+rewrite(void)
+{
+	uint32_t i, *newbitmap;
+	int r;
+
+	if ((newmap = calloc(nblocks, BLKSIZE)) == NULL)
+		panic("out of memory");
+
+	// Boot block and superblock stay; the bitmap is rebuilt
+	memcpy(newmap, diskmap, 2 * BLKSIZE);
+	nextblock = 2 + nbitblocks;
+	movedir(&((struct Super *) diskblock(newmap, 1))->s_root);
+
+	newbitmap = diskblock(newmap, 2);
+	memset(newbitmap, 0xFF, nbitblocks * BLKSIZE);
+	for (i = 0; i < nextblock; i++)
+		newbitmap[i / 32] &= ~(1 << (i % 32));
+
+	memcpy(diskmap, newmap, nblocks * BLKSIZE);
+	if ((r = msync(diskmap, nblocks * BLKSIZE, MS_SYNC)) < 0)
+		panic("msync: %s", strerror(errno));
+	free(newmap);
+}
+
+void
+opendisk(const char *name, bool writable)
+{
+	int diskfd;
+	struct stat st;
+	struct Super s;
+
+	if ((diskfd = open(name, writable ? O_RDWR : O_RDONLY)) < 0)
+		panic("open %s: %s", name, strerror(errno));
+	if (fstat(diskfd, &st) < 0)
+		panic("stat %s: %s", name, strerror(errno));
+	if (pread(diskfd, &s, sizeof s, BLKSIZE) != sizeof s
+	    || s.s_magic != FS_MAGIC)
+		panic("%s: not a JOS file system", name);
+	nblocks = s.s_nblocks;
+	if (nblocks < 3 || st.st_size < (off_t) nblocks * BLKSIZE)
+		panic("%s: bad block count %u", name, nblocks);
+	nbitblocks = ROUNDUP(nblocks, BLKBITSIZE) / BLKBITSIZE;
+
+	if ((diskmap = mmap(NULL, nblocks * BLKSIZE,
+			    PROT_READ | (writable ? PROT_WRITE : 0),
+			    MAP_SHARED, diskfd, 0)) == MAP_FAILED)
+		panic("mmap %s: %s", name, strerror(errno));
+	close(diskfd);
+
+	super = (struct Super *) (diskmap + BLKSIZE);
+	bitmap = (uint32_t *) (diskmap + 2 * BLKSIZE);
+}
+
+void
+usage(void)
+{
+	fprintf(stderr, "Usage: fsdefrag [-w] fs.img\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool writable = 0;
+
+	assert(BLKSIZE % sizeof(struct File) == 0);
+
+	if (argc == 3 && strcmp(argv[1], "-w") == 0) {
+		writable = 1;
+		argv++;
+		argc--;
+	}
+	if (argc != 2)
+		usage();
+
+	opendisk(argv[1], writable);
+	report();
+	if (writable) {
+		rewrite();
+		printf("rewrote %s, %u blocks in use\n", argv[1], nextblock);
+		report();
+	}
+	return 0;
+}
@@ -45,6 +45,8 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
+struct Fsstats fsstats;
+
 // Virtual address at which to receive page mappings containing client requests.
 union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
 
@@ -316,6 +318,82 @@ serve_sync(envid_t envid, union Fsipc *req)
 	return 0;
 }
 
+// Return the disk block number of block req->req_blockno of
+// req->req_fileid, 0 if that block is not allocated, or the file's
+// indirect block if req_blockno is FSBMAP_INDIRECT.  Used by fsck.
+int
+serve_bmap(envid_t envid, struct Fsreq_bmap *req)
+{
+	struct OpenFile *o;
+	uint32_t diskbno;
+	int r;
+
+	if (debug)
+		cprintf("serve_bmap %08x %08x %08x\n", envid, req->req_fileid, req->req_blockno);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_blockno == FSBMAP_INDIRECT)
+		return o->o_file->f_indirect;
+	if ((r = file_bmap(o->o_file, req->req_blockno, &diskbno)) < 0)
+		return r;
+	return diskbno;
+}
+
+// Copy bitmap block req->req_blockno to ipc->bitmapRet and return
+// the number of blocks on the disk.
+int
+serve_bitmap(envid_t envid, union Fsipc *ipc)
+{
+	uint32_t bno = ipc->bitmap.req_blockno;
+
+	if (debug)
+		cprintf("serve_bitmap %08x %08x\n", envid, bno);
+
+	if (bno >= (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE)
+		return -E_INVAL;
+	memmove(ipc->bitmapRet.ret_bits, bitmap + bno * (BLKSIZE / 4), BLKSIZE);
+	return super->s_nblocks;
+}
+
+int
+serve_drop_cache(envid_t envid, union Fsipc *ipc)
+{
+	if (debug)
+		cprintf("serve_drop_cache %08x\n", envid);
+
+	bc_drop();
+	return 0;
+}
+
+// Return the server's statistics in ipc->statsRet, after filling in
+// the gauges.
+int
+serve_stats(envid_t envid, union Fsipc *ipc)
+{
+	uint32_t i;
+
+	if (debug)
+		cprintf("serve_stats %08x\n", envid);
+
+	fsstats.fs_cached_blocks = fsstats.fs_dirty_blocks = 0;
+	for (i = 1; i < super->s_nblocks; i++)
+		if (va_is_mapped(diskaddr(i))) {
+			fsstats.fs_cached_blocks++;
+			if (va_is_dirty(diskaddr(i)))
+				fsstats.fs_dirty_blocks++;
+		}
+
+	// The server holds one reference to each Fd page; clients the rest
+	fsstats.fs_open_files = 0;
+	for (i = 0; i < MAXOPEN; i++)
+		if (pageref(opentab[i].o_fd) > 1)
+			fsstats.fs_open_files++;
+
+	ipc->statsRet.ret_stats = fsstats;
+	return 0;
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
@@ -327,14 +405,31 @@ fshandler handlers[] = {
 	[FSREQ_STAT] =		serve_stat,
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_REMOVE] =	(fshandler)serve_remove,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_BMAP] =		(fshandler)serve_bmap,
+	[FSREQ_BITMAP] =	serve_bitmap,
+	[FSREQ_STATS] =		serve_stats,
+	[FSREQ_DROP_CACHE] =	serve_drop_cache
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
+// Count a request of type req that took 'cycles' to serve.
+static void
+count_request(uint32_t req, uint64_t cycles)
+{
+	int i;
+
+	for (i = 0; i < FSSTAT_NLAT - 1 && (cycles >> (i + 1)); i++)
+		;
+	fsstats.fs_nreq[req]++;
+	fsstats.fs_lat[req][i]++;
+}
+
 void
 serve(void)
 {
 	uint32_t req, whom;
+	uint64_t start;
 	int perm, r;
 	void *pg;
 
@@ -353,6 +448,7 @@ serve(void)
 		}
 
 		pg = NULL;
+		start = read_tsc();
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
 		} else if (req < NHANDLERS && handlers[req]) {
@@ -361,6 +457,8 @@ serve(void)
 			cprintf("Invalid request code %d from %08x\n", whom, req);
 			r = -E_INVAL;
 		}
+		if (req < NFSREQ)
+			count_request(req, read_tsc() - start);
 		ipc_send(whom, r, pg, perm);
 		sys_page_unmap(0, fsreq);
 	}
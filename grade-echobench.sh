@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# Measure request rates through user/echosrv from the host: round trips
+# of small requests on one connection, and connections that each carry
+# one request.  The results are compared with echobench.baseline as
+# grade-netbench.sh does; remove echobench.baseline to start over.
+#
+# 'NIC=e1000 sh grade-echobench.sh' runs it on an e1000 instead, and
+# NIC=virtio on a virtio-net device.  ECHOBENCH_ROUNDS and
+# ECHOBENCH_CONNS set how many requests each test makes.
+# After 'make clean', 'LABDEFS=-DJIF_DROP=100 sh grade-echobench.sh'
+# has the network server lose one IP frame in 100, and -DJIF_REORDER=n
+# reorder one in n (see net/lwip/jos/jif/jif.c), to measure how TCP
+# recovers.
+
+case "$NIC" in
+e1000)	model=e1000 ;;
+virtio)	model=virtio ;;
+*)	model=i82559er ;;
+esac
+port=`perl -e 'print int(1024 + rand() * (65535 - 1024)), "\n"'`
+qemuopts="-hda obj/kern/kernel.img -hdb obj/fs/fs.img"
+qemuopts="$qemuopts -net user -net nic,model=$model -redir tcp:$port::7"
+. ./grade-functions.sh
+
+timeout=300
+brkfn=
+rounds=${ECHOBENCH_ROUNDS:-2000}
+conns=${ECHOBENCH_CONNS:-200}
+
+$make
+
+# Print '<test> <value> ops/s' lines for requests of echosrv's buffer
+# size on 127.0.0.1:$1, $2 round trips on one connection and then $3
+# connections.
+echoclient () {
+	perl -e '
+	use IO::Socket::INET;
+	use Socket qw(IPPROTO_TCP TCP_NODELAY);
+	use Time::HiRes qw(time);
+
+	my ($port, $rounds, $conns) = @ARGV;
+	my $msg = "x" x 32;
+
+	sub open1 {
+		my $s = IO::Socket::INET->new(PeerAddr => "127.0.0.1",
+			PeerPort => $port, Proto => "tcp")
+			or die "connect: $!\n";
+		setsockopt($s, IPPROTO_TCP, TCP_NODELAY, 1);
+		return $s;
+	}
+
+	sub echo1 {
+		my $s = shift;
+		my $got = "";
+		syswrite($s, $msg) == length($msg) or die "write: $!\n";
+		while (length($got) < length($msg)) {
+			sysread($s, $got, length($msg) - length($got),
+				length($got)) or die "read: $!\n";
+		}
+		$got eq $msg or die "echoed the wrong data\n";
+	}
+
+	my $s = open1();
+	echo1($s);
+	my $t0 = time;
+	echo1($s) for 1 .. $rounds;
+	printf "echobench round-trip %d ops/s\n", $rounds / (time - $t0);
+	close($s);
+
+	$t0 = time;
+	for (1 .. $conns) {
+		$s = open1();
+		echo1($s);
+		close($s);
+	}
+	printf "echobench connect %d ops/s\n", $conns / (time - $t0);
+	' "$@"
+}
+
+check_echobench () {
+	waited=0
+	while ! egrep 'bound' jos.out >/dev/null; do
+		if [ $waited -ge 30 ]; then
+			kill $PID
+			wait 2> /dev/null
+			fail "echosrv did not start"
+			return
+		fi
+		sleep 1
+		waited=`expr $waited + 1`
+	done
+
+	echoclient $port $rounds $conns > echobench.out
+	kill $PID
+	wait 2> /dev/null
+	if [ `wc -l < echobench.out` -ne 2 ]; then
+		fail "no results"
+		return
+	fi
+	pass
+
+	if [ ! -f echobench.baseline ]; then
+		cp echobench.out echobench.baseline
+		echo "saved results as echobench.baseline:"
+		cat echobench.out
+	else
+		benchcompare echobench.baseline echobench.out
+	fi
+}
+
+runtest1 -tag 'echobench' echosrv -check check_echobench
+
+showfinal
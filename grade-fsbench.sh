@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Run user/fsbench and compare its results with fsbench.baseline.  If
+# there is no baseline yet, this run's results become the baseline;
+# remove fsbench.baseline to start over.  'DISK=ahci sh grade-fsbench.sh'
+# benchmarks another disk driver (see DISK in GNUmakefile).
+#
+# Expect a few percent of noise between runs, more under a loaded host.
+
+. ./grade-functions.sh
+qemuopts="-hda obj/kern/kernel.img `$make -s --no-print-directory print-qemudisk`"
+
+timeout=300
+brkfn=
+
+$make
+
+runtest1 -tag 'fsbench' fsbench -DTEST_NO_NS -check runbench fsbench
+
+showfinal
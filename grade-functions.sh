@@ -250,3 +250,67 @@ runtest1 () {
 	runtest "$tag" "DEFS='-DTEST=_binary_obj_${dir}_${prog}_start' DEFS+='-DTESTSIZE=_binary_obj_${dir}_${prog}_size' $runtest1_defs" "$check" "$@"
 }
 
+#
+# Benchmarks
+#
+
+# Usage: benchcompare <baseline> <results>
+# Both files hold lines '<prefix> <test> <value> <unit>'.  Print each
+# result with its change against the baseline; a positive change is an
+# improvement.  Results in other units are shown for reference.
+benchcompare () {
+	echo "test                        value unit        baseline  change"
+	awk '
+	NR == FNR { base[$2] = $3; next }
+	{ better = 0 }
+	$4 == "KB/s" || $4 == "ops/s" || $4 == "frames/s" { better = 1 }
+	$4 == "us" || $4 == "cycles" || $4 == "cycles/KB" { better = -1 }
+	better == 0 {
+		printf "%-22s %10d %s\n", $2, $3, $4
+		next
+	}
+	!($2 in base) || base[$2] == 0 {
+		printf "%-22s %10d %-9s (new)\n", $2, $3, $4
+		next
+	}
+	{
+		pct = better * ($3 - base[$2]) * 100 / base[$2]
+		printf "%-22s %10d %-9s %10d %+7.1f%%\n", $2, $3, $4, base[$2], pct
+	}' "$1" "$2"
+}
+
+# Usage: runbench <name>
+# Check function for benchmarks run in asynchronous mode: wait up to
+# $timeout seconds for '<name> done', collect the '<name> ...' result
+# lines in <name>.out, and compare them with <name>.baseline, or save
+# them as the baseline if there is none yet.
+runbench () {
+	waited=0
+	while ! egrep "^$1 done" jos.out >/dev/null; do
+		if [ $waited -ge $timeout ]; then
+			kill $PID
+			wait 2> /dev/null
+			fail "$1 did not finish"
+			return
+		fi
+		sleep 1
+		waited=`expr $waited + 1`
+	done
+	kill $PID
+	wait 2> /dev/null
+
+	tr -d '\r' < jos.out | awk '$1 == "'$1'" && NF == 4' > $1.out
+	if [ ! -s $1.out ]; then
+		fail "no results"
+		return
+	fi
+	pass
+
+	if [ ! -f $1.baseline ]; then
+		cp $1.out $1.baseline
+		echo "saved results as $1.baseline:"
+		cat $1.out
+	else
+		benchcompare $1.baseline $1.out
+	fi
+}
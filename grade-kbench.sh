@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Run user/kbench and compare its results with kbench.baseline.  If
+# there is no baseline yet, this run's results become the baseline;
+# remove kbench.baseline to start over.
+#
+# The results are cycle counts, so compare runs on the same host.
+# Medians are stable to a few percent; the p99s much less so.
+
+qemuopts="-hda obj/kern/kernel.img -hdb obj/fs/fs.img"
+. ./grade-functions.sh
+
+timeout=300
+brkfn=
+
+$make
+
+runtest1 -tag 'kbench' kbench -DTEST_NO_NS -check runbench kbench
+
+showfinal
@@ -124,6 +124,13 @@ check_testinput() {
 	fi
 }
 
+check_testsockopt() {
+	wait_for_line '^testsockopt: ' || return
+	kill $PID
+	wait 2> /dev/null
+	checkregexps 'testsockopt: OK'
+}
+
 check_echosrv() {
 	if ! wait_for_line 'bound'; then
 		return
@@ -234,6 +241,10 @@ pts=10
 runtest1 -tag "testinput [100 packets]" -dir net testinput -DTEST_NO_NS \
 	-check check_testinput 100
 
+pts=5
+runtest1 -tag 'socket options [testsockopt]' testsockopt \
+	-check check_testsockopt
+
 pts=15
 runtest1 -tag 'tcp echo server [echosrv]' echosrv \
 	-check check_echosrv
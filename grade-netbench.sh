@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Run net/testflood and compare its transmit rates with
+# testflood.baseline.  If there is no baseline yet, this run's results
+# become the baseline; remove testflood.baseline to start over.
+#
+# Ring sizes are build-time options (see kern/e100.h, kern/e1000.h and
+# kern/virtio_net.h); to try others, 'make clean' and run e.g.
+# 'LABDEFS=-DTCB_MAX_NUM=32 sh grade-netbench.sh'.
+# 'NIC=e1000 sh grade-netbench.sh' runs it on an e1000 instead, and
+# NIC=virtio on a virtio-net device; with the e100's results as the
+# baseline, that compares the three.
+
+case "$NIC" in
+e1000)	model=e1000 ;;
+virtio)	model=virtio ;;
+*)	model=i82559er ;;
+esac
+qemuopts="-hda obj/kern/kernel.img -net user -net nic,model=$model"
+. ./grade-functions.sh
+
+timeout=300
+brkfn=
+
+$make
+
+runtest1 -tag 'testflood' -dir net testflood -DTEST_NO_NS \
+	-check runbench testflood
+
+showfinal
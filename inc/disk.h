@@ -0,0 +1,21 @@
+// See COPYRIGHT for copyright information.
+
+#ifndef JOS_INC_DISK_H
+#define JOS_INC_DISK_H
+
+#include <inc/mmu.h>
+
+// Interface between the file system server and the kernel's DMA disk
+// drivers (sys_disk_submit and sys_disk_reap).
+
+#define DISK_SECTSIZE	512		// bytes per sector
+#define DISK_NTAGS	32		// max requests in flight
+#define DISK_MAXPAGES	8		// max buffer pages per request
+#define DISK_MAXSECTS	(DISK_MAXPAGES * PGSIZE / DISK_SECTSIZE)
+
+// sys_disk_submit flags
+#define DISK_WRITE	0x1		// memory to disk (default is a read)
+#define DISK_DEFER	0x2		// don't start the device yet: a later
+					// submit or reap starts the batch
+
+#endif	// !JOS_INC_DISK_H
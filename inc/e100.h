@@ -0,0 +1,85 @@
+#ifndef JOS_INC_E100_H
+#define JOS_INC_E100_H
+
+// The Intel 8255x (e100) as the driver sees it: the SCB registers and
+// the command and receive frame blocks it reads and writes in memory.
+// Shared by the kernel driver and the user-space one in net/e100u.c.
+
+#include	<inc/types.h>
+
+#define PACKET_MAX_LEN 1524
+
+struct cb {
+    volatile uint16_t status;
+    uint16_t cmd;
+    uint32_t link;
+};
+
+#define CB_STATUS_C  0x8000 // command or frame complete
+
+union Tcb {
+    struct tcb_transmit {
+        struct cb cb;
+        uint32_t tbdarr;
+        uint16_t tcbbc;
+        uint8_t thrs;
+        uint8_t tbdcount;
+        char data[PACKET_MAX_LEN];
+    } tcb_transmit;
+
+    struct tcb_recieve {
+        struct cb cb;
+        uint32_t reserve;
+        uint16_t actualcount;
+        uint16_t size;
+        char data[PACKET_MAX_LEN];
+    } tcb_recieve;
+};
+
+// A transmit buffer descriptor, for flexible-mode TCBs
+struct e100_tbd {
+    uint32_t addr;
+    uint16_t size;
+    uint16_t el;
+};
+
+#define E100_NTBD 16    // TBDs in a gather send
+#define TBD_EL 0x01     // last TBD of the frame
+
+#define TCB_CMD_CS (0x01<<4)
+#define TCB_CMD_CC (0x01<<5)
+#define TCB_CMD_TRANS 0x0F04
+#define TCB_CMD_NOP  0x4000
+#define TCB_CMD_RI  0x4000
+#define TCB_CMD_CI  0x4000
+#define TCB_CMD_I  (0x01<<13)
+#define TCB_CMD_SF 0x0008
+#define TCB_CMD_RS 0x01
+#define TCB_CMD_RC 0x02
+
+#define TCB_MASK_S (0x01<<14)
+
+// SCB register offsets and bits
+#define SCB_STATUS  0x00
+#define SCB_STATACK 0x01
+#define SCB_CMD     0x02
+#define SCB_INTMASK 0x03
+#define SCB_GP      0x04    // general pointer
+#define SCB_PORT    0x08
+#define PORT_SELECTIVE_RESET 0x02 // stop both units, keep the setup
+#define SCB_STAT_CX  0x80   // command with the I bit done
+#define SCB_STAT_FR  0x40   // frame received
+#define SCB_STAT_CNA 0x20   // command unit left the active state
+#define SCB_STAT_RNR 0x10   // receive unit out of resources
+#define SCB_INT_M    0x01   // mask all interrupts
+
+#define RU_STATUS_READY 4
+
+#define TCB_STATUS_IDLE 0
+#define TCB_STATUS_SUSPENDED 2
+
+// Unit states in the SCB status word, as RU_STATUS_* and TCB_STATUS_*
+#define SCB_RUS(status) (((status) >> 2) & 0x0F)
+#define SCB_CUS(status) (((status) >> 5) & 0x03)
+
+#endif	// !JOS_INC_E100_H
@@ -56,6 +56,10 @@ struct Env {
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+	uint32_t env_ipc_timeout;	// time_msec to give up receiving, or 0
+
+	bool env_net_waiting;		// env is blocked in sys_net_wait
+	bool env_net_driver;		// env may drive the NIC itself
 };
 
 #endif // !JOS_INC_ENV_H
@@ -27,7 +27,9 @@
 
 #define E_RETRY	16	// Retry 
 #define E_BAD_PACKET	17	// Retry 
+#define E_IO		18	// Device reported an I/O error
+#define E_TIMEOUT	19	// Time ran out
 
-#define MAXERROR	17
+#define MAXERROR	19
 
 #endif	// !JOS_INC_ERROR_H */
@@ -29,6 +29,8 @@ struct FdFile {
 
 struct FdSock {
 	int sockid;
+	int rings;	// 1: data goes through the Nsrings at fd2data,
+			// -1: through IPC, 0: not decided yet
 };
 
 struct Fd {
@@ -70,7 +70,42 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Bmap returns the disk block holding a block of an open file
+	FSREQ_BMAP,
+	// Bitmap returns a block of the free-block bitmap on the request page
+	FSREQ_BITMAP,
+	// Stats returns a struct Fsstats on the request page
+	FSREQ_STATS,
+	// Drop-cache writes back and evicts every cached block except the
+	// superblock and bitmap, so benchmarks can start cold
+	FSREQ_DROP_CACHE,
+	NFSREQ
+};
+
+// Pass as req_blockno to FSREQ_BMAP to get the file's indirect block
+#define FSBMAP_INDIRECT	((uint32_t) -1)
+
+// File server statistics.  Counters only ever grow; tools print the
+// difference between two samples.  The gauges reflect the moment of the
+// FSREQ_STATS request.
+#define FSSTAT_NLAT	32	// latency buckets: [2^i, 2^(i+1)) TSC cycles
+
+struct Fsstats {
+	uint32_t fs_nreq[NFSREQ];	// requests served, by type
+	uint32_t fs_lat[NFSREQ][FSSTAT_NLAT];	// request latency histograms
+	uint32_t fs_bc_hits;		// file blocks found in the block cache
+	uint32_t fs_bc_misses;		// file blocks not in the block cache
+	uint32_t fs_blocks_read;
+	uint32_t fs_blocks_written;
+	uint32_t fs_disk_reads;		// disk read calls ...
+	uint32_t fs_disk_writes;	// ... and write calls
+	uint32_t fs_sectors_read;	// ... and the sectors they moved
+	uint32_t fs_sectors_written;
+	// Gauges
+	uint32_t fs_cached_blocks;
+	uint32_t fs_dirty_blocks;
+	uint32_t fs_open_files;
 };
 
 union Fsipc {
@@ -108,6 +143,19 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_bmap {
+		int req_fileid;
+		uint32_t req_blockno;
+	} bmap;
+	struct Fsreq_bitmap {
+		uint32_t req_blockno;	// index into the bitmap blocks
+	} bitmap;
+	struct Fsret_bitmap {
+		uint32_t ret_bits[BLKSIZE / 4];
+	} bitmapRet;
+	struct Fsret_stats {
+		struct Fsstats ret_stats;
+	} statsRet;
 };
 
 #endif /* !JOS_INC_FS_H */
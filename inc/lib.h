@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/disk.h>
 
 #define USED(x)		(void)(x)
 
@@ -54,9 +55,20 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_timed(void *rcv_pg, unsigned int msec);
 unsigned int sys_time_msec(void);
 int sys_net_send(void *src, size_t len);
-int sys_net_recv(void *dst, size_t len);
+int sys_net_recv(void *pg);
+int	sys_net_wait(int events);
+int	sys_net_send_sg(const struct net_sg *sg, int nsg, int flags);
+int	sys_net_tx_reap(uint32_t *done);
+int	sys_net_send_batch(const struct net_sg *frames, int n);
+int	sys_net_recv_batch(void *buf, size_t len);
+int	sys_net_features(void);
+int	sys_net_map_device(void *va);
+int	sys_page_alloc_dma(void *va, int npages, int perm);
+int	sys_disk_submit(uint32_t secno, void *va, size_t nsecs, int flags);
+int	sys_disk_reap(uint32_t *done);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t sys_exofork(void) __attribute__((always_inline));
@@ -75,6 +87,8 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_timed(envid_t *from_env_store, void *pg, int *perm_store,
+		       unsigned int msec);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -97,6 +111,10 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	fbmap(int fd, uint32_t blockno);
+int	fsbitmap(uint32_t blockno, void *buf);
+int	fsgetstats(struct Fsstats *st);
+int	fsdropcache(void);
 
 // pageref.c
 int	pageref(void *addr);
@@ -108,6 +126,8 @@ int     shutdown(int s, int how);
 int     connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     listen(int s, int backlog);
 int     socket(int domain, int type, int protocol);
+int     setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen);
+int     getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -119,6 +139,11 @@ int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen);
+int     nsipc_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen);
+int     nsipc_rings(int s, struct Nsrings *rings);
+void    nsipc_doorbell(void);
+void    nsipc_wait(void);
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
@@ -137,6 +162,9 @@ int	pipeisclosed(int pipefd);
 // wait.c
 void	wait(envid_t env);
 
+// tsc.c
+uint64_t	tsc_calibrate(void);
+
 /* File open modes */
 #define	O_RDONLY	0x0000		/* open for reading only */
 #define	O_WRONLY	0x0001		/* open for writing only */
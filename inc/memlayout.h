@@ -39,7 +39,9 @@
  *                     |         Kernel Stack         | RW/--  KSTKSIZE   |
  *                     | - - - - - - - - - - - - - - -|                 PTSIZE
  *                     |      Invalid Memory (*)      | --/--             |
- *    ULIM     ------> +------------------------------+ 0xef800000      --+
+ *                     | - - - - - - - - - - - - - - -|                   |
+ *                     |     Memory-mapped I/O        | RW/--  PTSIZE/2   |
+ * ULIM, MMIOBASE -->  +------------------------------+ 0xef800000      --+
  *                     |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
@@ -96,6 +98,11 @@
 #define KSTKSIZE	(8*PGSIZE)   		// size of a kernel stack
 #define ULIM		(KSTACKTOP - PTSIZE) 
 
+// Memory-mapped I/O.  Device registers are mapped uncached at the bottom
+// of the kernel stack's guard region; see mmio_map_region().
+#define MMIOBASE	ULIM
+#define MMIOLIM		(MMIOBASE + PTSIZE / 2)
+
 /*
  * User read-only mappings! Anything below here til UTOP are readonly to user.
  * They are global pages mapped in at env allocation time.
@@ -0,0 +1,55 @@
+// See COPYRIGHT for copyright information.
+
+#ifndef JOS_INC_NET_H
+#define JOS_INC_NET_H
+
+// Interface between the network server's input and output
+// environments and the kernel's network driver.
+
+#include <inc/types.h>
+
+// A frame, at the start of a page.  sys_net_recv hands the input
+// environment a page in this layout, and the input and output
+// environments exchange frames with the network server in it too.
+struct jif_pkt {
+	int jp_len;
+	int jp_flags;			// NET_RX_* on a received frame
+	// The e100 receives each frame straight into a page, after its
+	// 16-byte frame descriptor, and virtio-net after its header;
+	// jp_len and jp_flags then overwrite what precedes the frame.
+	char jp_reserved[8];
+	char jp_data[0];
+};
+
+// sys_net_features bits
+#define NET_F_TXCSUM	0x1		// can fill in IP, TCP and UDP checksums
+#define NET_F_RXCSUM	0x2		// verifies received checksums
+
+// sys_net_send_sg flags
+#define NET_TX_CSUM	0x1		// fill in the frame's checksums
+
+// jp_flags of received frames
+#define NET_RX_CSUM_OK	0x1		// IP and TCP or UDP checksums verified
+
+// sys_net_wait events
+#define NET_WAIT_RX	0x1		// a received frame is ready
+#define NET_WAIT_TX	0x2		// a transmit slot is free
+
+// A buffer of a frame sent with sys_net_send_sg
+struct net_sg {
+	const void *sg_va;
+	size_t sg_len;
+};
+
+// sys_net_recv_batch lays frames out back to back, each a struct
+// jif_pkt and the frame, rounded up to NET_RECALIGN bytes: the layout
+// of the network server's trains.
+#define NET_MAXFRAME	1518		// longest frame, less the CRC
+#define NET_RECALIGN	16
+#define NET_RECLEN(len)	ROUNDUP(sizeof(struct jif_pkt) + (len), NET_RECALIGN)
+
+#define NET_MAXSG	8		// buffers per sys_net_send_sg
+#define NET_MAXTAGS	32		// sys_net_send_sg tags are below this
+#define NET_MAXBATCH	32		// frames per sys_net_{send,recv}_batch
+
+#endif	// !JOS_INC_NET_H
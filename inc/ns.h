@@ -4,13 +4,11 @@
 #define JOS_INC_NS_H
 
 #include <inc/types.h>
+#include <inc/x86.h>
+#include <inc/env.h>
+#include <inc/net.h>
 #include <lwip/sockets.h>
 
-struct jif_pkt {
-	int jp_len;
-	char jp_data[0];
-};
-
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -25,17 +23,251 @@ enum {
 	NSREQ_RECV,
 	NSREQ_SEND,
 	NSREQ_SOCKET,
+	NSREQ_SETSOCKOPT,
+	// Getsockopt returns a Nsret_getsockopt on the request page.
+	NSREQ_GETSOCKOPT,
+	// Ring passes the page of a struct Nsrings, which the server keeps
+	// mapped until the socket is closed.
+	NSREQ_RING,
 
-	// The following two messages pass a page containing a struct jif_pkt
+	// The following messages pass no page.
+	// The input environment has put frames on a train (struct
+	// Nstrain) the server is sleeping on.
 	NSREQ_INPUT,
 	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
-	// network server, to the output environment
+	// network server, to the output environment, for the same with
+	// the train of frames to send.
 	NSREQ_OUTPUT,
+	// A client has changed a ring the server is sleeping on
+	NSREQ_DOORBELL,
+};
+
+// The data of a TCP socket can flow through a pair of byte rings in a
+// page shared by the client and the server, rather than an NSREQ_RECV
+// or NSREQ_SEND round trip per call; the other requests stay as they
+// are.  The producer of a ring advances nr_head and the consumer
+// nr_tail, each below NSRING_SIZE; the ring is empty when they are
+// equal, and one byte is left free so that full is head one short of
+// tail.  A side that finds the ring empty (full) sets nr_cwait
+// (nr_pwait) and sleeps; the other side clears the flag after it
+// changes the ring, and if it was set, wakes the sleeper: the client
+// with an NSREQ_DOORBELL, the server with an IPC to each environment
+// in nr_waiters.  So there is one message when an empty ring gets data,
+// or a full one room, and none while both sides keep up.
+//
+// The ring page is shared with forked children, so several clients can
+// sleep on one ring.  Each takes a slot in nr_waiters before setting
+// the flag.  If every slot is taken, a client polls instead.
+#define NSRING_SIZE	2000
+#define NSRING_NWAITERS	4
+
+struct Nsring {
+	volatile uint32_t nr_head;
+	volatile uint32_t nr_tail;
+	volatile uint32_t nr_cwait;	// consumer sleeping
+	volatile uint32_t nr_pwait;	// producer sleeping
+	volatile uint32_t nr_done;	// the server has stopped the ring,
+	volatile int32_t nr_ret;	//  and read or write returns this
+	volatile uint32_t nr_waiters[NSRING_NWAITERS];	// clients asleep
+	char nr_buf[NSRING_SIZE];
+};
+
+struct Nsrings {
+	int nrs_sock;
+	struct Nsring nrs_tx;		// client to server
+	struct Nsring nrs_rx;		// server to client
+};
+
+// Frames pass between the server and its input and output environments
+// in trains: byte rings of struct jif_pkt records, in pages all three
+// share, one ring for each direction.  nt_head and nt_tail count bytes
+// for ever and are taken modulo NSTRAIN_SIZE.  A record never wraps; a
+// jp_len of -1 marks jp_flags bytes the consumer skips, as at the end
+// of nt_buf.  The consumer sets nt_cwait before it sleeps in ipc_recv,
+// and the producer sends a message only if it takes the flag back after
+// adding frames, so a train of frames costs one message however long it
+// is.
+//
+// The consumer may keep a frame it has passed where it lies, by listing
+// it in nt_held until it is done; the producer then goes around it,
+// skipping the record with a marker written over its struct jif_pkt.
+#define NSTRAIN_SIZE	(16 * PGSIZE)	// a power of two
+#define NSTRAIN_ALIGN	NET_RECALIGN
+#define NSTRAIN_NHELD	16
 
-	// The following message passes no page
-	NSREQ_TIMER,
+// An nt_held entry: the offset in nt_buf and the length of a record, in
+// units of NSTRAIN_ALIGN; 0 is a free entry.
+#define NSTRAIN_HELD(off, len) \
+	((((off) / NSTRAIN_ALIGN) << 16) | ((len) / NSTRAIN_ALIGN))
+#define NSTRAIN_HELD_OFF(e)	(((e) >> 16) * NSTRAIN_ALIGN)
+#define NSTRAIN_HELD_LEN(e)	(((e) & 0xffff) * NSTRAIN_ALIGN)
+
+struct Nstrain {
+	volatile uint32_t nt_head;	// producer's
+	volatile uint32_t nt_tail;	// consumer's
+	volatile uint32_t nt_cwait;	// consumer sleeping
+	uint32_t nt_frames;		// statistics, kept by the producer
+	uint32_t nt_doorbells;
+	uint32_t nt_pad[3];
+	volatile uint32_t nt_held[NSTRAIN_NHELD];	// consumer's
+	char nt_buf[NSTRAIN_SIZE];
 };
 
+static inline uint32_t
+nstrain_reclen(int len)
+{
+	return NET_RECLEN(len);
+}
+
+// How far the producer must skip from offset off for need bytes: to the
+// end of nt_buf, or past a held record in the way.  0 if it need not.
+static inline uint32_t
+nstrain_blocked(struct Nstrain *t, uint32_t off, uint32_t need)
+{
+	uint32_t e, hoff, hend, skip = 0;
+	int i;
+
+	if (NSTRAIN_SIZE - off < need)
+		return NSTRAIN_SIZE - off;
+	for (i = 0; i < NSTRAIN_NHELD; i++) {
+		if (!(e = t->nt_held[i]))
+			continue;
+		hoff = NSTRAIN_HELD_OFF(e);
+		hend = hoff + NSTRAIN_HELD_LEN(e);
+		if (hoff < off + need && off < hend && (!skip || hend - off < skip))
+			skip = hend - off;
+	}
+	return skip;
+}
+
+// Room for a frame of len bytes at t's head, or NULL if t is full;
+// nstrain_push then adds it.
+static inline struct jif_pkt *
+nstrain_reserve(struct Nstrain *t, int len)
+{
+	uint32_t need = nstrain_reclen(len), off, skip, tail;
+	struct jif_pkt *mark;
+
+	while (1) {
+		// Read nt_tail first: nt_held has every record held
+		// behind it
+		tail = t->nt_tail;
+		__asm __volatile("" : : : "memory");
+		off = t->nt_head % NSTRAIN_SIZE;
+		if (!(skip = nstrain_blocked(t, off, need)))
+			break;
+		if (t->nt_head + skip - tail > NSTRAIN_SIZE)
+			return NULL;
+		mark = (struct jif_pkt *) &t->nt_buf[off];
+		mark->jp_len = -1;
+		mark->jp_flags = skip;
+		t->nt_head += skip;
+	}
+	if (t->nt_head + need - tail > NSTRAIN_SIZE)
+		return NULL;
+	return (struct jif_pkt *) &t->nt_buf[off];
+}
+
+static inline void
+nstrain_push(struct Nstrain *t, struct jif_pkt *pkt)
+{
+	t->nt_frames++;
+	// The frame must be in place before the consumer can see it
+	__asm __volatile("" : : : "memory");
+	t->nt_head += nstrain_reclen(pkt->jp_len);
+}
+
+// After pushing frames: whether the consumer sleeps and needs a message.
+static inline int
+nstrain_ring(struct Nstrain *t)
+{
+	if (!xchg(&t->nt_cwait, 0))
+		return 0;
+	t->nt_doorbells++;
+	return 1;
+}
+
+// The frame at *pos, a consumer's position in t, or NULL if there are
+// no more; *pos is moved past any bytes marked to be skipped.
+static inline struct jif_pkt *
+nstrain_at(struct Nstrain *t, uint32_t *pos)
+{
+	struct jif_pkt *pkt;
+
+	while (*pos != t->nt_head) {
+		pkt = (struct jif_pkt *) &t->nt_buf[*pos % NSTRAIN_SIZE];
+		if (pkt->jp_len >= 0)
+			return pkt;
+		*pos += pkt->jp_flags;
+	}
+	return NULL;
+}
+
+// The frame at t's tail, or NULL if t is empty; nstrain_pop drops it.
+static inline struct jif_pkt *
+nstrain_peek(struct Nstrain *t)
+{
+	uint32_t pos = t->nt_tail;
+	struct jif_pkt *pkt = nstrain_at(t, &pos);
+
+	t->nt_tail = pos;
+	return pkt;
+}
+
+static inline void
+nstrain_pop(struct Nstrain *t, struct jif_pkt *pkt)
+{
+	uint32_t len = nstrain_reclen(pkt->jp_len);
+
+	__asm __volatile("" : : : "memory");
+	t->nt_tail += len;
+}
+
+// Keep the frame at t's tail where it is after nstrain_pop, until
+// nstrain_unhold with the index returned; -1 if t holds all it can.
+static inline int
+nstrain_hold(struct Nstrain *t, struct jif_pkt *pkt)
+{
+	uint32_t off = (char *) pkt - t->nt_buf;
+	int i;
+
+	for (i = 0; i < NSTRAIN_NHELD; i++)
+		if (!t->nt_held[i]) {
+			t->nt_held[i] = NSTRAIN_HELD(off, nstrain_reclen(pkt->jp_len));
+			return i;
+		}
+	return -1;
+}
+
+static inline void
+nstrain_unhold(struct Nstrain *t, int i)
+{
+	t->nt_held[i] = 0;
+}
+
+// Set t's nt_cwait: every frame pushed from now on will have a message
+// sent for it, or will be seen before one already on its way.
+static inline void
+nstrain_arm(struct Nstrain *t)
+{
+	xchg(&t->nt_cwait, 1);
+}
+
+// For a consumer with nothing else to do: whether it should sleep in
+// ipc_recv until the producer's message.
+static inline int
+nstrain_idle(struct Nstrain *t)
+{
+	nstrain_arm(t);
+	if (!nstrain_peek(t))
+		return 1;
+	// If the producer took the flag back, its message is on the way
+	return !xchg(&t->nt_cwait, 0);
+}
+
+// The largest option value setsockopt and getsockopt pass
+#define NSSOCKOPT_MAX	16
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -95,6 +327,28 @@ union Nsipc {
 		int req_protocol;
 	} socket;
 
+	struct Nsreq_setsockopt {
+		int req_s;
+		int req_level;
+		int req_optname;
+		socklen_t req_optlen;
+		char req_optval[NSSOCKOPT_MAX];
+	} setsockopt;
+
+	struct Nsreq_getsockopt {
+		int req_s;
+		int req_level;
+		int req_optname;
+		socklen_t req_optlen;
+	} getsockopt;
+
+	struct Nsret_getsockopt {
+		socklen_t ret_optlen;
+		char ret_optval[NSSOCKOPT_MAX];
+	} getsockoptRet;
+
+	struct Nsrings rings;
+
 	struct jif_pkt pkt;
 };
 
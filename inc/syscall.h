@@ -21,6 +21,17 @@ enum
 	SYS_time_msec,
     SYS_net_send,
     SYS_net_recv,
+	SYS_net_wait,
+	SYS_net_send_sg,
+	SYS_net_tx_reap,
+	SYS_net_send_batch,
+	SYS_net_recv_batch,
+	SYS_net_features,
+	SYS_net_map_device,
+	SYS_page_alloc_dma,
+	SYS_disk_submit,
+	SYS_disk_reap,
+	SYS_ipc_recv_timed,
 	NSYSCALLS
 };
 
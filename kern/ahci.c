@@ -0,0 +1,378 @@
+// AHCI SATA host bus adapter driver.
+//
+// The kernel drives the first port with an ATA disk attached.  The file
+// system server passes block cache pages to sys_disk_submit, which hands
+// them to ahci_submit; the page frames are pinned (pp_ref) until
+// ahci_reap sees the command complete, so the device never DMAs into a
+// page that has been freed and reused.  Completion is polled from PxCI
+// and PxSACT; the HBA's interrupts stay disabled.
+//
+// If the drive supports native command queuing every command slot holds
+// a READ/WRITE FPDMA QUEUED command and the drive may work on all of
+// them at once.  Otherwise the slots hold ordinary DMA EXT commands that
+// the HBA issues one after another, which still lets the caller queue
+// work without waiting for each request.  Commands submitted with
+// DISK_DEFER are issued together by the next plain submit or reap.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/disk.h>
+
+#include <kern/ahci.h>
+#include <kern/disk.h>
+#include <kern/pmap.h>
+
+#define AHCI_SPIN	1000000		// register polls before giving up
+
+static volatile uint32_t *hba;		// ABAR, mapped uncached
+static volatile uint32_t *port;		// registers of the port we drive
+static struct ahci_cmd_header *cmd_list;
+static struct ahci_cmd_table *cmd_tables[AHCI_NSLOTS];
+static int nslots;
+static bool ncq;
+static uint32_t nsectors;
+
+// Per command slot: the user pages pinned for the transfer
+static struct ahci_slot {
+	struct Page *pages[AHCI_NPRD];
+	int npages;
+} slots[AHCI_NSLOTS];
+static uint32_t slots_busy;
+static uint32_t slots_pending;		// filled in, but not yet issued
+
+#define HBA_REG(off)	hba[(off) / 4]
+#define PORT_REG(off)	port[(off) / 4]
+
+static int
+ahci_wait(int off, uint32_t mask, uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < AHCI_SPIN; i++)
+		if ((PORT_REG(off) & mask) == val)
+			return 0;
+	return -E_IO;
+}
+
+static int
+ahci_port_stop(void)
+{
+	PORT_REG(AHCI_PxCMD) &= ~AHCI_PxCMD_ST;
+	if (ahci_wait(AHCI_PxCMD, AHCI_PxCMD_CR, 0) < 0)
+		return -E_IO;
+	PORT_REG(AHCI_PxCMD) &= ~AHCI_PxCMD_FRE;
+	return ahci_wait(AHCI_PxCMD, AHCI_PxCMD_FR, 0);
+}
+
+static int
+ahci_port_start(void)
+{
+	PORT_REG(AHCI_PxSERR) = ~0;
+	PORT_REG(AHCI_PxIS) = ~0;
+	PORT_REG(AHCI_PxCMD) |= AHCI_PxCMD_FRE;
+	if (ahci_wait(AHCI_PxTFD, AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ, 0) < 0)
+		return -E_IO;
+	PORT_REG(AHCI_PxCMD) |= AHCI_PxCMD_ST;
+	return 0;
+}
+
+// Allocate a zeroed page that the driver keeps for good.
+static void *
+ahci_alloc_page(void)
+{
+	struct Page *pp;
+
+	if (page_alloc(&pp) < 0)
+		return NULL;
+	page_incref(pp);
+	memset(page2kva(pp), 0, PGSIZE);
+	return page2kva(pp);
+}
+
+static void
+ahci_free_page(void *kva)
+{
+	page_decref(pa2page(PADDR(kva)));
+}
+
+// Set up the command list, the received-FIS area and a command table
+// for every slot, then restart the port.
+static int
+ahci_port_init(void)
+{
+	int i, per_page = PGSIZE / sizeof(struct ahci_cmd_table);
+	struct ahci_cmd_table *tables = NULL;
+	uint8_t *pg;
+
+	static_assert(sizeof(struct ahci_cmd_header) == 32);
+	static_assert(sizeof(struct ahci_cmd_table) == 256);
+	static_assert(sizeof(struct sata_fis_h2d) == 20);
+
+	if (ahci_port_stop() < 0)
+		return -E_IO;
+
+	// Command list (1KB aligned) and received-FIS area (256 bytes)
+	if ((pg = ahci_alloc_page()) == NULL)
+		return -E_NO_MEM;
+	cmd_list = (struct ahci_cmd_header *) pg;
+	PORT_REG(AHCI_PxCLB) = PADDR(pg);
+	PORT_REG(AHCI_PxCLBU) = 0;
+	PORT_REG(AHCI_PxFB) = PADDR(pg + 1024);
+	PORT_REG(AHCI_PxFBU) = 0;
+
+	for (i = 0; i < nslots; i++) {
+		if (i % per_page == 0 && (tables = ahci_alloc_page()) == NULL)
+			return -E_NO_MEM;
+		cmd_tables[i] = &tables[i % per_page];
+		cmd_list[i].ctba = PADDR(cmd_tables[i]);
+		cmd_list[i].ctbau = 0;
+	}
+
+	PORT_REG(AHCI_PxIE) = 0;
+	return ahci_port_start();
+}
+
+// Undo ahci_port_init after a failure: stop the port and free its
+// pages.  If the port will not stop, the HBA may still write into them,
+// so they are left allocated.
+static void
+ahci_port_fini(void)
+{
+	int i, per_page = PGSIZE / sizeof(struct ahci_cmd_table);
+
+	if (ahci_port_stop() < 0)
+		return;
+	for (i = 0; i < AHCI_NSLOTS; i += per_page)
+		if (cmd_tables[i])
+			ahci_free_page(cmd_tables[i]);
+	if (cmd_list)
+		ahci_free_page(cmd_list);
+	memset(cmd_tables, 0, sizeof(cmd_tables));
+	cmd_list = NULL;
+}
+
+// Build the command in 'slot': a host-to-device FIS and one PRD entry
+// per page.  Only the first nsecs sectors of the pages are transferred.
+static void
+ahci_fill(int slot, uint8_t command, uint32_t secno, size_t nsecs,
+	  physaddr_t *pas, int npages, bool write)
+{
+	struct ahci_cmd_table *t = cmd_tables[slot];
+	struct sata_fis_h2d *fis = (struct sata_fis_h2d *) t->cfis;
+	size_t left = nsecs * DISK_SECTSIZE;
+	int i;
+
+	memset(fis, 0, sizeof(*fis));
+	fis->type = SATA_FIS_TYPE_H2D;
+	fis->flags = SATA_FIS_H2D_CMD;
+	fis->command = command;
+	if (command != ATA_CMD_IDENTIFY) {
+		fis->device = ATA_DEV_LBA;
+		fis->lba0 = secno & 0xFF;
+		fis->lba1 = (secno >> 8) & 0xFF;
+		fis->lba2 = (secno >> 16) & 0xFF;
+		fis->lba3 = (secno >> 24) & 0xFF;
+	}
+	if (command == ATA_CMD_READ_FPDMA || command == ATA_CMD_WRITE_FPDMA) {
+		// Queued commands carry the count in the feature
+		// register and the tag in the count register.
+		fis->featurel = nsecs & 0xFF;
+		fis->featureh = (nsecs >> 8) & 0xFF;
+		fis->countl = slot << 3;
+	} else {
+		fis->countl = nsecs & 0xFF;
+		fis->counth = (nsecs >> 8) & 0xFF;
+	}
+
+	for (i = 0; i < npages; i++) {
+		t->prdt[i].dba = pas[i];
+		t->prdt[i].dbau = 0;
+		t->prdt[i].reserved = 0;
+		t->prdt[i].dbc = MIN(left, PGSIZE) - 1;
+		left -= MIN(left, PGSIZE);
+	}
+
+	cmd_list[slot].flags = AHCI_CMD_CFL(sizeof(*fis)) |
+		(write ? AHCI_CMD_WRITE : 0);
+	cmd_list[slot].prdtl = npages;
+	cmd_list[slot].prdbc = 0;
+}
+
+// Ask the drive to identify itself, synchronously, using slot 0.
+static int
+ahci_identify(void)
+{
+	struct Page *pp;
+	uint16_t *id;
+	physaddr_t pa;
+	int i, r;
+
+	if ((r = page_alloc(&pp)) < 0)
+		return r;
+	pa = page2pa(pp);
+	ahci_fill(0, ATA_CMD_IDENTIFY, 0, 1, &pa, 1, 0);
+	PORT_REG(AHCI_PxCI) = 1;
+	for (i = 0; i < AHCI_SPIN; i++)
+		if (!(PORT_REG(AHCI_PxCI) & 1)
+		    || (PORT_REG(AHCI_PxIS) & AHCI_PxIS_TFES))
+			break;
+	if (i == AHCI_SPIN || (PORT_REG(AHCI_PxIS) & AHCI_PxIS_TFES)) {
+		// The command may still be running: the page is only safe
+		// to reuse once the port has stopped
+		if (ahci_port_stop() == 0)
+			page_free(pp);
+		return -E_IO;
+	}
+
+	id = page2kva(pp);
+	if (id[83] & (1 << 10))		// 48-bit addressing
+		nsectors = id[100] | (id[101] << 16);
+	else
+		nsectors = id[60] | (id[61] << 16);
+	ncq = (HBA_REG(AHCI_CAP) & AHCI_CAP_SNCQ) && (id[76] & (1 << 8));
+	if (ncq)
+		nslots = MIN(nslots, (id[75] & 0x1F) + 1);
+	page_free(pp);
+	return 0;
+}
+
+// Issue the commands filled in by deferred submits.
+static void
+ahci_issue(void)
+{
+	if (!slots_pending)
+		return;
+	if (ncq)
+		PORT_REG(AHCI_PxSACT) = slots_pending;
+	PORT_REG(AHCI_PxCI) = slots_pending;
+	slots_pending = 0;
+}
+
+// Queue a transfer of nsecs sectors starting at secno to or from the
+// given pages.  Returns the tag (command slot) of the request, or
+// -E_RETRY if every slot is busy.  Each page gains a reference until
+// ahci_reap reports the tag as done.
+static int
+ahci_submit(uint32_t secno, struct Page **pages, int npages,
+	    size_t nsecs, int flags)
+{
+	bool write = flags & DISK_WRITE;
+	physaddr_t pas[AHCI_NPRD];
+	uint8_t command;
+	int slot, i;
+
+	assert(npages <= AHCI_NPRD);
+	if (secno + nsecs > nsectors || secno + nsecs < secno)
+		return -E_INVAL;
+	for (slot = 0; slot < nslots; slot++)
+		if (!(slots_busy & (1 << slot)))
+			break;
+	if (slot == nslots) {
+		ahci_issue();
+		return -E_RETRY;
+	}
+
+	for (i = 0; i < npages; i++) {
+		page_incref(pages[i]);
+		slots[slot].pages[i] = pages[i];
+		pas[i] = page2pa(pages[i]);
+	}
+	slots[slot].npages = npages;
+
+	if (ncq)
+		command = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+	else
+		command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+	ahci_fill(slot, command, secno, nsecs, pas, npages, write);
+
+	slots_busy |= 1 << slot;
+	slots_pending |= 1 << slot;
+	if (!(flags & DISK_DEFER))
+		ahci_issue();
+	return slot;
+}
+
+static void
+ahci_release(uint32_t done)
+{
+	int slot, i;
+
+	for (slot = 0; slot < nslots; slot++) {
+		if (!(done & (1 << slot)))
+			continue;
+		for (i = 0; i < slots[slot].npages; i++)
+			page_decref(slots[slot].pages[i]);
+		slots[slot].npages = 0;
+	}
+	slots_busy &= ~done;
+}
+
+// Store in *done the mask of tags that completed since the last call
+// and release their pages.  If the drive reported an error, every
+// outstanding request is aborted, reported as done, and -E_IO returned.
+static int
+ahci_reap(uint32_t *done)
+{
+	uint32_t active;
+
+	ahci_issue();
+	if (PORT_REG(AHCI_PxIS) & AHCI_PxIS_TFES) {
+		cprintf("AHCI: error, tfd %08x serr %08x\n",
+			PORT_REG(AHCI_PxTFD), PORT_REG(AHCI_PxSERR));
+		*done = slots_busy;
+		ahci_release(slots_busy);
+		// Restarting the command engine clears PxCI and PxSACT
+		if (ahci_port_stop() < 0 || ahci_port_start() < 0)
+			panic("AHCI: cannot restart port");
+		return -E_IO;
+	}
+
+	active = PORT_REG(AHCI_PxCI);
+	if (ncq)
+		active |= PORT_REG(AHCI_PxSACT);
+	*done = slots_busy & ~active;
+	ahci_release(*done);
+	return 0;
+}
+
+static struct diskdev ahci_diskdev = {
+	"AHCI", ahci_submit, ahci_reap
+};
+
+int
+ahci_attach(struct pci_func *pcif)
+{
+	uint32_t pi;
+	int i, r;
+
+	if (diskdev)
+		return 0;
+
+	pci_func_enable(pcif);
+	hba = mmio_map_region(pcif->reg_base[5], pcif->reg_size[5]);
+	HBA_REG(AHCI_GHC) |= AHCI_GHC_AE;
+	nslots = AHCI_CAP_NCS(HBA_REG(AHCI_CAP));
+
+	pi = HBA_REG(AHCI_PI);
+	for (i = 0; i < 32; i++) {
+		if (!(pi & (1 << i)))
+			continue;
+		port = &hba[AHCI_PORT(i) / 4];
+		if (AHCI_SSTS_DET(PORT_REG(AHCI_PxSSTS)) != AHCI_SSTS_DET_PRESENT
+		    || PORT_REG(AHCI_PxSIG) != AHCI_SIG_ATA)
+			continue;
+		if ((r = ahci_port_init()) < 0 || (r = ahci_identify()) < 0) {
+			cprintf("AHCI: port %d: %e\n", i, r);
+			ahci_port_fini();
+			continue;
+		}
+		cprintf("AHCI: port %d: %u sectors, %d slots%s\n", i,
+			nsectors, nslots, ncq ? ", NCQ" : "");
+		diskdev = &ahci_diskdev;
+		return 1;
+	}
+	port = NULL;
+	return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef JOS_KERN_AHCI_H
+#define JOS_KERN_AHCI_H
+
+#include <inc/types.h>
+#include <kern/pci.h>
+
+// Generic host control registers (byte offsets from ABAR, BAR5)
+#define AHCI_CAP		0x00	// host capabilities
+#define AHCI_GHC		0x04	// global host control
+#define AHCI_IS			0x08	// interrupt status
+#define AHCI_PI			0x0C	// ports implemented
+#define AHCI_VS			0x10	// version
+
+#define AHCI_CAP_NCS(cap)	((((cap) >> 8) & 0x1F) + 1) // command slots
+#define AHCI_CAP_SNCQ		(1 << 30)	// supports NCQ
+#define AHCI_GHC_AE		(1 << 31)	// AHCI enable
+
+// Port registers (byte offsets from the port's register block)
+#define AHCI_PORT(n)		(0x100 + (n) * 0x80)
+#define AHCI_PxCLB		0x00	// command list base
+#define AHCI_PxCLBU		0x04
+#define AHCI_PxFB		0x08	// FIS receive area base
+#define AHCI_PxFBU		0x0C
+#define AHCI_PxIS		0x10	// interrupt status
+#define AHCI_PxIE		0x14	// interrupt enable
+#define AHCI_PxCMD		0x18	// command and status
+#define AHCI_PxTFD		0x20	// task file data
+#define AHCI_PxSIG		0x24	// device signature
+#define AHCI_PxSSTS		0x28	// SATA status
+#define AHCI_PxSERR		0x30	// SATA error
+#define AHCI_PxSACT		0x34	// SATA active (NCQ tags)
+#define AHCI_PxCI		0x38	// command issue
+
+#define AHCI_PxCMD_ST		(1 << 0)	// start command list
+#define AHCI_PxCMD_FRE		(1 << 4)	// FIS receive enable
+#define AHCI_PxCMD_FR		(1 << 14)	// FIS receive running
+#define AHCI_PxCMD_CR		(1 << 15)	// command list running
+#define AHCI_PxIS_TFES		(1 << 30)	// task file error
+#define AHCI_PxTFD_ERR		0x01
+#define AHCI_PxTFD_DRQ		0x08
+#define AHCI_PxTFD_BSY		0x80
+#define AHCI_SSTS_DET(ssts)	((ssts) & 0xF)
+#define AHCI_SSTS_DET_PRESENT	3	// device present, phy up
+#define AHCI_SIG_ATA		0x00000101
+
+#define AHCI_NSLOTS		32
+#define AHCI_NPRD		8	// PRD entries per command table
+
+// Command list entry
+struct ahci_cmd_header {
+	uint16_t flags;			// FIS length, direction, ...
+	uint16_t prdtl;			// PRD table length
+	volatile uint32_t prdbc;	// bytes transferred
+	uint32_t ctba;			// command table base (128-byte aligned)
+	uint32_t ctbau;
+	uint32_t reserved[4];
+};
+
+#define AHCI_CMD_CFL(len)	((len) / 4)	// command FIS length in dwords
+#define AHCI_CMD_WRITE		(1 << 6)	// memory to device
+
+// Physical region descriptor
+struct ahci_prd {
+	uint32_t dba;			// data base address
+	uint32_t dbau;
+	uint32_t reserved;
+	uint32_t dbc;			// byte count - 1
+};
+
+// Command table: the command FIS followed by the PRD table
+struct ahci_cmd_table {
+	uint8_t cfis[64];
+	uint8_t acmd[16];
+	uint8_t reserved[48];
+	struct ahci_prd prdt[AHCI_NPRD];
+};
+
+// Register host-to-device FIS
+struct sata_fis_h2d {
+	uint8_t type;
+	uint8_t flags;
+	uint8_t command;
+	uint8_t featurel;
+	uint8_t lba0, lba1, lba2;
+	uint8_t device;
+	uint8_t lba3, lba4, lba5;
+	uint8_t featureh;
+	uint8_t countl, counth;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved[4];
+};
+
+#define SATA_FIS_TYPE_H2D	0x27
+#define SATA_FIS_H2D_CMD	0x80	// FIS carries a command
+
+#define ATA_CMD_READ_DMA_EXT	0x25
+#define ATA_CMD_WRITE_DMA_EXT	0x35
+#define ATA_CMD_READ_FPDMA	0x60	// NCQ
+#define ATA_CMD_WRITE_FPDMA	0x61	// NCQ
+#define ATA_CMD_IDENTIFY	0xEC
+#define ATA_DEV_LBA		0x40
+
+int ahci_attach(struct pci_func *pcif);
+
+#endif	// !JOS_KERN_AHCI_H
@@ -0,0 +1,23 @@
+#ifndef JOS_KERN_DISK_H
+#define JOS_KERN_DISK_H
+
+#include <inc/types.h>
+
+struct Page;
+
+// A DMA disk driver, as seen by sys_disk_submit and sys_disk_reap.
+// The first driver to attach sets 'diskdev'.
+struct diskdev {
+	const char *name;
+	// Queue a transfer of nsecs sectors between secno and 'pages'
+	// (flags are DISK_*).  Returns a tag in [0, DISK_NTAGS) or -E_RETRY
+	// if the device is full.  The pages are pinned until reaped.
+	int (*submit)(uint32_t secno, struct Page **pages, int npages,
+		      size_t nsecs, int flags);
+	// Store the mask of completed tags in *done; -E_IO on a disk error.
+	int (*reap)(uint32_t *done);
+};
+
+extern struct diskdev *diskdev;
+
+#endif	// !JOS_KERN_DISK_H
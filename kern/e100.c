@@ -5,17 +5,45 @@
 #include	<inc/mmu.h>
 #include	<kern/pmap.h>
 #include	<inc/string.h>
+#include	<inc/error.h>
+#include	<inc/net.h>
+#include	<kern/env.h>
+#include	<kern/trap.h>
+#include	<kern/picirq.h>
+#include	<kern/netdev.h>
 
-union Tcb *cbl_ka, *rfa_ka;
-union Tcb *noptcb_cu = NULL, *tcb_cu = NULL;
-union Tcb *noptcb_ru = NULL, *tcb_ru = NULL;
 
-uint32_t baseio;
+// The receive ring: one RFD per page, so that a filled page can be
+// handed to the input environment whole (see sys_net_recv).  The
+// frame lands right after the RFD header.  rx_ring[i] links to
+// rx_ring[i + 1]; the RFD before rx_head, the last one given back to
+// the device, has the S bit set.
+static struct Page *rx_ring[RFD_NUM];
+static int rx_head;		// next RFD the device completes
+static bool rx_started;
+
+// The CSRs, mapped uncached from BAR0.  Each register must be
+// accessed with its own width.
+static volatile uint8_t *csr;
+
+// Set once a user-space driver took the device over (e100_detach).
+// Its rings are then out of sight, so sys_net_wait's sleepers are
+// woken by what the device reports, collected in e100_events.
+static bool e100_user;
+static int e100_events;
+
+#define CSR8(off)   (*(volatile uint8_t *)(csr + (off)))
+#define CSR16(off)  (*(volatile uint16_t *)(csr + (off)))
+#define CSR32(off)  (*(volatile uint32_t *)(csr + (off)))
+
+#define E100_SPIN 100000    // polls of the command byte before giving up
+
+struct e100_stats e100_stats;
 
 uint16_t
 e100_read_status()
 {
-    return inw(baseio);
+    return CSR16(SCB_STATUS);
 }
 
 bool 
@@ -52,51 +80,88 @@ e100_cu_res(union Tcb *tcb)
     tcb->tcb_transmit.cb.cmd &= (~TCB_MASK_S);
 }
 
+// Commands are written and polled a byte at a time, so that they
+// leave the interrupt mask in the next byte alone.
 uint16_t 
 e100_read_cmd()
 {
-    return inw(baseio + 0x02);
+    return CSR8(SCB_CMD);
 }
 
+// Commands are dropped if the device has not accepted the previous
+// one after E100_SPIN polls; the transmit and receive paths retry
+// when they find a unit stopped.
 void 
 e100_write_cmd_cu(uint16_t cmd)
 {
-    e100_wait_cmd();
-    outw(baseio + 0x02, cmd);
+    if (0 == e100_wait_cmd())
+        CSR8(SCB_CMD) = cmd;
 }
 
 void
 e100_write_cmd_ru(uint16_t cmd)
 {
-    e100_wait_cmd();
-    outw(baseio + 0x02, cmd);
+    if (0 == e100_wait_cmd())
+        CSR8(SCB_CMD) = cmd;
 }
 
 void 
 e100_write_scbgp(uint32_t gp)
 {
-    e100_wait_cmd();
-    outl(baseio + 0x04, gp);
+    if (0 == e100_wait_cmd())
+        CSR32(SCB_GP) = gp;
 }
 
 uint32_t 
 e100_read_port()
 {
-    return inl(baseio + 0x08);
+    return CSR32(SCB_PORT);
 }
 
 void 
 e100_write_port(uint32_t port)
 {
-    outl(baseio + 0x08, port);
+    CSR32(SCB_PORT) = port;
 }
 
-void
+// Wait for the device to accept the last command, which it signals by
+// clearing the command byte.  Returns -E_IO if it has not after
+// E100_SPIN polls.
+int
 e100_wait_cmd()
 {
-    uint16_t cmd = e100_read_cmd();
-     while (0 != cmd)
-        cmd = e100_read_cmd();
+    int i;
+
+    for (i = 0; i < E100_SPIN; ++i)
+        if (0 == e100_read_cmd())
+            break;
+
+    e100_stats.cmd_waits++;
+    if (i > 0) {
+        e100_stats.cmd_busy++;
+        e100_stats.cmd_polls += i;
+        if (i > e100_stats.cmd_max_polls)
+            e100_stats.cmd_max_polls = i;
+    }
+    if (E100_SPIN == i) {
+        e100_stats.cmd_timeouts++;
+        return -E_IO;
+    }
+    return 0;
+}
+
+static void
+e100_print_stats(void)
+{
+    cprintf("e100: %u wait_cmd calls, %u busy, %u polls (max %u), %u timeouts\n",
+            e100_stats.cmd_waits, e100_stats.cmd_busy, e100_stats.cmd_polls,
+            e100_stats.cmd_max_polls, e100_stats.cmd_timeouts);
+}
+
+uint16_t
+e100_ru_status()
+{
+    return (e100_read_status() >> 2) & 0x0F;
 }
 
 uint16_t
@@ -111,99 +176,441 @@ e100_cu_int(union Tcb *tcb)
     tcb->tcb_transmit.cb.cmd |= TCB_CMD_CI;
 }
 
+static bool e100_ready(int events);
+static void e100_irq_unmask(int events);
+static void e100_irq_mask(int events);
+static void e100_detach(void);
+
+static struct netdev e100_netdev = {
+    "e100", 0, e100_tx_copy, e100_tx_gather, e100_tx_kick, e100_tx_reap,
+    e100_rx_swap, e100_ready, e100_irq_unmask, e100_irq_mask, 0, 0,
+    e100_detach, 0, e100_print_stats
+};
+
 int
 e100_attach(struct pci_func *pcif)
 {
     uint32_t portcmd;
 
+    if (netdev)
+        return 0;
     pci_func_enable(pcif);
 
-    baseio = pcif->reg_base[1];
+    csr = mmio_map_region(pcif->reg_base[0], pcif->reg_size[0]);
+    e100_netdev.mmio_pa = pcif->reg_base[0];
+    e100_netdev.mmio_size = pcif->reg_size[0];
 
     portcmd = e100_read_port();
     portcmd &= (~(0x0F));
     e100_write_port(portcmd);
+    CSR8(SCB_INTMASK) = SCB_INT_M;
 
-    cbl_ka = e100_alloc_tcb(TCB_MAX_NUM, e100_init_tcb_cu);
-    rfa_ka = e100_alloc_tcb(TCB_MAX_NUM, e100_init_tcb_ru);
+    e100_alloc_tx_ring();
+    e100_alloc_rx_ring();
 
-    assert(NULL != cbl_ka && NULL != rfa_ka);
+    if (pcif->irq_line > 0 && pcif->irq_line < MAX_IRQS) {
+        e100_netdev.irq = pcif->irq_line;
+        irq_register(e100_netdev.irq, e100_intr);
+    }
 
-    return 0;
+    netdev = &e100_netdev;
+    return 1;
 };
 
-void 
-e100_init_tcb_cu(union Tcb *tcb)
+static union Tcb *
+e100_rfd(int i)
 {
-    tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS;
-    tcb->tcb_transmit.cb.status = 0x01<<15;
-    tcb->tcb_transmit.tbdarr = 0xffffffff;
-    tcb->tcb_transmit.tbdcount = 0;
-    tcb->tcb_transmit.thrs = 0xe0;
-    tcb->tcb_transmit.tcbbc = 0;
+    return page2kva(rx_ring[i]);
+}
+
+static void
+e100_init_rfd(int i, struct Page *pp)
+{
+    union Tcb *rfd = page2kva(pp);
+
+    rx_ring[i] = pp;
+    e100_init_tcb_ru(rfd);
+    rfd->tcb_recieve.cb.link = page2pa(rx_ring[RING_NEXT(i, RFD_NUM)]);
 }
 
 void
-e100_init_tcb_ru(union Tcb *tcb)
+e100_alloc_rx_ring(void)
 {
-    tcb->tcb_recieve.cb.cmd = 0;
-    tcb->tcb_recieve.cb.status = 0;
-    tcb->tcb_recieve.reserve = 0xffffffff;
-    tcb->tcb_recieve.actualcount = 0;
-    tcb->tcb_recieve.size = PACKET_MAX_LEN & (~(0x03<<14));
+    struct Page *pp;
+    int i, r;
+
+    for (i = 0; i < RFD_NUM; ++i) {
+        if (0 != (r = page_alloc(&pp)))
+            panic("e100_alloc_rx_ring: %e!\n", r);
+        pp->pp_ref++;
+        // The whole page goes to the input environment with the frame
+        memset(page2kva(pp), 0, PGSIZE);
+        rx_ring[i] = pp;
+    }
+    for (i = 0; i < RFD_NUM; ++i)
+        e100_init_rfd(i, rx_ring[i]);
+    e100_rfd(RFD_NUM - 1)->tcb_recieve.cb.cmd |= TCB_MASK_S;
 }
 
-union Tcb * 
-e100_alloc_tcb(size_t n, void (*finit)(union Tcb *))
+// (Re)start the receive unit at the first RFD it has not filled.  We
+// never resume it: a suspended unit would continue at the link it read
+// before sys_net_recv swapped that RFD's page out.
+static void
+e100_ru_start(void)
+{
+    int i = rx_head, n;
+
+    for (n = 0; n < RFD_NUM - 1; ++n, i = RING_NEXT(i, RFD_NUM))
+        if (!e100_tcb_complete(e100_rfd(i)->tcb_recieve.cb.status))
+            break;
+    e100_write_scbgp(page2pa(rx_ring[i]));
+    e100_write_cmd_ru(TCB_CMD_RS);
+    rx_started = 1;
+}
+
+// Swap pp into the receive ring in place of the oldest filled RFD's
+// page, which is returned in *frame.  pp must not be mapped anywhere
+// the device's writes could be seen, and the caller must give the ring
+// a reference to it.  Returns the frame length, 0 if the device
+// reported an error, or -E_RETRY if no frame is ready.  The e100 does
+// not check checksums, so *flags is always 0.
+int
+e100_rx_swap(struct Page *pp, struct Page **frame, int *flags)
 {
-    extern struct Env *env;
+    union Tcb *rfd;
+    int i = rx_head, n;
 
-    union Tcb *tcb = NULL, *ntcb = NULL, *tcblist = NULL;
+    if (!rx_started) {
+        e100_ru_start();
+        return -E_RETRY;
+    }
+
+    rfd = e100_rfd(i);
+    if (!e100_tcb_complete(rfd->tcb_recieve.cb.status))
+        return -E_RETRY;
+    if (0x03 == e100_ru_resault(rfd->tcb_recieve.actualcount))
+        n = e100_ru_count(rfd->tcb_recieve.actualcount);
+    else
+        n = 0;
+
+    // pp becomes the new end of the ring: link it in, then move the
+    // S bit from the RFD before it.
+    *frame = rx_ring[i];
+    *flags = 0;
+    e100_init_rfd(i, pp);
+    e100_rfd(i)->tcb_recieve.cb.cmd |= TCB_MASK_S;
+    rfd = e100_rfd(RING_PREV(i, RFD_NUM));
+    rfd->tcb_recieve.cb.link = page2pa(pp);
+    e100_ru_res(rfd);
+    rx_head = RING_NEXT(i, RFD_NUM);
+
+    if (RU_STATUS_READY != e100_ru_status())
+        e100_ru_start();
+
+    return n;
+}
+
+// The transmit ring, in link order.  tx_cur is the CB filled last,
+// which has the S bit set; tx_nop is the CB the command unit last
+// suspended at.
+static union Tcb *tx_ring[TCB_MAX_NUM];
+static int tx_cur = -1, tx_nop;
+
+// A gather send (e100_tx_gather) pins the pages its buffers live in
+// until the CU is done with them, then keeps its CB until the sending
+// environment has heard so through e100_tx_reap.
+static struct Page *tx_pins[TCB_MAX_NUM][E100_NTBD];
+static int tx_npins[TCB_MAX_NUM];
+static envid_t tx_owner[TCB_MAX_NUM];
+static uint32_t tx_done;
+
+// Allocate the transmit CBs, packed into pages without straddling
+// any, and link them into a ring.
+void
+e100_alloc_tx_ring(void)
+{
+    struct Page *pp;
+    char *va = NULL;
+    size_t left = 0;
     int i, r;
 
-    for (i = 0; i < n; ++i) {
-        if (NULL == tcb || ROUNDUP(tcb, PGSIZE) - tcb < sizeof(*tcb)) {
-            struct Page *pag;
-            if (0 != (r = page_alloc(&pag)))
-                panic("e100_alloc_tcb: %e!\n");
-            if (NULL == tcb) {
-                tcb = page2kva(pag);
-                memset(tcb, 0, PGSIZE);
-                tcblist = tcb;
-            }
-            else {
-                ntcb = page2kva(pag);
-                tcb->tcb_transmit.cb.link = page2pa(pag);
-                tcb = ntcb;
-            }
+    // Reap masks have a bit per CB
+    static_assert(TCB_MAX_NUM <= 32);
+
+    for (i = 0; i < TCB_MAX_NUM; ++i) {
+        if (left < sizeof(union Tcb)) {
+            if (0 != (r = page_alloc(&pp)))
+                panic("e100_alloc_tx_ring: %e!\n", r);
+            pp->pp_ref++;
+            va = page2kva(pp);
+            memset(va, 0, PGSIZE);
+            left = PGSIZE;
+        }
+        tx_ring[i] = (union Tcb *)va;
+        e100_init_tcb_cu(tx_ring[i]);
+        va += sizeof(union Tcb);
+        left -= sizeof(union Tcb);
+    }
+    for (i = 0; i < TCB_MAX_NUM; ++i)
+        tx_ring[i]->tcb_transmit.cb.link = PADDR(tx_ring[RING_NEXT(i, TCB_MAX_NUM)]);
+}
+
+// Unpin the pages of finished gather sends.
+static void
+e100_tx_reclaim(void)
+{
+    int i, j;
+
+    for (i = 0; i < TCB_MAX_NUM; ++i) {
+        if (0 == tx_npins[i]
+            || !e100_tcb_complete(tx_ring[i]->tcb_transmit.cb.status))
+            continue;
+        for (j = 0; j < tx_npins[i]; ++j)
+            page_decref(tx_pins[i][j]);
+        tx_npins[i] = 0;
+        tx_done |= 1 << i;
+    }
+}
+
+// Can CB i take a new frame?  A finished gather send's CB is held until
+// its owner reaps it, unless the owner has gone away.
+static bool
+e100_tx_free(int i)
+{
+    struct Env *e;
+
+    if (!e100_tcb_complete(tx_ring[i]->tcb_transmit.cb.status))
+        return 0;
+    return 0 == tx_owner[i] || 0 != envid2env(tx_owner[i], &e, 0);
+}
 
+// Return the next CB to fill, or -E_RETRY if the ring is full.
+static int
+e100_tx_claim(void)
+{
+    int i = RING_NEXT(tx_cur, TCB_MAX_NUM);
+
+    e100_tx_reclaim();
+    if (!e100_tx_free(i))
+        return -E_RETRY;
+    tx_owner[i] = 0;
+    tx_done &= ~(1 << i);
+    return i;
+}
+
+// Append the filled CB i to the command list.  The command unit only
+// sees it once e100_tx_kick is called.
+static void
+e100_tx_commit(int i)
+{
+    union Tcb *tcb = tx_ring[i];
+
+    e100_cu_int(tcb);
+    tcb->tcb_transmit.cb.status = 0;
+    if (tx_cur >= 0)
+        e100_cu_res(tx_ring[tx_cur]);
+    tx_cur = i;
+}
+
+// Start or resume the command unit on the CBs committed since the last
+// kick.  Batching frames between kicks saves a device command, and an
+// exit to the VMM, per frame.
+void
+e100_tx_kick(void)
+{
+    uint16_t status;
+
+    if (tx_cur < 0)
+        return;
+    status = e100_cu_status();
+    if (TCB_STATUS_IDLE == status) {
+        e100_write_scbgp(PADDR(tx_ring[0]));
+        e100_write_cmd_cu(TCB_CMD_CS);
+    }
+    else if (TCB_STATUS_SUSPENDED == status) {
+        e100_cu_res(tx_ring[tx_nop]);
+        if (tx_nop == tx_cur) {
+            tx_nop = RING_PREV(tx_cur, TCB_MAX_NUM);
+            e100_cu_int(tx_ring[tx_nop]);
         }
-        else {
-            ntcb = tcb + 1;
-            tcb->tcb_transmit.cb.link = PADDR(tcb) + PGOFF(ntcb);
-            tcb = ntcb;
+        else
+            tx_nop = tx_cur;
+        e100_write_cmd_cu(TCB_CMD_CC);
+    }
+}
+
+// Queue a copy of the len bytes at src, which the caller has checked,
+// using a simplified-mode TCB.  Returns -E_RETRY if the ring is full.
+// The caller must call e100_tx_kick.
+int
+e100_tx_copy(const void *src, size_t len)
+{
+    union Tcb *tcb;
+    int i;
+
+    if (0 > (i = e100_tx_claim()))
+        return i;
+    tcb = tx_ring[i];
+    tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS | TCB_CMD_I;
+    tcb->tcb_transmit.tbdarr = 0xffffffff;
+    tcb->tcb_transmit.tbdcount = 0;
+    tcb->tcb_transmit.tcbbc = len;
+    memmove(tcb->tcb_transmit.data, src, len);
+    e100_tx_commit(i);
+    return 0;
+}
+
+// Queue a frame gathered from n buffers, the i'th being lens[i] bytes
+// at physical address addrs[i] in page pages[i].  The TCB is in
+// flexible mode and keeps its TBD array in its own data area; the
+// pages are pinned until the frame is sent.  The caller must call
+// e100_tx_kick.  There are no flags to honour: the e100 does not
+// offload checksums.  Returns the CB's index, which e100_tx_reap
+// reports to owner once the frame is gone, or -E_RETRY if the ring is
+// full.
+int
+e100_tx_gather(struct Page **pages, physaddr_t *addrs, size_t *lens, int n,
+               int flags, envid_t owner)
+{
+    union Tcb *tcb;
+    struct e100_tbd *tbd;
+    int i, j;
+
+    assert(n > 0 && n <= E100_NTBD);
+    if (0 > (i = e100_tx_claim()))
+        return i;
+    tcb = tx_ring[i];
+    tbd = (struct e100_tbd *) tcb->tcb_transmit.data;
+    for (j = 0; j < n; ++j) {
+        tbd[j].addr = addrs[j];
+        tbd[j].size = lens[j];
+        tbd[j].el = 0;
+        tx_pins[i][j] = pages[j];
+        pages[j]->pp_ref++;
+    }
+    tbd[n - 1].el = TBD_EL;
+    tx_npins[i] = n;
+    tx_owner[i] = owner;
+
+    tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS | TCB_CMD_SF | TCB_CMD_I;
+    tcb->tcb_transmit.tbdarr = PADDR(tbd);
+    tcb->tcb_transmit.tbdcount = n;
+    tcb->tcb_transmit.tcbbc = 0;
+    e100_tx_commit(i);
+    return i;
+}
+
+// Return, and forget, the set of owner's gather sends that the device
+// has finished with, as a bit mask of the indexes e100_tx_gather gave.
+uint32_t
+e100_tx_reap(envid_t owner)
+{
+    uint32_t done = 0;
+    int i;
+
+    e100_tx_reclaim();
+    for (i = 0; i < TCB_MAX_NUM; ++i)
+        if ((tx_done & (1 << i)) && owner == tx_owner[i]) {
+            done |= 1 << i;
+            tx_owner[i] = 0;
         }
+    tx_done &= ~done;
+    return done;
+}
 
-        finit(tcb);
+static bool
+e100_rx_ready(void)
+{
+    return !rx_started || e100_tcb_complete(e100_rfd(rx_head)->tcb_recieve.cb.status);
+}
+
+static bool
+e100_tx_ready(void)
+{
+    // Ready even if the sender has yet to reap the slot
+    return e100_tcb_complete(tx_ring[RING_NEXT(tx_cur, TCB_MAX_NUM)]->tcb_transmit.cb.status);
+}
+
+static bool
+e100_ready(int events)
+{
+    int r;
+
+    if (e100_user) {
+        r = e100_events & events;
+        e100_events &= ~events;
+        return r != 0;
     }
+    return ((events & NET_WAIT_RX) && e100_rx_ready())
+        || ((events & NET_WAIT_TX) && e100_tx_ready());
+}
+
+// The device has a single mask bit for all its interrupts.  Events
+// acknowledged here are passed on, as they will not interrupt.
+static void
+e100_irq_unmask(int events)
+{
+    e100_intr();
+    CSR8(SCB_INTMASK) = 0;
+}
+
+static void
+e100_irq_mask(int events)
+{
+    if (events == (NET_WAIT_RX | NET_WAIT_TX))
+        CSR8(SCB_INTMASK) = SCB_INT_M;
+}
 
-    ntcb->tcb_transmit.cb.link = PADDR(tcblist);
+void
+e100_intr(void)
+{
+    uint8_t stat = CSR8(SCB_STATACK);
+    int events = 0;
+
+    if (0 == stat)
+        return;
+    CSR8(SCB_STATACK) = stat;
+    if (stat & (SCB_STAT_FR | SCB_STAT_RNR))
+        events |= NET_WAIT_RX;
+    if (stat & (SCB_STAT_CX | SCB_STAT_CNA))
+        events |= NET_WAIT_TX;
+    if (e100_user)
+        e100_events |= events;
+    netdev_intr(events);
+}
 
-    return tcblist;
+// Stop both units and mask the device, so that a user-space driver can
+// take it over with rings of its own.  Pages still pinned by gather
+// sends stay pinned, and environments asleep in sys_net_wait wake to
+// find no device.  The interrupt stays ours: the user-space driver
+// sleeps in sys_net_wait until the device reports something.
+static void
+e100_detach(void)
+{
+    e100_write_port(PORT_SELECTIVE_RESET);
+    e100_wait_cmd();
+    netdev_intr(NET_WAIT_RX | NET_WAIT_TX);
+    e100_user = 1;
 }
 
-union Tcb * 
-e100_next_tcb(union Tcb *tcb)
+void 
+e100_init_tcb_cu(union Tcb *tcb)
 {
-    return KADDR(tcb->tcb_transmit.cb.link);
+    tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS | TCB_CMD_I;
+    tcb->tcb_transmit.cb.status = 0x01<<15;
+    tcb->tcb_transmit.tbdarr = 0xffffffff;
+    tcb->tcb_transmit.tbdcount = 0;
+    tcb->tcb_transmit.thrs = 0xe0;
+    tcb->tcb_transmit.tcbbc = 0;
 }
 
-union Tcb *
-e100_prev_tcb(union Tcb *tcb)
+void
+e100_init_tcb_ru(union Tcb *tcb)
 {
-    union Tcb *ptcb = tcb;
-    union Tcb *ntcb;
-    while (tcb != (ntcb = e100_next_tcb(ptcb)))
-        ptcb = ntcb;
-    return ptcb;
+    tcb->tcb_recieve.cb.link = 0;
+    tcb->tcb_recieve.cb.cmd = 0;
+    tcb->tcb_recieve.cb.status = 0;
+    tcb->tcb_recieve.reserve = 0xffffffff;
+    tcb->tcb_recieve.actualcount = 0;
+    tcb->tcb_recieve.size = PACKET_MAX_LEN & (~(0x03<<14));
 }
@@ -3,53 +3,48 @@
 
 #include	<inc/types.h>
 #include	<kern/pci.h>
+#include	<inc/env.h>
+#include	<kern/netdev.h>
+#include	<inc/e100.h>
 
-#define PACKET_MAX_LEN 1524
-#define TCB_MAX_NUM 24 
+// Ring sizes, which can be set at build time, e.g.
+//	make LABDEFS="-DTCB_MAX_NUM=32 -DRFD_NUM=128"
+// TCB_MAX_NUM is at most 32: reap masks have a bit per CB.
+#ifndef TCB_MAX_NUM
+#define TCB_MAX_NUM 24
+#endif
+#ifndef RFD_NUM
+#define RFD_NUM 32
+#endif
 
-
-struct cb {
-    volatile uint16_t status;
-    uint16_t cmd;
-    uint32_t link;
+// Command-wait statistics, shown by the monitor's e100 command
+struct e100_stats {
+    uint32_t cmd_waits;     // calls to e100_wait_cmd
+    uint32_t cmd_busy;      // ... that found the previous one pending
+    uint32_t cmd_polls;     // polls spent waiting in all
+    uint32_t cmd_max_polls; // longest wait
+    uint32_t cmd_timeouts;  // commands dropped after E100_SPIN polls
 };
 
-union Tcb {
-    struct tcb_transmit {
-        struct cb cb;
-        uint32_t tbdarr;
-        uint16_t tcbbc;
-        uint8_t thrs;
-        uint8_t tbdcount;
-        char data[PACKET_MAX_LEN];
-    } tcb_transmit;
-
-    struct tcb_recieve {
-        struct cb cb;
-        uint32_t reserve;
-        uint16_t actualcount;
-        uint16_t size;
-        char data[PACKET_MAX_LEN];
-    } tcb_recieve;
-};
+extern struct e100_stats e100_stats;
 
-extern union Tcb *cbl_ka;
-extern union Tcb *rfa_ka;
-extern union Tcb *noptcb_cu;
-extern union Tcb *endtcb_cu;
-extern union Tcb *noptcb_ru;
-extern union Tcb *tcb_ru;
-extern union Tcb *tcb_cu;
-extern uint32_t baseio;
+struct Env;
+struct Page;
 
 int e100_attach(struct pci_func *);
-union Tcb * e100_alloc_tcb(size_t n, void (*)(union Tcb *));
-union Tcb * e100_next_tcb(union Tcb *tcb);
-union Tcb * e100_prev_tcb(union Tcb *tcb);
+void e100_alloc_tx_ring(void);
+void e100_alloc_rx_ring(void);
+int e100_tx_copy(const void *src, size_t len);
+void e100_tx_kick(void);
+int e100_tx_gather(struct Page **pages, physaddr_t *addrs, size_t *lens, int n,
+                   int flags, envid_t owner);
+uint32_t e100_tx_reap(envid_t owner);
+int e100_rx_swap(struct Page *pp, struct Page **frame, int *flags);
+void e100_intr(void);
 bool e100_tcb_complete(uint16_t status);
 
 uint16_t e100_read_status();
-void e100_wait_cmd();
+int e100_wait_cmd();
 uint16_t e100_read_cmd();
 void e100_write_scbgp(uint32_t gp);
 uint32_t e100_read_port();
@@ -68,18 +63,4 @@ void e100_cu_int(union Tcb *tcb);
 uint16_t e100_cu_status();
 uint16_t e100_ru_status();
 
-#define TCB_CMD_CS (0x01<<4)
-#define TCB_CMD_CC (0x01<<5)
-#define TCB_CMD_TRANS 0x0F04
-#define TCB_CMD_NOP  0x4000
-#define TCB_CMD_RI  0x4000
-#define TCB_CMD_CI  0x4000
-#define TCB_CMD_RS 0x01
-#define TCB_CMD_RC 0x02
-
-#define TCB_MASK_S (0x01<<14)
-
-#define TCB_STATUS_IDLE 0
-#define TCB_STATUS_SUSPENDED 2
-
 #endif	// JOS_KERN_E100_H
@@ -0,0 +1,433 @@
+// Driver for the Intel 8254x (e1000) gigabit Ethernet controller,
+// as emulated by QEMU's "-net nic,model=e1000".  It offers the same
+// struct netdev as the e100 and adds checksum offload: the device
+// fills in the IP and TCP or UDP checksums of frames sent with
+// NET_TX_CSUM, and reports the checksums of received frames it has
+// verified.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/mmu.h>
+#include <inc/net.h>
+#include <inc/string.h>
+
+#include <kern/e1000.h>
+#include <kern/env.h>
+#include <kern/netdev.h>
+#include <kern/picirq.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+
+#define E1000_SPIN	100000	// polls of CTRL.RST before giving up
+#define E1000_TXBUF	2048	// bytes of a tx_copy bounce buffer
+
+static volatile uint32_t *regs;	// mapped uncached from BAR0
+
+#define REG(off)	(regs[(off) / 4])
+
+// The transmit ring.  The device owns the descriptors from tx_clean
+// up to tx_tail; every descriptor asks for its status to be written
+// back, so tx_clean advances past each one the device sets DD in.
+static union e1000_tx_desc *tx_ring;
+static int tx_tail, tx_clean;
+static char *tx_bufs[E1000_NTX];	// one per descriptor, for tx_copy
+static struct Page *tx_pins[E1000_NTX];	// page a gather piece is in
+static int tx_tags[E1000_NTX];		// tag of the frame a descriptor ends
+
+// Tags of gather sends: busy from tx_gather until reaped, done once
+// the frame's last descriptor is written back.
+static uint32_t tag_busy, tag_done;
+static envid_t tag_owner[NET_MAXTAGS];
+
+// The checksum context last loaded, so that a run of frames of the
+// same shape (say, TCP segments of one stream) only loads it once.
+static uint8_t ctx_ipcse, ctx_tucso;
+
+// The receive ring: one page per descriptor, which receives the frame
+// at jp_data so that sys_net_recv can hand the page over whole as a
+// struct jif_pkt.  rx_head is the next descriptor the device
+// completes; all but the one before it belong to the device.
+static struct e1000_rx_desc *rx_ring;
+static struct Page *rx_pages[E1000_NRX];
+static int rx_head;
+
+static struct Page *
+e1000_alloc_page(void)
+{
+	struct Page *pp;
+	int r;
+
+	if ((r = page_alloc(&pp)) < 0)
+		panic("e1000: %e", r);
+	pp->pp_ref++;
+	memset(page2kva(pp), 0, PGSIZE);
+	return pp;
+}
+
+// Unpin the pieces of sent frames and note which tags are done.
+static void
+e1000_tx_reclaim(void)
+{
+	union e1000_tx_desc *d;
+
+	while (tx_clean != tx_tail) {
+		d = &tx_ring[tx_clean];
+		if (!(d->data.status & E1000_TXD_STAT_DD))
+			break;
+		if (tx_pins[tx_clean]) {
+			page_decref(tx_pins[tx_clean]);
+			tx_pins[tx_clean] = NULL;
+		}
+		if (tx_tags[tx_clean] >= 0) {
+			tag_done |= 1 << tx_tags[tx_clean];
+			tx_tags[tx_clean] = -1;
+		}
+		tx_clean = RING_NEXT(tx_clean, E1000_NTX);
+	}
+}
+
+// Descriptors free for new frames; one is kept back so that a full
+// ring is not mistaken for an empty one.
+static int
+e1000_tx_free(void)
+{
+	return (tx_clean - tx_tail - 1 + E1000_NTX) % E1000_NTX;
+}
+
+// Fill the next data descriptor.  The device only sees it once
+// e1000_tx_kick writes the tail.
+static void
+e1000_tx_put(physaddr_t addr, size_t len, uint32_t cmd, uint8_t popts)
+{
+	union e1000_tx_desc *d = &tx_ring[tx_tail];
+
+	d->data.addr = addr;
+	d->data.cmdlen = len | E1000_TXD_DTYP_D | E1000_TXD_CMD_DEXT
+		| E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS | cmd;
+	d->data.status = 0;
+	d->data.popts = popts;
+	d->data.special = 0;
+	tx_tail = RING_NEXT(tx_tail, E1000_NTX);
+}
+
+// Queue a copy of the len bytes at src, which the caller has checked.
+// Returns -E_RETRY if the ring is full.  The caller must call
+// e1000_tx_kick.
+static int
+e1000_tx_copy(const void *src, size_t len)
+{
+	int i = tx_tail;
+
+	e1000_tx_reclaim();
+	if (e1000_tx_free() < 1)
+		return -E_RETRY;
+	memmove(tx_bufs[i], src, len);
+	e1000_tx_put(PADDR(tx_bufs[i]), len, E1000_TXD_CMD_EOP, 0);
+	return 0;
+}
+
+// Load the checksum context for the IPv4 TCP or UDP frame whose
+// headers start at hdr, len bytes of which are at hand, unless it is
+// loaded already.  The frame's TCP or UDP checksum field must hold the
+// pseudo-header sum and its IP checksum field zero, as the device adds
+// both fields into the sums.  Returns -E_INVAL for any other frame.
+static int
+e1000_tx_csum(const uint8_t *hdr, size_t len)
+{
+	union e1000_tx_desc *d;
+	int ihl, tucso;
+
+	if (len < 14 + 20 || hdr[12] != 0x08 || hdr[13] != 0x00
+	    || (hdr[14] >> 4) != 4)
+		return -E_INVAL;
+	ihl = (hdr[14] & 0x0F) * 4;
+	if (ihl < 20 || (((hdr[20] << 8) | hdr[21]) & 0x3FFF))
+		return -E_INVAL;	// bad header or a fragment
+	if (hdr[23] == 6)
+		tucso = 14 + ihl + 16;
+	else if (hdr[23] == 17)
+		tucso = 14 + ihl + 6;
+	else
+		return -E_INVAL;
+	if (len < tucso + 2)
+		return -E_INVAL;
+
+	if (ctx_ipcse == 14 + ihl - 1 && ctx_tucso == tucso)
+		return 0;
+	d = &tx_ring[tx_tail];
+	memset(d, 0, sizeof(*d));
+	d->ctx.ipcss = 14;
+	d->ctx.ipcso = 14 + 10;
+	d->ctx.ipcse = 14 + ihl - 1;
+	d->ctx.tucss = 14 + ihl;
+	d->ctx.tucso = tucso;
+	d->ctx.tucse = 0;
+	d->ctx.cmdlen = E1000_TXD_CMD_DEXT | E1000_TXD_CMD_RS | E1000_TXD_CMD_IP
+		| (hdr[23] == 6 ? E1000_TXD_CMD_TCP : 0);
+	tx_tail = RING_NEXT(tx_tail, E1000_NTX);
+	ctx_ipcse = 14 + ihl - 1;
+	ctx_tucso = tucso;
+	return 0;
+}
+
+// Queue a frame gathered from n pieces, the i'th being lens[i] bytes
+// at physical address addrs[i] in page pages[i], one data descriptor
+// each.  The pages are pinned until the frame is sent.  With
+// NET_TX_CSUM the device fills in the checksums; the headers must then
+// be in the first piece.  The caller must call e1000_tx_kick.  Returns
+// a tag, which e1000_tx_reap reports to owner once the frame is gone,
+// -E_RETRY if the ring or the tags are used up, or -E_INVAL if the
+// frame cannot be offloaded.
+static int
+e1000_tx_gather(struct Page **pages, physaddr_t *addrs, size_t *lens, int n,
+		int flags, envid_t owner)
+{
+	struct Env *e;
+	uint8_t popts = 0;
+	int i, tag, r;
+
+	assert(n > 0 && n <= NETDEV_MAXFRAGS);
+	e1000_tx_reclaim();
+	// A tag whose owner has gone away will never be reaped
+	for (tag = 0; tag < NET_MAXTAGS; tag++)
+		if ((tag_done & (1 << tag)) && envid2env(tag_owner[tag], &e, 0) < 0)
+			tag_busy &= ~(1 << tag);
+	for (tag = 0; tag < NET_MAXTAGS && (tag_busy & (1 << tag)); tag++)
+		;
+	if (tag == NET_MAXTAGS || e1000_tx_free() < n + 1)
+		return -E_RETRY;
+
+	if (flags & NET_TX_CSUM) {
+		if ((r = e1000_tx_csum(KADDR(addrs[0]), lens[0])) < 0)
+			return r;
+		popts = E1000_TXD_POPTS_IXSM | E1000_TXD_POPTS_TXSM;
+	}
+	for (i = 0; i < n; i++) {
+		tx_pins[tx_tail] = pages[i];
+		pages[i]->pp_ref++;
+		if (i == n - 1)
+			tx_tags[tx_tail] = tag;
+		e1000_tx_put(addrs[i], lens[i], i == n - 1 ? E1000_TXD_CMD_EOP : 0,
+			     popts);
+	}
+	tag_busy |= 1 << tag;
+	tag_done &= ~(1 << tag);
+	tag_owner[tag] = owner;
+	return tag;
+}
+
+// Hand the descriptors queued since the last call to the device.
+// Batching frames between kicks saves a register write, and an exit
+// to the VMM, per frame.
+static void
+e1000_tx_kick(void)
+{
+	REG(E1000_TDT) = tx_tail;
+}
+
+// Return, and forget, the set of owner's gather sends that the device
+// has finished with, as a bit mask of the tags e1000_tx_gather gave.
+static uint32_t
+e1000_tx_reap(envid_t owner)
+{
+	uint32_t done = 0;
+	int tag;
+
+	e1000_tx_reclaim();
+	for (tag = 0; tag < NET_MAXTAGS; tag++)
+		if ((tag_done & (1 << tag)) && owner == tag_owner[tag])
+			done |= 1 << tag;
+	tag_done &= ~done;
+	tag_busy &= ~done;
+	return done;
+}
+
+static void
+e1000_rx_give(int i, struct Page *pp)
+{
+	rx_pages[i] = pp;
+	rx_ring[i].addr = page2pa(pp) + offsetof(struct jif_pkt, jp_data);
+	rx_ring[i].status = 0;
+}
+
+// Swap pp into the receive ring in place of the oldest filled page,
+// which is returned in *frame, and store in *flags whether the device
+// verified the frame's checksums.  pp must not be mapped anywhere the
+// device's writes could be seen, and the caller must give the ring a
+// reference to it.  Returns the frame length, 0 if the device reported
+// an error, or -E_RETRY if no frame is ready.
+static int
+e1000_rx_swap(struct Page *pp, struct Page **frame, int *flags)
+{
+	struct e1000_rx_desc *d = &rx_ring[rx_head];
+	int n = 0;
+
+	if (!(d->status & E1000_RXD_STAT_DD))
+		return -E_RETRY;
+	if ((d->status & E1000_RXD_STAT_EOP) && !(d->errors & E1000_RXD_ERR_FRAME))
+		n = d->length;
+
+	// QEMU sets IXSM, "ignore checksum indication", rather than check
+	// received checksums, so there the stack checks them itself.
+	*flags = 0;
+	if (!(d->status & E1000_RXD_STAT_IXSM)
+	    && (d->status & E1000_RXD_STAT_IPCS) && (d->status & E1000_RXD_STAT_TCPCS)
+	    && !(d->errors & (E1000_RXD_ERR_IPE | E1000_RXD_ERR_TCPE)))
+		*flags = NET_RX_CSUM_OK;
+
+	*frame = rx_pages[rx_head];
+	e1000_rx_give(rx_head, pp);
+	REG(E1000_RDT) = rx_head;
+	rx_head = RING_NEXT(rx_head, E1000_NRX);
+	return n;
+}
+
+static bool
+e1000_rx_ready(void)
+{
+	return rx_ring[rx_head].status & E1000_RXD_STAT_DD;
+}
+
+static bool
+e1000_tx_ready(void)
+{
+	// Ready even if the sender has yet to reap its tags
+	e1000_tx_reclaim();
+	return tx_clean == tx_tail || e1000_tx_free() > NETDEV_MAXFRAGS;
+}
+
+static bool
+e1000_ready(int events)
+{
+	return ((events & NET_WAIT_RX) && e1000_rx_ready())
+		|| ((events & NET_WAIT_TX) && e1000_tx_ready());
+}
+
+static uint32_t
+e1000_irq_causes(int events)
+{
+	return ((events & NET_WAIT_RX) ? E1000_ICR_RX : 0)
+		| ((events & NET_WAIT_TX) ? E1000_ICR_TX : 0);
+}
+
+// ITR holds interrupts back while frames stream in, so a burst wakes
+// the input environment once.
+static void
+e1000_intr(void)
+{
+	uint32_t icr = REG(E1000_ICR);
+
+	if (icr == 0)
+		return;
+	netdev_intr(((icr & E1000_ICR_RX) ? NET_WAIT_RX : 0)
+		    | ((icr & E1000_ICR_TX) ? NET_WAIT_TX : 0));
+}
+
+// Reading ICR acknowledges every event the device reported so far,
+// so pass them on: they will not interrupt.
+static void
+e1000_irq_unmask(int events)
+{
+	e1000_intr();
+	REG(E1000_IMS) = e1000_irq_causes(events);
+}
+
+static void
+e1000_irq_mask(int events)
+{
+	REG(E1000_IMC) = e1000_irq_causes(events);
+}
+
+static void
+e1000_tx_init(void)
+{
+	int i;
+
+	tx_ring = page2kva(e1000_alloc_page());
+	for (i = 0; i < E1000_NTX; i += PGSIZE / E1000_TXBUF) {
+		tx_bufs[i] = page2kva(e1000_alloc_page());
+		tx_bufs[i + 1] = tx_bufs[i] + E1000_TXBUF;
+	}
+	for (i = 0; i < E1000_NTX; i++)
+		tx_tags[i] = -1;
+
+	REG(E1000_TDBAL) = PADDR(tx_ring);
+	REG(E1000_TDBAH) = 0;
+	REG(E1000_TDLEN) = E1000_NTX * sizeof(union e1000_tx_desc);
+	REG(E1000_TDH) = 0;
+	REG(E1000_TDT) = 0;
+	REG(E1000_TIPG) = E1000_TIPG_DEFAULT;
+	REG(E1000_TCTL) = E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT
+		| E1000_TCTL_COLD;
+}
+
+static void
+e1000_rx_init(void)
+{
+	int i;
+
+	rx_ring = page2kva(e1000_alloc_page());
+	for (i = 0; i < E1000_NRX; i++)
+		e1000_rx_give(i, e1000_alloc_page());
+
+	REG(E1000_RDBAL) = PADDR(rx_ring);
+	REG(E1000_RDBAH) = 0;
+	REG(E1000_RDLEN) = E1000_NRX * sizeof(struct e1000_rx_desc);
+	REG(E1000_RDH) = 0;
+	REG(E1000_RDT) = E1000_NRX - 1;
+	REG(E1000_RXCSUM) = E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL;
+	// 2048-byte buffers, which a frame at jp_data fits in
+	REG(E1000_RCTL) = E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_SECRC;
+}
+
+static struct netdev e1000_netdev = {
+	"e1000", NET_F_TXCSUM | NET_F_RXCSUM, e1000_tx_copy, e1000_tx_gather,
+	e1000_tx_kick, e1000_tx_reap, e1000_rx_swap, e1000_ready,
+	e1000_irq_unmask, e1000_irq_mask
+};
+
+int
+e1000_attach(struct pci_func *pcif)
+{
+	int i;
+
+	static_assert(E1000_NTX % 8 == 0
+		      && E1000_NTX <= PGSIZE / sizeof(union e1000_tx_desc));
+	static_assert(E1000_NRX % 8 == 0
+		      && E1000_NRX <= PGSIZE / sizeof(struct e1000_rx_desc));
+	if (netdev)
+		return 0;
+
+	pci_func_enable(pcif);
+	regs = mmio_map_region(pcif->reg_base[0], pcif->reg_size[0]);
+	REG(E1000_IMC) = ~0;
+	REG(E1000_CTRL) |= E1000_CTRL_RST;
+	for (i = 0; i < E1000_SPIN && (REG(E1000_CTRL) & E1000_CTRL_RST); i++)
+		;
+	if (REG(E1000_CTRL) & E1000_CTRL_RST) {
+		cprintf("e1000: reset timed out\n");
+		return 0;
+	}
+	REG(E1000_IMC) = ~0;
+	REG(E1000_CTRL) |= E1000_CTRL_SLU | E1000_CTRL_ASDE;
+
+	// Keep the address the reset loaded from the EEPROM
+	REG(E1000_RAH) |= E1000_RAH_AV;
+	for (i = 0; i < 128; i++)
+		REG(E1000_MTA + i * 4) = 0;
+
+	e1000_tx_init();
+	e1000_rx_init();
+	REG(E1000_ITR) = E1000_THROTTLE;
+
+	if (pcif->irq_line > 0 && pcif->irq_line < MAX_IRQS) {
+		e1000_netdev.irq = pcif->irq_line;
+		irq_register(e1000_netdev.irq, e1000_intr);
+	}
+
+	cprintf("e1000: %d tx, %d rx descriptors, checksum offload\n",
+		E1000_NTX, E1000_NRX);
+	netdev = &e1000_netdev;
+	return 1;
+}
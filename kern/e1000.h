@@ -0,0 +1,135 @@
+#ifndef JOS_KERN_E1000_H
+#define JOS_KERN_E1000_H
+
+#include <inc/types.h>
+#include <kern/pci.h>
+
+// Ring sizes and the interrupt throttle, which can be set at build
+// time, e.g.
+//	make NIC=e1000 LABDEFS="-DE1000_NTX=128 -DE1000_THROTTLE=0"
+// Each ring holds a multiple of 8 descriptors (a multiple of 128
+// bytes), at most 256 (one page).
+#ifndef E1000_NTX
+#define E1000_NTX		64
+#endif
+#ifndef E1000_NRX
+#define E1000_NRX		64
+#endif
+// Least time between interrupts, in 256ns units; 0 turns throttling
+// off.  488 is 8000 interrupts a second.
+#ifndef E1000_THROTTLE
+#define E1000_THROTTLE		488
+#endif
+
+// Registers (byte offsets from BAR0)
+#define E1000_CTRL		0x00000	// device control
+#define E1000_STATUS		0x00008	// device status
+#define E1000_ICR		0x000C0	// interrupt cause read (clears)
+#define E1000_ITR		0x000C4	// interrupt throttling
+#define E1000_IMS		0x000D0	// interrupt mask set
+#define E1000_IMC		0x000D8	// interrupt mask clear
+#define E1000_RCTL		0x00100	// receive control
+#define E1000_TCTL		0x00400	// transmit control
+#define E1000_TIPG		0x00410	// transmit inter-packet gap
+#define E1000_RDBAL		0x02800	// receive ring base
+#define E1000_RDBAH		0x02804
+#define E1000_RDLEN		0x02808	// receive ring length, in bytes
+#define E1000_RDH		0x02810	// receive head
+#define E1000_RDT		0x02818	// receive tail
+#define E1000_TDBAL		0x03800	// transmit ring base
+#define E1000_TDBAH		0x03804
+#define E1000_TDLEN		0x03808	// transmit ring length, in bytes
+#define E1000_TDH		0x03810	// transmit head
+#define E1000_TDT		0x03818	// transmit tail
+#define E1000_RXCSUM		0x05000	// receive checksum control
+#define E1000_MTA		0x05200	// multicast table, 128 words
+#define E1000_RAL		0x05400	// receive address 0, low
+#define E1000_RAH		0x05404	// receive address 0, high
+
+#define E1000_CTRL_ASDE		(1 << 5)	// auto-detect speed
+#define E1000_CTRL_SLU		(1 << 6)	// set link up
+#define E1000_CTRL_RST		(1 << 26)	// reset
+#define E1000_RCTL_EN		(1 << 1)
+#define E1000_RCTL_BAM		(1 << 15)	// accept broadcast
+#define E1000_RCTL_SECRC	(1 << 26)	// strip the CRC
+#define E1000_TCTL_EN		(1 << 1)
+#define E1000_TCTL_PSP		(1 << 3)	// pad short packets
+#define E1000_TCTL_CT		(0x10 << 4)	// collision threshold
+#define E1000_TCTL_COLD		(0x40 << 12)	// collision distance
+#define E1000_TIPG_DEFAULT	(10 | (8 << 10) | (6 << 20))
+#define E1000_RXCSUM_IPOFL	(1 << 8)	// check IP checksums
+#define E1000_RXCSUM_TUOFL	(1 << 9)	// check TCP/UDP checksums
+#define E1000_RAH_AV		(1 << 31)	// address valid
+
+// Interrupt causes (ICR, IMS, IMC)
+#define E1000_ICR_TXDW		0x01	// descriptor written back
+#define E1000_ICR_RXDMT0	0x10	// receive ring running low
+#define E1000_ICR_RXO		0x40	// receive overrun
+#define E1000_ICR_RXT0		0x80	// receive timer
+#define E1000_ICR_TX		E1000_ICR_TXDW
+#define E1000_ICR_RX		(E1000_ICR_RXDMT0 | E1000_ICR_RXO | E1000_ICR_RXT0)
+
+// Transmit descriptors.  A context descriptor tells the device where
+// the checksums of the frames after it go; the data descriptors of a
+// frame then ask for them in popts.
+union e1000_tx_desc {
+	struct {
+		uint64_t addr;
+		uint32_t cmdlen;	// length, DTYP and DCMD
+		volatile uint8_t status;
+		uint8_t popts;
+		uint16_t special;
+	} data;
+	struct {
+		uint8_t ipcss;		// IP checksum start
+		uint8_t ipcso;		// IP checksum offset
+		uint16_t ipcse;		// IP checksum end (inclusive)
+		uint8_t tucss;		// TCP/UDP checksum start
+		uint8_t tucso;		// TCP/UDP checksum offset
+		uint16_t tucse;		// TCP/UDP checksum end, 0 for the end
+		uint32_t cmdlen;	// payload length, DTYP and TUCMD
+		volatile uint8_t status;
+		uint8_t hdrlen;
+		uint16_t mss;
+	} ctx;
+};
+
+#define E1000_TXD_DTYP_D	(1 << 20)	// data descriptor
+#define E1000_TXD_CMD_EOP	(0x01 << 24)	// end of packet
+#define E1000_TXD_CMD_IFCS	(0x02 << 24)	// insert the CRC
+#define E1000_TXD_CMD_RS	(0x08 << 24)	// report status
+#define E1000_TXD_CMD_DEXT	(0x20 << 24)	// extended descriptor
+#define E1000_TXD_CMD_TCP	(0x01 << 24)	// context: TCP, not UDP
+#define E1000_TXD_CMD_IP	(0x02 << 24)	// context: IPv4
+#define E1000_TXD_STAT_DD	0x01		// descriptor done
+#define E1000_TXD_POPTS_IXSM	0x01		// insert the IP checksum
+#define E1000_TXD_POPTS_TXSM	0x02		// insert the TCP/UDP checksum
+
+struct e1000_rx_desc {
+	uint64_t addr;
+	uint16_t length;
+	uint16_t csum;
+	volatile uint8_t status;
+	uint8_t errors;
+	uint16_t special;
+};
+
+#define E1000_RXD_STAT_DD	0x01	// descriptor done
+#define E1000_RXD_STAT_EOP	0x02	// end of packet
+#define E1000_RXD_STAT_IXSM	0x04	// checksums not checked
+#define E1000_RXD_STAT_TCPCS	0x20	// TCP/UDP checksum checked
+#define E1000_RXD_STAT_IPCS	0x40	// IP checksum checked
+#define E1000_RXD_ERR_CE	0x01	// CRC error
+#define E1000_RXD_ERR_SE	0x02	// symbol error
+#define E1000_RXD_ERR_SEQ	0x04	// sequence error
+#define E1000_RXD_ERR_CXE	0x10	// carrier extension error
+#define E1000_RXD_ERR_TCPE	0x20	// TCP/UDP checksum error
+#define E1000_RXD_ERR_IPE	0x40	// IP checksum error
+#define E1000_RXD_ERR_RXE	0x80	// receive data error
+#define E1000_RXD_ERR_FRAME	(E1000_RXD_ERR_CE | E1000_RXD_ERR_SE | \
+				 E1000_RXD_ERR_SEQ | E1000_RXD_ERR_CXE | \
+				 E1000_RXD_ERR_RXE)
+
+int e1000_attach(struct pci_func *pcif);
+
+#endif	// !JOS_KERN_E1000_H
@@ -204,12 +204,22 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_ipc_timeout = 0;
+	e->env_net_waiting = 0;
 
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	// LAB 5: Your code here.
     if (e == &envs[1])
         e->env_tf.tf_eflags |= FL_IOPL_3;
 
+	// Only the network server (e == &envs[2]) and the environments it
+	// forks (see sys_exofork) may take the NIC over.
+	e->env_net_driver = 0;
+#if defined(NS_USER_DRIVER) && !defined(TEST_NO_NS)
+	if (e == &envs[2])
+		e->env_net_driver = 1;
+#endif
+
 	// commit the allocation
 	LIST_REMOVE(e, env_link);
 	*newenv_store = e;
@@ -0,0 +1,107 @@
+// What the network drivers share: sys_net_wait's sleepers.
+//
+// An environment sleeps in sys_net_wait for received frames
+// (NET_WAIT_RX), free transmit slots (NET_WAIT_TX), or either.  There
+// is at most one sleeper for each; a second gets -E_RETRY and polls.
+// Interrupts are only unmasked while somebody sleeps, so the rest of
+// the time, and under load when the rings are never empty or full, the
+// device is purely polled.  After a hand-over to a user-space driver
+// the same goes for the device that driver runs.
+
+#include <inc/error.h>
+#include <inc/net.h>
+
+#include <kern/env.h>
+#include <kern/netdev.h>
+
+// The network driver, if one attached.
+struct netdev *netdev;
+
+// The device a user-space driver took over from 'netdev'
+// (sys_net_map_device), if one did.
+struct netdev *netdev_user;
+
+static envid_t rx_waiter, tx_waiter;
+
+// The device whose interrupts the sleepers wait for
+static struct netdev *
+netdev_irqdev(void)
+{
+	return netdev ? netdev : netdev_user;
+}
+
+static bool
+netdev_waiting(envid_t id)
+{
+	struct Env *e;
+
+	return id != 0 && envid2env(id, &e, 0) == 0 && e->env_net_waiting;
+}
+
+// The events somebody still sleeps for
+static int
+netdev_waited(void)
+{
+	return (netdev_waiting(rx_waiter) ? NET_WAIT_RX : 0)
+		| (netdev_waiting(tx_waiter) ? NET_WAIT_TX : 0);
+}
+
+static void
+netdev_wake(envid_t id)
+{
+	struct Env *e;
+
+	if (rx_waiter == id)
+		rx_waiter = 0;
+	if (tx_waiter == id)
+		tx_waiter = 0;
+	if (envid2env(id, &e, 0) == 0 && e->env_net_waiting) {
+		e->env_net_waiting = 0;
+		e->env_status = ENV_RUNNABLE;
+	}
+}
+
+// Block e until one of 'events' may have happened, unless one already
+// has.  Returns -E_NOT_SUPP if there is no device or it has no
+// interrupt line, and -E_RETRY if another environment is waiting for
+// the same event.
+int
+netdev_wait(struct Env *e, int events)
+{
+	struct netdev *dev = netdev_irqdev();
+
+	if (dev == NULL || dev->irq == 0)
+		return -E_NOT_SUPP;
+	if (((events & NET_WAIT_RX) && netdev_waiting(rx_waiter) && rx_waiter != e->env_id)
+	    || ((events & NET_WAIT_TX) && netdev_waiting(tx_waiter) && tx_waiter != e->env_id))
+		return -E_RETRY;
+
+	// Unmask before checking the rings: anything that happens after
+	// the check interrupts.
+	dev->irq_unmask(events);
+	if (dev->ready(events)) {
+		dev->irq_mask(events & ~netdev_waited());
+		return 0;
+	}
+
+	if (events & NET_WAIT_RX)
+		rx_waiter = e->env_id;
+	if (events & NET_WAIT_TX)
+		tx_waiter = e->env_id;
+	e->env_net_waiting = 1;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Called by a driver's interrupt handler with the events the device
+// reported: wake whoever waits for them, and mask the events nobody
+// waits for any more.
+void
+netdev_intr(int events)
+{
+	if ((events & NET_WAIT_RX) && rx_waiter)
+		netdev_wake(rx_waiter);
+	if ((events & NET_WAIT_TX) && tx_waiter)
+		netdev_wake(tx_waiter);
+	netdev_irqdev()->irq_mask((NET_WAIT_RX | NET_WAIT_TX) & ~netdev_waited());
+}
@@ -0,0 +1,70 @@
+#ifndef JOS_KERN_NETDEV_H
+#define JOS_KERN_NETDEV_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+struct Env;
+struct Page;
+
+#define NETDEV_MAXFRAME	1518	// longest frame sent, less the CRC
+#define NETDEV_MAXFRAGS	16	// page pieces of a gathered frame
+
+// Neighbours of slot i in a ring of n
+#define RING_NEXT(i, n) (((i) + 1) % (n))
+#define RING_PREV(i, n) (((i) + (n) - 1) % (n))
+
+// A network driver, as seen by the sys_net_* calls.  The first driver
+// to attach sets 'netdev'.
+struct netdev {
+	const char *name;
+	int features;		// NET_F_*
+	// Queue a copy of a frame.  Returns 0, or -E_RETRY if the
+	// transmit ring is full.
+	int (*tx_copy)(const void *src, size_t len);
+	// Queue a frame gathered from n pieces, lens[i] bytes at physical
+	// address addrs[i] in page pages[i], which stay pinned until it is
+	// sent; flags are NET_TX_*.  Returns a tag below NET_MAXTAGS that
+	// tx_reap reports to owner once the frame is sent, -E_RETRY if the
+	// ring is full, or -E_INVAL if the frame cannot be offloaded.
+	int (*tx_gather)(struct Page **pages, physaddr_t *addrs, size_t *lens,
+			 int n, int flags, envid_t owner);
+	// Start the device on the frames queued since the last call.
+	void (*tx_kick)(void);
+	// Return, and forget, the mask of owner's tags that were sent.
+	uint32_t (*tx_reap)(envid_t owner);
+	// Trade pp for the page holding the oldest received frame, which
+	// starts at jp_data (struct jif_pkt).  Returns the frame length, 0
+	// for a bad frame, or -E_RETRY; stores NET_RX_* flags in *flags.
+	int (*rx_swap)(struct Page *pp, struct Page **frame, int *flags);
+	// Whether one of 'events' (NET_WAIT_*) has happened: a received
+	// frame, or room to send.  Once the device is handed over, whether
+	// it reported one since the last call.
+	bool (*ready)(int events);
+	// Let 'events' interrupt, after acknowledging those the device
+	// already reported; and stop them.  A device that cannot mask
+	// them apart masks only once asked to mask both.  netdev_wait
+	// and netdev_intr call these.
+	void (*irq_unmask)(int events);
+	void (*irq_mask)(int events);
+	// The registers, for a driver that can hand the device over to a
+	// user-space driver (sys_net_map_device); mmio_size is 0 if not.
+	physaddr_t mmio_pa;
+	size_t mmio_size;
+	// Stop the device and forget it, before the hand-over.  Its
+	// interrupt keeps working for netdev_wait.
+	void (*detach)(void);
+	// The interrupt line, or 0 if the device is only polled
+	uint8_t irq;
+	// Print the driver's statistics, for the monitor's netstats;
+	// NULL if it keeps none.
+	void (*print_stats)(void);
+};
+
+extern struct netdev *netdev;
+extern struct netdev *netdev_user;
+
+int netdev_wait(struct Env *e, int events);
+void netdev_intr(int events);
+
+#endif	// !JOS_KERN_NETDEV_H
@@ -4,6 +4,11 @@
 #include <kern/pci.h>
 #include <kern/pcireg.h>
 #include <kern/e100.h>
+#include <kern/e1000.h>
+#include <kern/ahci.h>
+#include <kern/virtio.h>
+#include <kern/virtio_blk.h>
+#include <kern/virtio_net.h>
 
 // Flag to do "lspci" at bootup
 static int pci_show_devs = 1;
@@ -31,6 +36,11 @@ struct pci_driver pci_attach_class[] = {
 // pci_attach_vendor matches the vendor ID and device ID of a PCI device
 struct pci_driver pci_attach_vendor[] = {
 	{ 0x8086, 0x1209, e100_attach},
+	{ 0x8086, 0x100E, e1000_attach },	// 82540EM (QEMU -net nic,model=e1000)
+	{ 0x8086, 0x2922, ahci_attach },	// ICH9 (QEMU -device ahci)
+	{ 0x8086, 0x2829, ahci_attach },	// ICH8M
+	{ VIRTIO_VENDOR, VIRTIO_DEV_BLK, virtio_blk_attach },
+	{ VIRTIO_VENDOR, VIRTIO_DEV_NET, virtio_net_attach },
 	{ 0, 0, 0 }
 };
 
@@ -500,6 +500,9 @@ page_init(void)
     LIST_INIT(&page_free_list);
     for (i = 0; i < npage; i++) {
             pages[i].pp_ref = is_sys_use(i);
+            // A null le_prev marks a page as not on the free list;
+            // page_alloc_npages relies on it.
+            pages[i].pp_link.le_prev = NULL;
             if (0 == pages[i].pp_ref)
                 LIST_INSERT_HEAD(&page_free_list, &pages[i], pp_link);
         }
@@ -545,6 +548,35 @@ page_alloc(struct Page **pp_store)
     return -E_NO_MEM;
 }
 
+//
+// Allocates n physically contiguous pages, for devices that DMA into
+// structures larger than a page.  As with page_alloc, neither the
+// contents nor the reference counts are touched.  *pp_store is set to
+// the first page of the run.
+//
+// RETURNS
+//   0 -- on success
+//   -E_NO_MEM -- if there is no run of n free pages
+//
+int
+page_alloc_npages(int n, struct Page **pp_store)
+{
+	int i, run = 0;
+
+	// Pages on the free list have a non-null le_prev
+	for (i = 0; i < npage && run < n; i++)
+		run = pages[i].pp_link.le_prev ? run + 1 : 0;
+	if (run < n)
+		return -E_NO_MEM;
+
+	*pp_store = &pages[i - n];
+	for (i -= n; run > 0; i++, run--) {
+		LIST_REMOVE(&pages[i], pp_link);
+		page_initpp(&pages[i]);
+	}
+	return 0;
+}
+
 //
 // Return a page to the free list.
 // (This function should only be called when pp->pp_ref reaches 0.)
@@ -687,6 +719,28 @@ boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int per
     }
 }
 
+//
+// Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+// location with cache-disabled and write-through PTEs, as device
+// registers require.  Returns the virtual address corresponding to pa.
+// The reservation is rounded to whole pages and never released; it is
+// meant for drivers mapping their register BARs at attach time.
+//
+void *
+mmio_map_region(physaddr_t pa, size_t size)
+{
+	static uintptr_t base = MMIOBASE;
+	physaddr_t pa0 = ROUNDDOWN(pa, PGSIZE);
+	uintptr_t va = base;
+
+	size = ROUNDUP(pa + size, PGSIZE) - pa0;
+	if (base + size > MMIOLIM || base + size < base)
+		panic("mmio_map_region: out of MMIO space mapping %08x", pa);
+	boot_map_segment(boot_pgdir, va, size, pa0, PTE_W | PTE_PCD | PTE_PWT);
+	base += size;
+	return (void *) (va + PGOFF(pa));
+}
+
 //
 // Return the page mapped at virtual address 'va'.
 // If pte_store is not zero, then we store in it the address
@@ -702,7 +756,8 @@ struct Page *
 page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
     pte_t * pte = pgdir_walk(pgdir, va, 0); 
-    if (pte && *pte) {
+    // Device registers (sys_net_map_device) have no struct Page
+    if (pte && *pte && PPN(*pte) < npage) {
         if (pte_store)
             *pte_store = pte;
         return pa2page(*pte);
@@ -737,6 +792,11 @@ page_remove(pde_t *pgdir, void *va)
         *pte = 0;
         tlb_invalidate(pgdir, va);
     }
+    else if ((pte = pgdir_walk(pgdir, va, 0)) && (*pte & PTE_P)) {
+        // A device mapping: nothing to free
+        *pte = 0;
+        tlb_invalidate(pgdir, va);
+    }
 }
 
 //
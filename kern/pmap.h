@@ -53,6 +53,7 @@ void	i386_detect_memory();
 
 void	page_init(void);
 int	page_alloc(struct Page **pp_store);
+int	page_alloc_npages(int n, struct Page **pp_store);
 void	page_free(struct Page *pp);
 int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
@@ -62,6 +63,8 @@ void	page_incref(struct Page *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
 
+void	*mmio_map_region(physaddr_t pa, size_t size);
+
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
 
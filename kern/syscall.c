@@ -12,7 +12,10 @@
 #include <kern/console.h>
 #include <kern/sched.h>
 #include <kern/time.h>
-#include <kern/e100.h>
+#include <kern/netdev.h>
+#include <kern/disk.h>
+#include <inc/disk.h>
+#include <inc/net.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -89,6 +92,7 @@ sys_exofork(void)
     env->env_status = ENV_NOT_RUNNABLE;
     env->env_tf = curenv->env_tf;
     env->env_tf.tf_regs.reg_eax = 0;
+    env->env_net_driver = curenv->env_net_driver;
     return env->env_id;
 }
 
@@ -117,6 +121,8 @@ sys_env_set_status(envid_t envid, int status)
         return -E_INVAL;
 
     env->env_status = status;
+    // Woken by hand, so no longer waiting for the network device
+    env->env_net_waiting = 0;
     return 0;
 }
 
@@ -206,6 +212,48 @@ sys_page_alloc(envid_t envid, void *va, int perm)
     return 0;
 }
 
+#ifdef NS_USER_DRIVER
+// Allocate npages physically contiguous pages, zeroed, for a user-space
+// device driver to hand to a device, and map them at va and up in the
+// caller's address space with permission 'perm' (as for
+// sys_page_alloc).  Only the network server and its children may call
+// this.  Returns the physical address of the first page.
+// Errors are:
+//	-E_BAD_ENV if curenv may not drive the NIC.
+//	-E_INVAL if va is not page-aligned, the pages would not all be
+//		below UTOP, npages is not positive, or perm is inappropriate.
+//	-E_NO_MEM if there is no run of npages free pages, or no memory
+//		for the page tables.
+    static int
+sys_page_alloc_dma(void *va, int npages, int perm)
+{
+    struct Page *pp;
+    int i, j;
+
+    if (!curenv->env_net_driver)
+        return -E_BAD_ENV;
+    if (0 != PGOFF(va) || npages <= 0 || npages > UTOP / PGSIZE
+        || (uintptr_t)va + npages * PGSIZE > UTOP
+        || (uintptr_t)va + npages * PGSIZE < (uintptr_t)va)
+        return -E_INVAL;
+    if ((PTE_U | PTE_P) != ((PTE_U | PTE_P) & perm) || (perm & ~PTE_USER))
+        return -E_INVAL;
+    if (0 != page_alloc_npages(npages, &pp))
+        return -E_NO_MEM;
+    memset(page2kva(pp), 0, npages * PGSIZE);
+    for (i = 0; i < npages; ++i)
+        if (0 != page_insert(curenv->env_pgdir, pp + i, (char *)va + i * PGSIZE, perm)) {
+            // Unmapping frees the pages mapped so far
+            for (j = i; j < npages; ++j)
+                page_free(pp + j);
+            while (i-- > 0)
+                page_remove(curenv->env_pgdir, (char *)va + i * PGSIZE);
+            return -E_NO_MEM;
+        }
+    return page2pa(pp);
+}
+#endif	// NS_USER_DRIVER
+
 // Map the page of memory at 'srcva' in srcenvid's address space
 // at 'dstva' in dstenvid's address space with permission 'perm'.
 // Perm has the same restrictions as in sys_page_alloc, except
@@ -274,17 +322,11 @@ sys_page_unmap(envid_t envid, void *va)
 
     // LAB 4: Your code here.
     struct Env *env;
-    struct Page *pag;
-    pte_t *pte = NULL;
     if ((void *)UTOP < va || (unsigned int)va % PGSIZE != 0)
         return -E_INVAL;
     if (0 != envid2env(envid, &env, true))
         return -E_BAD_ENV;
-    pag = page_lookup(env->env_pgdir, va, &pte);
-    if (NULL != pag && *pte) {
-        *pte = 0;
-        page_decref(pag);
-    }
+    page_remove(env->env_pgdir, va);
     return 0;
 }
 
@@ -360,6 +402,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 
     dstenv->env_ipc_value = value;
     dstenv->env_ipc_recving = false;
+    dstenv->env_ipc_timeout = 0;
     dstenv->env_ipc_from = curenv->env_id;
     dstenv->env_tf.tf_regs.reg_eax = 0;
     dstenv->env_status = ENV_RUNNABLE;
@@ -397,6 +440,58 @@ sys_ipc_recv(void *dstva)
     return 0;
 }
 
+// The earliest env_ipc_timeout of the environments blocked in
+// sys_ipc_recv_timed, or 0 if none is.
+static uint32_t ipc_next_timeout;
+
+// Like sys_ipc_recv, but give up once time_msec reaches 'msec', which
+// is checked on each clock tick.  A time already past still gives up
+// the CPU until the next tick, so that senders get a chance.  ~0 means
+// no time limit.
+// Errors are:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_TIMEOUT, returned when the time runs out.
+    static int
+sys_ipc_recv_timed(void *dstva, uint32_t msec)
+{
+    int r;
+
+    if (0 > (r = sys_ipc_recv(dstva)))
+        return r;
+    if ((uint32_t)~0 != msec) {
+        curenv->env_ipc_timeout = MAX(msec, 1);
+        if (0 == ipc_next_timeout || curenv->env_ipc_timeout < ipc_next_timeout)
+            ipc_next_timeout = curenv->env_ipc_timeout;
+    }
+    return 0;
+}
+
+// End the timed receives whose time is up.  Called on each clock tick;
+// the environments are only scanned once the earliest time comes.
+void
+ipc_expire(void)
+{
+    uint32_t now = time_msec(), next = 0;
+    struct Env *e;
+
+    if (0 == ipc_next_timeout || now < ipc_next_timeout)
+        return;
+
+    for (e = envs; e < envs + NENV; e++) {
+        if (ENV_NOT_RUNNABLE != e->env_status || !e->env_ipc_recving
+            || 0 == e->env_ipc_timeout)
+            continue;
+        if (now >= e->env_ipc_timeout) {
+            e->env_ipc_recving = false;
+            e->env_ipc_timeout = 0;
+            e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+            e->env_status = ENV_RUNNABLE;
+        } else if (0 == next || e->env_ipc_timeout < next)
+            next = e->env_ipc_timeout;
+    }
+    ipc_next_timeout = next;
+}
+
 // Return the current time.
     static int
 sys_time_msec(void) 
@@ -405,95 +500,369 @@ sys_time_msec(void)
     return time_msec();
 }
 
+// Return the NET_F_* features of the network device, or -E_NOT_SUPP if
+// there is none.
+    static int
+sys_net_features(void)
+{
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    return netdev->features;
+}
+
 //Send data from user 
 int
 sys_net_send(void * src, size_t len)
 {
-    uint16_t status;
-    union Tcb *ptcb = NULL;
+    int r;
 
-    if (NULL == tcb_cu) {
-        tcb_cu = cbl_ka;
-        noptcb_cu = tcb_cu;
-    }
-    else {
-        ptcb = tcb_cu;
-        tcb_cu = e100_next_tcb(tcb_cu);
-    }
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    if (len > NETDEV_MAXFRAME)
+        return -E_INVAL;
+    user_mem_assert(curenv, (const void *)src, len, PTE_P);
+    if (0 == (r = netdev->tx_copy(src, len)))
+        netdev->tx_kick();
+    return r;
+}
 
-    if (!e100_tcb_complete(tcb_cu->tcb_transmit.cb.status))
-        return -E_RETRY;
+// Queue up to n frames for sending in one trap, copying each, and start
+// the device on all of them at once.  frames[i] gives the i'th frame's
+// address and length.  Returns the number of frames queued, which is
+// less than n if the transmit ring filled up.
+// Errors are:
+//	-E_INVAL if n is 0 or over NET_MAXBATCH, or a frame is not user
+//		memory or is too long.
+//	-E_RETRY if the transmit ring is full.
+    static int
+sys_net_send_batch(const struct net_sg *uframes, int n)
+{
+    struct net_sg frames[NET_MAXBATCH];
+    int i, r = 0;
 
-    user_mem_assert(curenv, (const void *)src, len, PTE_P);
-    e100_cu_int(tcb_cu);
-    memmove(tcb_cu->tcb_transmit.data, src, len);
-    tcb_cu->tcb_transmit.cb.status = 0;
-    tcb_cu->tcb_transmit.tcbbc = len;
-
-    if (NULL != ptcb)
-        e100_cu_res(ptcb);
-
-    status = e100_cu_status();
-    if (TCB_STATUS_IDLE == status) {
-        e100_write_scbgp(PADDR(cbl_ka));
-        e100_write_cmd_cu(TCB_CMD_CS);
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    if (n <= 0 || n > NET_MAXBATCH
+        || 0 != user_mem_check(curenv, uframes, n * sizeof(frames[0]), PTE_U))
+        return -E_INVAL;
+    memmove(frames, uframes, n * sizeof(frames[0]));
+    for (i = 0; i < n; ++i)
+        if (frames[i].sg_len > NETDEV_MAXFRAME
+            || 0 != user_mem_check(curenv, frames[i].sg_va, frames[i].sg_len, PTE_U))
+            return -E_INVAL;
+
+    for (i = 0; i < n; ++i)
+        if (0 > (r = netdev->tx_copy(frames[i].sg_va, frames[i].sg_len)))
+            break;
+    netdev->tx_kick();
+    return i ? i : r;
+}
+
+// Send the frame made of the nsg buffers described by sg, without
+// copying it: the device gathers the buffers straight from the pages
+// they are in, which stay allocated until it is done, even if they are
+// unmapped.  The buffers must not change until then.  With
+// NET_TX_CSUM in flags, the device fills in the IP header checksum and
+// the TCP or UDP checksum, whose field must hold the sum of the
+// pseudo-header.  Returns the frame's tag, which sys_net_tx_reap
+// reports once the frame is sent.
+// Errors are:
+//	-E_INVAL if nsg is 0 or over NET_MAXSG, a buffer is not user
+//		memory, the buffers span over NETDEV_MAXFRAGS pages, the
+//		frame is too long, or the device cannot offload it.
+//	-E_NOT_SUPP if there is no network device.
+//	-E_RETRY if the transmit ring is full.
+    static int
+sys_net_send_sg(const struct net_sg *usg, int nsg, int flags)
+{
+    struct net_sg sg[NET_MAXSG];
+    struct Page *pages[NETDEV_MAXFRAGS];
+    physaddr_t addrs[NETDEV_MAXFRAGS];
+    size_t lens[NETDEV_MAXFRAGS], len = 0;
+    uintptr_t va, end;
+    pte_t *pte;
+    int i, n = 0;
+
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    if ((flags & ~NET_TX_CSUM)
+        || ((flags & NET_TX_CSUM) && !(netdev->features & NET_F_TXCSUM)))
+        return -E_INVAL;
+    if (nsg <= 0 || nsg > NET_MAXSG
+        || 0 != user_mem_check(curenv, usg, nsg * sizeof(sg[0]), PTE_U))
+        return -E_INVAL;
+    memmove(sg, usg, nsg * sizeof(sg[0]));
+
+    for (i = 0; i < nsg; ++i) {
+        if (0 != user_mem_check(curenv, sg[i].sg_va, sg[i].sg_len, PTE_U))
+            return -E_INVAL;
+        len += sg[i].sg_len;
     }
-    else if (TCB_STATUS_SUSPENDED == status) {
-        e100_cu_res(noptcb_cu);
-        if (noptcb_cu == tcb_cu) {
-            noptcb_cu = e100_prev_tcb(tcb_cu);
-            e100_cu_int(noptcb_cu);
+    if (0 == len || len > NETDEV_MAXFRAME)
+        return -E_INVAL;
+
+    // One piece per part of a buffer within a page
+    for (i = 0; i < nsg; ++i) {
+        end = (uintptr_t)sg[i].sg_va + sg[i].sg_len;
+        for (va = (uintptr_t)sg[i].sg_va; va < end; va += lens[n++]) {
+            if (NETDEV_MAXFRAGS == n)
+                return -E_INVAL;
+            // Not device registers
+            if (NULL == (pages[n] = page_lookup(curenv->env_pgdir, (void *)va, &pte)))
+                return -E_INVAL;
+            addrs[n] = page2pa(pages[n]) + PGOFF(va);
+            lens[n] = MIN(ROUNDDOWN(va, PGSIZE) + PGSIZE, end) - va;
         }
-        else
-            noptcb_cu = tcb_cu;
-        e100_write_cmd_cu(TCB_CMD_CC);
     }
 
+    if (0 <= (i = netdev->tx_gather(pages, addrs, lens, n, flags, curenv->env_id)))
+        netdev->tx_kick();
+    return i;
+}
+
+// Store in *done the mask of the caller's sys_net_send_sg tags whose
+// frames were sent since the last call.  Their buffers may then be
+// reused.
+    static int
+sys_net_tx_reap(uint32_t *done)
+{
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    user_mem_assert(curenv, done, sizeof(*done), PTE_U | PTE_W);
+    *done = netdev->tx_reap(curenv->env_id);
     return 0;
 }
 
-//recieve data from net
-int
-sys_net_recv(char * dst, size_t len)
+// Receive a frame without copying it.  The caller gives up the page
+// mapped at pg, which joins the device's receive ring, and in return
+// gets the page the oldest received frame was written into, mapped at
+// pg as a struct jif_pkt, whose jp_flags tell which checksums the
+// device verified (NET_RX_*).  Returns the frame's length, 0 for a bad
+// frame (the pages are swapped all the same).
+// Errors are:
+//	-E_NOT_SUPP if there is no network device.
+//	-E_INVAL if pg is not page-aligned, is not mapped writable, or
+//		its page is shared (the device writes into it).
+//	-E_RETRY if no frame has arrived.
+    static int
+sys_net_recv(void *pg)
 {
-    int n;
-
-    if (NULL == tcb_ru) {
-        tcb_ru = rfa_ka;
-        noptcb_ru = e100_prev_tcb(tcb_ru);
-        noptcb_ru->tcb_recieve.cb.cmd = TCB_CMD_NOP;
-        e100_write_scbgp(PADDR(tcb_ru));
-        e100_write_cmd_ru(TCB_CMD_RS);
+    struct Page *pp, *frame;
+    struct jif_pkt *pkt;
+    pte_t *pte;
+    int n, r, flags;
+
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    if ((void *)UTOP <= pg || 0 != PGOFF(pg))
+        return -E_INVAL;
+    pp = page_lookup(curenv->env_pgdir, pg, &pte);
+    if (NULL == pp || (PTE_U | PTE_W) != (*pte & (PTE_U | PTE_W)) || 1 != pp->pp_ref)
+        return -E_INVAL;
+
+    if ((n = netdev->rx_swap(pp, &frame, &flags)) < 0)
+        return n;
+
+    // The ring keeps a reference to pp and hands over its reference
+    // to frame.
+    pp->pp_ref++;
+    if (0 != (r = page_insert(curenv->env_pgdir, frame, pg, PTE_U | PTE_W | PTE_P)))
+        panic("sys_net_recv: %e", r);
+    page_decref(frame);
+    pkt = page2kva(frame);
+    pkt->jp_len = n;
+    pkt->jp_flags = flags;
+
+    return n;
+}
+
+// The page sys_net_recv_batch trades for each frame it copies out; the
+// frame's page becomes the next one.  It never leaves the kernel.
+static struct Page *net_rx_spare;
+
+// Copy up to NET_MAXBATCH received frames into the len bytes at buf in
+// one trap, back to back as NET_RECLEN records: a struct jif_pkt, as
+// sys_net_recv fills it in, and the frame.  Frames are taken while a
+// record of NET_MAXFRAME bytes still fits; bad frames, and frames over
+// NET_MAXFRAME, are dropped.  Returns the bytes filled, which is 0 if
+// every frame was dropped.
+// Errors are:
+//	-E_NOT_SUPP if there is no network device.
+//	-E_INVAL if len is less than NET_RECLEN(NET_MAXFRAME).
+//	-E_NO_MEM if there is no page to trade.
+//	-E_RETRY if no frame has arrived.
+    static int
+sys_net_recv_batch(void *buf, size_t len)
+{
+    struct Page *frame;
+    struct jif_pkt *pkt;
+    size_t used = 0;
+    int i, n = 0, flags;
+
+    if (NULL == netdev)
+        return -E_NOT_SUPP;
+    if (len < NET_RECLEN(NET_MAXFRAME))
+        return -E_INVAL;
+    user_mem_assert(curenv, buf, len, PTE_U | PTE_W);
+    if (NULL == net_rx_spare) {
+        if (0 != page_alloc(&net_rx_spare))
+            return -E_NO_MEM;
+        net_rx_spare->pp_ref++;
     }
 
-    if (!e100_tcb_complete(tcb_ru->tcb_recieve.cb.status))
-        return -E_RETRY;
+    for (i = 0; i < NET_MAXBATCH && len - used >= NET_RECLEN(NET_MAXFRAME); ++i) {
+        // The ring takes our reference to the spare and gives us its
+        // reference to frame.
+        if ((n = netdev->rx_swap(net_rx_spare, &frame, &flags)) < 0)
+            break;
+        net_rx_spare = frame;
+        if (0 == n || n > NET_MAXFRAME)
+            continue;
+        pkt = (struct jif_pkt *)((char *)buf + used);
+        memmove(pkt->jp_data, ((struct jif_pkt *)page2kva(frame))->jp_data, n);
+        pkt->jp_len = n;
+        pkt->jp_flags = flags;
+        used += NET_RECLEN(n);
+    }
+    return (0 == i && n < 0) ? n : (int)used;
+}
+
+// Block until the network device has a received frame (NET_WAIT_RX)
+// or a free transmit slot (NET_WAIT_TX), or return at once if it
+// already does.  The wait can end early, so callers must retry their
+// sys_net_recv or sys_net_send and wait again if it still fails.
+// Once a user-space driver took the device over, its environments
+// wait here instead until the device reports a frame received or sent
+// since their last wait; they must check their rings before sleeping.
+// Errors are:
+//	-E_INVAL if events is not a combination of NET_WAIT_RX and NET_WAIT_TX.
+//	-E_NOT_SUPP if there is no device or it has no interrupt; poll
+//		instead.
+//	-E_RETRY if another environment waits for the same event.
+    static int
+sys_net_wait(int events)
+{
+    if (0 == events || (events & ~(NET_WAIT_RX | NET_WAIT_TX)))
+        return -E_INVAL;
+    if (NULL == netdev && !curenv->env_net_driver)
+        return -E_NOT_SUPP;
+    return netdev_wait(curenv, events);
+}
+
+#ifdef NS_USER_DRIVER
+
+// Hand the network device over to user space: map its registers,
+// uncached, at va and up in the caller's address space, for a
+// user-space driver to program with rings in sys_page_alloc_dma pages.
+// The first call stops the kernel's driver, and the sys_net_* calls
+// then fail with -E_NOT_SUPP; later calls, from the other environments
+// of the same driver, only map the registers.  The mapping is not
+// copied by sys_page_map or fork.  The device can write anywhere in
+// memory, so this trusts the caller as much as the kernel: only the
+// network server and its children may call it.
+// Returns the size of the register window.
+// Errors are:
+//	-E_BAD_ENV if curenv may not drive the NIC.
+//	-E_NOT_SUPP if there is no device, or its driver cannot hand it over.
+//	-E_INVAL if va is not page-aligned or the window would reach UTOP.
+//	-E_NO_MEM if there is no memory for the page tables.
+    static int
+sys_net_map_device(void *va)
+{
+    struct netdev *dev = netdev_user ? netdev_user : netdev;
+    physaddr_t pa;
+    size_t off, size;
+    pte_t *pte;
+
+    if (!curenv->env_net_driver)
+        return -E_BAD_ENV;
+    if (NULL == dev || 0 == dev->mmio_size)
+        return -E_NOT_SUPP;
+    pa = ROUNDDOWN(dev->mmio_pa, PGSIZE);
+    size = ROUNDUP(dev->mmio_pa + dev->mmio_size, PGSIZE) - pa;
+    if (0 != PGOFF(va) || (uintptr_t)va >= UTOP || UTOP - (uintptr_t)va < size)
+        return -E_INVAL;
 
-    if (0x03 == e100_ru_resault(tcb_ru->tcb_recieve.actualcount)) {
-        n = e100_ru_count(tcb_ru->tcb_recieve.actualcount);
-        n = MIN(len, n);
-        user_mem_assert(curenv, (const void *)dst, n, PTE_P);
-        memmove(dst, tcb_ru->tcb_recieve.data, n);
+    if (NULL == netdev_user) {
+        dev->detach();
+        netdev_user = dev;
+        netdev = NULL;
     }
-    else
-        n = 0;
+    for (off = 0; off < size; off += PGSIZE) {
+        if (NULL == (pte = pgdir_walk(curenv->env_pgdir, (char *)va + off, 1)))
+            return -E_NO_MEM;
+        page_remove(curenv->env_pgdir, (char *)va + off);
+        *pte = (pa + off) | PTE_P | PTE_U | PTE_W | PTE_PCD | PTE_PWT;
+        tlb_invalidate(curenv->env_pgdir, (char *)va + off);
+    }
+    return size;
+}
+#endif	// NS_USER_DRIVER
 
-    uint16_t status = e100_read_status();
-    if (e100_ru_sus(status)) {
-        e100_ru_res(noptcb_ru);
-        noptcb_ru = (tcb_ru == noptcb_ru) ? e100_prev_tcb(tcb_ru) : tcb_ru;
+// The DMA disk, if a driver for one attached.
+struct diskdev *diskdev;
 
-        noptcb_ru->tcb_recieve.cb.cmd = TCB_CMD_RI;
-        noptcb_ru->tcb_recieve.cb.status = 0;
-        noptcb_ru->tcb_recieve.actualcount = 0;
-        e100_write_cmd_ru(TCB_CMD_RC);
+// Start a DMA transfer of nsecs sectors between disk sector secno and
+// the page-aligned buffer at va.  Only environments with I/O privilege
+// (the file system server) may use the disk.  The buffer pages stay
+// allocated until the request is reaped, even if va is unmapped.
+// Returns the request's tag, which sys_disk_reap reports on completion.
+// Errors are:
+//	-E_BAD_ENV if curenv has no I/O privilege.
+//	-E_NOT_SUPP if no DMA disk driver is attached.
+//	-E_INVAL if va is not page-aligned user memory mapped with the
+//		needed permissions, or nsecs is 0 or over DISK_MAXSECTS.
+//	-E_RETRY if the maximum number of requests is in flight.
+    static int
+sys_disk_submit(uint32_t secno, void *va, size_t nsecs, int flags)
+{
+    struct Page *pages[DISK_MAXPAGES];
+    int i, npages, perm;
+    pte_t *pte;
+
+    if ((curenv->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+        return -E_BAD_ENV;
+    if (diskdev == NULL)
+        return -E_NOT_SUPP;
+    if (PGOFF(va) || nsecs == 0 || nsecs > DISK_MAXSECTS)
+        return -E_INVAL;
+
+    // The device writes memory on a disk read
+    perm = PTE_U | PTE_P | ((flags & DISK_WRITE) ? 0 : PTE_W);
+    npages = ROUNDUP(nsecs * DISK_SECTSIZE, PGSIZE) / PGSIZE;
+    for (i = 0; i < npages; i++) {
+        void *pg = (char *)va + i * PGSIZE;
+        if ((uintptr_t)pg >= UTOP)
+            return -E_INVAL;
+        pages[i] = page_lookup(curenv->env_pgdir, pg, &pte);
+        if (pages[i] == NULL || (*pte & perm) != perm)
+            return -E_INVAL;
     }
 
-    tcb_ru->tcb_recieve.actualcount = 0;
-    tcb_ru->tcb_recieve.cb.status = 0;
-    tcb_ru = e100_next_tcb(tcb_ru);
+    return diskdev->submit(secno, pages, npages, nsecs, flags);
+}
 
-    return n;
+// Store in *done the mask of request tags that completed since the
+// last call.  Returns -E_IO if the disk reported an error, in which
+// case every outstanding request was aborted and is included in *done.
+// Errors are also:
+//	-E_BAD_ENV if curenv has no I/O privilege.
+//	-E_NOT_SUPP if no DMA disk driver is attached.
+    static int
+sys_disk_reap(uint32_t *done)
+{
+    uint32_t mask;
+    int r;
+
+    if ((curenv->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+        return -E_BAD_ENV;
+    if (diskdev == NULL)
+        return -E_NOT_SUPP;
+    user_mem_assert(curenv, done, sizeof(*done), PTE_U | PTE_W);
+
+    r = diskdev->reap(&mask);
+    *done = mask;
+    return r;
 }
 
 // Dispatches to the correct kernel function, passing the arguments.
@@ -546,18 +915,53 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
         case SYS_ipc_recv:
             return sys_ipc_recv((void *)a1);
             break;
+        case SYS_ipc_recv_timed:
+            return sys_ipc_recv_timed((void *)a1, a2);
+            break;
         case SYS_env_set_trapframe:
             return sys_env_set_trapframe((envid_t)a1, (struct Trapframe *)a2);
             break;
         case SYS_net_send:
             return sys_net_send((void *)a1, (size_t)a2);
             break;
+        case SYS_net_send_sg:
+            return sys_net_send_sg((const struct net_sg *)a1, (int)a2, (int)a3);
+            break;
+        case SYS_net_send_batch:
+            return sys_net_send_batch((const struct net_sg *)a1, (int)a2);
+            break;
+        case SYS_net_recv_batch:
+            return sys_net_recv_batch((void *)a1, (size_t)a2);
+            break;
+        case SYS_net_tx_reap:
+            return sys_net_tx_reap((uint32_t *)a1);
+            break;
         case SYS_net_recv:
-            return sys_net_recv((void *)a1, (size_t)a2);
+            return sys_net_recv((void *)a1);
+            break;
+        case SYS_net_features:
+            return sys_net_features();
+            break;
+        case SYS_net_wait:
+            return sys_net_wait((int)a1);
             break;
+#ifdef NS_USER_DRIVER
+        case SYS_net_map_device:
+            return sys_net_map_device((void *)a1);
+            break;
+        case SYS_page_alloc_dma:
+            return sys_page_alloc_dma((void *)a1, (int)a2, (int)a3);
+            break;
+#endif
         case SYS_time_msec:
             return sys_time_msec();
             break;
+        case SYS_disk_submit:
+            return sys_disk_submit(a1, (void *)a2, (size_t)a3, (int)a4);
+            break;
+        case SYS_disk_reap:
+            return sys_disk_reap((uint32_t *)a1);
+            break;
 
         default:
             return -E_INVAL;
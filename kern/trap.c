@@ -60,6 +60,26 @@ static const char *trapname(int trapno)
     return "(unknown trap)";
 }
 
+// Device interrupt handlers, by IRQ line.  PCI devices may share a
+// line, so each handler must check whether its device interrupted.
+#define IRQ_NHANDLERS 4
+static void (*irq_handlers[MAX_IRQS][IRQ_NHANDLERS])(void);
+
+// Call handler on every interrupt on 'irq', and unmask the line.
+    void
+irq_register(int irq, void (*handler)(void))
+{
+    int i;
+
+    assert(irq > 0 && irq < MAX_IRQS && irq != IRQ_SLAVE);
+    for (i = 0; i < IRQ_NHANDLERS && irq_handlers[irq][i]; i++)
+        ;
+    if (i == IRQ_NHANDLERS)
+        panic("irq_register: too many handlers for irq %d", irq);
+    irq_handlers[irq][i] = handler;
+    irq_setmask_8259A(irq_mask_8259A & ~(1 << irq));
+}
+
 #define DPL_K 0
 #define DPL_U 3
 extern unsigned int vectors[];
@@ -68,6 +88,7 @@ extern unsigned int vectors[];
 idt_init(void)
 {
     extern struct Segdesc gdt[];
+    int i;
 
     // LAB 3: Your code here.
 
@@ -92,11 +113,8 @@ idt_init(void)
 
     SETGATE(idt[T_SYSCALL], 0, GD_KT, vectors[T_SYSCALL], DPL_U);
 
-    SETGATE(idt[IRQ_OFFSET+IRQ_TIMER], 0, GD_KT, vectors[IRQ_OFFSET+IRQ_TIMER], DPL_K);
-    SETGATE(idt[IRQ_OFFSET+IRQ_KBD], 0, GD_KT, vectors[IRQ_OFFSET+IRQ_KBD], DPL_K);
-    SETGATE(idt[IRQ_OFFSET+IRQ_SERIAL], 0, GD_KT, vectors[IRQ_OFFSET+IRQ_SERIAL], DPL_K);
-    SETGATE(idt[IRQ_OFFSET+IRQ_SPURIOUS], 0, GD_KT, vectors[IRQ_OFFSET+IRQ_SPURIOUS], DPL_K);
-    SETGATE(idt[IRQ_OFFSET+IRQ_IDE], 0, GD_KT, vectors[IRQ_OFFSET+IRQ_IDE], DPL_K);
+    for (i = 0; i < MAX_IRQS; i++)
+        SETGATE(idt[IRQ_OFFSET+i], 0, GD_KT, vectors[IRQ_OFFSET+i], DPL_K);
 
     // Setup a TSS so that we get the right stack
     // when we trap to the kernel.
@@ -175,6 +193,7 @@ trap_dispatch(struct Trapframe *tf)
 
     if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
         time_tick();
+        ipc_expire();
         sched_yield();
         return;
     }
@@ -201,6 +220,19 @@ trap_dispatch(struct Trapframe *tf)
         return;
     }
 
+    // Device interrupts.  The slave PIC is not in automatic EOI mode,
+    // so acknowledge the interrupt once the handlers have run.
+    if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + MAX_IRQS
+        && irq_handlers[tf->tf_trapno - IRQ_OFFSET][0]) {
+        void (**h)(void) = irq_handlers[tf->tf_trapno - IRQ_OFFSET];
+        int i;
+
+        for (i = 0; i < IRQ_NHANDLERS && h[i]; i++)
+            h[i]();
+        irq_eoi();
+        return;
+    }
+
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
 	if (tf->tf_cs == GD_KT)
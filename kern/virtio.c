@@ -0,0 +1,165 @@
+// Legacy virtio PCI transport and split virtqueues, shared by the
+// virtio device drivers.
+//
+// A virtqueue lives in physically contiguous pages: the descriptor
+// table, then the available ring, then (on the next VRING_ALIGN
+// boundary) the used ring.  The driver chains descriptors for a
+// request, publishes the head in the available ring and, once a batch
+// is ready, notifies the device with virtq_kick.  The device returns
+// heads through the used ring, which virtq_get consumes.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/virtio.h>
+#include <kern/pmap.h>
+
+// Keep the compiler from reordering ring updates across this point.
+// x86 does not reorder stores with other stores, so that is enough.
+static __inline void
+vring_barrier(void)
+{
+	__asm __volatile("" : : : "memory");
+}
+
+// Reset the device, acknowledge it, and agree on the features in
+// 'wanted' that the device offers.  Returns the I/O base.
+uint32_t
+virtio_reset(struct pci_func *pcif, uint32_t wanted, uint32_t *features)
+{
+	uint32_t iobase;
+
+	pci_func_enable(pcif);
+	iobase = pcif->reg_base[0];
+
+	outb(iobase + VIRTIO_PCI_STATUS, 0);
+	outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+	outb(iobase + VIRTIO_PCI_STATUS,
+	     VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+	*features = inl(iobase + VIRTIO_PCI_HOST_FEATURES) & wanted;
+	outl(iobase + VIRTIO_PCI_GUEST_FEATURES, *features);
+	return iobase;
+}
+
+void
+virtio_driver_ok(uint32_t iobase)
+{
+	outb(iobase + VIRTIO_PCI_STATUS, inb(iobase + VIRTIO_PCI_STATUS)
+	     | VIRTIO_STATUS_DRIVER_OK);
+}
+
+// Allocate and register queue 'index'.  Its size is fixed by the device.
+int
+virtq_init(struct virtq *vq, uint32_t iobase, int index)
+{
+	struct Page *pp;
+	size_t size;
+	char *va;
+	int i, r;
+
+	outw(iobase + VIRTIO_PCI_QUEUE_SEL, index);
+	memset(vq, 0, sizeof(*vq));
+	vq->iobase = iobase;
+	vq->index = index;
+	if ((vq->num = inw(iobase + VIRTIO_PCI_QUEUE_NUM)) == 0)
+		return -E_NOT_SUPP;
+
+	size = ROUNDUP(sizeof(struct vring_desc) * vq->num
+		       + sizeof(uint16_t) * (3 + vq->num), VIRTIO_PCI_VRING_ALIGN)
+		+ ROUNDUP(sizeof(uint16_t) * 3
+			  + sizeof(struct vring_used_elem) * vq->num, PGSIZE);
+	if ((r = page_alloc_npages(size / PGSIZE, &pp)) < 0)
+		return r;
+	for (i = 0; i < size / PGSIZE; i++)
+		page_incref(pp + i);
+	va = page2kva(pp);
+	memset(va, 0, size);
+
+	vq->desc = (struct vring_desc *) va;
+	vq->avail = (struct vring_avail *) (va + sizeof(struct vring_desc) * vq->num);
+	vq->used = (struct vring_used *) (va + ROUNDUP(sizeof(struct vring_desc) * vq->num
+		+ sizeof(uint16_t) * (3 + vq->num), VIRTIO_PCI_VRING_ALIGN));
+
+	for (i = 0; i < vq->num; i++)
+		vq->desc[i].next = i + 1;
+	vq->free_head = 0;
+	vq->nfree = vq->num;
+
+	outl(iobase + VIRTIO_PCI_QUEUE_PFN, page2pa(pp) >> PGSHIFT);
+	return 0;
+}
+
+// Chain n buffers into one request and make it available to the device.
+// The device is not notified until virtq_kick.  Returns the head
+// descriptor, which virtq_get will return on completion, or -E_RETRY
+// if the queue is out of descriptors.
+int
+virtq_add(struct virtq *vq, const struct virtq_buf *bufs, int n)
+{
+	uint16_t head, d = 0;
+	int i;
+
+	if (n == 0 || vq->nfree < n)
+		return -E_RETRY;
+
+	head = vq->free_head;
+	for (i = 0; i < n; i++) {
+		d = vq->free_head;
+		vq->desc[d].addr = bufs[i].addr;
+		vq->desc[d].len = bufs[i].len;
+		vq->desc[d].flags = (i < n - 1 ? VRING_DESC_F_NEXT : 0)
+			| (bufs[i].device_writes ? VRING_DESC_F_WRITE : 0);
+		vq->free_head = vq->desc[d].next;
+	}
+	vq->nfree -= n;
+
+	vq->avail->ring[vq->avail->idx % vq->num] = head;
+	vring_barrier();
+	vq->avail->idx++;
+	vq->unkicked++;
+	return head;
+}
+
+// Notify the device of the buffers added since the last kick, unless
+// it has said it is already processing the queue and does not need one.
+void
+virtq_kick(struct virtq *vq)
+{
+	if (vq->unkicked == 0)
+		return;
+	// The avail->idx store must be visible before used->flags is read,
+	// or the device may set NO_NOTIFY after we looked and miss the batch.
+	vring_mb();
+	if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY))
+		outw(vq->iobase + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+	vq->unkicked = 0;
+}
+
+// Take the next request the device has finished with, free its
+// descriptors, and return its head.  *len is set to the number of bytes
+// the device wrote.  Returns -E_RETRY if nothing has completed.
+int
+virtq_get(struct virtq *vq, uint32_t *len)
+{
+	struct vring_used_elem *e;
+	uint16_t head, d;
+
+	if (vq->last_used == vq->used->idx)
+		return -E_RETRY;
+	vring_barrier();
+
+	e = &vq->used->ring[vq->last_used % vq->num];
+	vq->last_used++;
+	head = e->id;
+	if (len)
+		*len = e->len;
+
+	for (d = head, vq->nfree++; vq->desc[d].flags & VRING_DESC_F_NEXT; vq->nfree++)
+		d = vq->desc[d].next;
+	vq->desc[d].next = vq->free_head;
+	vq->free_head = head;
+	return head;
+}
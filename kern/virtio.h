@@ -0,0 +1,100 @@
+#ifndef JOS_KERN_VIRTIO_H
+#define JOS_KERN_VIRTIO_H
+
+#include <inc/types.h>
+#include <kern/pci.h>
+
+// Legacy virtio PCI devices: vendor 0x1AF4, device 0x1000 + subsystem
+#define VIRTIO_VENDOR		0x1AF4
+#define VIRTIO_DEV_NET		0x1000
+#define VIRTIO_DEV_BLK		0x1001
+
+// Legacy PCI registers, as offsets into the I/O BAR
+#define VIRTIO_PCI_HOST_FEATURES	0x00
+#define VIRTIO_PCI_GUEST_FEATURES	0x04
+#define VIRTIO_PCI_QUEUE_PFN		0x08
+#define VIRTIO_PCI_QUEUE_NUM		0x0C
+#define VIRTIO_PCI_QUEUE_SEL		0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY		0x10
+#define VIRTIO_PCI_STATUS		0x12
+#define VIRTIO_PCI_ISR			0x13
+#define VIRTIO_PCI_CONFIG		0x14	// device-specific config
+
+// Device status bits
+#define VIRTIO_STATUS_ACK		0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTIO_PCI_VRING_ALIGN		4096
+
+// Split virtqueue layout, shared with the device
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+#define VRING_DESC_F_NEXT	1	// chain continues at 'next'
+#define VRING_DESC_F_WRITE	2	// device writes this buffer
+
+struct vring_avail {
+	uint16_t flags;
+	volatile uint16_t idx;
+	uint16_t ring[];
+};
+
+#define VRING_AVAIL_F_NO_INTERRUPT	1
+
+struct vring_used_elem {
+	uint32_t id;			// head of the used chain
+	uint32_t len;			// bytes written by the device
+};
+
+struct vring_used {
+	volatile uint16_t flags;
+	volatile uint16_t idx;
+	struct vring_used_elem ring[];
+};
+
+#define VRING_USED_F_NO_NOTIFY		1
+
+// Driver state for one virtqueue
+struct virtq {
+	uint32_t iobase;
+	uint16_t index;			// queue number on the device
+	uint16_t num;			// number of descriptors
+	struct vring_desc *desc;
+	struct vring_avail *avail;
+	struct vring_used *used;
+	uint16_t free_head;		// free descriptors, linked by 'next'
+	uint16_t nfree;
+	uint16_t last_used;		// next used entry to consume
+	uint16_t unkicked;		// buffers made available since the last kick
+};
+
+// One buffer of a descriptor chain
+struct virtq_buf {
+	physaddr_t addr;
+	uint32_t len;
+	bool device_writes;
+};
+
+// Full fence.  x86 may let a load pass an earlier store, so a driver
+// that publishes in one ring field and then reads a field the device
+// writes (used->flags, used->idx) needs this, not a compiler barrier.
+static __inline void
+vring_mb(void)
+{
+	__asm __volatile("mfence" : : : "memory");
+}
+
+uint32_t virtio_reset(struct pci_func *pcif, uint32_t wanted, uint32_t *features);
+void	virtio_driver_ok(uint32_t iobase);
+int	virtq_init(struct virtq *vq, uint32_t iobase, int index);
+int	virtq_add(struct virtq *vq, const struct virtq_buf *bufs, int n);
+void	virtq_kick(struct virtq *vq);
+int	virtq_get(struct virtq *vq, uint32_t *len);
+
+#endif	// !JOS_KERN_VIRTIO_H
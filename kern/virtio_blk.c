@@ -0,0 +1,143 @@
+// virtio-blk driver (legacy PCI transport).
+//
+// Each request is a descriptor chain: a request header, one descriptor
+// per block cache page, and a status byte the device writes.  Headers
+// and status bytes live in the kernel, one per tag.  Requests submitted
+// with DISK_DEFER are made available without notifying the device; the
+// next plain submit or reap kicks the whole batch at once.  Completion
+// is polled from the used ring, so the device is asked not to interrupt.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/disk.h>
+
+#include <kern/virtio_blk.h>
+#include <kern/virtio.h>
+#include <kern/disk.h>
+#include <kern/pmap.h>
+
+static struct virtq vq;
+static uint64_t capacity;		// in sectors
+
+static struct vblk_req {
+	struct virtio_blk_req_hdr hdr;
+	uint8_t status;
+	int head;			// first descriptor of the chain
+	struct Page *pages[DISK_MAXPAGES];
+	int npages;
+} reqs[DISK_NTAGS];
+static uint32_t tags_busy;
+
+static int
+virtio_blk_submit(uint32_t secno, struct Page **pages, int npages,
+		  size_t nsecs, int flags)
+{
+	struct virtq_buf bufs[DISK_MAXPAGES + 2];
+	size_t left = nsecs * DISK_SECTSIZE;
+	struct vblk_req *req;
+	int tag, i, head;
+
+	if (secno + nsecs > capacity)
+		return -E_INVAL;
+	for (tag = 0; tag < DISK_NTAGS; tag++)
+		if (!(tags_busy & (1 << tag)))
+			break;
+	if (tag == DISK_NTAGS)
+		return -E_RETRY;
+
+	req = &reqs[tag];
+	req->hdr.type = (flags & DISK_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	req->hdr.reserved = 0;
+	req->hdr.sector = secno;
+	req->status = 0xFF;
+
+	bufs[0].addr = PADDR(&req->hdr);
+	bufs[0].len = sizeof(req->hdr);
+	bufs[0].device_writes = 0;
+	for (i = 0; i < npages; i++) {
+		bufs[i + 1].addr = page2pa(pages[i]);
+		bufs[i + 1].len = MIN(left, PGSIZE);
+		bufs[i + 1].device_writes = !(flags & DISK_WRITE);
+		left -= bufs[i + 1].len;
+	}
+	bufs[npages + 1].addr = PADDR(&req->status);
+	bufs[npages + 1].len = 1;
+	bufs[npages + 1].device_writes = 1;
+
+	if ((head = virtq_add(&vq, bufs, npages + 2)) < 0) {
+		// Out of descriptors: get the batch going so they come back
+		virtq_kick(&vq);
+		return head;
+	}
+
+	for (i = 0; i < npages; i++) {
+		page_incref(pages[i]);
+		req->pages[i] = pages[i];
+	}
+	req->npages = npages;
+	req->head = head;
+	tags_busy |= 1 << tag;
+
+	if (!(flags & DISK_DEFER))
+		virtq_kick(&vq);
+	return tag;
+}
+
+static int
+virtio_blk_reap(uint32_t *done)
+{
+	int head, tag, i, r = 0;
+
+	virtq_kick(&vq);
+	*done = 0;
+	while ((head = virtq_get(&vq, NULL)) >= 0) {
+		for (tag = 0; tag < DISK_NTAGS; tag++)
+			if ((tags_busy & (1 << tag)) && reqs[tag].head == head)
+				break;
+		assert(tag < DISK_NTAGS);
+
+		for (i = 0; i < reqs[tag].npages; i++)
+			page_decref(reqs[tag].pages[i]);
+		reqs[tag].npages = 0;
+		if (reqs[tag].status != VIRTIO_BLK_S_OK) {
+			cprintf("virtio-blk: sector %u: status %d\n",
+				(uint32_t) reqs[tag].hdr.sector, reqs[tag].status);
+			r = -E_IO;
+		}
+		tags_busy &= ~(1 << tag);
+		*done |= 1 << tag;
+	}
+	return r;
+}
+
+static struct diskdev virtio_blk_diskdev = {
+	"virtio-blk", virtio_blk_submit, virtio_blk_reap
+};
+
+int
+virtio_blk_attach(struct pci_func *pcif)
+{
+	uint32_t iobase, features;
+	int r;
+
+	if (diskdev)
+		return 0;
+
+	iobase = virtio_reset(pcif, 0, &features);
+	if ((r = virtq_init(&vq, iobase, 0)) < 0) {
+		outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+		return r;
+	}
+	vq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+	capacity = inl(iobase + VIRTIO_PCI_CONFIG)
+		| ((uint64_t) inl(iobase + VIRTIO_PCI_CONFIG + 4) << 32);
+	virtio_driver_ok(iobase);
+
+	cprintf("virtio-blk: %u sectors, queue size %d\n",
+		(uint32_t) capacity, vq.num);
+	diskdev = &virtio_blk_diskdev;
+	return 1;
+}
@@ -0,0 +1,23 @@
+#ifndef JOS_KERN_VIRTIO_BLK_H
+#define JOS_KERN_VIRTIO_BLK_H
+
+#include <inc/types.h>
+#include <kern/pci.h>
+
+// Request header, followed by the data buffers and a status byte
+struct virtio_blk_req_hdr {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+};
+
+#define VIRTIO_BLK_T_IN		0	// read
+#define VIRTIO_BLK_T_OUT	1	// write
+
+#define VIRTIO_BLK_S_OK		0
+#define VIRTIO_BLK_S_IOERR	1
+#define VIRTIO_BLK_S_UNSUPP	2
+
+int virtio_blk_attach(struct pci_func *pcif);
+
+#endif	// !JOS_KERN_VIRTIO_BLK_H
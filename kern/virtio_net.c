@@ -0,0 +1,363 @@
+// virtio-net driver (legacy PCI transport), as emulated by QEMU's
+// "-net nic,model=virtio".  It offers the same struct netdev as the
+// e100 and e1000.
+//
+// Receive buffers are whole pages, posted one descriptor each so that
+// a page can be handed to the input environment as a struct jif_pkt:
+// the header goes just before jp_data and the frame at jp_data.  With
+// VIRTIO_NET_F_MRG_RXBUF that takes one descriptor per frame instead
+// of a header descriptor and a data descriptor; no frame we accept
+// spans two pages, so a frame that says it did is dropped.
+//
+// Each frame sent is a chain of a shared, all-zero header (no offloads
+// are negotiated) and the frame's pieces.  Buffers are made available
+// without notifying the device; tx_kick notifies it once per batch, and
+// not at all while the device says, through the used ring's flags, that
+// it is still working on the queue.  The device is asked not to
+// interrupt, through the available rings' flags, except while an
+// environment sleeps in sys_net_wait.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/net.h>
+
+#include <kern/virtio_net.h>
+#include <kern/virtio.h>
+#include <kern/netdev.h>
+#include <kern/env.h>
+#include <kern/picirq.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+
+#define TXBUF		2048	// bytes of a tx_copy bounce buffer
+
+static uint32_t iobase;
+static struct virtq rxq, txq;
+static size_t hdrlen;		// bytes of struct virtio_net_hdr in use
+
+// The page posted as each receive descriptor.  Only the first
+// VIRTIO_NET_NRX descriptors are ever taken from the queue's free list,
+// as no more buffers than that are ever posted.
+static struct Page *rx_pages[VIRTIO_NET_NRX];
+
+static struct virtio_net_hdr tx_hdr;
+static char *tx_bufs[VIRTIO_NET_NTX];	// bounce buffers, for tx_copy
+
+// Frames in flight, by tag.  A gather send's slot stays busy, and done,
+// until its owner reaps it.
+static struct vnet_tx {
+	int head;			// first descriptor of the chain
+	struct Page *pins[NETDEV_MAXFRAGS];
+	int npins;
+	envid_t owner;			// 0 for tx_copy
+} txs[VIRTIO_NET_NTX];
+static uint32_t tx_busy, tx_done;
+
+static int
+virtio_net_rx_post(struct Page *pp)
+{
+	struct virtq_buf buf;
+	int head;
+
+	buf.addr = page2pa(pp) + offsetof(struct jif_pkt, jp_data) - hdrlen;
+	buf.len = PGSIZE - offsetof(struct jif_pkt, jp_data) + hdrlen;
+	buf.device_writes = 1;
+	if ((head = virtq_add(&rxq, &buf, 1)) < 0)
+		return head;
+	assert(head < VIRTIO_NET_NRX);
+	rx_pages[head] = pp;
+	return 0;
+}
+
+// Swap pp into the receive queue in place of the page holding the
+// oldest received frame, which is returned in *frame.  pp must not be
+// mapped anywhere the device's writes could be seen, and the caller
+// must give the queue a reference to it.  Returns the frame length, 0
+// for a frame we cannot take, or -E_RETRY if no frame is ready.
+static int
+virtio_net_rx_swap(struct Page *pp, struct Page **frame, int *flags)
+{
+	struct virtio_net_hdr *hdr;
+	uint32_t len;
+	int head, n, extra = 0, r;
+
+	if ((head = virtq_get(&rxq, &len)) < 0) {
+		virtq_kick(&rxq);
+		return head;
+	}
+	*frame = rx_pages[head];
+	*flags = 0;
+	n = len - hdrlen;
+	if (hdrlen == sizeof(*hdr)) {
+		hdr = (struct virtio_net_hdr *)
+			((char *) page2kva(*frame) + offsetof(struct jif_pkt, jp_data) - hdrlen);
+		extra = hdr->num_buffers - 1;
+	}
+	// Put the rest of a frame that spanned buffers straight back
+	for (; extra > 0; extra--) {
+		n = 0;
+		if ((head = virtq_get(&rxq, NULL)) < 0)
+			break;
+		if ((r = virtio_net_rx_post(rx_pages[head])) < 0)
+			panic("virtio-net: %e", r);
+	}
+	if (n < 0 || n > PGSIZE - offsetof(struct jif_pkt, jp_data))
+		n = 0;
+
+	if ((r = virtio_net_rx_post(pp)) < 0)
+		panic("virtio-net: %e", r);
+	if (rxq.unkicked >= VIRTIO_NET_RXBATCH || rxq.last_used == rxq.used->idx)
+		virtq_kick(&rxq);
+	return n;
+}
+
+// Release the slots of frames the device has finished with.
+static void
+virtio_net_tx_reclaim(void)
+{
+	struct Env *e;
+	int head, tag, i;
+
+	while ((head = virtq_get(&txq, NULL)) >= 0) {
+		for (tag = 0; tag < VIRTIO_NET_NTX; tag++)
+			if ((tx_busy & (1 << tag)) && !(tx_done & (1 << tag))
+			    && txs[tag].head == head)
+				break;
+		assert(tag < VIRTIO_NET_NTX);
+		for (i = 0; i < txs[tag].npins; i++)
+			page_decref(txs[tag].pins[i]);
+		txs[tag].npins = 0;
+		if (txs[tag].owner)
+			tx_done |= 1 << tag;
+		else
+			tx_busy &= ~(1 << tag);
+	}
+	// A slot whose owner has gone away will never be reaped
+	for (tag = 0; tag < VIRTIO_NET_NTX; tag++)
+		if ((tx_done & (1 << tag)) && envid2env(txs[tag].owner, &e, 0) < 0) {
+			tx_done &= ~(1 << tag);
+			tx_busy &= ~(1 << tag);
+		}
+}
+
+static int
+virtio_net_tx_claim(void)
+{
+	int tag;
+
+	virtio_net_tx_reclaim();
+	for (tag = 0; tag < VIRTIO_NET_NTX; tag++)
+		if (!(tx_busy & (1 << tag)))
+			return tag;
+	return -E_RETRY;
+}
+
+// Make the chain of bufs[1..n] available as slot tag's frame, after
+// the shared header.
+static int
+virtio_net_tx_add(int tag, struct virtq_buf *bufs, int n, envid_t owner)
+{
+	int head;
+
+	bufs[0].addr = PADDR(&tx_hdr);
+	bufs[0].len = hdrlen;
+	bufs[0].device_writes = 0;
+	if ((head = virtq_add(&txq, bufs, n + 1)) < 0) {
+		// Out of descriptors: get the batch going so they come back
+		virtq_kick(&txq);
+		return head;
+	}
+	txs[tag].head = head;
+	txs[tag].owner = owner;
+	tx_busy |= 1 << tag;
+	tx_done &= ~(1 << tag);
+	return tag;
+}
+
+static int
+virtio_net_tx_copy(const void *src, size_t len)
+{
+	struct virtq_buf bufs[2];
+	int tag;
+
+	if ((tag = virtio_net_tx_claim()) < 0)
+		return tag;
+	memmove(tx_bufs[tag], src, len);
+	bufs[1].addr = PADDR(tx_bufs[tag]);
+	bufs[1].len = len;
+	bufs[1].device_writes = 0;
+	tag = virtio_net_tx_add(tag, bufs, 1, 0);
+	return tag < 0 ? tag : 0;
+}
+
+// There are no flags to honour: no offloads are negotiated, and the
+// netdev does not advertise NET_F_TXCSUM.
+static int
+virtio_net_tx_gather(struct Page **pages, physaddr_t *addrs, size_t *lens,
+		     int n, int flags, envid_t owner)
+{
+	struct virtq_buf bufs[NETDEV_MAXFRAGS + 1];
+	int tag, i;
+
+	assert(n > 0 && n <= NETDEV_MAXFRAGS);
+	if ((tag = virtio_net_tx_claim()) < 0)
+		return tag;
+	for (i = 0; i < n; i++) {
+		bufs[i + 1].addr = addrs[i];
+		bufs[i + 1].len = lens[i];
+		bufs[i + 1].device_writes = 0;
+	}
+	if ((tag = virtio_net_tx_add(tag, bufs, n, owner)) < 0)
+		return tag;
+	for (i = 0; i < n; i++) {
+		page_incref(pages[i]);
+		txs[tag].pins[i] = pages[i];
+	}
+	txs[tag].npins = n;
+	return tag;
+}
+
+static void
+virtio_net_tx_kick(void)
+{
+	virtq_kick(&txq);
+}
+
+static uint32_t
+virtio_net_tx_reap(envid_t owner)
+{
+	uint32_t done = 0;
+	int tag;
+
+	virtio_net_tx_reclaim();
+	for (tag = 0; tag < VIRTIO_NET_NTX; tag++)
+		if ((tx_done & (1 << tag)) && owner == txs[tag].owner)
+			done |= 1 << tag;
+	tx_done &= ~done;
+	tx_busy &= ~done;
+	return done;
+}
+
+static bool
+virtio_net_rx_ready(void)
+{
+	return rxq.last_used != rxq.used->idx;
+}
+
+static bool
+virtio_net_tx_ready(void)
+{
+	// Ready even if the sender has yet to reap its slots
+	return tx_done || txq.last_used != txq.used->idx
+		|| tx_busy != (uint32_t) ((1ULL << VIRTIO_NET_NTX) - 1);
+}
+
+static bool
+virtio_net_ready(int events)
+{
+	return ((events & NET_WAIT_RX) && virtio_net_rx_ready())
+		|| ((events & NET_WAIT_TX) && virtio_net_tx_ready());
+}
+
+// Interrupts are asked for queue by queue, through the available
+// rings' flags.  The flag stores must be visible before netdev_wait
+// loads used->idx, or a buffer used in between neither shows up nor
+// interrupts.
+static void
+virtio_net_irq_unmask(int events)
+{
+	if (events & NET_WAIT_RX)
+		rxq.avail->flags = 0;
+	if (events & NET_WAIT_TX)
+		txq.avail->flags = 0;
+	vring_mb();
+	virtq_kick(&rxq);
+}
+
+static void
+virtio_net_irq_mask(int events)
+{
+	if (events & NET_WAIT_RX)
+		rxq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+	if (events & NET_WAIT_TX)
+		txq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// Reading the ISR acknowledges the interrupt.
+static void
+virtio_net_intr(void)
+{
+	if (!(inb(iobase + VIRTIO_PCI_ISR) & 1))
+		return;
+	netdev_intr((virtio_net_rx_ready() ? NET_WAIT_RX : 0)
+		    | (txq.last_used != txq.used->idx ? NET_WAIT_TX : 0));
+}
+
+static struct netdev virtio_net_netdev = {
+	"virtio-net", 0, virtio_net_tx_copy, virtio_net_tx_gather,
+	virtio_net_tx_kick, virtio_net_tx_reap, virtio_net_rx_swap,
+	virtio_net_ready, virtio_net_irq_unmask, virtio_net_irq_mask
+};
+
+int
+virtio_net_attach(struct pci_func *pcif)
+{
+	struct Page *pp;
+	uint32_t features;
+	uint8_t mac[6];
+	int i, r;
+
+	static_assert(VIRTIO_NET_NTX <= NET_MAXTAGS);
+	if (netdev)
+		return 0;
+
+	iobase = virtio_reset(pcif, VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF,
+			      &features);
+	hdrlen = (features & VIRTIO_NET_F_MRG_RXBUF)
+		? sizeof(struct virtio_net_hdr)
+		: offsetof(struct virtio_net_hdr, num_buffers);
+	if ((r = virtq_init(&rxq, iobase, VIRTIO_NET_RXQ)) < 0
+	    || (r = virtq_init(&txq, iobase, VIRTIO_NET_TXQ)) < 0
+	    || rxq.num < VIRTIO_NET_NRX) {
+		outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+		return r < 0 ? r : -E_NOT_SUPP;
+	}
+	rxq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+	txq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+	for (i = 0; i < VIRTIO_NET_NRX; i++) {
+		if ((r = page_alloc(&pp)) < 0)
+			panic("virtio-net: %e", r);
+		page_incref(pp);
+		// The whole page goes to the input environment with the frame
+		memset(page2kva(pp), 0, PGSIZE);
+		if ((r = virtio_net_rx_post(pp)) < 0)
+			panic("virtio-net: %e", r);
+	}
+	for (i = 0; i < VIRTIO_NET_NTX; i += PGSIZE / TXBUF) {
+		if ((r = page_alloc(&pp)) < 0)
+			panic("virtio-net: %e", r);
+		page_incref(pp);
+		tx_bufs[i] = page2kva(pp);
+		if (i + 1 < VIRTIO_NET_NTX)
+			tx_bufs[i + 1] = tx_bufs[i] + TXBUF;
+	}
+
+	if (pcif->irq_line > 0 && pcif->irq_line < MAX_IRQS) {
+		virtio_net_netdev.irq = pcif->irq_line;
+		irq_register(virtio_net_netdev.irq, virtio_net_intr);
+	}
+	virtio_driver_ok(iobase);
+	virtq_kick(&rxq);
+
+	for (i = 0; i < 6; i++)
+		mac[i] = (features & VIRTIO_NET_F_MAC)
+			? inb(iobase + VIRTIO_PCI_CONFIG + i) : 0;
+	cprintf("virtio-net: %02x:%02x:%02x:%02x:%02x:%02x, queue sizes %d/%d%s\n",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], rxq.num, txq.num,
+		hdrlen == sizeof(struct virtio_net_hdr) ? ", mergeable rx buffers" : "");
+	netdev = &virtio_net_netdev;
+	return 1;
+}
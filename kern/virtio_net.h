@@ -0,0 +1,41 @@
+#ifndef JOS_KERN_VIRTIO_NET_H
+#define JOS_KERN_VIRTIO_NET_H
+
+#include <inc/types.h>
+#include <kern/pci.h>
+
+// Receive buffers kept posted, one page each, and transmit slots, each
+// a frame in flight.  Both can be set at build time, e.g.
+//	make NIC=virtio LABDEFS=-DVIRTIO_NET_NRX=128
+#ifndef VIRTIO_NET_NRX
+#define VIRTIO_NET_NRX		64
+#endif
+#ifndef VIRTIO_NET_NTX
+#define VIRTIO_NET_NTX		32	// at most NET_MAXTAGS
+#endif
+// Receive buffers given back before the device is notified
+#define VIRTIO_NET_RXBATCH	16
+
+// Feature bits
+#define VIRTIO_NET_F_MAC	(1 << 5)	// config holds the MAC address
+#define VIRTIO_NET_F_MRG_RXBUF	(1 << 15)	// frames may span buffers
+
+// Queues
+#define VIRTIO_NET_RXQ		0
+#define VIRTIO_NET_TXQ		1
+
+// Header before every frame, in both directions.  num_buffers is only
+// there with VIRTIO_NET_F_MRG_RXBUF.
+struct virtio_net_hdr {
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+	uint16_t num_buffers;		// buffers the frame was received into
+};
+
+int virtio_net_attach(struct pci_func *pcif);
+
+#endif	// !JOS_KERN_VIRTIO_NET_H
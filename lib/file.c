@@ -188,3 +188,53 @@ sync(void)
 	return fsipc(FSREQ_SYNC, NULL);
 }
 
+
+// Return the disk block holding block 'blockno' of open file 'fdnum'
+// (FSBMAP_INDIRECT for its indirect block), or 0 if it is unallocated.
+int
+fbmap(int fdnum, uint32_t blockno)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	fsipcbuf.bmap.req_fileid = fd->fd_file.id;
+	fsipcbuf.bmap.req_blockno = blockno;
+	return fsipc(FSREQ_BMAP, NULL);
+}
+
+// Copy bitmap block 'blockno' of the file system into 'buf', which must
+// hold BLKSIZE bytes.  Returns the number of blocks on the disk.
+int
+fsbitmap(uint32_t blockno, void *buf)
+{
+	int r;
+
+	fsipcbuf.bitmap.req_blockno = blockno;
+	if ((r = fsipc(FSREQ_BITMAP, NULL)) < 0)
+		return r;
+	memmove(buf, fsipcbuf.bitmapRet.ret_bits, BLKSIZE);
+	return r;
+}
+
+// Fetch the file server's statistics.
+int
+fsgetstats(struct Fsstats *st)
+{
+	int r;
+
+	if ((r = fsipc(FSREQ_STATS, NULL)) < 0)
+		return r;
+	*st = fsipcbuf.statsRet.ret_stats;
+	return 0;
+}
+
+// Empty the file server's block cache, writing dirty blocks back first.
+int
+fsdropcache(void)
+{
+	return fsipc(FSREQ_DROP_CACHE, NULL);
+}
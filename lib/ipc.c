@@ -23,12 +23,24 @@ int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 {
 	// LAB 4: Your code here.
+    return ipc_recv_timed(from_env_store, pg, perm_store, ~0);
+}
+
+// Like ipc_recv, but return -E_TIMEOUT if nothing arrives before
+// sys_time_msec reaches 'msec'; ~0 waits for ever.
+int32_t
+ipc_recv_timed(envid_t *from_env_store, void *pg, int *perm_store,
+	       unsigned int msec)
+{
     int r;
 
     if (NULL == pg)
         pg = (void *)UTOP;
 
-    r = sys_ipc_recv(pg);
+    if (~0U == msec)
+        r = sys_ipc_recv(pg);
+    else
+        r = sys_ipc_recv_timed(pg, msec);
 
     if (0 > r) {
         if (NULL != from_env_store)
@@ -114,3 +114,64 @@ nsipc_socket(int domain, int type, int protocol)
 	nsipcbuf.socket.req_protocol = protocol;
 	return nsipc(NSREQ_SOCKET);
 }
+
+int
+nsipc_setsockopt(int s, int level, int optname, const void *optval,
+		 socklen_t optlen)
+{
+	if (optlen > NSSOCKOPT_MAX)
+		return -E_INVAL;
+	nsipcbuf.setsockopt.req_s = s;
+	nsipcbuf.setsockopt.req_level = level;
+	nsipcbuf.setsockopt.req_optname = optname;
+	memmove(nsipcbuf.setsockopt.req_optval, optval, optlen);
+	nsipcbuf.setsockopt.req_optlen = optlen;
+	return nsipc(NSREQ_SETSOCKOPT);
+}
+
+int
+nsipc_getsockopt(int s, int level, int optname, void *optval,
+		 socklen_t *optlen)
+{
+	int r;
+
+	nsipcbuf.getsockopt.req_s = s;
+	nsipcbuf.getsockopt.req_level = level;
+	nsipcbuf.getsockopt.req_optname = optname;
+	nsipcbuf.getsockopt.req_optlen = MIN(*optlen, NSSOCKOPT_MAX);
+	if ((r = nsipc(NSREQ_GETSOCKOPT)) >= 0) {
+		struct Nsret_getsockopt *ret = &nsipcbuf.getsockoptRet;
+		*optlen = MIN(ret->ret_optlen, *optlen);
+		memmove(optval, ret->ret_optval, *optlen);
+	}
+	return r;
+}
+
+// Share the ring page 'rings' with the network server for socket s.
+// The server keeps it mapped until the socket is closed.
+int
+nsipc_rings(int s, struct Nsrings *rings)
+{
+	rings->nrs_sock = s;
+	ipc_send(envs[2].env_id, NSREQ_RING, rings, PTE_P|PTE_W|PTE_U);
+	return ipc_recv(NULL, NULL, NULL);
+}
+
+// Wake the network server, which is sleeping on a ring we have just
+// changed.
+void
+nsipc_doorbell(void)
+{
+	ipc_send(envs[2].env_id, NSREQ_DOORBELL, 0, 0);
+}
+
+// Sleep until the network server wakes us, having changed a ring.
+void
+nsipc_wait(void)
+{
+	envid_t whom;
+
+	do {
+		ipc_recv(&whom, NULL, NULL);
+	} while (whom != envs[2].env_id);
+}
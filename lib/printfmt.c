@@ -36,6 +36,10 @@ static const char * const error_string[MAXERROR + 1] =
 	"file already exists",
 	"file is not a valid executable",
 	"operation not supported",
+	"try again",
+	"bad packet",
+	"device I/O error",
+	"timed out",
 };
 
 /*
@@ -1,4 +1,5 @@
 #include <inc/lib.h>
+#include <inc/x86.h>
 #include <lwip/sockets.h>
 
 static ssize_t devsock_read(struct Fd *fd, void *buf, size_t n);
@@ -79,7 +80,13 @@ shutdown(int s, int how)
 static int
 devsock_close(struct Fd *fd)
 {
-	return nsipc_close(fd->fd_sock.sockid);
+	int r;
+
+	// The server drains and drops its side of the rings first
+	r = nsipc_close(fd->fd_sock.sockid);
+	if (fd->fd_sock.rings > 0)
+		sys_page_unmap(0, fd2data(fd));
+	return r;
 }
 
 int
@@ -100,15 +107,158 @@ listen(int s, int backlog)
 	return nsipc_listen(r, backlog);
 }
 
+int
+setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_setsockopt(r, level, optname, optval, optlen);
+}
+
+int
+getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_getsockopt(r, level, optname, optval, optlen);
+}
+
+// Return the socket's rings, setting them up on first use, or NULL if
+// the server will not take them (it only does for TCP sockets).
+static struct Nsrings *
+fd2rings(struct Fd *fd)
+{
+	struct Nsrings *rings = (struct Nsrings *) fd2data(fd);
+	int r;
+
+	if (fd->fd_sock.rings == 0) {
+		// Shared, so that forked children use the same rings
+		r = sys_page_alloc(0, rings, PTE_P|PTE_W|PTE_U|PTE_SHARE);
+		if (r >= 0 && (r = nsipc_rings(fd->fd_sock.sockid, rings)) < 0)
+			sys_page_unmap(0, rings);
+		fd->fd_sock.rings = (r < 0 ? -1 : 1);
+	}
+	return (fd->fd_sock.rings > 0 ? rings : NULL);
+}
+
+static bool
+ring_readable(struct Nsring *ring)
+{
+	return ring->nr_head != ring->nr_tail || ring->nr_done;
+}
+
+static bool
+ring_writable(struct Nsring *ring)
+{
+	return (ring->nr_head + 1) % NSRING_SIZE != ring->nr_tail
+		|| ring->nr_done;
+}
+
+// Sleep until the server has made ready(ring) true.  The server wakes
+// the clients in nr_waiters only if it finds *flag set, so take a slot,
+// set the flag and look again.  If the ring is ready and our slot still
+// ours, no wakeup is coming.  The flag stays set, since another client
+// may be asleep on it.
+static void
+ring_sleep(struct Nsring *ring, volatile uint32_t *flag,
+	   bool (*ready)(struct Nsring *))
+{
+	volatile uint32_t *slot = NULL;
+	int i;
+
+	for (i = 0; i < NSRING_NWAITERS && !slot; i++)
+		if (cmpxchg(&ring->nr_waiters[i], 0, env->env_id) == 0)
+			slot = &ring->nr_waiters[i];
+	if (!slot) {
+		sys_yield();
+		return;
+	}
+	xchg(flag, 1);
+	if (ready(ring) && xchg(slot, 0) == env->env_id)
+		return;
+	nsipc_wait();
+}
+
+static ssize_t
+ring_read(struct Nsrings *rings, void *buf, size_t n)
+{
+	struct Nsring *ring = &rings->nrs_rx;
+	uint32_t head, tail, done;
+	size_t m, off;
+
+	tail = ring->nr_tail;
+	while (1) {
+		// nr_done before nr_head: the server sets it last
+		done = ring->nr_done;
+		head = ring->nr_head;
+		if (head != tail)
+			break;
+		if (done)
+			return ring->nr_ret;
+		ring_sleep(ring, &ring->nr_cwait, ring_readable);
+	}
+
+	for (off = 0; off < n && tail != head; off += m) {
+		m = (head > tail ? head : NSRING_SIZE) - tail;
+		m = MIN(m, n - off);
+		memmove((char *) buf + off, ring->nr_buf + tail, m);
+		tail = (tail + m) % NSRING_SIZE;
+	}
+	ring->nr_tail = tail;
+	if (xchg(&ring->nr_pwait, 0))
+		nsipc_doorbell();
+	return off;
+}
+
+static ssize_t
+ring_write(struct Nsrings *rings, const void *buf, size_t n)
+{
+	struct Nsring *ring = &rings->nrs_tx;
+	uint32_t head, tail;
+	size_t m, off;
+
+	head = ring->nr_head;
+	for (off = 0; off < n; off += m) {
+		if (ring->nr_done)
+			return off ? off : ring->nr_ret;
+		tail = ring->nr_tail;
+		if (tail > head)
+			m = tail - head - 1;
+		else
+			m = NSRING_SIZE - head - (tail == 0);
+		if (m == 0) {
+			ring_sleep(ring, &ring->nr_pwait, ring_writable);
+			continue;
+		}
+		m = MIN(m, n - off);
+		memmove(ring->nr_buf + head, (const char *) buf + off, m);
+		head = (head + m) % NSRING_SIZE;
+		ring->nr_head = head;
+		if (xchg(&ring->nr_cwait, 0))
+			nsipc_doorbell();
+	}
+	return n;
+}
+
 static ssize_t
 devsock_read(struct Fd *fd, void *buf, size_t n)
 {
+	struct Nsrings *rings;
+
+	if ((rings = fd2rings(fd)))
+		return ring_read(rings, buf, n);
 	return nsipc_recv(fd->fd_sock.sockid, buf, n, 0);
 }
 
 static ssize_t
 devsock_write(struct Fd *fd, const void *buf, size_t n)
 {
+	struct Nsrings *rings;
+
+	if ((rings = fd2rings(fd)))
+		return ring_write(rings, buf, n);
 	return nsipc_send(fd->fd_sock.sockid, buf, n, 0);
 }
 
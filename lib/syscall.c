@@ -117,6 +117,12 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_timed(void *dstva, unsigned int msec)
+{
+	return syscall(SYS_ipc_recv_timed, 1, (uint32_t) dstva, msec, 0, 0, 0);
+}
+
 unsigned int
 sys_time_msec(void)
 {
@@ -130,7 +136,67 @@ sys_net_send(void *src, size_t len)
 }
 
 int
-sys_net_recv(void *dst, size_t len)
+sys_net_recv(void *pg)
+{
+    return syscall(SYS_net_recv, 0, (uint32_t)pg, 0, 0, 0, 0);
+}
+
+int
+sys_net_wait(int events)
+{
+	return syscall(SYS_net_wait, 0, events, 0, 0, 0, 0);
+}
+
+int
+sys_net_send_sg(const struct net_sg *sg, int nsg, int flags)
+{
+	return syscall(SYS_net_send_sg, 0, (uint32_t) sg, nsg, flags, 0, 0);
+}
+
+int
+sys_net_tx_reap(uint32_t *done)
+{
+	return syscall(SYS_net_tx_reap, 0, (uint32_t) done, 0, 0, 0, 0);
+}
+
+int
+sys_net_send_batch(const struct net_sg *frames, int n)
+{
+	return syscall(SYS_net_send_batch, 0, (uint32_t) frames, n, 0, 0, 0);
+}
+
+int
+sys_net_recv_batch(void *buf, size_t len)
+{
+	return syscall(SYS_net_recv_batch, 0, (uint32_t) buf, len, 0, 0, 0);
+}
+
+int
+sys_net_features(void)
+{
+	return syscall(SYS_net_features, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_net_map_device(void *va)
+{
+	return syscall(SYS_net_map_device, 0, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_page_alloc_dma(void *va, int npages, int perm)
+{
+	return syscall(SYS_page_alloc_dma, 0, (uint32_t) va, npages, perm, 0, 0);
+}
+
+int
+sys_disk_submit(uint32_t secno, void *va, size_t nsecs, int flags)
+{
+	return syscall(SYS_disk_submit, 0, secno, (uint32_t) va, nsecs, flags, 0);
+}
+
+int
+sys_disk_reap(uint32_t *done)
 {
-    return syscall(SYS_net_recv, 0, (uint32_t)dst, len, 0, 0, 0);
+	return syscall(SYS_disk_reap, 0, (uint32_t) done, 0, 0, 0, 0);
 }
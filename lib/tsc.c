@@ -0,0 +1,20 @@
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+// Return the number of TSC cycles per millisecond, measured against
+// sys_time_msec over about 200ms.  The clock only ticks every 10ms, so
+// start on a tick edge.
+uint64_t
+tsc_calibrate(void)
+{
+	unsigned t0, t1;
+	uint64_t c0;
+
+	t0 = sys_time_msec();
+	while ((t1 = sys_time_msec()) == t0)
+		sys_yield();
+	c0 = read_tsc();
+	while ((t0 = sys_time_msec()) < t1 + 200)
+		sys_yield();
+	return (read_tsc() - c0) / (t0 - t1);
+}
@@ -0,0 +1,245 @@
+// A user-space driver for the e100, for a network server built with
+//	make LABDEFS=-DNS_USER_DRIVER
+// The kernel maps the device's registers into the input and output
+// environments (sys_net_map_device) and stops its own driver; they run
+// the receive and transmit rings themselves, in pages whose physical
+// addresses they know (sys_page_alloc_dma), and sending or receiving a
+// frame takes no system call at all: frames pass to and from the
+// network server on its trains (struct Nstrain), with an IPC only to
+// wake it or be woken.  The kernel keeps the device's interrupt: when
+// its ring has nothing for it, an environment sleeps in sys_net_wait
+// until the device reports a frame received or sent.
+//
+// The network server takes the device over and allocates the rings
+// before it forks, shared, so that both environments see them; they
+// take turns at the SCB command byte through a lock in the first page.
+// Frames are copied from the receive ring onto the receive train, and
+// from the transmit train into the transmit ring, since the rings stay
+// put.
+
+#include "ns.h"
+#include <inc/e100.h>
+#include <inc/x86.h>
+
+#define E100U_CSR	((volatile uint8_t *) 0x30000000)
+#define E100U_DMA	0x30100000
+
+#define E100U_NRFD	32
+#define E100U_NTCB	32
+#define E100U_BLKSIZE	2048	// bytes per RFD or TCB
+#define E100U_NPAGES	(1 + (E100U_NRFD + E100U_NTCB) * E100U_BLKSIZE / PGSIZE)
+#define E100U_SPIN	100000	// polls of the command byte before giving up
+
+#define CSR8(off)	(*(volatile uint8_t *) (E100U_CSR + (off)))
+#define CSR16(off)	(*(volatile uint16_t *) (E100U_CSR + (off)))
+#define CSR32(off)	(*(volatile uint32_t *) (E100U_CSR + (off)))
+
+// The first page of the shared pages; the RFDs and then the TCBs follow.
+struct e100u_ctl {
+	volatile uint32_t lock;		// held while issuing an SCB command
+	physaddr_t dma_pa;		// physical address of E100U_DMA
+};
+
+#define ctl	((struct e100u_ctl *) E100U_DMA)
+
+static bool e100u_ready;
+
+static union Tcb *
+e100u_rfd(int i)
+{
+	return (union Tcb *) (E100U_DMA + PGSIZE + i * E100U_BLKSIZE);
+}
+
+static union Tcb *
+e100u_tcb(int i)
+{
+	return e100u_rfd(E100U_NRFD + i);
+}
+
+static physaddr_t
+e100u_pa(void *va)
+{
+	return ctl->dma_pa + ((uintptr_t) va - E100U_DMA);
+}
+
+// Issue SCB command cmd, first loading the general pointer with gp
+// unless it is 0.  The command is dropped if the device has not taken
+// the previous one after E100_SPIN polls, as the kernel driver does;
+// both rings retry when they find their unit stopped.
+static void
+e100u_command(uint8_t cmd, physaddr_t gp)
+{
+	int i;
+
+	while (xchg(&ctl->lock, 1) != 0)
+		sys_yield();
+	for (i = 0; i < E100U_SPIN && CSR8(SCB_CMD) != 0; i++)
+		;
+	if (i < E100U_SPIN) {
+		if (gp)
+			CSR32(SCB_GP) = gp;
+		CSR8(SCB_CMD) = cmd;
+	}
+	ctl->lock = 0;
+}
+
+// Allocate the rings, shared with the environments forked after, and
+// take the device over from the kernel.  Fails, leaving the kernel's
+// driver in charge, if the device is not one the kernel can hand over.
+// The caller does not touch the registers, and fork cannot copy their
+// mapping, so they are unmapped again here.
+int
+e100u_init(void)
+{
+	int r, size, off;
+
+	static_assert(sizeof(union Tcb) <= E100U_BLKSIZE);
+	r = sys_page_alloc_dma((void *) E100U_DMA, E100U_NPAGES,
+			       PTE_P | PTE_U | PTE_W | PTE_SHARE);
+	if (r < 0)
+		return r;
+	ctl->dma_pa = r;
+	if ((size = sys_net_map_device((void *) E100U_CSR)) < 0) {
+		for (off = 0; off < E100U_NPAGES * PGSIZE; off += PGSIZE)
+			sys_page_unmap(0, (void *) (E100U_DMA + off));
+		return size;
+	}
+	for (off = 0; off < size; off += PGSIZE)
+		sys_page_unmap(0, (void *) (E100U_CSR + off));
+	e100u_ready = 1;
+	return 0;
+}
+
+// Map the registers of the device e100u_init took over.  Returns
+// -E_NOT_SUPP if it did not, and the kernel's driver is still in
+// charge.  Once the device is ours there is no going back, so a failure
+// here panics rather than leave the other half of the driver running
+// alone.
+int
+e100u_attach(void)
+{
+	int r;
+
+	if (!e100u_ready)
+		return -E_NOT_SUPP;
+	if ((r = sys_net_map_device((void *) E100U_CSR)) < 0)
+		panic("e100u_attach: %e", r);
+	return 0;
+}
+
+// Receive frames forever, as input() does.  The RFD before 'head' ends
+// the list, with its S bit set; the unit is restarted at 'head' when
+// it stops.  The server is rung for when the frames received so far
+// have been pushed, or when the train is full.  After INPUT_POLLS
+// empty polls, sleep until the device reports a frame.
+void
+e100u_input(envid_t ns_envid)
+{
+	struct Nstrain *train = NSTRAIN_RX;
+	struct jif_pkt *pkt;
+	union Tcb *rfd;
+	int i, n, head = 0, pushed = 0, polls = 0;
+
+	for (i = 0; i < E100U_NRFD; i++) {
+		rfd = e100u_rfd(i);
+		rfd->tcb_recieve.cb.status = 0;
+		rfd->tcb_recieve.cb.cmd = (i == E100U_NRFD - 1) ? TCB_MASK_S : 0;
+		rfd->tcb_recieve.cb.link = e100u_pa(e100u_rfd((i + 1) % E100U_NRFD));
+		rfd->tcb_recieve.reserve = 0xffffffff;
+		rfd->tcb_recieve.actualcount = 0;
+		rfd->tcb_recieve.size = PACKET_MAX_LEN;
+	}
+	e100u_command(TCB_CMD_RS, e100u_pa(e100u_rfd(0)));
+
+	while (1) {
+		rfd = e100u_rfd(head);
+		if (!(rfd->tcb_recieve.cb.status & CB_STATUS_C)) {
+			if (pushed && nstrain_ring(train))
+				ipc_send(ns_envid, NSREQ_INPUT, 0, 0);
+			pushed = 0;
+			if (SCB_RUS(CSR16(SCB_STATUS)) != RU_STATUS_READY)
+				e100u_command(TCB_CMD_RS, e100u_pa(rfd));
+			if (++polls >= INPUT_POLLS) {
+				if (sys_net_wait(NET_WAIT_RX) < 0)
+					sys_yield();
+				polls = 0;
+			}
+			continue;
+		}
+		polls = 0;
+
+		// EOF and F set: the count is valid
+		n = 0;
+		if ((rfd->tcb_recieve.actualcount >> 14) == 0x03)
+			n = rfd->tcb_recieve.actualcount & 0x3FFF;
+		if (n > 0) {
+			while ((pkt = nstrain_reserve(train, n)) == NULL) {
+				if (nstrain_ring(train))
+					ipc_send(ns_envid, NSREQ_INPUT, 0, 0);
+				sys_yield();
+			}
+			memmove(pkt->jp_data, rfd->tcb_recieve.data, n);
+			pkt->jp_len = n;
+			pkt->jp_flags = 0;
+			nstrain_push(train, pkt);
+			pushed = 1;
+		}
+
+		rfd->tcb_recieve.cb.status = 0;
+		rfd->tcb_recieve.actualcount = 0;
+		rfd->tcb_recieve.cb.cmd = TCB_MASK_S;
+		e100u_rfd((head + E100U_NRFD - 1) % E100U_NRFD)->tcb_recieve.cb.cmd = 0;
+		head = (head + 1) % E100U_NRFD;
+	}
+}
+
+// Send the frames on the server's transmit train forever, as output()
+// does.  The TCB filled last has its S bit set, so the command unit
+// suspends there until it is resumed with the next frame.  Every TCB
+// has its I bit set, so that a full ring can sleep until one is sent.
+void
+e100u_output(envid_t ns_envid)
+{
+	struct Nstrain *train = NSTRAIN_TX;
+	struct jif_pkt *pkt;
+	union Tcb *tcb;
+	int i, len, cur = E100U_NTCB - 1;
+
+	for (i = 0; i < E100U_NTCB; i++) {
+		tcb = e100u_tcb(i);
+		tcb->tcb_transmit.cb.status = CB_STATUS_C;
+		tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS | TCB_CMD_I;
+		tcb->tcb_transmit.cb.link = e100u_pa(e100u_tcb((i + 1) % E100U_NTCB));
+		tcb->tcb_transmit.tbdarr = 0xffffffff;
+		tcb->tcb_transmit.tcbbc = 0;
+		tcb->tcb_transmit.thrs = 0xe0;
+		tcb->tcb_transmit.tbdcount = 0;
+	}
+
+	while (1) {
+		if ((pkt = nstrain_peek(train)) == NULL) {
+			if (nstrain_idle(train))
+				ipc_recv(NULL, NULL, NULL);
+			continue;
+		}
+		i = (cur + 1) % E100U_NTCB;
+		tcb = e100u_tcb(i);
+		while (!(tcb->tcb_transmit.cb.status & CB_STATUS_C))
+			if (sys_net_wait(NET_WAIT_TX) < 0)
+				sys_yield();
+
+		len = MIN(pkt->jp_len, PACKET_MAX_LEN);
+		memmove(tcb->tcb_transmit.data, pkt->jp_data, len);
+		nstrain_pop(train, pkt);
+		tcb->tcb_transmit.tcbbc = len;
+		tcb->tcb_transmit.cb.cmd = TCB_CMD_TRANS | TCB_CMD_I | TCB_MASK_S;
+		tcb->tcb_transmit.cb.status = 0;
+		e100u_tcb(cur)->tcb_transmit.cb.cmd &= ~TCB_MASK_S;
+		cur = i;
+
+		if (SCB_CUS(CSR16(SCB_STATUS)) == TCB_STATUS_SUSPENDED)
+			e100u_command(TCB_CMD_CC, 0);
+		else
+			e100u_command(TCB_CMD_CS, e100u_pa(tcb));
+	}
+}
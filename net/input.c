@@ -2,6 +2,23 @@
 
 extern union Nsipc nsipcbuf;
 
+// Room at the train's head for up to INPUT_BATCH frames of the largest
+// size, halving the batch until it fits; *room is set to its size.
+// NULL if there is not room for one.
+static struct jif_pkt *
+input_reserve(struct Nstrain *train, uint32_t *room)
+{
+    struct jif_pkt *pkt;
+    int n;
+
+    for (n = INPUT_BATCH; n > 0; n /= 2) {
+        *room = n * nstrain_reclen(NET_MAXFRAME);
+        if (NULL != (pkt = nstrain_reserve(train, *room - sizeof(*pkt))))
+            return pkt;
+    }
+    return NULL;
+}
+
 void
 input(envid_t ns_envid)
 {
@@ -14,30 +31,37 @@ input(envid_t ns_envid)
     // reading from it for a while, so don't immediately receive
     // another packet in to the same physical page.
 
-    union Nsipc *packet;
-    int r;
-    int i;
-    for (i = 0; i < QUEUE_SIZE; ++i) {
-        packet = (union Nsipc *)(i * PGSIZE + REQVA);
-        if (0 != (r = sys_page_alloc(env->env_id, packet, PTE_U | PTE_W | PTE_P)))
-            panic("ns_input: %e!\n", r);
-    }
+    struct Nstrain *train = NSTRAIN_RX;
+    struct jif_pkt *first, *pkt;
+    uint32_t room;
+    int r, off, polls = 0;
 
-    packet = (union Nsipc *)REQVA;
+#ifdef NS_USER_DRIVER
+    if (0 == e100u_attach())
+        e100u_input(ns_envid);
+#endif
 
+    // sys_net_recv_batch copies frames straight onto the train, into
+    // room reserved at its head for up to INPUT_BATCH of them, and they
+    // are pushed where they landed.  The server only hears from us when
+    // it sleeps waiting for the train.
     while (1) {
-        memset(packet, 0, PGSIZE);
-        packet->pkt.jp_len = PGSIZE - sizeof(int);
-        while(-E_RETRY == (r = sys_net_recv(packet->pkt.jp_data, packet->pkt.jp_len)))
+        while (NULL == (first = input_reserve(train, &room))) {
+            if (nstrain_ring(train))
+                ipc_send(ns_envid, NSREQ_INPUT, 0, 0);
             sys_yield();
+        }
+        while (0 > (r = sys_net_recv_batch(first, room))) {
+            if (++polls < INPUT_POLLS || sys_net_wait(NET_WAIT_RX) < 0)
+                sys_yield();
+        }
+        polls = 0;
 
-        if (0 == r)
-            continue;
-
-        packet->pkt.jp_len = r;
-        ipc_send(ns_envid, NSREQ_INPUT, packet, PTE_W | PTE_U | PTE_P);
-        packet = (union Nsipc *)((uint32_t)packet + PGSIZE);
-        if ((union Nsipc *)(REQVA + QUEUE_SIZE * PGSIZE) == packet)
-            packet = (union Nsipc *)REQVA;
+        for (off = 0; off < r; off += nstrain_reclen(pkt->jp_len)) {
+            pkt = (struct jif_pkt *)((char *) first + off);
+            nstrain_push(train, pkt);
+        }
+        if (nstrain_ring(train))
+            ipc_send(ns_envid, NSREQ_INPUT, 0, 0);
     }
 }
@@ -498,6 +498,26 @@ netconn_close(struct netconn *conn)
   return conn->err;
 }
 
+/**
+ * Half-close a TCP netconn: send a FIN but keep receiving.
+ *
+ * @param conn the TCP netconn to half-close
+ * @return ERR_OK if the FIN was enqueued, ERR_CONN if conn is not
+ *         connected, ERR_VAL if it is not TCP
+ */
+err_t
+netconn_shutdown_tx(struct netconn *conn)
+{
+  struct api_msg msg;
+
+  LWIP_ERROR("netconn_shutdown_tx: invalid conn",  (conn != NULL), return ERR_ARG;);
+
+  msg.function = do_shutdown_tx;
+  msg.msg.conn = conn;
+  tcpip_apimsg(&msg);
+  return conn->err;
+}
+
 #if LWIP_IGMP
 /**
  * Join multicast groups for UDP netconns.
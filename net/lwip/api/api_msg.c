@@ -56,6 +56,7 @@
 #if LWIP_TCP
 static err_t do_writemore(struct netconn *conn);
 static void do_close_internal(struct netconn *conn);
+static void do_shutdown_tx_internal(struct netconn *conn);
 #endif
 
 #if LWIP_RAW
@@ -238,6 +239,8 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
     do_writemore(conn);
   } else if (conn->state == NETCONN_CLOSE) {
     do_close_internal(conn);
+  } else if (conn->state == NETCONN_SHUTWR) {
+    do_shutdown_tx_internal(conn);
   }
 
   return ERR_OK;
@@ -263,6 +266,8 @@ sent_tcp(void *arg, struct tcp_pcb *pcb, u16_t len)
     do_writemore(conn);
   } else if (conn->state == NETCONN_CLOSE) {
     do_close_internal(conn);
+  } else if (conn->state == NETCONN_SHUTWR) {
+    do_shutdown_tx_internal(conn);
   }
 
   if (conn) {
@@ -291,7 +296,12 @@ err_tcp(void *arg, err_t err)
 
   conn->pcb.tcp = NULL;
 
-  conn->err = err;
+  /* ERR_CLSD: a half-closed connection has closed at both ends.  The
+     peer's FIN already ended the stream, and what came before it may
+     still be unread, so this is no error. */
+  if (err != ERR_CLSD) {
+    conn->err = err;
+  }
   if (conn->recvmbox != SYS_MBOX_NULL) {
     /* Register event with callback */
     API_EVENT(conn, NETCONN_EVT_RCVPLUS, 0);
@@ -306,7 +316,8 @@ err_tcp(void *arg, err_t err)
     API_EVENT(conn, NETCONN_EVT_RCVPLUS, 0);
     sys_mbox_post(conn->acceptmbox, NULL);
   }
-  if ((conn->state == NETCONN_WRITE) || (conn->state == NETCONN_CLOSE)) {
+  if ((conn->state == NETCONN_WRITE) || (conn->state == NETCONN_CLOSE) ||
+      (conn->state == NETCONN_SHUTWR)) {
     /* calling do_writemore/do_close_internal is not necessary
        since the pcb has already been deleted! */
     conn->state = NETCONN_NONE;
@@ -635,6 +646,32 @@ do_close_internal(struct netconn *conn)
   /* If closing didn't succeed, we get called again either
      from poll_tcp or from sent_tcp */
 }
+
+/**
+ * Internal helper function to half-close a TCP netconn: it sends a FIN
+ * and leaves the callbacks in place, so that data keeps coming in.  If
+ * there is no room for the FIN yet, we get called again from poll_tcp
+ * or sent_tcp.
+ *
+ * @param conn the TCP netconn to half-close
+ */
+static void
+do_shutdown_tx_internal(struct netconn *conn)
+{
+  err_t err;
+
+  LWIP_ASSERT("conn must be in state NETCONN_SHUTWR", (conn->state == NETCONN_SHUTWR));
+  LWIP_ASSERT("pcb already closed", (conn->pcb.tcp != NULL));
+
+  err = tcp_shutdown_tx(conn->pcb.tcp);
+  if (err == ERR_MEM) {
+    return;
+  }
+  conn->state = NETCONN_NONE;
+  conn->err = err;
+  API_EVENT(conn, NETCONN_EVT_SENDPLUS, 0);
+  sys_sem_signal(conn->op_completed);
+}
 #endif /* LWIP_TCP */
 
 /**
@@ -1127,7 +1164,31 @@ do_close(struct api_msg_msg *msg)
 #endif /* LWIP_TCP */
   {
     msg->conn->err = ERR_VAL;
-    TCPIP_APIMSG_ACK(msg);
+    /* netconn_close waits in tcpip_apimsg even with core locking */
+    sys_sem_signal(msg->conn->op_completed);
+  }
+}
+
+/**
+ * Half-close a TCP netconn: send a FIN but keep receiving.
+ * Called from netconn_shutdown_tx.
+ *
+ * @param msg the api_msg_msg pointing to the connection
+ */
+void
+do_shutdown_tx(struct api_msg_msg *msg)
+{
+#if LWIP_TCP
+  if ((msg->conn->pcb.tcp != NULL) && (msg->conn->type == NETCONN_TCP)) {
+      msg->conn->state = NETCONN_SHUTWR;
+      do_shutdown_tx_internal(msg->conn);
+      /* for tcp netconns, do_shutdown_tx_internal ACKs the message */
+  } else
+#endif /* LWIP_TCP */
+  {
+    msg->conn->err = (msg->conn->type == NETCONN_TCP ? ERR_CONN : ERR_VAL);
+    /* netconn_shutdown_tx waits in tcpip_apimsg even with core locking */
+    sys_sem_signal(msg->conn->op_completed);
   }
 }
 
@@ -677,13 +677,21 @@ lwip_sendto(int s, const void *data, int size, unsigned int flags,
       p->payload = (void*)data;
       p->len = p->tot_len = size;
       
-      remote_addr.addr = ((struct sockaddr_in *)to)->sin_addr.s_addr;
-      
       LOCK_TCPIP_CORE();
-      if (sock->conn->type==NETCONN_RAW) {
-        err = sock->conn->err = raw_sendto(sock->conn->pcb.raw, p, &remote_addr);
+      if (to == NULL) {
+        /* lwip_send on a connected socket */
+        if (sock->conn->type==NETCONN_RAW) {
+          err = sock->conn->err = raw_send(sock->conn->pcb.raw, p);
+        } else {
+          err = sock->conn->err = udp_send(sock->conn->pcb.udp, p);
+        }
       } else {
-        err = sock->conn->err = udp_sendto(sock->conn->pcb.udp, p, &remote_addr, ntohs(((struct sockaddr_in *)to)->sin_port));
+        remote_addr.addr = ((struct sockaddr_in *)to)->sin_addr.s_addr;
+        if (sock->conn->type==NETCONN_RAW) {
+          err = sock->conn->err = raw_sendto(sock->conn->pcb.raw, p, &remote_addr);
+        } else {
+          err = sock->conn->err = udp_sendto(sock->conn->pcb.udp, p, &remote_addr, ntohs(((struct sockaddr_in *)to)->sin_port));
+        }
       }
       UNLOCK_TCPIP_CORE();
       
@@ -1081,15 +1089,63 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
 }
 
 /**
- * Unimplemented: Close one end of a full-duplex connection.
- * Currently, the full connection is closed.
+ * Wake every lwip_select() waiting for socket s to become readable, as
+ * if it had.  The woken select returns 0 if it has not: this is for a
+ * thread that selects without a timeout and must be told to stop.
+ * A select that starts after this call is not woken, so the caller's
+ * stop condition must be set first and looked at before selecting.
+ */
+void
+lwip_select_wake(int s)
+{
+  struct lwip_select_cb *scb;
+
+  while (1) {
+    sys_sem_wait(selectsem);
+    for (scb = select_cb_list; scb; scb = scb->next) {
+      if (scb->sem_signalled == 0 && scb->readset && FD_ISSET(s, scb->readset))
+        break;
+    }
+    if (scb) {
+      scb->sem_signalled = 1;
+      sys_sem_signal(selectsem);
+      sys_sem_signal(scb->sem);
+    } else {
+      sys_sem_signal(selectsem);
+      break;
+    }
+  }
+}
+
+/**
+ * Close one end of a full-duplex connection: SHUT_WR and SHUT_RDWR
+ * send a FIN.  The socket stays open until lwip_close.
  */
 int
 lwip_shutdown(int s, int how)
 {
-  LWIP_UNUSED_ARG(how);
+  struct lwip_socket *sock;
+  err_t err = ERR_OK;
+
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_shutdown(%d, how=%d)\n", s, how));
-  return lwip_close(s); /* XXX temporary hack until proper implementation */
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+  if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+    sock_set_errno(sock, EINVAL);
+    return -1;
+  }
+
+  /* The receive side is left to the caller: the network server stops
+     the socket's receive ring, so its client reads the end of the
+     stream.  The socket stays open until lwip_close. */
+  if (how != SHUT_RD) {
+    err = netconn_shutdown_tx(sock->conn);
+  }
+  sock_set_errno(sock, err_to_errno(err));
+  return (err == ERR_OK ? 0 : -1);
 }
 
 static int
@@ -1174,12 +1230,10 @@ lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
     case SO_RCVBUF:
 #endif /* LWIP_SO_RCVBUF */
     /* UNIMPL case SO_OOBINLINE: */
-    /* UNIMPL case SO_SNDBUF: */
     /* UNIMPL case SO_RCVLOWAT: */
     /* UNIMPL case SO_SNDLOWAT: */
 #if SO_REUSE
     case SO_REUSEADDR:
-    case SO_REUSEPORT:
 #endif /* SO_REUSE */
     case SO_TYPE:
     /* UNIMPL case SO_USELOOPBACK: */
@@ -1188,6 +1242,17 @@ lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
       }
       break;
 
+#if LWIP_SO_SNDBUF
+    case SO_SNDBUF:
+      if (*optlen < sizeof(int)) {
+        err = EINVAL;
+      }
+      if (sock->conn->type != NETCONN_TCP) {
+        err = ENOPROTOOPT;
+      }
+      break;
+#endif /* LWIP_SO_SNDBUF */
+
     case SO_NO_CHECK:
       if (*optlen < sizeof(int)) {
         err = EINVAL;
@@ -1359,7 +1424,6 @@ lwip_getsockopt_internal(void *arg)
     /* UNIMPL case SO_OOBINCLUDE: */
 #if SO_REUSE
     case SO_REUSEADDR:
-    case SO_REUSEPORT:
 #endif /* SO_REUSE */
     /*case SO_USELOOPBACK: UNIMPL */
       *(int*)optval = sock->conn->pcb.ip->so_options & optname;
@@ -1405,9 +1469,20 @@ lwip_getsockopt_internal(void *arg)
 #endif /* LWIP_SO_RCVTIMEO */
 #if LWIP_SO_RCVBUF
     case SO_RCVBUF:
-      *(int *)optval = sock->conn->recv_bufsize;
+      /* for TCP, the window it bounds */
+      if (sock->conn->type == NETCONN_TCP && sock->conn->pcb.tcp != NULL) {
+        *(int *)optval = sock->conn->pcb.tcp->rcv_buf_size;
+      } else {
+        *(int *)optval = sock->conn->recv_bufsize;
+      }
       break;
 #endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+    case SO_SNDBUF:
+      *(int *)optval = sock->conn->pcb.tcp != NULL ?
+        sock->conn->pcb.tcp->snd_buf_size : 0;
+      break;
+#endif /* LWIP_SO_SNDBUF */
 #if LWIP_UDP
     case SO_NO_CHECK:
       *(int*)optval = (udp_flags(sock->conn->pcb.udp) & UDP_FLAGS_NOCHKSUM) ? 1 : 0;
@@ -1536,18 +1611,26 @@ lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t opt
     case SO_RCVBUF:
 #endif /* LWIP_SO_RCVBUF */
     /* UNIMPL case SO_OOBINLINE: */
-    /* UNIMPL case SO_SNDBUF: */
     /* UNIMPL case SO_RCVLOWAT: */
     /* UNIMPL case SO_SNDLOWAT: */
 #if SO_REUSE
     case SO_REUSEADDR:
-    case SO_REUSEPORT:
 #endif /* SO_REUSE */
     /* UNIMPL case SO_USELOOPBACK: */
       if (optlen < sizeof(int)) {
         err = EINVAL;
       }
       break;
+#if LWIP_SO_SNDBUF
+    case SO_SNDBUF:
+      if (optlen < sizeof(int)) {
+        err = EINVAL;
+      }
+      if (sock->conn->type != NETCONN_TCP) {
+        err = ENOPROTOOPT;
+      }
+      break;
+#endif /* LWIP_SO_SNDBUF */
     case SO_NO_CHECK:
       if (optlen < sizeof(int)) {
         err = EINVAL;
@@ -1732,7 +1815,6 @@ lwip_setsockopt_internal(void *arg)
     /* UNIMPL case SO_OOBINCLUDE: */
 #if SO_REUSE
     case SO_REUSEADDR:
-    case SO_REUSEPORT:
 #endif /* SO_REUSE */
     /* UNIMPL case SO_USELOOPBACK: */
       if (*(int*)optval) {
@@ -1751,8 +1833,18 @@ lwip_setsockopt_internal(void *arg)
 #if LWIP_SO_RCVBUF
     case SO_RCVBUF:
       sock->conn->recv_bufsize = ( *(int*)optval );
+      if (sock->conn->type == NETCONN_TCP && sock->conn->pcb.tcp != NULL) {
+        tcp_setrcvbuf(sock->conn->pcb.tcp, (u32_t)LWIP_MAX(*(int*)optval, 0));
+      }
       break;
 #endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+    case SO_SNDBUF:
+      if (sock->conn->pcb.tcp != NULL) {
+        tcp_setsndbuf(sock->conn->pcb.tcp, (u32_t)LWIP_MAX(*(int*)optval, 0));
+      }
+      break;
+#endif /* LWIP_SO_SNDBUF */
 #if LWIP_UDP
     case SO_NO_CHECK:
       if (*(int*)optval) {
@@ -315,6 +315,38 @@ inet_chksum_pseudo(struct pbuf *p,
   return (u16_t)~(acc & 0xffffUL);
 }
 
+/* inet_chksum_pseudo_hdr:
+ *
+ * Sums the pseudo header alone, for a netif that checksums the TCP or UDP
+ * data itself (NETIF_FLAG_TXCSUM): it adds the checksum field into its
+ * sum, so the field must hold this value rather than zero.
+ * IP addresses are expected to be in network byte order.
+ *
+ * @param src source ip address
+ * @param dst destination ip address
+ * @param proto ip protocol
+ * @param proto_len length of the ip data part
+ * @return uncomplemented sum (as u16_t) to be saved directly in the
+ *         protocol header
+ */
+u16_t
+inet_chksum_pseudo_hdr(struct ip_addr *src, struct ip_addr *dest,
+       u8_t proto, u16_t proto_len)
+{
+  u32_t acc;
+
+  acc = (src->addr & 0xffffUL);
+  acc += ((src->addr >> 16) & 0xffffUL);
+  acc += (dest->addr & 0xffffUL);
+  acc += ((dest->addr >> 16) & 0xffffUL);
+  acc += (u32_t)htons((u16_t)proto);
+  acc += (u32_t)htons(proto_len);
+
+  acc = FOLD_U32T(acc);
+  acc = FOLD_U32T(acc);
+  return (u16_t)(acc & 0xffffUL);
+}
+
 /* inet_chksum_pseudo:
  *
  * Calculates the pseudo Internet checksum used by TCP and UDP for a pbuf chain.
@@ -85,25 +85,29 @@ struct mem_helper
 void *
 mem_malloc(mem_size_t size)
 {
-  struct mem_helper *element;
+  struct mem_helper *element = NULL;
   memp_t poolnr;
 
+  /* the pools are few and sorted by size, so this takes constant time */
   for (poolnr = MEMP_POOL_FIRST; poolnr <= MEMP_POOL_LAST; poolnr++) {
     /* is this pool big enough to hold an element of the required size
        plus a struct mem_helper that saves the pool this element came from? */
     if ((size + sizeof(struct mem_helper)) <= memp_sizes[poolnr]) {
+      element = (struct mem_helper*)memp_malloc(poolnr);
+#if MEM_USE_POOLS_TRY_BIGGER_POOL
+      if (element == NULL) {
+        /* this pool is empty: try a bigger one */
+        continue;
+      }
+#endif /* MEM_USE_POOLS_TRY_BIGGER_POOL */
       break;
     }
   }
-  if (poolnr > MEMP_POOL_LAST) {
-    LWIP_ASSERT("mem_malloc(): no pool is that big!", 0);
-    return NULL;
-  }
-  element = (struct mem_helper*)memp_malloc(poolnr);
   if (element == NULL) {
-    /* No need to DEBUGF or ASSERT: This error is already
-       taken care of in memp.c */
-    /** @todo: we could try a bigger pool if this one is empty! */
+    /* An empty pool is already taken care of in memp.c; a request too
+       big for every pool fails the same way, as a heap would. */
+    LWIP_DEBUGF(MEM_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
+                ("mem_malloc: no pool for %"U32_F" bytes\n", (u32_t)size));
     return NULL;
   }
 
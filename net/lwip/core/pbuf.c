@@ -249,6 +249,69 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
   return p;
 }
 
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/**
+ * Initialize a custom pbuf, whose struct and payload memory the caller
+ * owns, as pbuf_alloc would a pbuf of the given layer, length and type.
+ * pbuf_free passes it to p->custom_free_function, which the caller must
+ * set, instead of freeing it.
+ *
+ * @param l flag to define header size, as for pbuf_alloc
+ * @param length size of the pbuf's payload
+ * @param type type of the pbuf (PBUF_REF or PBUF_ROM)
+ * @param p the struct pbuf_custom to initialize
+ * @param payload_mem the memory holding the headers and payload
+ * @param payload_mem_len size of payload_mem
+ *
+ * @return the pbuf, or NULL if payload_mem cannot hold the headers and
+ * length bytes
+ */
+struct pbuf *
+pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type,
+                    struct pbuf_custom *p, void *payload_mem,
+                    u16_t payload_mem_len)
+{
+  u16_t offset;
+
+  LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_TRACE | 3, ("pbuf_alloced_custom(length=%"U16_F")\n", length));
+  LWIP_ASSERT("pbuf_alloced_custom: bad pbuf type",
+    type == PBUF_REF || type == PBUF_ROM);
+
+  /* determine header offset */
+  offset = 0;
+  switch (l) {
+  case PBUF_TRANSPORT:
+    offset += PBUF_TRANSPORT_HLEN;
+    /* FALLTHROUGH */
+  case PBUF_IP:
+    offset += PBUF_IP_HLEN;
+    /* FALLTHROUGH */
+  case PBUF_LINK:
+    offset += PBUF_LINK_HLEN;
+    break;
+  case PBUF_RAW:
+    break;
+  default:
+    LWIP_ASSERT("pbuf_alloced_custom: bad pbuf layer", 0);
+    return NULL;
+  }
+
+  if (payload_mem == NULL || offset + length > payload_mem_len) {
+    LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_LEVEL_WARNING, ("pbuf_alloced_custom(length=%"U16_F") buffer too short\n", length));
+    return NULL;
+  }
+
+  p->pbuf.next = NULL;
+  p->pbuf.payload = (u8_t *)payload_mem + offset;
+  p->pbuf.len = p->pbuf.tot_len = length;
+  p->pbuf.type = type;
+  p->pbuf.flags = PBUF_FLAG_IS_CUSTOM;
+  p->pbuf.ref = 1;
+  p->custom_mem = payload_mem;
+  return &p->pbuf;
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
 
 /**
  * Shrink a pbuf chain to a desired length.
@@ -341,8 +404,9 @@ pbuf_realloc(struct pbuf *p, u16_t new_len)
  * If hdr_size_inc is 0, this function does nothing and returns succesful.
  *
  * PBUF_ROM and PBUF_REF type buffers cannot have their sizes increased, so
- * the call will fail. A check is made that the increase in header size does
- * not move the payload pointer in front of the start of the buffer.
+ * the call will fail, unless they are custom pbufs and the header lies in
+ * their payload memory. A check is made that the increase in header size
+ * does not move the payload pointer in front of the start of the buffer.
  * @return non-zero on failure, zero on success.
  *
  */
@@ -399,6 +463,14 @@ pbuf_header(struct pbuf *p, s16_t header_size_increment)
     if ((header_size_increment < 0) && (increment_magnitude <= p->len)) {
       /* increase payload pointer */
       p->payload = (u8_t *)p->payload - header_size_increment;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+    /* reveal one hidden earlier, still in the caller's memory? */
+    } else if ((header_size_increment > 0) &&
+               (p->flags & PBUF_FLAG_IS_CUSTOM) &&
+               ((u8_t *)p->payload - increment_magnitude >=
+                (u8_t *)((struct pbuf_custom *)p)->custom_mem)) {
+      p->payload = (u8_t *)p->payload - header_size_increment;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
     } else {
       /* cannot expand payload to front (yet!)
        * bail out unsuccesfully */
@@ -495,6 +567,14 @@ pbuf_free(struct pbuf *p)
       q = p->next;
       LWIP_DEBUGF( PBUF_DEBUG | 2, ("pbuf_free: deallocating %p\n", (void *)p));
       type = p->type;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+      /* is this a custom pbuf? its owner frees it */
+      if (p->flags & PBUF_FLAG_IS_CUSTOM) {
+        struct pbuf_custom *pc = (struct pbuf_custom *)p;
+        LWIP_ASSERT("pc->custom_free_function != NULL", pc->custom_free_function != NULL);
+        pc->custom_free_function(p);
+      } else
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
       /* is this a pbuf from the pool? */
       if (type == PBUF_POOL) {
         memp_free(MEMP_PBUF_POOL, p);
@@ -55,6 +55,8 @@ struct sswt_cb
   sys_sem_t *psem;
 };
 
+#if !SYS_ARCH_TIMEOUTS
+
 /**
  * Wait (forever) for a message to arrive in an mbox.
  * While waiting, timeouts (for this thread) are processed.
@@ -278,6 +280,37 @@ sys_untimeout(sys_timeout_handler h, void *arg)
   return;
 }
 
+#else /* !SYS_ARCH_TIMEOUTS */
+
+/**
+ * Wait (forever) for a message to arrive in an mbox.
+ * The port processes timeouts (SYS_ARCH_TIMEOUTS).
+ *
+ * @param mbox the mbox to fetch the message from
+ * @param msg the place to store the message
+ */
+void
+sys_mbox_fetch(sys_mbox_t mbox, void **msg)
+{
+  UNLOCK_TCPIP_CORE();
+  sys_arch_mbox_fetch(mbox, msg, 0);
+  LOCK_TCPIP_CORE();
+}
+
+/**
+ * Wait (forever) for a semaphore to become available.
+ * The port processes timeouts (SYS_ARCH_TIMEOUTS).
+ *
+ * @param sem semaphore to wait for
+ */
+void
+sys_sem_wait(sys_sem_t sem)
+{
+  sys_arch_sem_wait(sem, 0);
+}
+
+#endif /* !SYS_ARCH_TIMEOUTS */
+
 /**
  * Timeout handler function for sys_sem_wait_timeout()
  *
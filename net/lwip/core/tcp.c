@@ -117,6 +117,9 @@ tcp_close(struct tcp_pcb *pcb)
   tcp_debug_print_state(pcb->state);
 #endif /* TCP_DEBUG */
 
+  /* The application is done receiving, too */
+  pcb->flags &= ~TF_SHUTWR;
+
   switch (pcb->state) {
   case CLOSED:
     /* Closing a pcb in the CLOSED state might seem erroneous,
@@ -185,6 +188,46 @@ tcp_close(struct tcp_pcb *pcb)
   return err;
 }
 
+/**
+ * Half-closes a connection, as shutdown(SHUT_WR) does: sends a FIN but
+ * keeps receiving.  The pcb and its callbacks stay the application's
+ * until it calls tcp_close.  If the connection closes at both ends
+ * before then, the error callback gets ERR_CLSD before the pcb is
+ * freed.
+ *
+ * @param pcb the tcp_pcb to half-close
+ * @return ERR_OK if the FIN has been enqueued or was already sent,
+ *         ERR_CONN if the pcb is not connected,
+ *         ERR_MEM if there is no room for the FIN yet (try again later)
+ */
+err_t
+tcp_shutdown_tx(struct tcp_pcb *pcb)
+{
+  err_t err;
+
+  switch (pcb->state) {
+  case SYN_RCVD:
+  case ESTABLISHED:
+  case CLOSE_WAIT:
+    err = tcp_send_ctrl(pcb, TCP_FIN);
+    if (err != ERR_OK) {
+      return err;
+    }
+    pcb->state = (pcb->state == CLOSE_WAIT ? LAST_ACK : FIN_WAIT_1);
+    pcb->flags |= TF_SHUTWR;
+    tcp_output(pcb);
+    return ERR_OK;
+  case FIN_WAIT_1:
+  case FIN_WAIT_2:
+  case CLOSING:
+  case LAST_ACK:
+  case TIME_WAIT:
+    return ERR_OK;
+  default:
+    return ERR_CONN;
+  }
+}
+
 /**
  * Aborts a connection by sending a RST to the remote host and deletes
  * the local protocol control block. This is done when a connection is
@@ -208,8 +251,14 @@ tcp_abort(struct tcp_pcb *pcb)
      are in an active state, call the receive function associated with
      the PCB with a NULL argument, and send an RST to the remote end. */
   if (pcb->state == TIME_WAIT) {
+    /* A half-closed pcb may still be the application's */
+#if LWIP_CALLBACK_API
+    errf = pcb->errf;
+#endif /* LWIP_CALLBACK_API */
+    errf_arg = pcb->callback_arg;
     tcp_pcb_remove(&tcp_tw_pcbs, pcb);
     memp_free(MEMP_TCP_PCB, pcb);
+    TCP_EVENT_ERR(errf, errf_arg, ERR_ABRT);
   } else {
     seqno = pcb->snd_nxt;
     ackno = pcb->rcv_nxt;
@@ -296,8 +345,11 @@ tcp_bind(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port)
       }
     }
   }
-  /* @todo: until SO_REUSEADDR is implemented (see task #6995 on savannah),
-   * we have to check the pcbs in TIME-WAIT state, also: */
+  /* Unless SO_REUSEADDR is set, we have to check the pcbs in TIME-WAIT
+   * state, also: */
+#if SO_REUSE
+  if (!(pcb->so_options & SOF_REUSEADDR))
+#endif /* SO_REUSE */
   for(cpcb = tcp_tw_pcbs; cpcb != NULL; cpcb = cpcb->next) {
     if (cpcb->local_port == port) {
       if (ip_addr_cmp(&(cpcb->local_ip), ipaddr)) {
@@ -366,6 +418,12 @@ tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
   lpcb->so_options |= SOF_ACCEPTCONN;
   lpcb->ttl = pcb->ttl;
   lpcb->tos = pcb->tos;
+#if LWIP_SO_RCVBUF
+  lpcb->rcv_buf_size = pcb->rcv_buf_size;
+#endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+  lpcb->snd_buf_size = pcb->snd_buf_size;
+#endif /* LWIP_SO_SNDBUF */
   ip_addr_set(&lpcb->local_ip, &pcb->local_ip);
   TCP_RMV(&tcp_bound_pcbs, pcb);
   memp_free(MEMP_TCP_PCB, pcb);
@@ -391,9 +449,12 @@ tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
 void
 tcp_recved(struct tcp_pcb *pcb, u16_t len)
 {
-  if ((u32_t)pcb->rcv_wnd + len > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
-    pcb->rcv_ann_wnd = TCP_WND;
+  if ((u32_t)pcb->rcv_wnd + len > TCP_WND_MAX(pcb)) {
+    /* a window left wider than a lowered SO_RCVBUF closes down to it */
+    if (pcb->rcv_wnd <= TCP_WND_MAX(pcb)) {
+      pcb->rcv_wnd = TCP_WND_MAX(pcb);
+      pcb->rcv_ann_wnd = TCP_WND_MAX(pcb);
+    }
   } else {
     pcb->rcv_wnd += len;
     if (pcb->rcv_wnd >= pcb->mss) {
@@ -415,7 +476,7 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
      */
     tcp_ack(pcb);
   } 
-  else if (pcb->flags & TF_ACK_DELAY && pcb->rcv_wnd >= TCP_WND/2) {
+  else if (pcb->flags & TF_ACK_DELAY && pcb->rcv_wnd >= TCP_WND_MAX(pcb)/2) {
     /* If we can send a window update such that there is a full
      * segment available in the window, do so now.  This is sort of
      * nagle-like in its goals, and tries to hit a compromise between
@@ -426,8 +487,8 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
     tcp_ack_now(pcb);
   }
 
-  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"TCPWNDSIZE_F" (%"TCPWNDSIZE_F").\n",
+         len, pcb->rcv_wnd, TCP_WND_MAX(pcb) - pcb->rcv_wnd));
 }
 
 /**
@@ -485,9 +546,9 @@ err_t
 tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
       err_t (* connected)(void *arg, struct tcp_pcb *tpcb, err_t err))
 {
-  u32_t optdata;
   err_t ret;
   u32_t iss;
+  u8_t optflags;
 
   LWIP_ERROR("tcp_connect: can only connected from state CLOSED", pcb->state == CLOSED, return ERR_ISCONN);
 
@@ -506,9 +567,12 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
-  pcb->rcv_ann_wnd = TCP_WND;
-  pcb->snd_wnd = TCP_WND;
+  /* Until the SYN|ACK tells us whether the window may be scaled,
+     it has to fit in 16 bits (TCP_WND_MAX() without TF_WND_SCALE),
+     and SO_RCVBUF may have narrowed it. */
+  pcb->rcv_wnd = TCPWND16(TCP_WND_MAX(pcb));
+  pcb->rcv_ann_wnd = TCPWND16(TCP_WND_MAX(pcb));
+  pcb->snd_wnd = TCPWND16(TCP_WND);
   /* As initial send MSS, we use TCP_MSS but limit it to 536.
      The send MSS is updated when an MSS option is received. */
   pcb->mss = (TCP_MSS > 536) ? 536 : TCP_MSS;
@@ -526,10 +590,19 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
 
   snmp_inc_tcpactiveopens();
   
-  /* Build an MSS option */
-  optdata = TCP_BUILD_MSS_OPTION();
-
-  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)&optdata, 4);
+  /* Offer an MSS, a window scale, timestamps and SACK */
+  optflags = TF_SEG_OPTS_MSS;
+#if LWIP_WND_SCALE
+  optflags |= TF_SEG_OPTS_WND_SCALE;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_TIMESTAMPS
+  optflags |= TF_SEG_OPTS_TS;
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+  optflags |= TF_SEG_OPTS_SACK_PERM;
+#endif /* LWIP_TCP_SACK */
+
+  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, optflags);
   if (ret == ERR_OK) { 
     tcp_output(pcb);
   }
@@ -547,7 +620,7 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *pcb2, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   err_t err;
 
@@ -615,8 +688,8 @@ tcp_slowtmr(void)
             pcb->ssthresh = pcb->mss * 2;
           }
           pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
-                                       " ssthresh %"U16_F"\n",
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
+                                       " ssthresh %"TCPWNDSIZE_F"\n",
                                        pcb->cwnd, pcb->ssthresh));
  
           /* The following needs to be called AFTER cwnd is set to one
@@ -625,8 +698,9 @@ tcp_slowtmr(void)
         }
       }
     }
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
-    if (pcb->state == FIN_WAIT_2) {
+    /* Check if this PCB has stayed too long in FIN-WAIT-2, unless
+       the application still reads it */
+    if (pcb->state == FIN_WAIT_2 && !(pcb->flags & TF_SHUTWR)) {
       if ((u32_t)(tcp_ticks - pcb->tmr) >
           TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
         ++pcb_remove;
@@ -761,6 +835,8 @@ tcp_slowtmr(void)
         tcp_tw_pcbs = pcb->next;
       }
       pcb2 = pcb->next;
+      /* Let a half-closed pcb's application forget it */
+      TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_CLSD);
       memp_free(MEMP_TCP_PCB, pcb);
       pcb = pcb2;
     } else {
@@ -855,6 +931,69 @@ tcp_setprio(struct tcp_pcb *pcb, u8_t prio)
 {
   pcb->prio = prio;
 }
+
+#if LWIP_SO_RCVBUF
+/**
+ * Sets the receive buffer size of a connection (SO_RCVBUF): the largest
+ * window it advertises, kept between TCP_MSS and TCP_WND.  Before the
+ * connection opens this is the window its SYN offers.  After, a wider
+ * buffer opens the window by the difference at once, with a window
+ * update, and a narrower one closes it down as data arrives.  A
+ * listening pcb passes it on to the connections it accepts.
+ *
+ * @param pcb the tcp_pcb to manipulate
+ * @param size new receive buffer size in bytes
+ */
+void
+tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  tcpwnd_size_t old_max;
+
+  size = LWIP_MAX(LWIP_MIN(size, TCP_WND), TCP_MSS);
+  if (pcb->state == CLOSED || pcb->state == LISTEN) {
+    pcb->rcv_buf_size = (tcpwnd_size_t)size;
+    if (pcb->state == CLOSED) {
+      pcb->rcv_wnd = TCPWND16(pcb->rcv_buf_size);
+      pcb->rcv_ann_wnd = TCPWND16(pcb->rcv_buf_size);
+    }
+    return;
+  }
+
+  old_max = TCP_WND_MAX(pcb);
+  pcb->rcv_buf_size = (tcpwnd_size_t)size;
+  if (TCP_WND_MAX(pcb) > old_max) {
+    /* After an earlier shrink the window may still be wider than the
+       old maximum, so the sum is clamped to the new one. */
+    pcb->rcv_wnd = (tcpwnd_size_t)LWIP_MIN((u32_t)pcb->rcv_wnd + TCP_WND_MAX(pcb) - old_max,
+                                           TCP_WND_MAX(pcb));
+    if (pcb->rcv_wnd >= pcb->mss) {
+      pcb->rcv_ann_wnd = pcb->rcv_wnd;
+    }
+    /* The peer may be waiting on a closed window */
+    if (pcb->state == ESTABLISHED || pcb->state == FIN_WAIT_1 ||
+        pcb->state == FIN_WAIT_2) {
+      tcp_ack_now(pcb);
+      tcp_output(pcb);
+    }
+  }
+}
+#endif /* LWIP_SO_RCVBUF */
+
+#if LWIP_SO_SNDBUF
+/**
+ * Sets the send buffer size of a connection (SO_SNDBUF): the most data
+ * tcp_write may have queued, kept between TCP_MSS and TCP_SND_BUF.  A
+ * listening pcb passes it on to the connections it accepts.
+ *
+ * @param pcb the tcp_pcb to manipulate
+ * @param size new send buffer size in bytes
+ */
+void
+tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  pcb->snd_buf_size = (tcpwnd_size_t)LWIP_MAX(LWIP_MIN(size, TCP_SND_BUF), TCP_MSS);
+}
+#endif /* LWIP_SO_SNDBUF */
 #if TCP_QUEUE_OOSEQ
 
 /**
@@ -988,8 +1127,14 @@ tcp_alloc(u8_t prio)
     pcb->prio = TCP_PRIO_NORMAL;
     pcb->snd_buf = TCP_SND_BUF;
     pcb->snd_queuelen = 0;
-    pcb->rcv_wnd = TCP_WND;
-    pcb->rcv_ann_wnd = TCP_WND;
+    pcb->rcv_wnd = TCPWND16(TCP_WND);
+    pcb->rcv_ann_wnd = TCPWND16(TCP_WND);
+#if LWIP_SO_RCVBUF
+    pcb->rcv_buf_size = TCP_WND;
+#endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+    pcb->snd_buf_size = TCP_SND_BUF;
+#endif /* LWIP_SO_SNDBUF */
     pcb->tos = 0;
     pcb->ttl = TCP_TTL;
     /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -1006,6 +1151,9 @@ tcp_alloc(u8_t prio)
     pcb->snd_max = iss;
     pcb->lastack = iss;
     pcb->snd_lbb = iss;   
+#if LWIP_TCP_SACK
+    pcb->sack_high = iss;
+#endif /* LWIP_TCP_SACK */
     pcb->tmr = tcp_ticks;
 
     pcb->polltmr = 0;
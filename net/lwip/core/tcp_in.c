@@ -70,12 +70,31 @@ static u16_t tcplen;
 static u8_t recv_flags;
 static struct pbuf *recv_data;
 
+#if LWIP_TCP_TIMESTAMPS
+/* The timestamp option of the segment being processed, if it had one;
+   set by tcp_parseopt(). */
+static u8_t ts_present;
+static u32_t ts_ecr;
+#endif /* LWIP_TCP_TIMESTAMPS */
+
+#if LWIP_TCP_SACK
+/* The SACK blocks of the segment being processed, as left and right
+   edges in host byte order; set by tcp_parseopt(). */
+static u32_t sack_edges[2 * LWIP_TCP_SACK_MAX_BLOCKS];
+static u8_t sack_n;
+#endif /* LWIP_TCP_SACK */
+
 struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
 static u8_t tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+static void tcp_rtt_sample(struct tcp_pcb *pcb, s16_t m);
+#if LWIP_TCP_SACK
+static void tcp_sack_update(struct tcp_pcb *pcb);
+static u8_t tcp_sack_rexmit(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -131,8 +150,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
   }
 
 #if CHECKSUM_CHECK_TCP
-  /* Verify TCP checksum. */
-  if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
+  /* Verify TCP checksum, unless the netif did. */
+  if (!(p->flags & PBUF_FLAG_RXCSUM_OK) && inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
       (struct ip_addr *)&(iphdr->dest),
       IP_PROTO_TCP, p->tot_len) != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
@@ -305,7 +324,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
         memp_free(MEMP_TCP_PCB, pcb);
       } else if (recv_flags & TF_CLOSED) {
         /* The connection has been closed and we will deallocate the
-           PCB. */
+           PCB.  A half-closed (tcp_shutdown_tx) pcb is still the
+           application's, so tell it first. */
+        TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_CLSD);
         tcp_pcb_remove(&tcp_active_pcbs, pcb);
         memp_free(MEMP_TCP_PCB, pcb);
       } else {
@@ -314,7 +335,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
            called when new send buffer space is available, we call it
            now. */
         if (pcb->acked > 0) {
-          TCP_EVENT_SENT(pcb, pcb->acked, err);
+          TCP_EVENT_SENT(pcb, TCPWND16(pcb->acked), err);
         }
       
         if (recv_data != NULL) {
@@ -393,7 +414,7 @@ static err_t
 tcp_listen_input(struct tcp_pcb_listen *pcb)
 {
   struct tcp_pcb *npcb;
-  u32_t optdata;
+  u8_t optflags;
 
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
@@ -439,6 +460,14 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 #endif /* LWIP_CALLBACK_API */
     /* inherit socket options */
     npcb->so_options = pcb->so_options & (SOF_DEBUG|SOF_DONTROUTE|SOF_KEEPALIVE|SOF_OOBINLINE|SOF_LINGER);
+#if LWIP_SO_RCVBUF
+    npcb->rcv_buf_size = pcb->rcv_buf_size;
+    npcb->rcv_wnd = TCPWND16(npcb->rcv_buf_size);
+    npcb->rcv_ann_wnd = TCPWND16(npcb->rcv_buf_size);
+#endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+    npcb->snd_buf_size = pcb->snd_buf_size;
+#endif /* LWIP_SO_SNDBUF */
     /* Register the new PCB so that we can begin receiving segments
        for it. */
     TCP_REG(&tcp_active_pcbs, npcb);
@@ -451,10 +480,21 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 
     snmp_inc_tcppassiveopens();
 
-    /* Build an MSS option. */
-    optdata = TCP_BUILD_MSS_OPTION();
-    /* Send a SYN|ACK together with the MSS option. */
-    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)&optdata, 4);
+    /* Send a SYN|ACK together with the MSS option, and a window scale
+       and SACK permitted if the SYN had them (timestamps are added by
+       tcp_enqueue when the SYN had them). */
+    optflags = TF_SEG_OPTS_MSS;
+#if LWIP_WND_SCALE
+    if (npcb->flags & TF_WND_SCALE) {
+      optflags |= TF_SEG_OPTS_WND_SCALE;
+    }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+    if (npcb->flags & TF_SACK) {
+      optflags |= TF_SEG_OPTS_SACK_PERM;
+    }
+#endif /* LWIP_TCP_SACK */
+    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, optflags);
     return tcp_output(npcb);
   }
   return ERR_OK;
@@ -535,6 +575,25 @@ tcp_process(struct tcp_pcb *pcb)
   pcb->tmr = tcp_ticks;
   pcb->keep_cnt_sent = 0;
 
+  /* A SYN after our own SYN has been answered does not open the
+     connection again, so its options must not change it: in a
+     synchronized state, answer it with an ACK (RFC 5961, 4.2) and
+     drop it.  A SYN repeated in SYN_RCVD is dropped too; the
+     retransmission timer repeats our SYN|ACK. */
+  if ((flags & TCP_SYN) && pcb->state != SYN_SENT) {
+    if (pcb->state != SYN_RCVD) {
+      tcp_ack_now(pcb);
+    }
+    return ERR_OK;
+  }
+
+  /* The options of a SYN|ACK are parsed below, once it is known to be
+     acceptable; those of other segments only carry timestamps and SACK
+     blocks. */
+  if (pcb->state != SYN_SENT) {
+    tcp_parseopt(pcb);
+  }
+
   /* Do different things depending on the TCP state. */
   switch (pcb->state) {
   case SYN_SENT:
@@ -596,7 +655,7 @@ tcp_process(struct tcp_pcb *pcb)
        !(flags & TCP_RST)) {
       /* expected ACK number? */
       if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
-        u16_t old_cwnd;
+        tcpwnd_size_t old_cwnd;
         pcb->state = ESTABLISHED;
         LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
@@ -717,10 +776,12 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif
   struct pbuf *p;
   s32_t off;
-  s16_t m;
   u32_t right_wnd_edge;
   u16_t new_tot_len;
   u8_t accepted_inseq = 0;
+#if LWIP_TCP_SACK
+  u8_t sack_partial = 0;
+#endif /* LWIP_TCP_SACK */
 
   if (flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl1;
@@ -728,27 +789,40 @@ tcp_receive(struct tcp_pcb *pcb)
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && SND_WND_SCALE(pcb, tcphdr->wnd) > pcb->snd_wnd)) {
+      pcb->snd_wnd = SND_WND_SCALE(pcb, tcphdr->wnd);
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
           pcb->persist_backoff = 0;
       }
-      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
+      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"TCPWNDSIZE_F"\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != SND_WND_SCALE(pcb, tcphdr->wnd)) {
         LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %"U32_F" snd_max %"U32_F" ackno %"U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
                                pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
       }
 #endif /* TCP_WND_DEBUG */
     }
 
+#if LWIP_TCP_SACK
+    if (sack_n > 0) {
+      tcp_sack_update(pcb);
+    }
+#endif /* LWIP_TCP_SACK */
+
     if (pcb->lastack == ackno) {
       pcb->acked = 0;
 
-      if (pcb->snd_wl1 + pcb->snd_wnd == right_wnd_edge){
+      /* An ACK that moves the window is taken for a window update,
+         not a duplicate, unless it has SACK blocks: a peer with a
+         scaled window may open it further with every ACK. */
+      if (pcb->snd_wl1 + pcb->snd_wnd == right_wnd_edge
+#if LWIP_TCP_SACK
+          || ((pcb->flags & TF_SACK) && sack_n > 0)
+#endif /* LWIP_TCP_SACK */
+          ){
         ++pcb->dupacks;
         if (pcb->dupacks >= 3 && pcb->unacked != NULL) {
           if (!(pcb->flags & TF_INFR)) {
@@ -756,6 +830,18 @@ tcp_receive(struct tcp_pcb *pcb)
             LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: dupacks %"U16_F" (%"U32_F"), fast retransmit %"U32_F"\n",
                                        (u16_t)pcb->dupacks, pcb->lastack,
                                        ntohl(pcb->unacked->tcphdr->seqno)));
+#if LWIP_TCP_SACK
+            if (pcb->flags & TF_SACK) {
+              /* Retransmit in place, so that the scoreboard keeps
+                 its order, and recover until all we sent is acked. */
+              for (next = pcb->unacked; next != NULL; next = next->next) {
+                next->flags &= ~TF_SEG_RXMIT;
+              }
+              pcb->recover = pcb->snd_max;
+              ++pcb->nrtx;
+              tcp_rexmit_seg(pcb, pcb->unacked);
+            } else
+#endif /* LWIP_TCP_SACK */
             tcp_rexmit(pcb);
             /* Set ssthresh to max (FlightSize / 2, 2*SMSS) */
             /*pcb->ssthresh = LWIP_MAX((pcb->snd_max -
@@ -769,16 +855,23 @@ tcp_receive(struct tcp_pcb *pcb)
 
             /* The minimum value for ssthresh should be 2 MSS */
             if (pcb->ssthresh < 2*pcb->mss) {
-              LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: The minimum value for ssthresh %"U16_F" should be min 2 mss %"U16_F"...\n", pcb->ssthresh, 2*pcb->mss));
+              LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F" should be min 2 mss %"U16_F"...\n", pcb->ssthresh, 2*pcb->mss));
               pcb->ssthresh = 2*pcb->mss;
             }
 
             pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
             pcb->flags |= TF_INFR;
           } else {
+#if LWIP_TCP_SACK
+            /* A segment has left the network: send a hole the remote
+               side reports in its place, if there is one. */
+            if ((pcb->flags & TF_SACK) && tcp_sack_rexmit(pcb)) {
+              /* the hole is sent instead of inflating the window */
+            } else
+#endif /* LWIP_TCP_SACK */
             /* Inflate the congestion window, but not if it means that
                the value overflows. */
-            if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+            if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
               pcb->cwnd += pcb->mss;
             }
           }
@@ -794,8 +887,17 @@ tcp_receive(struct tcp_pcb *pcb)
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        pcb->flags &= ~TF_INFR;
-        pcb->cwnd = pcb->ssthresh;
+#if LWIP_TCP_SACK
+        /* A partial ACK means more was lost: stay in recovery and
+           retransmit the next hole once the acked segments are gone. */
+        if ((pcb->flags & TF_SACK) && TCP_SEQ_LT(ackno, pcb->recover)) {
+          sack_partial = 1;
+        } else
+#endif /* LWIP_TCP_SACK */
+        {
+          pcb->flags &= ~TF_INFR;
+          pcb->cwnd = pcb->ssthresh;
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -804,29 +906,32 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Reset the retransmission time-out. */
       pcb->rto = (pcb->sa >> 3) + pcb->sv;
 
-      /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      /* Update the send buffer space. Diff between the two can never
+         exceed the largest window. */
+      pcb->acked = (tcpwnd_size_t)(ackno - pcb->lastack);
 
       pcb->snd_buf += pcb->acked;
 
-      /* Reset the fast retransmit variables. */
-      pcb->dupacks = 0;
+      /* Reset the fast retransmit variables, unless still recovering. */
+      if (!(pcb->flags & TF_INFR)) {
+        pcb->dupacks = 0;
+      }
       pcb->lastack = ackno;
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
+      if (pcb->state >= ESTABLISHED && !(pcb->flags & TF_INFR)) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
         }
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
@@ -861,6 +966,14 @@ tcp_receive(struct tcp_pcb *pcb)
         }
       }
 
+#if LWIP_TCP_SACK
+      if (sack_partial && !tcp_sack_rexmit(pcb) && pcb->unacked != NULL &&
+          !(pcb->unacked->flags & TF_SEG_RXMIT)) {
+        /* nothing SACKed above it, but it is missing all the same */
+        tcp_rexmit_seg(pcb, pcb->unacked);
+      }
+#endif /* LWIP_TCP_SACK */
+
       /* If there's nothing left to acknowledge, stop the retransmit
          timer, otherwise reset it to start again */
       if(pcb->unacked == NULL)
@@ -910,30 +1023,23 @@ tcp_receive(struct tcp_pcb *pcb)
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: pcb->rttest %"U32_F" rtseq %"U32_F" ackno %"U32_F"\n",
                                 pcb->rttest, pcb->rtseq, ackno));
 
+#if LWIP_TCP_TIMESTAMPS
+    /* With timestamps, an ACK for new data echoes when the segment it
+       acknowledges was sent, whether or not that was a retransmission,
+       so every such ACK gives a round-trip time measurement. */
+    if ((pcb->flags & TF_TIMESTAMP) && ts_present && ts_ecr != 0 &&
+        pcb->acked > 0) {
+      tcp_rtt_sample(pcb, (s16_t)((sys_now() - ts_ecr) / TCP_SLOW_INTERVAL));
+      pcb->rttest = 0;
+    } else
+#endif /* LWIP_TCP_TIMESTAMPS */
     /* RTT estimation calculations. This is done by checking if the
        incoming segment acknowledges the segment we use to take a
        round-trip time measurement. */
     if (pcb->rttest && TCP_SEQ_LT(pcb->rtseq, ackno)) {
       /* diff between this shouldn't exceed 32K since this are tcp timer ticks
          and a round-trip shouldn't be that long... */
-      m = (s16_t)(tcp_ticks - pcb->rttest);
-
-      LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: experienced rtt %"U16_F" ticks (%"U16_F" msec).\n",
-                                  m, m * TCP_SLOW_INTERVAL));
-
-      /* This is taken directly from VJs original code in his paper */
-      m = m - (pcb->sa >> 3);
-      pcb->sa += m;
-      if (m < 0) {
-        m = -m;
-      }
-      m = m - (pcb->sv >> 2);
-      pcb->sv += m;
-      pcb->rto = (pcb->sa >> 3) + pcb->sv;
-
-      LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: RTO %"U16_F" (%"U16_F" milliseconds)\n",
-                                  pcb->rto, pcb->rto * TCP_SLOW_INTERVAL));
-
+      tcp_rtt_sample(pcb, (s16_t)(tcp_ticks - pcb->rttest));
       pcb->rttest = 0;
     }
   }
@@ -1160,6 +1266,19 @@ tcp_receive(struct tcp_pcb *pcb)
         /* We get here if the incoming segment is out-of-sequence. */
         tcp_ack_now(pcb);
 #if TCP_QUEUE_OOSEQ
+#if LWIP_TCP_SACK
+        /* our next SACK option reports this segment first */
+        pcb->ooseq_last = seqno;
+#endif /* LWIP_TCP_SACK */
+#if LWIP_WND_SCALE
+        if (TCP_SEQ_GT(seqno + tcplen, pcb->rcv_nxt + 0xffff)) {
+          /* What is queued is handed to the application chained onto
+             the segment that fills the gap, in one pbuf chain, and a
+             chain's tot_len is 16 bits.  A scaled window reaches
+             further than that, so such a segment must come again. */
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: not queueing %"U32_F", too far above rcv_nxt\n", seqno));
+        } else
+#endif /* LWIP_WND_SCALE */
         /* We queue the segment on the ->ooseq queue. */
         if (pcb->ooseq == NULL) {
           pcb->ooseq = tcp_seg_copy(&inseg);
@@ -1296,27 +1415,136 @@ tcp_receive(struct tcp_pcb *pcb)
   return accepted_inseq;
 }
 
+/**
+ * Updates the round-trip time estimate and the retransmission time-out
+ * with one measurement.
+ *
+ * Called from tcp_receive().
+ *
+ * @param pcb the tcp_pcb the measurement was taken on
+ * @param m the measured round-trip time, in slow timer ticks
+ */
+static void
+tcp_rtt_sample(struct tcp_pcb *pcb, s16_t m)
+{
+  LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: experienced rtt %"U16_F" ticks (%"U16_F" msec).\n",
+                              m, m * TCP_SLOW_INTERVAL));
+
+  /* This is taken directly from VJs original code in his paper */
+  m = m - (pcb->sa >> 3);
+  pcb->sa += m;
+  if (m < 0) {
+    m = -m;
+  }
+  m = m - (pcb->sv >> 2);
+  pcb->sv += m;
+  pcb->rto = (pcb->sa >> 3) + pcb->sv;
+
+  LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: RTO %"U16_F" (%"U16_F" milliseconds)\n",
+                              pcb->rto, pcb->rto * TCP_SLOW_INTERVAL));
+}
+
+#if LWIP_TCP_SACK
+/**
+ * Mark the unacked segments the SACK blocks of the incoming segment
+ * cover, and note the highest sequence number SACKed.  Blocks that are
+ * below the cumulative ACK or beyond what was sent are ignored.
+ *
+ * @param pcb the tcp_pcb the segment is for
+ */
+static void
+tcp_sack_update(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  u32_t left, right, segno;
+  u8_t i;
+
+  if (TCP_SEQ_LT(pcb->sack_high, pcb->lastack)) {
+    pcb->sack_high = pcb->lastack;
+  }
+  for (i = 0; i < sack_n; i++) {
+    left = sack_edges[2 * i];
+    right = sack_edges[2 * i + 1];
+    if (!TCP_SEQ_LT(left, right) || !TCP_SEQ_LT(ackno, left) ||
+        TCP_SEQ_GT(right, pcb->snd_max)) {
+      continue;
+    }
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      segno = ntohl(seg->tcphdr->seqno);
+      if (TCP_SEQ_LEQ(left, segno) &&
+          TCP_SEQ_LEQ(segno + TCP_TCPLEN(seg), right)) {
+        seg->flags |= TF_SEG_SACKED;
+      }
+    }
+    if (TCP_SEQ_GT(right, pcb->sack_high)) {
+      pcb->sack_high = right;
+    }
+  }
+}
+
+/**
+ * Retransmit the first segment below the highest SACKed sequence
+ * number that the remote side is missing and that has not been
+ * retransmitted in this recovery yet (RFC 6675, NextSeg() rule 1).
+ *
+ * @param pcb the tcp_pcb in recovery
+ * @return 1 if a segment was retransmitted, 0 if there was none
+ */
+static u8_t
+tcp_sack_rexmit(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+
+  for (seg = pcb->unacked; seg != NULL &&
+       TCP_SEQ_LT(ntohl(seg->tcphdr->seqno), pcb->sack_high); seg = seg->next) {
+    if (!(seg->flags & (TF_SEG_SACKED | TF_SEG_RXMIT))) {
+      LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_sack_rexmit: %"U32_F"\n",
+                                 ntohl(seg->tcphdr->seqno)));
+      tcp_rexmit_seg(pcb, seg);
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* LWIP_TCP_SACK */
+
 /**
  * Parses the options contained in the incoming segment. (Code taken
  * from uIP with only small changes.)
  *
  * Called from tcp_listen_input() and tcp_process().
- * Currently, only the MSS option is supported!
+ * The MSS, window scale and SACK permitted options are only taken from
+ * SYN segments, which only arrive here in LISTEN and SYN_SENT; the
+ * timestamp and SACK options are noted for tcp_receive() in every
+ * segment.  An option whose length does not fit in the header's option
+ * area is malformed, and parsing stops there.
  *
  * @param pcb the tcp_pcb for which a segment arrived
  */
 static void
 tcp_parseopt(struct tcp_pcb *pcb)
 {
-  u8_t c;
+  u8_t c, len, optlen;
   u8_t *opts, opt;
   u16_t mss;
+#if LWIP_TCP_TIMESTAMPS
+  u32_t tsval;
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+  u8_t *b;
+#endif /* LWIP_TCP_SACK */
 
   opts = (u8_t *)tcphdr + TCP_HLEN;
+#if LWIP_TCP_TIMESTAMPS
+  ts_present = 0;
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+  sack_n = 0;
+#endif /* LWIP_TCP_SACK */
 
-  /* Parse the TCP MSS option, if present. */
   if(TCPH_HDRLEN(tcphdr) > 0x5) {
-    for(c = 0; c < (TCPH_HDRLEN(tcphdr) - 5) << 2 ;) {
+    optlen = (TCPH_HDRLEN(tcphdr) - 5) << 2;
+    for(c = 0; c < optlen ;) {
       opt = opts[c];
       if (opt == 0x00) {
         /* End of options. */
@@ -1324,24 +1552,74 @@ tcp_parseopt(struct tcp_pcb *pcb)
       } else if (opt == 0x01) {
         ++c;
         /* NOP option. */
-      } else if (opt == 0x02 &&
-        opts[c + 1] == 0x04) {
+        continue;
+      }
+      /* All other options have a length field, which counts the kind
+         and length bytes and must not run past the option area. */
+      if (c + 1 >= optlen || opts[c + 1] < 2 || opts[c + 1] > optlen - c) {
+        break;
+      }
+      len = opts[c + 1];
+      if (opt == 0x02 && len == 0x04 && (flags & TCP_SYN)) {
         /* An MSS option with the right option length. */
         mss = (opts[c + 2] << 8) | opts[c + 3];
         /* Limit the mss to the configured TCP_MSS and prevent division by zero */
         pcb->mss = ((mss > TCP_MSS) || (mss == 0)) ? TCP_MSS : mss;
-
-        /* And we are done processing options. */
-        break;
-      } else {
-        if (opts[c + 1] == 0) {
-          /* If the length field is zero, the options are malformed
-             and we don't process them further. */
-          break;
+        /* and leave room for data beside the options */
+        pcb->mss = LWIP_MAX(pcb->mss, LWIP_MIN(TCP_MSS_MIN, TCP_MSS));
+        c += 0x04;
+#if LWIP_WND_SCALE
+      } else if (opt == 0x03 && len == 0x03 && (flags & TCP_SYN)) {
+        /* A window scale option with the right option length.  Both
+           sides have now offered one, so windows after the SYNs are
+           scaled, and ours may grow to TCP_WND. */
+        pcb->snd_scale = LWIP_MIN(opts[c + 2], 14);
+        pcb->rcv_scale = TCP_RCV_SCALE;
+        pcb->flags |= TF_WND_SCALE;
+        pcb->rcv_wnd = TCP_WND_MAX(pcb);
+        pcb->rcv_ann_wnd = TCP_WND_MAX(pcb);
+        c += 0x03;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_TIMESTAMPS
+      } else if (opt == 0x08 && len == 0x0A) {
+        /* A timestamp option with the right option length. */
+        tsval = (opts[c + 2] << 24) | (opts[c + 3] << 16) |
+          (opts[c + 4] << 8) | opts[c + 5];
+        ts_ecr = (opts[c + 6] << 24) | (opts[c + 7] << 16) |
+          (opts[c + 8] << 8) | opts[c + 9];
+        ts_present = 1;
+        if (flags & TCP_SYN) {
+          pcb->ts_recent = tsval;
+          pcb->flags |= TF_TIMESTAMP;
+        } else if (TCP_SEQ_BETWEEN(pcb->ts_lastacksent, seqno, seqno + tcplen)) {
+          /* The segment covers the ACK we last sent: its timestamp is
+             the one to echo (RFC 1323, 3.4) */
+          pcb->ts_recent = tsval;
         }
-        /* All other options have a length field, so that we easily
-           can skip past them. */
-        c += opts[c + 1];
+        c += 0x0A;
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+      } else if (opt == 0x04 && len == 0x02 && (flags & TCP_SYN)) {
+        /* SACK permitted: both sides have now offered it. */
+        pcb->flags |= TF_SACK;
+        c += 0x02;
+      } else if (opt == 0x05 && len >= 0x0A && len <= 0x22 &&
+        (len - 2) % 8 == 0 && (pcb->flags & TF_SACK)) {
+        /* SACK blocks, each a left and a right edge; at most four fit
+           in the option area, and none is read past its end. */
+        for (b = opts + c + 2; b + 8 <= opts + c + len &&
+             b + 8 <= opts + optlen &&
+             sack_n < LWIP_TCP_SACK_MAX_BLOCKS; b += 8, sack_n++) {
+          sack_edges[2 * sack_n] = ((u32_t)b[0] << 24) | (b[1] << 16) |
+            (b[2] << 8) | b[3];
+          sack_edges[2 * sack_n + 1] = ((u32_t)b[4] << 24) | (b[5] << 16) |
+            (b[6] << 8) | b[7];
+        }
+        c += len;
+#endif /* LWIP_TCP_SACK */
+      } else {
+        /* Skip any other option, or one of ours with the wrong length. */
+        c += len;
       }
     }
   }
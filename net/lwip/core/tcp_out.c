@@ -59,6 +59,133 @@
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
 
+#if LWIP_TCP_TIMESTAMPS
+/**
+ * Build a timestamp option (12 bytes long) at the specified options pointer
+ *
+ * @param pcb tcp_pcb
+ * @param opts option pointer where to store the timestamp option
+ */
+static void
+tcp_build_timestamp_option(struct tcp_pcb *pcb, u32_t *opts)
+{
+  /* Pad with two NOP options to make everything nicely aligned */
+  opts[0] = htonl(0x0101080A);
+  opts[1] = htonl(sys_now());
+  opts[2] = htonl(pcb->ts_recent);
+}
+#endif /* LWIP_TCP_TIMESTAMPS */
+
+/**
+ * The length of the options to send in a segment without data, which
+ * are only timestamps once those have been agreed on.
+ */
+static u8_t
+tcp_ctrl_optlen(struct tcp_pcb *pcb)
+{
+#if LWIP_TCP_TIMESTAMPS
+  if (pcb->flags & TF_TIMESTAMP) {
+    return LWIP_TCP_OPT_LENGTH(TF_SEG_OPTS_TS);
+  }
+#endif /* LWIP_TCP_TIMESTAMPS */
+  LWIP_UNUSED_ARG(pcb);
+  return 0;
+}
+
+/**
+ * Fill in the options of a segment without data, as sized by
+ * tcp_ctrl_optlen(), and note that this acknowledges rcv_nxt.
+ */
+static void
+tcp_build_ctrl_options(struct tcp_pcb *pcb, struct tcp_hdr *tcphdr)
+{
+#if LWIP_TCP_TIMESTAMPS
+  pcb->ts_lastacksent = pcb->rcv_nxt;
+  if (pcb->flags & TF_TIMESTAMP) {
+    tcp_build_timestamp_option(pcb, (u32_t *)(tcphdr + 1));
+  }
+#endif /* LWIP_TCP_TIMESTAMPS */
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(tcphdr);
+}
+
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+/**
+ * Find the contiguous run of out-of-sequence segments starting at seg.
+ *
+ * @param seg the first segment of the run
+ * @param left set to the first sequence number of the run
+ * @param right set to the sequence number following the run
+ * @return the segment after the run
+ */
+static struct tcp_seg *
+tcp_sack_run(struct tcp_seg *seg, u32_t *left, u32_t *right)
+{
+  *left = seg->tcphdr->seqno;
+  *right = *left + TCP_TCPLEN(seg);
+  for (seg = seg->next; seg != NULL &&
+       TCP_SEQ_LEQ(seg->tcphdr->seqno, *right); seg = seg->next) {
+    if (TCP_SEQ_GT(seg->tcphdr->seqno + TCP_TCPLEN(seg), *right)) {
+      *right = seg->tcphdr->seqno + TCP_TCPLEN(seg);
+    }
+  }
+  return seg;
+}
+
+/**
+ * Describe the out-of-sequence data we hold as SACK blocks, the block
+ * holding the segment received last first (RFC 2018, section 4).
+ *
+ * @param pcb the tcp_pcb whose ooseq queue to describe
+ * @param edges filled with the left and right edge of each block
+ * @param max the number of blocks there is room for
+ * @return the number of blocks filled in
+ */
+static u8_t
+tcp_sack_blocks(struct tcp_pcb *pcb, u32_t *edges, u8_t max)
+{
+  struct tcp_seg *seg;
+  u32_t left, right;
+  u8_t n = 0;
+
+  if (!(pcb->flags & TF_SACK)) {
+    return 0;
+  }
+  for (seg = pcb->ooseq; seg != NULL && n == 0; ) {
+    seg = tcp_sack_run(seg, &left, &right);
+    if (TCP_SEQ_BETWEEN(pcb->ooseq_last, left, right - 1)) {
+      edges[0] = left;
+      edges[1] = right;
+      n = 1;
+    }
+  }
+  for (seg = pcb->ooseq; seg != NULL && n < max; ) {
+    seg = tcp_sack_run(seg, &left, &right);
+    if (n == 0 || left != edges[0]) {
+      edges[2 * n] = left;
+      edges[2 * n + 1] = right;
+      n++;
+    }
+  }
+  return n;
+}
+
+/**
+ * Build a SACK option of n blocks at the specified options pointer
+ */
+static void
+tcp_build_sack_option(u32_t *opts, u32_t *edges, u8_t n)
+{
+  u8_t i;
+
+  /* Pad with two NOP options to keep the blocks aligned */
+  opts[0] = htonl(0x01010500 | (2 + 8 * n));
+  for (i = 0; i < 2 * n; i++) {
+    opts[1 + i] = htonl(edges[i]);
+  }
+}
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+
 /**
  * Called by tcp_close() to send a segment including flags but not data.
  *
@@ -69,8 +196,8 @@ static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
 err_t
 tcp_send_ctrl(struct tcp_pcb *pcb, u8_t flags)
 {
-  /* no data, no length, flags, copy=1, no optdata, no optdatalen */
-  return tcp_enqueue(pcb, NULL, 0, flags, TCP_WRITE_FLAG_COPY, NULL, 0);
+  /* no data, no length, flags, copy=1, no options */
+  return tcp_enqueue(pcb, NULL, 0, flags, TCP_WRITE_FLAG_COPY, 0);
 }
 
 /**
@@ -102,7 +229,7 @@ tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags)
      pcb->state == SYN_SENT ||
      pcb->state == SYN_RCVD) {
     if (len > 0) {
-      return tcp_enqueue(pcb, (void *)data, len, 0, apiflags, NULL, 0);
+      return tcp_enqueue(pcb, (void *)data, len, 0, apiflags, 0);
     }
     return ERR_OK;
   } else {
@@ -112,7 +239,7 @@ tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags)
 }
 
 /**
- * Enqueue either data or TCP options (but not both) for tranmission
+ * Enqueue data and/or TCP options for tranmission
  *
  * Called by tcp_connect(), tcp_listen_input(), tcp_send_ctrl() and tcp_write().
  *
@@ -123,13 +250,14 @@ tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags)
  * @param apiflags combination of following flags :
  * - TCP_WRITE_FLAG_COPY (0x01) data will be copied into memory belonging to the stack
  * - TCP_WRITE_FLAG_MORE (0x02) for TCP connection, PSH flag will be set on last segment sent,
- * @param optdata
- * @param optlen
+ * @param optflags options to include in the segment header (TF_SEG_OPTS_xxx);
+ *        the timestamp option is added to every segment once it has been
+ *        agreed on.  The options themselves are filled in when the segment
+ *        is sent, by tcp_output_segment().
  */
 err_t
 tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
-  u8_t flags, u8_t apiflags,
-  u8_t *optdata, u8_t optlen)
+  u8_t flags, u8_t apiflags, u8_t optflags)
 {
   struct pbuf *p;
   struct tcp_seg *seg, *useg, *queue;
@@ -137,16 +265,26 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
   u16_t left, seglen;
   void *ptr;
   u16_t queuelen;
+  u8_t optlen;
 
   LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue(pcb=%p, arg=%p, len=%"U16_F", flags=%"X16_F", apiflags=%"U16_F")\n",
     (void *)pcb, arg, len, (u16_t)flags, (u16_t)apiflags));
-  LWIP_ERROR("tcp_enqueue: len == 0 || optlen == 0 (programmer violates API)",
-      ((len == 0) || (optlen == 0)), return ERR_ARG;);
-  LWIP_ERROR("tcp_enqueue: arg == NULL || optdata == NULL (programmer violates API)",
-      ((arg == NULL) || (optdata == NULL)), return ERR_ARG;);
+  LWIP_ERROR("tcp_enqueue: packet needs payload, options, or SYN/FIN (programmer violates API)",
+      ((len != 0) || (optflags != 0) || ((flags & (TCP_SYN | TCP_FIN)) != 0)),
+      return ERR_ARG;);
+#if LWIP_TCP_TIMESTAMPS
+  if (pcb->flags & TF_TIMESTAMP) {
+    optflags |= TF_SEG_OPTS_TS;
+  }
+#endif /* LWIP_TCP_TIMESTAMPS */
+  optlen = LWIP_TCP_OPT_LENGTH(optflags);
+  /* tcp_parseopt keeps the MSS above TCP_MSS_MIN; without room for the
+     options seglen below would wrap */
+  LWIP_ERROR("tcp_enqueue: options do not fit in the MSS",
+      optlen < pcb->mss, return ERR_VAL;);
   /* fail on too much data */
-  if (len > pcb->snd_buf) {
-    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_enqueue: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n", len, pcb->snd_buf));
+  if (len > tcp_sndbuf(pcb)) {
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_enqueue: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n", len, tcp_sndbuf(pcb)));
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
   }
@@ -183,9 +321,9 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
   seglen = 0;
   while (queue == NULL || left > 0) {
 
-    /* The segment length should be the MSS if the data to be enqueued
-     * is larger than the MSS. */
-    seglen = left > pcb->mss? pcb->mss: left;
+    /* The segment length (including options) should be the MSS if the
+     * data to be enqueued is larger than the MSS. */
+    seglen = left > (pcb->mss - optlen) ? (pcb->mss - optlen) : left;
 
     /* Allocate memory for tcp_seg, and fill in fields. */
     seg = memp_malloc(MEMP_TCP_SEG);
@@ -195,6 +333,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     }
     seg->next = NULL;
     seg->p = NULL;
+    seg->flags = optflags;
 
     /* first segment of to-be-queued data? */
     if (queue == NULL) {
@@ -211,32 +350,22 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
 
     /* If copy is set, memory should be allocated
      * and data copied into pbuf, otherwise data comes from
-     * ROM or other static memory, and need not be copied. If
-     * optdata is != NULL, we have options instead of data. */
-     
-    /* options? */
-    if (optdata != NULL) {
-      if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM)) == NULL) {
-        goto memerr;
-      }
-      LWIP_ASSERT("check that first pbuf can hold optlen",
-                  (seg->p->len >= optlen));
-      queuelen += pbuf_clen(seg->p);
-      seg->dataptr = seg->p->payload;
-    }
-    /* copy from volatile memory? */
-    else if (apiflags & TCP_WRITE_FLAG_COPY) {
-      if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_RAM)) == NULL) {
+     * ROM or other static memory, and need not be copied.
+     * Room for the options is left in front of the data. */
+
+    /* copy from volatile memory, or no data at all? */
+    if (arg == NULL || (apiflags & TCP_WRITE_FLAG_COPY)) {
+      if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, seglen + optlen, PBUF_RAM)) == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_enqueue : could not allocate memory for pbuf copy size %"U16_F"\n", seglen));
         goto memerr;
       }
       LWIP_ASSERT("check that first pbuf can hold the complete seglen",
-                  (seg->p->len >= seglen));
+                  (seg->p->len >= seglen + optlen));
       queuelen += pbuf_clen(seg->p);
+      seg->dataptr = (u8_t *)seg->p->payload + optlen;
       if (arg != NULL) {
-        MEMCPY(seg->p->payload, ptr, seglen);
+        MEMCPY(seg->dataptr, ptr, seglen);
       }
-      seg->dataptr = seg->p->payload;
     }
     /* do not copy data */
     else {
@@ -254,8 +383,8 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       p->payload = ptr;
       seg->dataptr = ptr;
 
-      /* Second, allocate a pbuf for the headers. */
-      if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM)) == NULL) {
+      /* Second, allocate a pbuf for the headers and options. */
+      if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM)) == NULL) {
         /* If allocation fails, we have to deallocate the data pbuf as
          * well. */
         pbuf_free(p);
@@ -292,17 +421,9 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     TCPH_FLAGS_SET(seg->tcphdr, flags);
     /* don't fill in tcphdr->ackno and tcphdr->wnd until later */
 
-    /* Copy the options into the header, if they are present. */
-    if (optdata == NULL) {
-      TCPH_HDRLEN_SET(seg->tcphdr, 5);
-    }
-    else {
-      TCPH_HDRLEN_SET(seg->tcphdr, (5 + optlen / 4));
-      /* Copy options into data portion of segment.
-       Options can thus only be sent in non data carrying
-       segments such as SYN|ACK. */
-      SMEMCPY(seg->dataptr, optdata, optlen);
-    }
+    /* The options follow the header; tcp_output_segment() fills
+       them in. */
+    TCPH_HDRLEN_SET(seg->tcphdr, (5 + optlen / 4));
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_TRACE, ("tcp_enqueue: queueing %"U32_F":%"U32_F" (0x%"X16_F")\n",
       ntohl(seg->tcphdr->seqno),
       ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg),
@@ -330,10 +451,12 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     TCP_TCPLEN(useg) != 0 &&
     !(TCPH_FLAGS(useg->tcphdr) & (TCP_SYN | TCP_FIN)) &&
     !(flags & (TCP_SYN | TCP_FIN)) &&
+    /* the same options in both */
+    (useg->flags & TF_SEG_OPTS) == (queue->flags & TF_SEG_OPTS) &&
     /* fit within max seg size */
-    useg->len + queue->len <= pcb->mss) {
-    /* Remove TCP header from first segment of our to-be-queued list */
-    if(pbuf_header(queue->p, -TCP_HLEN)) {
+    useg->len + queue->len + optlen <= pcb->mss) {
+    /* Remove TCP header and options from first segment of our to-be-queued list */
+    if(pbuf_header(queue->p, -(TCP_HLEN + optlen))) {
       /* Can we cope with this failing?  Just assert for now */
       LWIP_ASSERT("pbuf_header failed\n", 0);
       TCP_STATS_INC(tcp.err);
@@ -414,6 +537,11 @@ tcp_output(struct tcp_pcb *pcb)
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
   u32_t wnd;
+  u8_t optlen;
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+  u32_t sack[2 * LWIP_TCP_SACK_MAX_BLOCKS];
+  u8_t nsack;
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
@@ -445,7 +573,13 @@ tcp_output(struct tcp_pcb *pcb)
   if (pcb->flags & TF_ACK_NOW &&
      (seg == NULL ||
       ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd)) {
-    p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+    optlen = tcp_ctrl_optlen(pcb);
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+    /* at most three blocks fit beside a timestamp */
+    nsack = tcp_sack_blocks(pcb, sack, optlen > 0 ? 3 : LWIP_TCP_SACK_MAX_BLOCKS);
+    optlen += LWIP_TCP_OPT_LEN_SACK(nsack);
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+    p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen, PBUF_RAM);
     if (p == NULL) {
       LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
       return ERR_BUF;
@@ -460,9 +594,16 @@ tcp_output(struct tcp_pcb *pcb)
     tcphdr->seqno = htonl(pcb->snd_nxt);
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_FLAGS_SET(tcphdr, TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->urgp = 0;
-    TCPH_HDRLEN_SET(tcphdr, 5);
+    TCPH_HDRLEN_SET(tcphdr, (5 + optlen / 4));
+    tcp_build_ctrl_options(pcb, tcphdr);
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+    if (nsack > 0) {
+      tcp_build_sack_option((u32_t *)((u8_t *)(tcphdr + 1) + tcp_ctrl_optlen(pcb)),
+                            sack, nsack);
+    }
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 
     tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
@@ -497,13 +638,13 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* TCP_OUTPUT_DEBUG */
 #if TCP_CWND_DEBUG
   if (seg == NULL) {
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F
-                                 ", cwnd %"U16_F", wnd %"U32_F
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F
+                                 ", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                                  ", seg == NULL, ack %"U32_F"\n",
                                  pcb->snd_wnd, pcb->cwnd, wnd, pcb->lastack));
   } else {
     LWIP_DEBUGF(TCP_CWND_DEBUG, 
-                ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F
+                ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                  ", effwnd %"U32_F", seq %"U32_F", ack %"U32_F"\n",
                  pcb->snd_wnd, pcb->cwnd, wnd,
                  ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len,
@@ -527,7 +668,7 @@ tcp_output(struct tcp_pcb *pcb)
       break;
     }
 #if TCP_CWND_DEBUG
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
                             pcb->snd_wnd, pcb->cwnd, wnd,
                             ntohl(seg->tcphdr->seqno) + seg->len -
                             pcb->lastack,
@@ -598,6 +739,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 {
   u16_t len;
   struct netif *netif;
+  u32_t *opts;
 
   /** @bug Exclude retransmitted segments from this count. */
   snmp_inc_tcpoutsegs();
@@ -606,8 +748,38 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
    wnd fields remain. */
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
-  /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  /* advertise our receive window size in this TCP segment; the
+     window in a SYN segment is never scaled */
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
+
+  /* Add any requested options.  NB MSS and window scale options are
+     only set on SYN packets. */
+  opts = (u32_t *)(seg->tcphdr + 1);
+  if (seg->flags & TF_SEG_OPTS_MSS) {
+    *opts++ = TCP_BUILD_MSS_OPTION();
+  }
+#if LWIP_WND_SCALE
+  if (seg->flags & TF_SEG_OPTS_WND_SCALE) {
+    *opts++ = TCP_BUILD_WND_SCALE_OPTION();
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_TIMESTAMPS
+  pcb->ts_lastacksent = pcb->rcv_nxt;
+  if (seg->flags & TF_SEG_OPTS_TS) {
+    tcp_build_timestamp_option(pcb, opts);
+    opts += 3;
+  }
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+  if (seg->flags & TF_SEG_OPTS_SACK_PERM) {
+    /* two NOPs, then SACK permitted */
+    *opts++ = htonl(0x01010402);
+  }
+#endif /* LWIP_TCP_SACK */
 
   /* If we don't have a local IP address, we get one by
      calling ip_route(). */
@@ -642,10 +814,19 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
   seg->tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
+  netif = ip_route(&(pcb->remote_ip));
+  if (netif != NULL && (netif->flags & NETIF_FLAG_TXCSUM)) {
+    /* the netif sums the segment; it needs the pseudo header's sum */
+    seg->tcphdr->chksum = inet_chksum_pseudo_hdr(&(pcb->local_ip),
+             &(pcb->remote_ip), IP_PROTO_TCP, seg->p->tot_len);
+    seg->p->flags |= PBUF_FLAG_TXCSUM;
+  } else {
+    seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
              &(pcb->local_ip),
              &(pcb->remote_ip),
              IP_PROTO_TCP, seg->p->tot_len);
+    seg->p->flags &= ~PBUF_FLAG_TXCSUM;
+  }
 #endif
   TCP_STATS_INC(tcp.xmit);
 
@@ -707,7 +888,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_FLAGS_SET(tcphdr, TCP_RST | TCP_ACK);
-  tcphdr->wnd = htons(TCP_WND);
+  tcphdr->wnd = htons(TCPWND16(TCP_WND));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -740,6 +921,16 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
     return;
   }
 
+#if LWIP_TCP_SACK
+  /* After a timeout the remote side may have discarded what it SACKed
+     (RFC 2018, section 8): send everything again and leave recovery. */
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    seg->flags &= ~(TF_SEG_SACKED | TF_SEG_RXMIT);
+  }
+  pcb->sack_high = pcb->lastack;
+  pcb->flags &= ~TF_INFR;
+#endif /* LWIP_TCP_SACK */
+
   /* Move all unacked segments to the head of the unsent queue */
   for (seg = pcb->unacked; seg->next != NULL; seg = seg->next);
   /* concatenate unsent queue after unacked queue */
@@ -794,6 +985,26 @@ tcp_rexmit(struct tcp_pcb *pcb)
   tcp_output(pcb);
 }
 
+/**
+ * Retransmit one segment of the unacked queue, leaving it where it is
+ *
+ * Called by tcp_receive() to fill the holes the remote side reports
+ * during SACK recovery.
+ *
+ * @param pcb the tcp_pcb the segment belongs to
+ * @param seg the segment to retransmit
+ */
+void
+tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  seg->flags |= TF_SEG_RXMIT;
+  snmp_inc_tcpretranssegs();
+  tcp_output_segment(seg, pcb);
+
+  /* Don't take any rtt measurements after retransmitting. */
+  pcb->rttest = 0;
+}
+
 /**
  * Send keepalive packets to keep a connection active although
  * no data is sent over it.
@@ -807,6 +1018,7 @@ tcp_keepalive(struct tcp_pcb *pcb)
 {
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
+  u8_t optlen;
 
   LWIP_DEBUGF(TCP_DEBUG, ("tcp_keepalive: sending KEEPALIVE probe to %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
                           ip4_addr1(&pcb->remote_ip), ip4_addr2(&pcb->remote_ip),
@@ -815,7 +1027,8 @@ tcp_keepalive(struct tcp_pcb *pcb)
   LWIP_DEBUGF(TCP_DEBUG, ("tcp_keepalive: tcp_ticks %"U32_F"   pcb->tmr %"U32_F" pcb->keep_cnt_sent %"U16_F"\n", 
                           tcp_ticks, pcb->tmr, pcb->keep_cnt_sent));
    
-  p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+  optlen = tcp_ctrl_optlen(pcb);
+  p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen, PBUF_RAM);
    
   if(p == NULL) {
     LWIP_DEBUGF(TCP_DEBUG, 
@@ -831,9 +1044,10 @@ tcp_keepalive(struct tcp_pcb *pcb)
   tcphdr->seqno = htonl(pcb->snd_nxt - 1);
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
-  TCPH_HDRLEN_SET(tcphdr, 5);
+  TCPH_HDRLEN_SET(tcphdr, (5 + optlen / 4));
+  tcp_build_ctrl_options(pcb, tcphdr);
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
@@ -879,6 +1093,7 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg;
+  u8_t optlen;
 
   LWIP_DEBUGF(TCP_DEBUG, 
               ("tcp_zero_window_probe: sending ZERO WINDOW probe to %"
@@ -899,7 +1114,8 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   if(seg == NULL)
     return;
 
-  p = pbuf_alloc(PBUF_IP, TCP_HLEN + 1, PBUF_RAM);
+  optlen = tcp_ctrl_optlen(pcb);
+  p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen + 1, PBUF_RAM);
    
   if(p == NULL) {
     LWIP_DEBUGF(TCP_DEBUG, ("tcp_zero_window_probe: no memory for pbuf\n"));
@@ -914,12 +1130,13 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   tcphdr->seqno = seg->tcphdr->seqno;
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
-  TCPH_HDRLEN_SET(tcphdr, 5);
+  TCPH_HDRLEN_SET(tcphdr, (5 + optlen / 4));
+  tcp_build_ctrl_options(pcb, tcphdr);
 
   /* Copy in one byte from the head of the unacked queue */
-  *((char *)p->payload + sizeof(struct tcp_hdr)) = *(char *)seg->dataptr;
+  *((char *)p->payload + TCP_HLEN + optlen) = *(char *)seg->dataptr;
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
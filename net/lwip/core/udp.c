@@ -246,7 +246,7 @@ udp_input(struct pbuf *p, struct netif *inp)
 #endif /* LWIP_UDPLITE */
     {
 #if CHECKSUM_CHECK_UDP
-      if (udphdr->chksum != 0) {
+      if (udphdr->chksum != 0 && !(p->flags & PBUF_FLAG_RXCSUM_OK)) {
         if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
                                (struct ip_addr *)&(iphdr->dest),
                                IP_PROTO_UDP, p->tot_len) != 0) {
@@ -508,9 +508,16 @@ udp_sendto_if(struct udp_pcb *pcb, struct pbuf *p,
     /* calculate checksum */
 #if CHECKSUM_GEN_UDP
     if ((pcb->flags & UDP_FLAGS_NOCHKSUM) == 0) {
-      udphdr->chksum = inet_chksum_pseudo(q, src_ip, dst_ip, IP_PROTO_UDP, q->tot_len);
-      /* chksum zero must become 0xffff, as zero means 'no checksum' */
-      if (udphdr->chksum == 0x0000) udphdr->chksum = 0xffff;
+      if ((netif->flags & NETIF_FLAG_TXCSUM) && q->tot_len + IP_HLEN <= netif->mtu) {
+        /* the netif sums the datagram, unless it is to be fragmented;
+           it needs the pseudo header's sum */
+        udphdr->chksum = inet_chksum_pseudo_hdr(src_ip, dst_ip, IP_PROTO_UDP, q->tot_len);
+        q->flags |= PBUF_FLAG_TXCSUM;
+      } else {
+        udphdr->chksum = inet_chksum_pseudo(q, src_ip, dst_ip, IP_PROTO_UDP, q->tot_len);
+        /* chksum zero must become 0xffff, as zero means 'no checksum' */
+        if (udphdr->chksum == 0x0000) udphdr->chksum = 0xffff;
+      }
     }
 #endif /* CHECKSUM_CHECK_UDP */
     LWIP_DEBUGF(UDP_DEBUG, ("udp_send: UDP checksum 0x%04"X16_F"\n", udphdr->chksum));
@@ -49,6 +49,8 @@ u16_t inet_chksum_pseudo(struct pbuf *p,
 u16_t inet_chksum_pseudo_partial(struct pbuf *p,
        struct ip_addr *src, struct ip_addr *dest,
        u8_t proto, u16_t proto_len, u16_t chksum_len);
+u16_t inet_chksum_pseudo_hdr(struct ip_addr *src, struct ip_addr *dest,
+       u8_t proto, u16_t proto_len);
 
 #ifdef __cplusplus
 }
@@ -76,7 +76,8 @@ enum netconn_state {
   NETCONN_WRITE,
   NETCONN_LISTEN,
   NETCONN_CONNECT,
-  NETCONN_CLOSE
+  NETCONN_CLOSE,
+  NETCONN_SHUTWR
 };
 
 enum netconn_evt {
@@ -194,6 +195,7 @@ err_t             netconn_write   (struct netconn *conn,
                                    const void *dataptr, int size,
                                    u8_t apiflags);
 err_t             netconn_close   (struct netconn *conn);
+err_t             netconn_shutdown_tx(struct netconn *conn);
 
 #if LWIP_IGMP
 err_t             netconn_join_leave_group (struct netconn *conn,
@@ -64,9 +64,10 @@ typedef size_t mem_size_t;
 #else /* MEM_LIBC_MALLOC */
 
 /* MEM_SIZE would have to be aligned, but using 64000 here instead of
- * 65535 leaves some room for alignment...
+ * 65535 leaves some room for alignment...  Pools have no MEM_SIZE, and
+ * a pbuf of 64k plus its headers must not wrap.
  */
-#if MEM_SIZE > 64000l
+#if MEM_SIZE > 64000l || MEM_USE_POOLS
 typedef u32_t mem_size_t;
 #else
 typedef u16_t mem_size_t;
@@ -80,6 +80,9 @@ extern "C" {
 #define NETIF_FLAG_ETHARP       0x20U
 /** if set, the netif has IGMP capability */
 #define NETIF_FLAG_IGMP         0x40U
+/** if set, the netif fills in the IP and TCP or UDP checksums of packets
+ *  marked PBUF_FLAG_TXCSUM (set by the network interface driver) */
+#define NETIF_FLAG_TXCSUM       0x80U
 
 /** Generic data structure used for all lwIP network interfaces.
  *  The following fields should be filled in by the initialization
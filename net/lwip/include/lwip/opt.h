@@ -145,6 +145,15 @@
 #define MEM_USE_POOLS                   0
 #endif
 
+/**
+ * MEM_USE_POOLS_TRY_BIGGER_POOL==1: if one malloc-pool is empty, try the
+ * next bigger pool - WARNING: THIS MIGHT WASTE MEMORY but it can make a
+ * system more reliable.
+ */
+#ifndef MEM_USE_POOLS_TRY_BIGGER_POOL
+#define MEM_USE_POOLS_TRY_BIGGER_POOL   0
+#endif
+
 /**
  * MEMP_USE_CUSTOM_POOLS==1: whether to include a user file lwippools.h
  * that defines additional pools beyond the "standard" ones required
@@ -734,6 +743,39 @@
 #define TCP_SNDLOWAT                    (TCP_SND_BUF/2)
 #endif
 
+/**
+ * LWIP_WND_SCALE==1: Enable the RFC 1323 window scale option, so that
+ * TCP_WND may be larger than 64k.  The scale is only used when the remote
+ * side offers it too; otherwise the window is limited to 0xffff.
+ * TCP_RCV_SCALE is the shift we announce for our receive window; TCP_WND
+ * must not be larger than (0xffff << TCP_RCV_SCALE).
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#endif
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * LWIP_TCP_TIMESTAMPS==1: Enable the RFC 1323 timestamp option.  When the
+ * remote side agrees, every segment carries a timestamp and the
+ * round-trip time is measured from the echoed timestamps.
+ */
+#ifndef LWIP_TCP_TIMESTAMPS
+#define LWIP_TCP_TIMESTAMPS             0
+#endif
+
+/**
+ * LWIP_TCP_SACK==1: Enable selective acknowledgements (RFC 2018).  When
+ * the remote side agrees, our ACKs describe the out-of-sequence data we
+ * hold, and after a loss we retransmit the segments the remote side
+ * reports missing rather than only the first unacknowledged one.
+ */
+#ifndef LWIP_TCP_SACK
+#define LWIP_TCP_SACK                   0
+#endif
+
 /**
  * TCP_LISTEN_BACKLOG: Enable the backlog option for tcp listen pcb.
  */
@@ -789,6 +831,15 @@
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 #endif
 
+/**
+ * LWIP_SUPPORT_CUSTOM_PBUF==1: Support pbufs whose payload memory and
+ * struct belong to the caller (struct pbuf_custom), which a callback
+ * gets back when the last reference is freed.
+ */
+#ifndef LWIP_SUPPORT_CUSTOM_PBUF
+#define LWIP_SUPPORT_CUSTOM_PBUF        0
+#endif
+
 /*
    ------------------------------------------------
    ---------- Network Interfaces options ----------
@@ -1007,6 +1058,15 @@
 #define DEFAULT_THREAD_PRIO             1
 #endif
 
+/**
+ * SYS_ARCH_TIMEOUTS==1: The port provides sys_timeout() and
+ * sys_untimeout() and runs the timeouts of all threads itself, so
+ * sys_mbox_fetch() and sys_sem_wait() only wait.
+ */
+#ifndef SYS_ARCH_TIMEOUTS
+#define SYS_ARCH_TIMEOUTS               0
+#endif
+
 /**
  * DEFAULT_RAW_RECVMBOX_SIZE: The mailbox size for the incoming packets on a
  * NETCONN_RAW. The queue size value itself is platform-dependent, but is passed
@@ -1109,14 +1169,24 @@
 #endif
 
 /**
- * LWIP_SO_RCVBUF==1: Enable SO_RCVBUF processing.
+ * LWIP_SO_RCVBUF==1: Enable SO_RCVBUF processing.  For TCP it bounds the
+ * window a connection advertises, up to TCP_WND.
  */
 #ifndef LWIP_SO_RCVBUF
 #define LWIP_SO_RCVBUF                  0
 #endif
 
 /**
- * SO_REUSE==1: Enable SO_REUSEADDR and SO_REUSEPORT options. DO NOT USE!
+ * LWIP_SO_SNDBUF==1: Enable SO_SNDBUF processing for TCP: the most data a
+ * connection keeps queued, up to TCP_SND_BUF.
+ */
+#ifndef LWIP_SO_SNDBUF
+#define LWIP_SO_SNDBUF                  0
+#endif
+
+/**
+ * SO_REUSE==1: Enable the SO_REUSEADDR option, with which a TCP pcb may
+ * bind a port that connections in TIME-WAIT still hold.
  */
 #ifndef SO_REUSE
 #define SO_REUSE                        0
@@ -60,6 +60,14 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** the netif is to fill in this packet's IP and TCP or UDP checksums;
+ *  the latter's field holds the pseudo-header sum */
+#define PBUF_FLAG_TXCSUM 0x02U
+/** the netif verified this packet's IP and TCP or UDP checksums */
+#define PBUF_FLAG_RXCSUM_OK 0x04U
+/** this pbuf is a struct pbuf_custom: pbuf_free hands it back to its
+ *  owner's callback */
+#define PBUF_FLAG_IS_CUSTOM 0x08U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -95,10 +103,30 @@ struct pbuf {
   
 };
 
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/** Gets a custom pbuf back once nothing refers to it */
+typedef void (*pbuf_free_custom_fn)(struct pbuf *p);
+
+/** A pbuf whose struct and payload memory belong to the caller */
+struct pbuf_custom {
+  /** the pbuf itself; must come first */
+  struct pbuf pbuf;
+  /** called by pbuf_free in place of freeing the pbuf */
+  pbuf_free_custom_fn custom_free_function;
+  /** start of the payload memory, which pbuf_header may reveal again */
+  void *custom_mem;
+};
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
 #define pbuf_init()
 
 struct pbuf *pbuf_alloc(pbuf_layer l, u16_t size, pbuf_type type);
+#if LWIP_SUPPORT_CUSTOM_PBUF
+struct pbuf *pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type,
+                                 struct pbuf_custom *p, void *payload_mem,
+                                 u16_t payload_mem_len);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
 void pbuf_realloc(struct pbuf *p, u16_t size); 
 u8_t pbuf_header(struct pbuf *p, s16_t header_size);
 void pbuf_ref(struct pbuf *p);
@@ -74,7 +74,7 @@ struct sockaddr {
  */
 #define  SO_DEBUG       0x0001 /* Unimplemented: turn on debugging info recording */
 #define  SO_ACCEPTCONN  0x0002 /* socket has had listen() */
-#define  SO_REUSEADDR   0x0004 /* Unimplemented: allow local address reuse */
+#define  SO_REUSEADDR   0x0004 /* allow local address reuse */
 #define  SO_KEEPALIVE   0x0008 /* keep connections alive */
 #define  SO_DONTROUTE   0x0010 /* Unimplemented: just use interface addresses */
 #define  SO_BROADCAST   0x0020 /* Unimplemented: permit sending of broadcast msgs */
@@ -88,7 +88,7 @@ struct sockaddr {
 /*
  * Additional options, not kept in so_options.
  */
-#define SO_SNDBUF    0x1001    /* Unimplemented: send buffer size */
+#define SO_SNDBUF    0x1001    /* send buffer size */
 #define SO_RCVBUF    0x1002    /* receive buffer size */
 #define SO_SNDLOWAT  0x1003    /* Unimplemented: send low-water mark */
 #define SO_RCVLOWAT  0x1004    /* Unimplemented: receive low-water mark */
@@ -134,6 +134,11 @@ struct linger {
 #define MSG_DONTWAIT   0x08    /* Nonblocking i/o for this operation only */
 #define MSG_MORE       0x10    /* Sender will send more */
 
+/* Values of 'how' for shutdown */
+#define SHUT_RD        0       /* No more receptions: only the network server's receive ring stops */
+#define SHUT_WR        1       /* No more transmissions: sends a FIN, still receives */
+#define SHUT_RDWR      2       /* Both */
+
 
 /*
  * Options for level IPPROTO_IP
@@ -320,6 +325,7 @@ int lwip_socket(int domain, int type, int protocol);
 int lwip_write(int s, const void *dataptr, int size);
 int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
                 struct timeval *timeout);
+void lwip_select_wake(int s);
 int lwip_ioctl(int s, long cmd, void *argp);
 
 #if LWIP_COMPAT_SOCKETS
@@ -139,10 +139,9 @@ void sys_mbox_fetch(sys_mbox_t mbox, void **msg);
 /* Thread functions. */
 sys_thread_t sys_thread_new(char *name, void (* thread)(void *arg), void *arg, int stacksize, int prio);
 
-/* The following functions are used only in Unix code, and
-   can be omitted when porting the stack. */
-/* Returns the current time in microseconds. */
-unsigned long sys_now(void);
+/* Returns the current time in milliseconds; TCP timestamps are
+   taken from it. */
+u32_t sys_now(void);
 
 #endif /* NO_SYS */
 
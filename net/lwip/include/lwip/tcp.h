@@ -77,7 +77,13 @@ void             tcp_err     (struct tcp_pcb *pcb,
                               void (* err)(void *arg, err_t err));
 
 #define          tcp_mss(pcb)      ((pcb)->mss)
-#define          tcp_sndbuf(pcb)   ((pcb)->snd_buf)
+#if LWIP_SO_SNDBUF
+/* SO_SNDBUF leaves snd_buf_size of the TCP_SND_BUF bytes of snd_buf */
+#define          tcp_sndbuf(pcb)   (TCPWND16((pcb)->snd_buf + (pcb)->snd_buf_size > TCP_SND_BUF ? \
+                                             (pcb)->snd_buf + (pcb)->snd_buf_size - TCP_SND_BUF : 0))
+#else
+#define          tcp_sndbuf(pcb)   (TCPWND16((pcb)->snd_buf))
+#endif /* LWIP_SO_SNDBUF */
 
 #if TCP_LISTEN_BACKLOG
 #define          tcp_accepted(pcb) (((struct tcp_pcb_listen *)(pcb))->accepts_pending--)
@@ -98,6 +104,7 @@ struct tcp_pcb * tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog);
 
 void             tcp_abort   (struct tcp_pcb *pcb);
 err_t            tcp_close   (struct tcp_pcb *pcb);
+err_t            tcp_shutdown_tx(struct tcp_pcb *pcb);
 
 /* Flags for "apiflags" parameter in tcp_write and tcp_enqueue */
 #define TCP_WRITE_FLAG_COPY 0x01
@@ -107,6 +114,12 @@ err_t            tcp_write   (struct tcp_pcb *pcb, const void *dataptr, u16_t le
                               u8_t apiflags);
 
 void             tcp_setprio (struct tcp_pcb *pcb, u8_t prio);
+#if LWIP_SO_RCVBUF
+void             tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size);
+#endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+void             tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size);
+#endif /* LWIP_SO_SNDBUF */
 
 #define TCP_PRIO_MIN    1
 #define TCP_PRIO_NORMAL 64
@@ -144,6 +157,13 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
                                 (((u32_t)TCP_MSS / 256) << 8) | \
                                 (TCP_MSS & 255))
 
+/** This returns a TCP header option for our window scale in an u32_t,
+    preceded by a NOP to keep the following options aligned */
+#define TCP_BUILD_WND_SCALE_OPTION()  htonl(((u32_t)1 << 24) | \
+                                      ((u32_t)3 << 16) | \
+                                      ((u32_t)3 << 8) | \
+                                      (TCP_RCV_SCALE & 255))
+
 #define TCP_SEQ_LT(a,b)     ((s32_t)((a)-(b)) < 0)
 #define TCP_SEQ_LEQ(a,b)    ((s32_t)((a)-(b)) <= 0)
 #define TCP_SEQ_GT(a,b)     ((s32_t)((a)-(b)) > 0)
@@ -167,6 +187,57 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
 /* Length of the TCP header, excluding options. */
 #define TCP_HLEN 20
 
+/* Lengths of the options we send, with the NOPs that align them. */
+#define LWIP_TCP_OPT_LEN_MSS  4
+#if LWIP_WND_SCALE
+#define LWIP_TCP_OPT_LEN_WS   4
+#else
+#define LWIP_TCP_OPT_LEN_WS   0
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_TIMESTAMPS
+#define LWIP_TCP_OPT_LEN_TS   12
+#else
+#define LWIP_TCP_OPT_LEN_TS   0
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+#define LWIP_TCP_OPT_LEN_SACK_PERM 4
+#else
+#define LWIP_TCP_OPT_LEN_SACK_PERM 0
+#endif /* LWIP_TCP_SACK */
+/* A SACK option of n blocks; at most 4 fit, or 3 beside timestamps. */
+#define LWIP_TCP_OPT_LEN_SACK(n) ((n) > 0 ? 4 + 8 * (n) : 0)
+#define LWIP_TCP_SACK_MAX_BLOCKS 4
+
+/* The smallest MSS taken from a peer's SYN, so that a segment always has
+   room for data after our options. */
+#define TCP_MSS_MIN 64
+
+/* Window sizes are 32 bits wide once they may be scaled. */
+#if LWIP_WND_SCALE
+typedef u32_t tcpwnd_size_t;
+#define TCPWNDSIZE_F U32_F
+#define RCV_WND_SCALE(pcb, wnd) ((wnd) >> (pcb)->rcv_scale)
+#define SND_WND_SCALE(pcb, wnd) ((tcpwnd_size_t)(wnd) << (pcb)->snd_scale)
+#else
+typedef u16_t tcpwnd_size_t;
+#define TCPWNDSIZE_F U16_F
+#define RCV_WND_SCALE(pcb, wnd) (wnd)
+#define SND_WND_SCALE(pcb, wnd) (wnd)
+#endif /* LWIP_WND_SCALE */
+#define TCPWND16(x)             ((u16_t)LWIP_MIN((x), 0xffff))
+#if LWIP_WND_SCALE
+#define TCP_WND_LIMIT(pcb)      ((tcpwnd_size_t)(((pcb)->flags & TF_WND_SCALE) ? \
+                                                 TCP_WND : TCPWND16(TCP_WND)))
+#else
+#define TCP_WND_LIMIT(pcb)      TCP_WND
+#endif /* LWIP_WND_SCALE */
+#if LWIP_SO_RCVBUF
+/* SO_RCVBUF lowers the largest window to rcv_buf_size */
+#define TCP_WND_MAX(pcb)        ((tcpwnd_size_t)LWIP_MIN(TCP_WND_LIMIT(pcb), (pcb)->rcv_buf_size))
+#else
+#define TCP_WND_MAX(pcb)        TCP_WND_LIMIT(pcb)
+#endif /* LWIP_SO_RCVBUF */
+
 #ifndef TCP_TMR_INTERVAL
 #define TCP_TMR_INTERVAL       250  /* The TCP timer interval in milliseconds. */
 #endif /* TCP_TMR_INTERVAL */
@@ -252,6 +323,8 @@ enum tcp_state {
   TIME_WAIT   = 10
 };
 
+typedef u16_t tcpflags_t;
+
 /** Flags used on input processing, not on pcb->flags
 */
 #define TF_RESET     (u8_t)0x08U   /* Connection was reset. */
@@ -261,13 +334,28 @@ enum tcp_state {
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
+/* Buffer sizes set with SO_RCVBUF and SO_SNDBUF, which a listening
+   pcb passes on to the connections it accepts */
+#if LWIP_SO_RCVBUF
+#define TCP_PCB_RCVBUF ;tcpwnd_size_t rcv_buf_size
+#else
+#define TCP_PCB_RCVBUF
+#endif /* LWIP_SO_RCVBUF */
+#if LWIP_SO_SNDBUF
+#define TCP_PCB_SNDBUF ;tcpwnd_size_t snd_buf_size
+#else
+#define TCP_PCB_SNDBUF
+#endif /* LWIP_SO_SNDBUF */
+
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
   void *callback_arg; \
   /* ports are in host byte order */ \
-  u16_t local_port
+  u16_t local_port \
+  TCP_PCB_RCVBUF \
+  TCP_PCB_SNDBUF
 
 /* the TCP protocol control block */
 struct tcp_pcb {
@@ -279,20 +367,24 @@ struct tcp_pcb {
   /* ports are in host byte order */
   u16_t remote_port;
   
-  u8_t flags;
-#define TF_ACK_DELAY   (u8_t)0x01U   /* Delayed ACK. */
-#define TF_ACK_NOW     (u8_t)0x02U   /* Immediate ACK. */
-#define TF_INFR        (u8_t)0x04U   /* In fast recovery. */
-#define TF_FIN         (u8_t)0x20U   /* Connection was closed locally (FIN segment enqueued). */
-#define TF_NODELAY     (u8_t)0x40U   /* Disable Nagle algorithm */
-#define TF_NAGLEMEMERR (u8_t)0x80U /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+  tcpflags_t flags;
+#define TF_ACK_DELAY   (tcpflags_t)0x01U   /* Delayed ACK. */
+#define TF_ACK_NOW     (tcpflags_t)0x02U   /* Immediate ACK. */
+#define TF_INFR        (tcpflags_t)0x04U   /* In fast recovery. */
+#define TF_TIMESTAMP   (tcpflags_t)0x08U   /* Timestamp option enabled */
+#define TF_WND_SCALE   (tcpflags_t)0x10U   /* Window scale option enabled */
+#define TF_FIN         (tcpflags_t)0x20U   /* Connection was closed locally (FIN segment enqueued). */
+#define TF_NODELAY     (tcpflags_t)0x40U   /* Disable Nagle algorithm */
+#define TF_NAGLEMEMERR (tcpflags_t)0x80U /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+#define TF_SACK        (tcpflags_t)0x0100U /* SACK option enabled */
+#define TF_SHUTWR      (tcpflags_t)0x0200U /* FIN sent by tcp_shutdown_tx, still receiving */
 
   /* the rest of the fields are in host byte order
      as we have to do some math with them */
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window */
-  u16_t rcv_ann_wnd; /* announced receive window */
+  tcpwnd_size_t rcv_wnd;   /* receiver window */
+  tcpwnd_size_t rcv_ann_wnd; /* announced receive window */
 
   /* Timers */
   u32_t tmr;
@@ -316,20 +408,20 @@ struct tcp_pcb {
   u8_t dupacks;
   
   /* congestion avoidance/control variables */
-  u16_t cwnd;  
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;
+  tcpwnd_size_t ssthresh;
 
   /* sender variables */
   u32_t snd_nxt,   /* next seqno to be sent */
     snd_max;       /* Highest seqno sent. */
-  u16_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd;   /* sender window */
   u32_t snd_wl1, snd_wl2, /* Sequence and acknowledgement numbers of last
                              window update. */
     snd_lbb;       /* Sequence number of next byte to be buffered. */
 
-  u16_t acked;
+  tcpwnd_size_t acked;
   
-  u16_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffff-3)
   u16_t snd_queuelen; /* Available buffer space for sending (in tcp_segs). */
   
@@ -412,6 +504,22 @@ struct tcp_pcb {
 
   /* KEEPALIVE counter */
   u8_t keep_cnt_sent;
+
+#if LWIP_WND_SCALE
+  u8_t snd_scale;   /* shift applied to windows the remote side announces */
+  u8_t rcv_scale;   /* shift applied to windows we announce */
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_TIMESTAMPS
+  u32_t ts_lastacksent; /* rcv_nxt when we last sent an ACK */
+  u32_t ts_recent;      /* timestamp to echo to the remote side */
+#endif /* LWIP_TCP_TIMESTAMPS */
+#if LWIP_TCP_SACK
+  u32_t recover;    /* snd_max when fast recovery began */
+  u32_t sack_high;  /* highest sequence number the remote side has SACKed */
+#if TCP_QUEUE_OOSEQ
+  u32_t ooseq_last; /* seqno of the out-of-sequence segment received last */
+#endif /* TCP_QUEUE_OOSEQ */
+#endif /* LWIP_TCP_SACK */
 };
 
 struct tcp_pcb_listen {  
@@ -494,9 +602,23 @@ struct tcp_seg {
   struct pbuf *p;          /* buffer containing data + TCP header */
   void *dataptr;           /* pointer to the TCP data in the pbuf */
   u16_t len;               /* the TCP length of this segment */
+  u8_t flags;
+#define TF_SEG_OPTS_MSS       (u8_t)0x01U /* Include MSS option. */
+#define TF_SEG_OPTS_WND_SCALE (u8_t)0x02U /* Include window scale option. */
+#define TF_SEG_OPTS_TS        (u8_t)0x04U /* Include timestamp option. */
+#define TF_SEG_OPTS_SACK_PERM (u8_t)0x08U /* Include SACK permitted option. */
+#define TF_SEG_OPTS           (u8_t)0x0fU /* All of the above. */
+#define TF_SEG_SACKED         (u8_t)0x40U /* SACKed by the remote side. */
+#define TF_SEG_RXMIT          (u8_t)0x80U /* Retransmitted in this SACK recovery. */
   struct tcp_hdr *tcphdr;  /* the TCP header */
 };
 
+#define LWIP_TCP_OPT_LENGTH(flags)                                       \
+  (((flags) & TF_SEG_OPTS_MSS ? LWIP_TCP_OPT_LEN_MSS : 0) +              \
+   ((flags) & TF_SEG_OPTS_WND_SCALE ? LWIP_TCP_OPT_LEN_WS : 0) +         \
+   ((flags) & TF_SEG_OPTS_TS ? LWIP_TCP_OPT_LEN_TS : 0) +                \
+   ((flags) & TF_SEG_OPTS_SACK_PERM ? LWIP_TCP_OPT_LEN_SACK_PERM : 0))
+
 /* Internal functions and global variables: */
 struct tcp_pcb *tcp_pcb_copy(struct tcp_pcb *pcb);
 void tcp_pcb_purge(struct tcp_pcb *pcb);
@@ -519,8 +641,7 @@ struct tcp_seg *tcp_seg_copy(struct tcp_seg *seg);
 
 err_t tcp_send_ctrl(struct tcp_pcb *pcb, u8_t flags);
 err_t tcp_enqueue(struct tcp_pcb *pcb, void *dataptr, u16_t len,
-    u8_t flags, u8_t apiflags,
-                u8_t *optdata, u8_t optlen);
+    u8_t flags, u8_t apiflags, u8_t optflags);
 
 void tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg);
 
@@ -47,10 +47,13 @@ extern "C" {
 #endif
 
 #if LWIP_TCPIP_CORE_LOCKING
+/* The port can provide its own lock */
+#ifndef LOCK_TCPIP_CORE
 /** The global semaphore to lock the stack. */
 extern sys_sem_t lock_tcpip_core;
 #define LOCK_TCPIP_CORE()     sys_sem_wait(lock_tcpip_core)
 #define UNLOCK_TCPIP_CORE()   sys_sem_signal(lock_tcpip_core)
+#endif /* LOCK_TCPIP_CORE */
 #define TCPIP_APIMSG(m)       tcpip_apimsg_lock(m)
 #define TCPIP_APIMSG_ACK(m)
 #define TCPIP_NETIFAPI(m)     tcpip_netifapi_lock(m)
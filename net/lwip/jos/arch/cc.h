@@ -18,6 +18,11 @@ typedef int8_t s8_t;
 
 typedef uintptr_t mem_ptr_t;
 
+// JOS has no <limits.h>; api_msg.c needs this for LWIP_SO_RCVBUF
+#ifndef INT_MAX
+#define INT_MAX	0x7fffffff
+#endif
+
 #define PACK_STRUCT_FIELD(x)	x
 #define PACK_STRUCT_STRUCT
 #define PACK_STRUCT_BEGIN
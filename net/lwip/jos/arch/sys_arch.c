@@ -6,23 +6,22 @@
 #include <arch/sys_arch.h>
 #include <arch/perror.h>
 #include <arch/thread.h>
+#include <arch/threadq.h>
 
 #define debug 0
 
 #define NSEM		256
 #define NMBOX		128
-#define MBOXSLOTS	32
+#define MBOX_MINSLOTS	8	// a mailbox doubles from here when full
 
+// Semaphores and mailboxes each keep the threads that block on them.
+// A post or signal wakes one; freeing one wakes them all, and they see
+// gen change.
 struct sys_sem_entry {
     int freed;
     int gen;
-    union {
-	uint32_t v;
-	struct {
-	    uint16_t counter;
-	    uint16_t waiters;
-	};
-    };
+    uint32_t counter;
+    struct thread_queue waiters;
     LIST_ENTRY(sys_sem_entry) link;
 };
 static struct sys_sem_entry sems[NSEM];
@@ -30,23 +29,29 @@ static LIST_HEAD(sem_list, sys_sem_entry) sem_free;
 
 struct sys_mbox_entry {
     int freed;
-    int head, nextq;
-    void *msg[MBOXSLOTS];
-    sys_sem_t queued_msg;
-    sys_sem_t free_msg;
+    int gen;
+    uint32_t head, count, size;
+    void **msg;
+    struct thread_queue waiters;
     LIST_ENTRY(sys_mbox_entry) link;
 };
 static struct sys_mbox_entry mboxes[NMBOX];
 static LIST_HEAD(mbox_list, sys_mbox_entry) mbox_free;
 
-struct sys_thread {
-    thread_id_t tid;
-    struct sys_timeouts tmo;
-    LIST_ENTRY(sys_thread) link;
+// All threads' timeouts (SYS_ARCH_TIMEOUTS), in a heap ordered by
+// deadline.  timeouts_thread sleeps until the first one is due and runs
+// it under the core lock.
+struct sys_arch_timeo {
+    uint32_t when;	// sys_time_msec deadline
+    uint32_t seq;	// keeps timeouts with the same deadline in order
+    sys_timeout_handler h;
+    void *arg;
 };
+static struct sys_arch_timeo *timeo_heap;
+static uint32_t ntimeo, timeo_slots, timeo_seq;
+static struct thread_queue timeo_waiters;
 
-enum { thread_hash_size = 257 };
-static LIST_HEAD(thread_list, sys_thread) threads[thread_hash_size];
+static void timeouts_thread(uint32_t arg);
 
 void
 sys_init(void)
@@ -54,78 +59,125 @@ sys_init(void)
     int i = 0;
     for (i = 0; i < NSEM; i++) {
 	sems[i].freed = 1;
+	threadq_init(&sems[i].waiters);
 	LIST_INSERT_HEAD(&sem_free, &sems[i], link);
     }
 
     for (i = 0; i < NMBOX; i++) {
 	mboxes[i].freed = 1;
+	threadq_init(&mboxes[i].waiters);
 	LIST_INSERT_HEAD(&mbox_free, &mboxes[i], link);
     }
+
+    int r = thread_create(0, "lwip timeouts", timeouts_thread, 0);
+    if (r < 0)
+	panic("lwip: sys_init: cannot create timeout thread: %s", e2s(r));
+}
+
+// Sleep on wq until *count is nonzero, for at most tm_msec (0 for
+// ever).  Returns the msec waited, or SYS_ARCH_TIMEOUT if the time ran
+// out or the object was freed, which *gen shows.
+static u32_t
+sys_arch_wait(struct thread_queue *wq, volatile uint32_t *count,
+	      volatile int *gen, u32_t tm_msec)
+{
+    if (*count > 0)
+	return 0;
+    if (tm_msec == SYS_ARCH_NOWAIT)
+	return SYS_ARCH_TIMEOUT;
+
+    int g = *gen;
+    uint32_t start = sys_time_msec();
+    uint32_t until = tm_msec ? start + tm_msec : ~0;
+
+    while (*count == 0) {
+	// lwIP lets go of the core lock itself where it has to
+	if (thread_sleep(wq, until))
+	    return SYS_ARCH_TIMEOUT;
+	if (g != *gen) {
+	    cprintf("sys_arch_wait: freed under waiter!\n");
+	    return SYS_ARCH_TIMEOUT;
+	}
+    }
+    return sys_time_msec() - start;
 }
 
 sys_mbox_t
 sys_mbox_new(int size)
 {
-    assert(size < MBOXSLOTS);
     struct sys_mbox_entry *mbe = LIST_FIRST(&mbox_free);
     if (!mbe) {
 	cprintf("lwip: sys_mbox_new: out of mailboxes\n");
 	return SYS_MBOX_NULL;
     }
-    LIST_REMOVE(mbe, link);
-    assert(mbe->freed);
-    mbe->freed = 0;
 
-    int i = mbe - &mboxes[0];
-    mbe->head = -1;
-    mbe->nextq = 0;
-    mbe->queued_msg = sys_sem_new(0);
-    mbe->free_msg = sys_sem_new(MBOXSLOTS);
-
-    if (mbe->queued_msg == SYS_SEM_NULL ||
-	mbe->free_msg == SYS_SEM_NULL)
-    {
-	sys_mbox_free(i);
-	cprintf("lwip: sys_mbox_new: can't get semaphore\n");
+    size = MAX(size, MBOX_MINSLOTS);
+    mbe->msg = malloc(size * sizeof(void *));
+    if (!mbe->msg) {
+	cprintf("lwip: sys_mbox_new: cannot allocate %d slots\n", size);
 	return SYS_MBOX_NULL;
     }
-    return i;
+    LIST_REMOVE(mbe, link);
+    assert(mbe->freed);
+    mbe->freed = 0;
+    mbe->gen++;
+    mbe->head = 0;
+    mbe->count = 0;
+    mbe->size = size;
+    return mbe - &mboxes[0];
 }
 
 void
 sys_mbox_free(sys_mbox_t mbox)
 {
-    assert(!mboxes[mbox].freed);
-    sys_sem_free(mboxes[mbox].queued_msg);
-    sys_sem_free(mboxes[mbox].free_msg);
-    LIST_INSERT_HEAD(&mbox_free, &mboxes[mbox], link);
-    mboxes[mbox].freed = 1;
+    struct sys_mbox_entry *mbe = &mboxes[mbox];
+
+    assert(!mbe->freed);
+    mbe->freed = 1;
+    mbe->gen++;
+    thread_wakeup_all(&mbe->waiters);
+    free(mbe->msg);
+    mbe->msg = 0;
+    LIST_INSERT_HEAD(&mbox_free, mbe, link);
+}
+
+// Double a full mailbox's slots, keeping its messages in order.
+static int
+mbox_grow(struct sys_mbox_entry *mbe)
+{
+    void **msg = malloc(2 * mbe->size * sizeof(void *));
+    uint32_t i;
+
+    if (!msg)
+	return -E_NO_MEM;
+    for (i = 0; i < mbe->count; i++)
+	msg[i] = mbe->msg[(mbe->head + i) % mbe->size];
+    free(mbe->msg);
+    mbe->msg = msg;
+    mbe->head = 0;
+    mbe->size *= 2;
+    return 0;
 }
 
 void
 sys_mbox_post(sys_mbox_t mbox, void *msg)
 {
-    assert(sys_mbox_trypost(mbox, msg) == ERR_OK);
+    if (sys_mbox_trypost(mbox, msg) != ERR_OK)
+	panic("lwip: sys_mbox_post: cannot grow mailbox %d", mbox);
 }
 
 err_t 
 sys_mbox_trypost(sys_mbox_t mbox, void *msg)
 {
-    assert(!mboxes[mbox].freed);
+    struct sys_mbox_entry *mbe = &mboxes[mbox];
 
-    sys_arch_sem_wait(mboxes[mbox].free_msg, 0);
-    if (mboxes[mbox].nextq == mboxes[mbox].head)
+    assert(!mbe->freed);
+    if (mbe->count == mbe->size && mbox_grow(mbe) < 0)
 	return ERR_MEM;
 
-    int slot = mboxes[mbox].nextq;
-    mboxes[mbox].nextq = (slot + 1) % MBOXSLOTS;
-    mboxes[mbox].msg[slot] = msg;
-
-    if (mboxes[mbox].head == -1)
-	mboxes[mbox].head = slot;
-
-    sys_sem_signal(mboxes[mbox].queued_msg);
-
+    mbe->msg[(mbe->head + mbe->count) % mbe->size] = msg;
+    mbe->count++;
+    thread_wakeup_one(&mbe->waiters);
     return ERR_OK;
 }
 
@@ -152,6 +204,7 @@ sys_sem_free(sys_sem_t sem)
     assert(!sems[sem].freed);
     sems[sem].freed = 1;
     sems[sem].gen++;
+    thread_wakeup_all(&sems[sem].waiters);
     LIST_INSERT_HEAD(&sem_free, &sems[sem], link);
 }
 
@@ -160,66 +213,35 @@ sys_sem_signal(sys_sem_t sem)
 {
     assert(!sems[sem].freed);
     sems[sem].counter++;
-    if (sems[sem].waiters) {
-	sems[sem].waiters = 0;
-	thread_wakeup(&sems[sem].v);
-    }
+    thread_wakeup_one(&sems[sem].waiters);
 }
 
 u32_t
 sys_arch_sem_wait(sys_sem_t sem, u32_t tm_msec)
 {
-    assert(!sems[sem].freed);
-    u32_t waited = 0;
+    struct sys_sem_entry *se = &sems[sem];
 
-    int gen = sems[sem].gen;
-
-    while (tm_msec == 0 || waited < tm_msec) {
-	if (sems[sem].counter > 0) {
-	    sems[sem].counter--;
-	    return waited;
- 	} else if (tm_msec == SYS_ARCH_NOWAIT) {
-	    return SYS_ARCH_TIMEOUT;
-	} else {
-	    uint32_t a = sys_time_msec();
-	    uint32_t sleep_until = tm_msec ? a + (tm_msec - waited) : ~0;
-	    sems[sem].waiters = 1;
-	    uint32_t cur_v = sems[sem].v;
-	    lwip_core_unlock();
-	    thread_wait(&sems[sem].v, cur_v, sleep_until);
-	    lwip_core_lock();
-	    if (gen != sems[sem].gen) {
-		cprintf("sys_arch_sem_wait: sem freed under waiter!\n");
-		return SYS_ARCH_TIMEOUT;
-	    }
-	    uint32_t b = sys_time_msec();
-	    waited += (b - a);
-	}
-    }
-
-    return SYS_ARCH_TIMEOUT;
+    assert(!se->freed);
+    u32_t waited = sys_arch_wait(&se->waiters, &se->counter, &se->gen, tm_msec);
+    if (waited != SYS_ARCH_TIMEOUT)
+	se->counter--;
+    return waited;
 }
 
 u32_t
 sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, u32_t tm_msec)
 {
-    assert(!mboxes[mbox].freed);
+    struct sys_mbox_entry *mbe = &mboxes[mbox];
 
-    u32_t waited = sys_arch_sem_wait(mboxes[mbox].queued_msg, tm_msec);
+    assert(!mbe->freed);
+    u32_t waited = sys_arch_wait(&mbe->waiters, &mbe->count, &mbe->gen, tm_msec);
     if (waited == SYS_ARCH_TIMEOUT)
 	return waited;
 
-    int slot = mboxes[mbox].head;
-    if (slot == -1)
-	panic("lwip: sys_arch_mbox_fetch: no message");
     if (msg)
-	*msg = mboxes[mbox].msg[slot];
-
-    mboxes[mbox].head = (slot + 1) % MBOXSLOTS;
-    if (mboxes[mbox].head == mboxes[mbox].nextq)
-	mboxes[mbox].head = -1;
-
-    sys_sem_signal(mboxes[mbox].free_msg);
+	*msg = mbe->msg[mbe->head];
+    mbe->head = (mbe->head + 1) % mbe->size;
+    mbe->count--;
     return waited;
 }
 
@@ -238,9 +260,7 @@ static void
 lwip_thread_entry(uint32_t arg)
 {
     struct lwip_thread *lt = (struct lwip_thread *)arg;
-    lwip_core_lock();
     lt->func(lt->arg);
-    lwip_core_unlock();
     free(lt);
 }
 
@@ -267,56 +287,137 @@ sys_thread_new(char *name, void (* thread)(void *arg), void *arg,
     return tid;
 }
 
+u32_t
+sys_now(void)
+{
+    return sys_time_msec();
+}
+
+static int
+timeo_before(struct sys_arch_timeo *a, struct sys_arch_timeo *b)
+{
+    int32_t d = a->when - b->when;
+    return d < 0 || (d == 0 && (int32_t)(a->seq - b->seq) < 0);
+}
+
 static void
-timeout_cleanup(thread_id_t tid)
+timeo_swap(uint32_t i, uint32_t j)
 {
-    lwip_core_lock();
+    struct sys_arch_timeo t = timeo_heap[i];
+    timeo_heap[i] = timeo_heap[j];
+    timeo_heap[j] = t;
+}
 
-    struct sys_thread *t;
-    LIST_FOREACH(t, &threads[tid % thread_hash_size], link)
-	if (t->tid == tid) {
-	    LIST_REMOVE(t, link);
-	    free(t);
-	    goto done;
-	}
+// Move timeo_heap[i] up or down to its place; returns where it ends.
+static uint32_t
+timeo_fix(uint32_t i)
+{
+    uint32_t c;
+
+    while (i > 0 && timeo_before(&timeo_heap[i], &timeo_heap[(i - 1) / 2])) {
+	timeo_swap(i, (i - 1) / 2);
+	i = (i - 1) / 2;
+    }
+    while ((c = 2 * i + 1) < ntimeo) {
+	if (c + 1 < ntimeo && timeo_before(&timeo_heap[c + 1], &timeo_heap[c]))
+	    c++;
+	if (!timeo_before(&timeo_heap[c], &timeo_heap[i]))
+	    break;
+	timeo_swap(i, c);
+	i = c;
+    }
+    return i;
+}
 
-    if (debug) cprintf("timeout_cleanup: bogus tid %ld\n", tid);
- done:
-    lwip_core_unlock();
+static void
+timeo_remove(uint32_t i)
+{
+    if (i != --ntimeo) {
+	timeo_heap[i] = timeo_heap[ntimeo];
+	timeo_fix(i);
+    }
 }
 
-struct sys_timeouts *
-sys_arch_timeouts(void)
+void
+sys_timeout(u32_t msecs, sys_timeout_handler h, void *arg)
 {
-    thread_id_t tid = thread_id();
+    struct sys_arch_timeo *t;
+
+    if (ntimeo == timeo_slots) {
+	uint32_t slots = timeo_slots ? 2 * timeo_slots : MEMP_NUM_SYS_TIMEOUT;
+	if (!(t = malloc(slots * sizeof(*t))))
+	    panic("lwip: sys_timeout: cannot grow the timeout heap");
+	memmove(t, timeo_heap, ntimeo * sizeof(*t));
+	free(timeo_heap);
+	timeo_heap = t;
+	timeo_slots = slots;
+    }
 
-    struct sys_thread *t;
-    LIST_FOREACH(t, &threads[tid % thread_hash_size], link)
-	if (t->tid == tid)
-	    goto out;
+    t = &timeo_heap[ntimeo++];
+    t->when = sys_time_msec() + msecs;
+    t->seq = timeo_seq++;
+    t->h = h;
+    t->arg = arg;
+    // A new first deadline: timeouts_thread sleeps until the old one
+    if (timeo_fix(ntimeo - 1) == 0)
+	thread_wakeup_one(&timeo_waiters);
+}
 
-    t = malloc(sizeof(*t));
-    if (t == 0)
-	panic("sys_arch_timeouts: cannot malloc");
+// Cancel the timeout calling h(arg) that is due first.  If that was the
+// first deadline, timeouts_thread finds nothing due when it wakes and
+// goes back to sleep.
+void
+sys_untimeout(sys_timeout_handler h, void *arg)
+{
+    uint32_t i, found = ntimeo;
+
+    for (i = 0; i < ntimeo; i++)
+	if (timeo_heap[i].h == h && timeo_heap[i].arg == arg
+	    && (found == ntimeo || timeo_before(&timeo_heap[i], &timeo_heap[found])))
+	    found = i;
+    if (found < ntimeo)
+	timeo_remove(found);
+}
 
-    int r = thread_onhalt(timeout_cleanup);
-    if (r < 0)
-	panic("thread_onhalt failed: %s", e2s(r));
+static void
+timeouts_thread(uint32_t arg)
+{
+    struct sys_arch_timeo t;
 
-    t->tid = tid;
-    memset(&t->tmo, 0, sizeof(t->tmo));
-    LIST_INSERT_HEAD(&threads[tid % thread_hash_size], t, link);
+    lwip_core_lock();
+    for (;;) {
+	if (ntimeo == 0 || (int32_t)(timeo_heap[0].when - sys_time_msec()) > 0) {
+	    uint32_t until = ntimeo ? timeo_heap[0].when : ~0;
+	    lwip_core_unlock();
+	    thread_sleep(&timeo_waiters, until);
+	    lwip_core_lock();
+	    continue;
+	}
 
-out:
-    return &t->tmo;
+	t = timeo_heap[0];
+	timeo_remove(0);
+	t.h(t.arg);
+    }
 }
 
+// The core lock (LOCK_TCPIP_CORE).  Threads only switch when they
+// block, so all it keeps out is other threads while its holder blocks,
+// e.g. tcpip_thread posting to a full mbox.  tcpip_thread holds it
+// except while it waits for messages.
+static int core_locked;
+static struct thread_queue core_waiters;
+
 void
 lwip_core_lock(void)
 {
+    while (core_locked)
+	thread_sleep(&core_waiters, (uint32_t)~0);
+    core_locked = 1;
 }
 
 void
 lwip_core_unlock(void)
 {
+    core_locked = 0;
+    thread_wakeup_one(&core_waiters);
 }
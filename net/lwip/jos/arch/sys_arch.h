@@ -14,6 +14,9 @@ void lwip_core_lock(void);
 void lwip_core_unlock(void);
 void lwip_core_init(void);
 
+#define LOCK_TCPIP_CORE()	lwip_core_lock()
+#define UNLOCK_TCPIP_CORE()	lwip_core_unlock()
+
 #define SYS_ARCH_DECL_PROTECT(lev)
 #define SYS_ARCH_PROTECT(lev)
 #define SYS_ARCH_UNPROTECT(lev)
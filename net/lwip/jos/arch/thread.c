@@ -7,12 +7,27 @@
 static thread_id_t max_tid;
 static struct thread_context *cur_tc;
 
+// Threads that can run; the running thread is not on it.  A thread that
+// blocks is on at most one wait queue, and on the sleepers list, sorted
+// by deadline, if it blocks with one.
 static struct thread_queue thread_queue;
 static struct thread_queue kill_queue;
+static struct thread_context *sleepers;
+
+// Wait queues for thread_wait, hashed by address
+enum { wait_hash_size = 61 };
+static struct thread_queue wait_queues[wait_hash_size];
+
+static void thread_switch(void);
 
 void
 thread_init(void) {
+    int i;
+
     threadq_init(&thread_queue);
+    for (i = 0; i < wait_hash_size; i++)
+	threadq_init(&wait_queues[i]);
+    sleepers = 0;
     max_tid = 0;
 }
 
@@ -21,53 +36,140 @@ thread_id(void) {
     return cur_tc->tc_tid;
 }
 
+static struct thread_queue *
+wait_queue(volatile uint32_t *addr) {
+    return &wait_queues[((uintptr_t) addr >> 2) % wait_hash_size];
+}
+
+// Whether deadline 'until' has come at 'now'; ~0 never comes.
+static int
+deadline_passed(uint32_t until, uint32_t now) {
+    return until != (uint32_t)~0 && (int32_t)(until - now) <= 0;
+}
+
+// Make a blocked thread runnable again.
+static void
+thread_ready(struct thread_context *tc, int timedout) {
+    struct thread_context **pp;
+
+    if (tc->tc_waitq) {
+	threadq_remove(tc->tc_waitq, tc);
+	tc->tc_waitq = 0;
+    }
+    if (tc->tc_timed) {
+	for (pp = &sleepers; *pp != tc; pp = &(*pp)->tc_sleep_link)
+	    ;
+	*pp = tc->tc_sleep_link;
+	tc->tc_timed = 0;
+    }
+    tc->tc_wait_addr = 0;
+    tc->tc_timedout = timedout;
+    threadq_push(&thread_queue, tc);
+}
+
+// Wake the threads whose deadlines have passed.
+static void
+thread_expire(void) {
+    uint32_t now;
+
+    if (!sleepers)
+	return;
+    now = sys_time_msec();
+    while (sleepers && deadline_passed(sleepers->tc_deadline, now))
+	thread_ready(sleepers, 1);
+}
+
+// Block the running thread on wq, or only until the deadline if wq is
+// null, until it is woken or the absolute time 'until' (in msec, ~0
+// for never) passes.  Returns nonzero if the deadline passed.
+int
+thread_sleep(struct thread_queue *wq, uint32_t until) {
+    struct thread_context **pp;
+
+    if (deadline_passed(until, sys_time_msec()))
+	return 1;
+
+    if (wq) {
+	threadq_push(wq, cur_tc);
+	cur_tc->tc_waitq = wq;
+    }
+    if (until != (uint32_t)~0) {
+	for (pp = &sleepers; *pp; pp = &(*pp)->tc_sleep_link)
+	    if ((int32_t)(until - (*pp)->tc_deadline) < 0)
+		break;
+	cur_tc->tc_deadline = until;
+	cur_tc->tc_sleep_link = *pp;
+	*pp = cur_tc;
+	cur_tc->tc_timed = 1;
+    }
+    cur_tc->tc_timedout = 0;
+
+    thread_switch();
+    return cur_tc->tc_timedout;
+}
+
+// Wake the first thread on wq, if any; returns whether there was one.
+int
+thread_wakeup_one(struct thread_queue *wq) {
+    if (!wq->tq_first)
+	return 0;
+    thread_ready(wq->tq_first, 0);
+    return 1;
+}
+
+void
+thread_wakeup_all(struct thread_queue *wq) {
+    while (wq->tq_first)
+	thread_ready(wq->tq_first, 0);
+}
+
 void
 thread_wakeup(volatile uint32_t *addr) {
-    struct thread_context *tc = thread_queue.tq_first;
-    while (tc) {
+    struct thread_context *tc, *next;
+
+    for (tc = wait_queue(addr)->tq_first; tc; tc = next) {
+	next = tc->tc_queue_link;
 	if (tc->tc_wait_addr == addr)
-	    tc->tc_wakeup = 1;
-	tc = tc->tc_queue_link;
+	    thread_ready(tc, 0);
     }
 }
 
+// Block until *addr is not val and thread_wakeup(addr) is called, or
+// the absolute time msec passes.  With a null addr, only sleep.
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
-
-    cur_tc->tc_wait_addr = addr;
-    cur_tc->tc_wakeup = 0;
-
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
-	thread_yield();
-	p = sys_time_msec();
+    if (!addr) {
+	thread_sleep(0, msec);
+	return;
     }
+    if (*addr != val)
+	return;
 
+    cur_tc->tc_wait_addr = addr;
+    thread_sleep(wait_queue(addr), msec);
     cur_tc->tc_wait_addr = 0;
-    cur_tc->tc_wakeup = 0;
 }
 
+// How many threads besides the running one can run.
 int
 thread_wakeups_pending(void)
 {
-    struct thread_context *tc = thread_queue.tq_first;
+    struct thread_context *tc;
     int n = 0;
-    while (tc) {
-	if (tc->tc_wakeup)
-	    ++n;
-	tc = tc->tc_queue_link;
-    }
+
+    thread_expire();
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link)
+	++n;
     return n;
 }
 
+// The first deadline a sleeping thread has, or ~0 if none has one.
+uint32_t
+thread_next_deadline(void)
+{
+    return sleepers ? sleepers->tc_deadline : (uint32_t)~0;
+}
+
 int
 thread_onhalt(void (*fun)(thread_id_t)) {
     if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
@@ -153,29 +255,49 @@ thread_halt() {
 
     threadq_push(&kill_queue, cur_tc);
     cur_tc = NULL;
-    thread_yield();
-    // WHAT IF THERE ARE NO MORE THREADS? HOW DO WE STOP?
-    // when yield has no thread to run, it will return here!
+    thread_switch();
+    // thread_switch returns only when no thread is left to run
     exit();
 }
 
-void
-thread_yield(void) {
-    struct thread_context *next_tc = threadq_pop(&thread_queue);
-
-    if (!next_tc)
-	return;
-
-    if (cur_tc) {
-	if (jos_setjmp(&cur_tc->tc_jb) != 0)
+// Run the next runnable thread.  The running thread must already be
+// on the run queue, blocked, or halted.  With nothing to run but
+// threads sleeping until deadlines, spin until the first one passes.
+static void
+thread_switch(void) {
+    struct thread_context *next_tc;
+
+    while (!(next_tc = threadq_pop(&thread_queue))) {
+	if (!sleepers) {
+	    if (cur_tc)
+		panic("thread_switch: %s blocked with nothing to wake it",
+		      cur_tc->tc_name);
 	    return;
-	threadq_push(&thread_queue, cur_tc);
+	}
+	sys_yield();
+	thread_expire();
     }
 
+    if (next_tc == cur_tc)
+	return;
+    if (cur_tc && jos_setjmp(&cur_tc->tc_jb) != 0)
+	return;
+
     cur_tc = next_tc;
     jos_longjmp(&cur_tc->tc_jb, 1);
 }
 
+void
+thread_yield(void) {
+    thread_expire();
+    if (!thread_queue.tq_first)
+	return;
+
+    if (cur_tc)
+	threadq_push(&thread_queue, cur_tc);
+    thread_switch();
+}
+
 static void
 print_jb(struct thread_context *tc) {
     cprintf("jump buffer for thread %s:\n", tc->tc_name);
@@ -5,11 +5,17 @@
 
 typedef uint32_t thread_id_t;
 
+struct thread_queue;
+
 void thread_init(void);
 thread_id_t thread_id(void);
 void thread_wakeup(volatile uint32_t *addr);
 void thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec);
+int thread_sleep(struct thread_queue *wq, uint32_t msec);
+int thread_wakeup_one(struct thread_queue *wq);
+void thread_wakeup_all(struct thread_queue *wq);
 int thread_wakeups_pending(void);
+uint32_t thread_next_deadline(void);
 int thread_onhalt(void (*fun)(thread_id_t));
 int thread_create(thread_id_t *tid, const char *name, 
 		void (*entry)(uint32_t), uint32_t arg);
@@ -23,8 +23,12 @@ struct thread_context {
     void		(*tc_entry)(uint32_t);
     uint32_t		tc_arg;
     struct jos_jmp_buf	tc_jb;
-    volatile uint32_t	*tc_wait_addr;
-    volatile char	tc_wakeup;
+    volatile uint32_t	*tc_wait_addr;	// for thread_wait
+    struct thread_queue	*tc_waitq;	// queue it sleeps on, if any
+    uint32_t		tc_deadline;	// when it stops sleeping, if timed
+    char		tc_timed;	// on the deadline list
+    char		tc_timedout;
+    struct thread_context *tc_sleep_link;
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
     int			tc_nonhalt;
     struct thread_context *tc_queue_link;
@@ -50,6 +54,23 @@ threadq_push(struct thread_queue *tq, struct thread_context *tc)
     }
 }
 
+static inline void
+threadq_remove(struct thread_queue *tq, struct thread_context *tc)
+{
+    struct thread_context **pp = &tq->tq_first, *prev = 0;
+
+    while (*pp && *pp != tc) {
+	prev = *pp;
+	pp = &prev->tc_queue_link;
+    }
+    if (!*pp)
+	return;
+    *pp = tc->tc_queue_link;
+    if (tq->tq_last == tc)
+	tq->tq_last = prev;
+    tc->tc_queue_link = 0;
+}
+
 static inline struct thread_context *
 threadq_pop(struct thread_queue *tq)
 {
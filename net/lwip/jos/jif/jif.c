@@ -40,17 +40,91 @@
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
 #include "lwip/sys.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
 #include <lwip/stats.h>
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
-
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
+    struct Nstrain *train;
 };
 
+/*
+ * Loss and reordering, to exercise TCP's recovery: with JIF_DROP set
+ * to n, one IP frame in n is dropped in each direction, and with
+ * JIF_REORDER set to n, one in n is held back until the next one has
+ * passed, or for JIF_HOLD_MS if none comes, so that the last frame of
+ * a burst is late rather than lost.  The choice is pseudo-random from a
+ * fixed seed, so that runs repeat.  After 'make clean', try e.g.
+ *	LABDEFS='-DJIF_DROP=100 -DJIF_REORDER=50' sh grade-echobench.sh
+ */
+#ifndef JIF_DROP
+#define JIF_DROP	0
+#endif
+#ifndef JIF_REORDER
+#define JIF_REORDER	0
+#endif
+#ifndef JIF_HOLD_MS
+#define JIF_HOLD_MS	10
+#endif
+#define JIF_INJECT	(JIF_DROP || JIF_REORDER)
+
+#if JIF_INJECT
+enum { JIF_PASS, JIF_LOSE, JIF_DELAY };
+
+static uint32_t jif_seed = 6828;
+
+static uint32_t
+jif_rand(void)
+{
+    /* xorshift32 */
+    jif_seed ^= jif_seed << 13;
+    jif_seed ^= jif_seed >> 17;
+    jif_seed ^= jif_seed << 5;
+    return jif_seed;
+}
+
+/* What to do with the next IP frame in one direction; holding is set
+ * if that direction already holds a frame back. */
+static int
+jif_inject(int holding)
+{
+#if JIF_DROP
+    if (jif_rand() % JIF_DROP == 0)
+	return JIF_LOSE;
+#endif
+#if JIF_REORDER
+    if (!holding && jif_rand() % JIF_REORDER == 0)
+	return JIF_DELAY;
+#endif
+    return JIF_PASS;
+}
+
+/* The frames held back, one per direction */
+static struct pbuf *jif_rx_held, *jif_tx_held;
+static int jif_held_pending;
+
+static void jif_held_tmr(void *arg);
+
+/* Keeps jif_held_tmr pending exactly while a frame is held back */
+static void
+jif_held_timer(struct netif *netif)
+{
+    int held = jif_rx_held != NULL || jif_tx_held != NULL;
+
+    if (held && !jif_held_pending)
+	sys_timeout(JIF_HOLD_MS, jif_held_tmr, netif);
+    else if (!held && jif_held_pending)
+	sys_untimeout(jif_held_tmr, netif);
+    jif_held_pending = held;
+}
+#endif
+
 static void
 low_level_init(struct netif *netif)
 {
@@ -59,6 +133,9 @@ low_level_init(struct netif *netif)
     netif->hwaddr_len = 6;
     netif->mtu = 1500;
     netif->flags = NETIF_FLAG_BROADCAST;
+    r = sys_net_features();
+    if (r > 0 && (r & NET_F_TXCSUM))
+	netif->flags |= NETIF_FLAG_TXCSUM;
 
     // MAC address is hardcoded to eliminate a system call
     netif->hwaddr[0] = 0x52;
@@ -69,61 +146,290 @@ low_level_init(struct netif *netif)
     netif->hwaddr[5] = 0x56;
 }
 
+/* Frames handed to sys_net_send_sg, by tag, until the device is done
+ * with their pbufs. */
+static struct pbuf *txpbufs[NET_MAXTAGS];
+
+/* lwIP rewrites a segment's headers in its pbuf when it retransmits
+ * it, which may be while the device still reads the first send.  So
+ * the device reads the headers from a copy, one per frame in flight:
+ * txhdr_of[tag] is the copy frame 'tag' uses. */
+#define JIF_TXHDR	(sizeof(struct eth_hdr) + 60 + 60)
+static char txhdrs[NET_MAXTAGS][JIF_TXHDR];
+static uint8_t txhdr_of[NET_MAXTAGS];
+static uint32_t txhdr_busy;
+
+/* Set once the kernel has no device to gather from, as when ns_input
+ * and ns_output drive the e100 themselves. */
+static int jif_nogather;
+
+static void
+jif_tx_reap(void)
+{
+    uint32_t done;
+    int i;
+
+    if (jif_nogather || sys_net_tx_reap(&done) < 0)
+	return;
+    for (i = 0; done != 0; i++, done >>= 1)
+	if ((done & 1) && txpbufs[i] != NULL) {
+	    pbuf_free(txpbufs[i]);
+	    txpbufs[i] = NULL;
+	    txhdr_busy &= ~(1U << txhdr_of[i]);
+	}
+}
+
 /*
- * low_level_output():
+ * jif_fill_csum():
+ *
+ * Fills in the checksums of a PBUF_FLAG_TXCSUM frame of len bytes at
+ * frame, as the device would: the IP checksum field is zero and the
+ * TCP or UDP one holds the pseudo header's sum.
+ *
+ */
+static void
+jif_fill_csum(char *frame, int len)
+{
+    struct ip_hdr *iphdr = (struct ip_hdr *)(frame + sizeof(struct eth_hdr));
+    u16_t ihl = IPH_HL(iphdr) * 4, sum;
+    char *seg = (char *)iphdr + ihl;
+    int seglen = ntohs(IPH_LEN(iphdr)) - ihl;
+
+    if (seg + seglen > frame + len)
+	return;
+    IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, ihl));
+    if (IPH_PROTO(iphdr) == IP_PROTO_TCP) {
+	sum = inet_chksum(seg, seglen);
+	((struct tcp_hdr *)seg)->chksum = sum;
+    } else if (IPH_PROTO(iphdr) == IP_PROTO_UDP) {
+	sum = inet_chksum(seg, seglen);
+	/* chksum zero must become 0xffff, as zero means 'no checksum' */
+	((struct udp_hdr *)seg)->chksum = sum ? sum : 0xffff;
+    }
+}
+
+/*
+ * low_level_output_copy():
+ *
+ * Copies the packet onto the output environment's train, and wakes it
+ * if it sleeps.  Used for chains too long to send in place, when the
+ * kernel has no device to gather from, and as the queue of frames the
+ * transmit ring has no room for: the output environment waits for room,
+ * so that we need not.  If the train is full too, the frame is dropped,
+ * as a NIC drops frames its queue has no room for.
+ *
+ */
+static err_t
+low_level_output_copy(struct netif *netif, struct pbuf *p)
+{
+    struct jif *jif;
+    jif = netif->state;
+
+    int txsize = p->tot_len;
+    if (txsize > 2000)
+	panic("oversized packet, txsize %d\n", txsize);
+
+    /* The train is full: make sure the output environment is awake
+       to drain it */
+    struct jif_pkt *pkt;
+    if ((pkt = nstrain_reserve(jif->train, txsize)) == NULL) {
+	if (nstrain_ring(jif->train))
+	    ipc_send(jif->envid, NSREQ_OUTPUT, 0, 0);
+	LINK_STATS_INC(link.memerr);
+	return ERR_MEM;
+    }
+
+    pbuf_copy_partial(p, pkt->jp_data, txsize, 0);
+    pkt->jp_len = txsize;
+    pkt->jp_flags = 0;
+    if (p->flags & PBUF_FLAG_TXCSUM)
+	jif_fill_csum(pkt->jp_data, txsize);
+
+    nstrain_push(jif->train, pkt);
+    if (nstrain_ring(jif->train))
+	ipc_send(jif->envid, NSREQ_OUTPUT, 0, 0);
+
+    return ERR_OK;
+}
+
+/*
+ * low_level_send():
  *
  * Should do the actual transmission of the packet. The packet is
  * contained in the pbuf that is passed to the function. This pbuf
  * might be chained.
  *
+ * The device gathers the chain straight from our memory, so we hold a
+ * reference to it until the kernel reports the frame sent.  The
+ * headers, at the front of the first pbuf, go from a copy.  While
+ * frames wait on the train, this one goes behind them.
+ *
  */
 static err_t
-low_level_output(struct netif *netif, struct pbuf *p)
+low_level_send(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
+    struct jif *jif = netif->state;
+    struct net_sg sg[NET_MAXSG];
+    struct pbuf *q;
+    int nsg = 1, r, flags = 0, h, hlen;
+
+    if (jif_nogather || jif->train->nt_tail != jif->train->nt_head)
+	return low_level_output_copy(netif, p);
+    jif_tx_reap();
+    for (h = 0; h < NET_MAXTAGS && (txhdr_busy & (1U << h)); h++)
+	;
+    if (h == NET_MAXTAGS)
+	return low_level_output_copy(netif, p);
+
+    hlen = MIN(p->len, JIF_TXHDR);
+    memcpy(txhdrs[h], p->payload, hlen);
+    sg[0].sg_va = txhdrs[h];
+    sg[0].sg_len = hlen;
+    for (q = p; q != NULL; q = q->next) {
+	int off = (q == p ? hlen : 0);
+
+	if (q->len == off)
+	    continue;
+	if (nsg == NET_MAXSG)
+	    return low_level_output_copy(netif, p);
+	sg[nsg].sg_va = (char *) q->payload + off;
+	sg[nsg++].sg_len = q->len - off;
+    }
+
+    if (p->flags & PBUF_FLAG_TXCSUM)
+	flags |= NET_TX_CSUM;
+    if ((r = sys_net_send_sg(sg, nsg, flags)) == -E_RETRY) {
+	/* The ring may only be full of frames we have yet to reap */
+	jif_tx_reap();
+	r = sys_net_send_sg(sg, nsg, flags);
+    }
+    if (r == -E_NOT_SUPP)
+	jif_nogather = 1;
     if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
+	return low_level_output_copy(netif, p);
 
-    struct jif *jif;
-    jif = netif->state;
+    pbuf_ref(p);
+    txpbufs[r] = p;
+    txhdr_of[r] = h;
+    txhdr_busy |= 1U << h;
+    return ERR_OK;
+}
 
-    char *txbuf = pkt->jp_data;
-    int txsize = 0;
+/*
+ * low_level_output():
+ *
+ * Sends the packet with low_level_send(), unless JIF_DROP or
+ * JIF_REORDER has it lost or held back.  A frame held back is a copy,
+ * since lwIP may change the pbuf once we return.
+ *
+ */
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
+{
+#if JIF_INJECT
+    struct eth_hdr *ethhdr = p->payload;
     struct pbuf *q;
-    for (q = p; q != NULL; q = q->next) {
-	/* Send the data from the pbuf to the interface, one pbuf at a
-	   time. The size of the data in each pbuf is kept in the ->len
-	   variable. */
-
-	if (txsize + q->len > 2000)
-	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
-	txsize += q->len;
+    err_t r;
+
+    if (ethhdr->type != htons(ETHTYPE_IP))
+	return low_level_send(netif, p);
+
+    switch (jif_inject(jif_tx_held != NULL)) {
+    case JIF_LOSE:
+	return ERR_OK;
+    case JIF_DELAY:
+	if ((q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM)) == NULL)
+	    break;
+	pbuf_copy(q, p);
+	q->flags |= p->flags & PBUF_FLAG_TXCSUM;
+	jif_tx_held = q;
+	jif_held_timer(netif);
+	return ERR_OK;
     }
 
-    pkt->jp_len = txsize;
+    r = low_level_send(netif, p);
+    if ((q = jif_tx_held) != NULL) {
+	jif_tx_held = NULL;
+	low_level_send(netif, q);
+	pbuf_free(q);
+	jif_held_timer(netif);
+    }
+    return r;
+#else
+    return low_level_send(netif, p);
+#endif
+}
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+/* Received frames lwIP keeps where they lie on the receive train, by
+ * their index in the train's nt_held. */
+struct jif_rxbuf {
+    struct pbuf_custom pc;
+    struct Nstrain *train;
+    int held;
+};
 
-    return ERR_OK;
+static struct jif_rxbuf rxbufs[NSTRAIN_NHELD];
+
+static void
+jif_rxbuf_free(struct pbuf *p)
+{
+    struct jif_rxbuf *rb = (struct jif_rxbuf *)p;
+
+    nstrain_unhold(rb->train, rb->held);
+    rb->train = NULL;
+}
+
+/*
+ * low_level_input_ref():
+ *
+ * Wraps the frame at the tail of train in a pbuf without copying it,
+ * and has the train keep it until lwIP frees the pbuf.  Returns NULL
+ * if the train already keeps all the frames it can.
+ *
+ */
+static struct pbuf *
+low_level_input_ref(struct Nstrain *train, struct jif_pkt *pkt)
+{
+    struct jif_rxbuf *rb;
+    struct pbuf *p;
+    int held;
+
+    if ((held = nstrain_hold(train, pkt)) < 0)
+	return NULL;
+    rb = &rxbufs[held];
+    rb->pc.custom_free_function = jif_rxbuf_free;
+    rb->train = train;
+    rb->held = held;
+    p = pbuf_alloced_custom(PBUF_RAW, pkt->jp_len, PBUF_REF, &rb->pc,
+			    pkt->jp_data, pkt->jp_len);
+    if (p == NULL) {
+	jif_rxbuf_free(&rb->pc.pbuf);
+	return NULL;
+    }
+    if (pkt->jp_flags & NET_RX_CSUM_OK)
+	p->flags |= PBUF_FLAG_RXCSUM_OK;
+    return p;
 }
 
 /*
  * low_level_input():
  *
  * Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
+ * packet from the interface into the pbuf.  Frames on a train are
+ * passed in place while it can keep them, and copied after.
  *
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_input(struct Nstrain *train, void *va)
 {
     struct jif_pkt *pkt = (struct jif_pkt *)va;
     s16_t len = pkt->jp_len;
+    struct pbuf *p;
+
+    if (train && (p = low_level_input_ref(train, pkt)) != NULL)
+	return p;
 
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
@@ -142,6 +448,8 @@ low_level_input(void *va)
 	memcpy(q->payload, rxbuf + copied, bytes);
 	copied += bytes;
     }
+    if (pkt->jp_flags & NET_RX_CSUM_OK)
+	p->flags |= PBUF_FLAG_RXCSUM_OK;
 
     return p;
 }
@@ -162,6 +470,44 @@ jif_output(struct netif *netif, struct pbuf *p,
     return etharp_output(netif, p, ipaddr);
 }
 
+/*
+ * jif_input_ip():
+ *
+ * Passes a received IP frame to the network layer.
+ *
+ */
+static void
+jif_input_ip(struct netif *netif, struct pbuf *p)
+{
+    /* update ARP table */
+    etharp_ip_input(netif, p);
+    /* skip Ethernet header */
+    pbuf_header(p, -(int)sizeof(struct eth_hdr));
+    /* pass to network layer */
+    netif->input(p, netif);
+}
+
+#if JIF_INJECT
+/* Lets the held frames go: nothing has come after them for JIF_HOLD_MS */
+static void
+jif_held_tmr(void *arg)
+{
+    struct netif *netif = arg;
+    struct pbuf *p;
+
+    jif_held_pending = 0;
+    if ((p = jif_tx_held) != NULL) {
+	jif_tx_held = NULL;
+	low_level_send(netif, p);
+	pbuf_free(p);
+    }
+    if ((p = jif_rx_held) != NULL) {
+	jif_rx_held = NULL;
+	jif_input_ip(netif, p);
+    }
+}
+#endif
+
 /*
  * jif_input():
  *
@@ -170,19 +516,24 @@ jif_output(struct netif *netif, struct pbuf *p,
  * should handle the actual reception of bytes from the network
  * interface.
  *
+ * If the packet is the one at the tail of train, lwIP may keep it
+ * there until it is done with it: the caller pops it from the train,
+ * but the train keeps its record until then.
+ *
  */
 
 void
-jif_input(struct netif *netif, void *va)
+jif_input(struct netif *netif, struct Nstrain *train, void *va)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
     struct pbuf *p;
 
     jif = netif->state;
+    jif_tx_reap();
   
     /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    p = low_level_input(train, va);
 
     /* no packet could be read, silently ignore this */
     if (p == NULL) return;
@@ -191,12 +542,25 @@ jif_input(struct netif *netif, void *va)
 
     switch (htons(ethhdr->type)) {
     case ETHTYPE_IP:
-	/* update ARP table */
-	etharp_ip_input(netif, p);
-	/* skip Ethernet header */
-	pbuf_header(p, -(int)sizeof(struct eth_hdr));
-	/* pass to network layer */
-	netif->input(p, netif);
+#if JIF_INJECT
+	switch (jif_inject(jif_rx_held != NULL)) {
+	case JIF_LOSE:
+	    pbuf_free(p);
+	    return;
+	case JIF_DELAY:
+	    jif_rx_held = p;
+	    jif_held_timer(netif);
+	    return;
+	}
+#endif
+	jif_input_ip(netif, p);
+#if JIF_INJECT
+	if ((p = jif_rx_held) != NULL) {
+	    jif_rx_held = NULL;
+	    jif_input_ip(netif, p);
+	    jif_held_timer(netif);
+	}
+#endif
 	break;
       
     case ETHTYPE_ARP:
@@ -222,7 +586,7 @@ err_t
 jif_init(struct netif *netif)
 {
     struct jif *jif;
-    envid_t *output_envid; 
+    struct jif_out *out;
 
     jif = mem_malloc(sizeof(struct jif));
 
@@ -231,7 +595,7 @@ jif_init(struct netif *netif)
 	return ERR_MEM;
     }
 
-    output_envid = (envid_t *)netif->state;
+    out = (struct jif_out *)netif->state;
 
     netif->state = jif;
     netif->output = jif_output;
@@ -239,7 +603,8 @@ jif_init(struct netif *netif)
     memcpy(&netif->name[0], "en", 2);
 
     jif->ethaddr = (struct eth_addr *)&(netif->hwaddr[0]);
-    jif->envid = *output_envid; 
+    jif->envid = out->jo_envid;
+    jif->train = out->jo_train;
 
     low_level_init(netif);
 
@@ -251,5 +616,9 @@ jif_init(struct netif *netif)
     uint32_t ipaddr = inet_addr("10.0.2.2");
     etharp_query(netif, (struct ip_addr *) &ipaddr, 0);
 
+#if JIF_INJECT
+    cprintf("jif: losing 1 in %d and reordering 1 in %d IP frames\n",
+	    JIF_DROP, JIF_REORDER);
+#endif
     return ERR_OK;
 }
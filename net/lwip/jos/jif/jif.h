@@ -1,4 +1,11 @@
 #include <lwip/netif.h>
+#include <inc/ns.h>
 
-void	jif_input(struct netif *netif, void *va);
+/* The state jif_init expects in the netif: where frames to send go */
+struct jif_out {
+    envid_t jo_envid;			/* the output environment */
+    struct Nstrain *jo_train;		/* the train it sends from */
+};
+
+void	jif_input(struct netif *netif, struct Nstrain *train, void *va);
 err_t	jif_init(struct netif *netif);
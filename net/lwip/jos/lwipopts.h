@@ -10,12 +10,29 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
 
+// NS_STATS makes the server print how full lwIP's pools are
+#if defined(NS_STATS) && NS_STATS
+#define LWIP_STATS		1
+#else
 #define LWIP_STATS		0
+#endif
 #define LWIP_STATS_DISPLAY	0
 #define LWIP_DHCP		1
 #define LWIP_COMPAT_SOCKETS	0
+// setsockopt may size a TCP socket's buffers and let a server rebind
+// its port while old connections sit in TIME-WAIT
+#define LWIP_SO_RCVBUF		1
+#define LWIP_SO_SNDBUF		1
+#define SO_REUSE		1
 //#define SYS_LIGHTWEIGHT_PROT	1
 #define LWIP_PROVIDE_ERRNO      1
+// Socket calls run the core functions themselves, under the core lock
+// (lwip_core_lock), rather than posting them to tcpip_thread and
+// waiting for it.
+#define LWIP_TCPIP_CORE_LOCKING	1
+// One thread runs all timeouts, from a heap in sys_arch.c, rather than
+// each thread running its own while it waits.
+#define SYS_ARCH_TIMEOUTS	1
 
 // Various tuning knobs, see:
 // http://lists.gnu.org/archive/html/lwip-users/2006-11/msg00007.html
@@ -31,15 +48,43 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define MEMP_NUM_NETCONN	32
 #define MEMP_NUM_SYS_TIMEOUT    6
 
+// mem_malloc takes memory from the size classes in lwippools.h rather
+// than the first-fit heap: constant time, and no fragmentation across
+// classes.  NS_STATS shows how full each class gets.
+// LABDEFS=-DNS_MEM_POOLS=0 goes back to the heap.
+#if !defined(NS_MEM_POOLS) || NS_MEM_POOLS
+#define MEM_USE_POOLS		1
+#define MEMP_USE_CUSTOM_POOLS	1
+#define MEM_USE_POOLS_TRY_BIGGER_POOL	1
+#else
 #define PER_TCP_PCB_BUFFER	(16 * 4096)
 #define MEM_SIZE		(PER_TCP_PCB_BUFFER*MEMP_NUM_TCP_SEG + 4096*MEMP_NUM_TCP_SEG)
+#endif
 
 #define PBUF_POOL_SIZE		512
 #define PBUF_POOL_BUFSIZE	2000
+// jif hands lwIP received frames where they lie on the receive train
+#define LWIP_SUPPORT_CUSTOM_PBUF	1
 
 #define TCP_MSS			1460
+// SACK lets a loss cost one retransmission rather than a window's worth.
+#ifndef LWIP_TCP_SACK
+#define LWIP_TCP_SACK		1
+#endif
+// The window scale option, for windows past 64k (peers that do not
+// offer it get 0xffff), and timestamps, which time every ACK, with
+// buffers sized to use them.  LABDEFS=-DNS_BIG_WND=0 goes back to a
+// 24000-byte window without either option.
+#if !defined(NS_BIG_WND) || NS_BIG_WND
+#define LWIP_WND_SCALE		1
+#define TCP_RCV_SCALE		2
+#define LWIP_TCP_TIMESTAMPS	1
+#define TCP_WND			(128 * 1024)
+#define TCP_SND_BUF		(64 * TCP_MSS)
+#else
 #define TCP_WND			24000
 #define TCP_SND_BUF		(16 * TCP_MSS)
+#endif
 // lwip prints a warning if TCP_SND_QUEUELEN < (2 * TCP_SND_BUF/TCP_MSS), 
 // but 16 is faster.. 
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
@@ -0,0 +1,18 @@
+// The size classes behind mem_malloc with NS_MEM_POOLS, smallest first.
+// Sizes include the 4-byte header recording an element's class.  Most
+// allocations are PBUF_RAM pbufs: TCP segments without data, with their
+// options, fit in 128 bytes, and a full segment of TCP_MSS plus headers
+// and options in 1600.  Every full segment is queued on a tcp_seg, and
+// jif holds up to NET_MAXTAGS (32) frames more until the device has
+// sent them, so the 1600 class has one per tcp_seg and 32 over; the 128
+// class has room for a ring full of ACKs.  The largest class takes
+// reassembled datagrams that must be copied, as ICMP echo replies to
+// big pings are.  A full class borrows from the next bigger one.
+
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(32, 64)
+LWIP_MALLOC_MEMPOOL(64, 128)
+LWIP_MALLOC_MEMPOOL(64, 512)
+LWIP_MALLOC_MEMPOOL(MEMP_NUM_TCP_SEG + 32, 1600)
+LWIP_MALLOC_MEMPOOL(4, 16384)
+LWIP_MALLOC_MEMPOOL_END
@@ -956,6 +956,8 @@ etharp_query(struct netif *netif, struct ip_addr *ipaddr, struct pbuf *q)
           if (pbuf_copy(p, q) != ERR_OK) {
             pbuf_free(p);
             p = NULL;
+          } else {
+            p->flags |= q->flags & PBUF_FLAG_TXCSUM;
           }
         }
       } else {
@@ -1,18 +1,56 @@
 #include <inc/ns.h>
 #include <inc/lib.h>
+#include <inc/net.h>
 
 #define IP "10.0.2.15"
 #define MASK "255.255.255.0"
 #define DEFAULT "10.0.2.2"
 
-#define TIMER_INTERVAL 250
+// Empty polls of the receive ring before ns_input sleeps in
+// sys_net_wait.  While frames keep coming the ring is rarely empty
+// this long, so the input environment polls and the device interrupt
+// stays off; when traffic stops it sleeps until the next frame.
+#define INPUT_POLLS	16
+
+// Frames ns_input makes room for on the receive train for each
+// sys_net_recv_batch.  The room is reserved for frames of the largest
+// size, and must not wrap, so a large batch wastes the end of the train.
+#define INPUT_BATCH	8
 
 // Virtual address at which to receive page mappings containing client requests.
 #define QUEUE_SIZE	20
 #define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
 
-/* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
+// Worker threads the server starts with, which can be set at build
+// time, e.g.
+//	make LABDEFS=-DNS_WORKERS=8
+// Requests queue for them; while every worker is busy (some socket
+// calls block for long) the server starts another, up to QUEUE_SIZE,
+// since that many requests can be outstanding at once.
+#ifndef NS_WORKERS
+#define NS_WORKERS	4
+#endif
+
+// Every NS_STATS ms, while it is busy, the server prints how deep its
+// request queue gets; 0 turns this off.
+#ifndef NS_STATS
+#define NS_STATS	0
+#endif
+
+// Where the server keeps the ring page of socket s (NSREQ_RING), at
+// NSRINGVA + s * PGSIZE.
+#define NSRINGVA	0x20000000
+
+// The trains (struct Nstrain) of frames received, from ns_input, and of
+// frames to send, to ns_output.  The server allocates them before it
+// forks those environments, so that all three share them.
+#define NSTRAINVA	0x31000000
+#define NSTRAIN_RX	((struct Nstrain *) NSTRAINVA)
+#define NSTRAIN_TX	((struct Nstrain *) \
+			 (NSTRAINVA + ROUNDUP(sizeof(struct Nstrain), PGSIZE)))
+
+/* train.c */
+void train_alloc(struct Nstrain *t);
 
 /* input.c */
 void input(envid_t ns_envid);
@@ -20,3 +58,9 @@ void input(envid_t ns_envid);
 /* output.c */
 void output(envid_t ns_envid);
 
+/* e100u.c */
+int e100u_init(void);
+int e100u_attach(void);
+void e100u_input(envid_t ns_envid);
+void e100u_output(envid_t ns_envid);
+
@@ -11,12 +11,40 @@ output(envid_t ns_envid)
 	// 	- read a packet from the network server
 	//	- send the packet to the device driver
 
-    union Nsipc *packet = (union Nsipc*)REQVA;
+    struct Nstrain *train = NSTRAIN_TX;
+    struct net_sg frames[NET_MAXBATCH];
+    struct jif_pkt *pkt;
+    uint32_t pos;
+    int i, n, r;
 
+#ifdef NS_USER_DRIVER
+    if (0 == e100u_attach())
+        e100u_output(ns_envid);
+#endif
+
+    // Hand the device what is on the train, NET_MAXBATCH frames a trap,
+    // and sleep until the server rings when the train is empty.
     while (1) {
-        if (NSREQ_OUTPUT == ipc_recv(NULL, packet, NULL)) {
-            while (0 != sys_net_send(packet->pkt.jp_data, packet->pkt.jp_len))
+        pos = train->nt_tail;
+        for (n = 0; n < NET_MAXBATCH && NULL != (pkt = nstrain_at(train, &pos)); ++n) {
+            frames[n].sg_va = pkt->jp_data;
+            frames[n].sg_len = pkt->jp_len;
+            pos += nstrain_reclen(pkt->jp_len);
+        }
+        if (0 == n) {
+            if (nstrain_idle(train))
+                ipc_recv(NULL, NULL, NULL);
+            continue;
+        }
+
+        while (-E_RETRY == (r = sys_net_send_batch(frames, n)))
+            if (sys_net_wait(NET_WAIT_TX) < 0)
                 sys_yield();
+        if (0 > r) {
+            cprintf("ns_output: dropping a frame: %e\n", r);
+            r = 1;
         }
+        for (i = 0; i < r; ++i)
+            nstrain_pop(train, nstrain_peek(train));
     }
 }
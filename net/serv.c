@@ -21,6 +21,7 @@
 #include <lwip/tcpip.h>
 #include <lwip/stats.h>
 #include <lwip/netbuf.h>
+#include <lwip/memp.h>
 #include <netif/etharp.h>
 #include <jif/jif.h>
 
@@ -33,19 +34,25 @@ struct netif nif;
 
 #define debug 0
 
-struct timer_thread {
-	uint32_t msec;
-	void (*func)(void);
-	const char *name;
+static envid_t input_envid;
+static envid_t output_envid;
+static struct jif_out jif_out;
+
+// Sockets whose data goes through rings (NSREQ_RING); a thread pumps
+// each direction between the ring and lwIP.  Each thread has a bit,
+// RINGS_TX or RINGS_RX, in 'running' while it runs and in 'stopping'
+// once it has been asked to stop, which shutdown does for one
+// direction and close for both.
+struct ns_rings {
+	struct Nsrings *rings;
+	volatile uint32_t running;
+	uint32_t stopping;
 };
 
-static struct timer_thread t_arp;
-static struct timer_thread t_tcpf;
-static struct timer_thread t_tcps;
+#define RINGS_TX	1
+#define RINGS_RX	2
 
-static envid_t timer_envid;
-static envid_t input_envid;
-static envid_t output_envid;
+static struct ns_rings ring_socks[MEMP_NUM_NETCONN];
 
 static bool buse[QUEUE_SIZE];
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
@@ -95,33 +102,6 @@ lwip_init(struct netif *nif, void *if_state,
 	netif_set_up(nif);
 }
 
-static void __attribute__((noreturn))
-net_timer(uint32_t arg)
-{
-	struct timer_thread *t = (struct timer_thread *) arg;
-
-	for (;;) {
-		uint32_t cur = sys_time_msec();
-
-		lwip_core_lock();
-		t->func();
-		lwip_core_unlock();
-
-		thread_wait(0, 0, cur + t->msec);
-	}
-}
-
-static void
-start_timer(struct timer_thread *t, void (*func)(void), const char *name, int msec)
-{
-	t->msec = msec;
-	t->func = func;
-	t->name = name;
-	int r = thread_create(0, name, &net_timer, (uint32_t)t);
-	if (r < 0)
-		panic("cannot create timer thread: %s", e2s(r));
-}
-
 static void
 tcpip_init_done(void *arg)
 {
@@ -142,11 +122,11 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	thread_wait(&done, 0, (uint32_t)~0);
 	lwip_core_lock();
 
-	lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
-
-	start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
-	start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
-	start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
+	// tcpip_thread has set up the ARP timeout and the TCP timeout
+	// follows the first connection; sys_arch runs them.
+	jif_out.jo_envid = output_envid;
+	jif_out.jo_train = NSTRAIN_TX;
+	lwip_init(&nif, &jif_out, ipaddr, netmask, gw);
 
 	struct in_addr ia = {ipaddr};
 	cprintf("ns: %02x:%02x:%02x:%02x:%02x:%02x" 
@@ -160,21 +140,224 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	cprintf("NS: TCP/IP initialized.\n");
 }
 
+// Wake the clients sleeping on a ring.  Each took its slot just
+// before going to sleep, so it will be receiving soon if it is not
+// already; one that has since exited fails the send.
+static void
+rings_wake(struct Nsring *ring)
+{
+	envid_t id;
+	int i;
+
+	for (i = 0; i < NSRING_NWAITERS; i++)
+		if ((id = xchg(&ring->nr_waiters[i], 0)) != 0)
+			while (sys_ipc_try_send(id, 0, (void *) UTOP, 0)
+			       == -E_IPC_NOT_RECV)
+				sys_yield();
+}
+
+// Sleep until the client changes *addr from val or the thread with
+// bit 'dir' is asked to stop.  The client rings the doorbell only if it
+// finds *flag set.
+static void
+rings_sleep(struct ns_rings *nr, int dir, volatile uint32_t *flag,
+	    volatile uint32_t *addr, uint32_t val)
+{
+	xchg(flag, 1);
+	if (*addr == val && !(nr->stopping & dir))
+		thread_wait(addr, val, (uint32_t) ~0);
+	xchg(flag, 0);
+}
+
+// Stop a ring for good, with r for the client's read or write to
+// return, and wake the clients if one sleeps on *flag.
+static void
+rings_done(struct ns_rings *nr, int dir, struct Nsring *ring,
+	   volatile uint32_t *flag, int r)
+{
+	ring->nr_ret = r;
+	ring->nr_done = 1;
+	if (xchg(flag, 0))
+		rings_wake(ring);
+	nr->running &= ~dir;
+	thread_wakeup(&nr->running);
+}
+
+// Send what the client puts in its transmit ring.  The ring's head
+// comes from the client, so it is checked; its tail is ours.
 static void
-process_timer(envid_t envid) {
-	uint32_t start, now, to;
+rings_tx_thread(uint32_t arg)
+{
+	struct ns_rings *nr = (struct ns_rings *) arg;
+	struct Nsring *ring = &nr->rings->nrs_tx;
+	int s = nr - ring_socks;
+	uint32_t head, tail = 0;
+	int n, r = 0;
 
-	if (envid != timer_envid) {
-		cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
+	while (1) {
+		head = ring->nr_head;
+		if (head >= NSRING_SIZE) {
+			r = -E_INVAL;
+			break;
+		}
+		if (head == tail) {
+			// Stopping drains the ring first
+			if (nr->stopping & RINGS_TX) {
+				r = 0;
+				break;
+			}
+			rings_sleep(nr, RINGS_TX, &ring->nr_cwait,
+				    &ring->nr_head, tail);
+			continue;
+		}
+		n = (head > tail ? head : NSRING_SIZE) - tail;
+		if ((r = lwip_send(s, ring->nr_buf + tail, n, 0)) < 0)
+			break;
+		tail = (tail + n) % NSRING_SIZE;
+		ring->nr_tail = tail;
+		if (xchg(&ring->nr_pwait, 0))
+			rings_wake(ring);
+	}
+	rings_done(nr, RINGS_TX, ring, &ring->nr_pwait, r);
+}
+
+// Fill the client's receive ring from the socket.  lwip_close must not
+// find the thread blocked in lwip_recv, so it waits in lwip_select,
+// with no timeout; rings_stop wakes it with lwip_select_wake.  Threads
+// only switch where they block, and nothing blocks between the loop's
+// look at 'stopping' and the select registering itself (a recv that
+// finds no data returns at once, and selectsem is never held across a
+// block), so the wakeup cannot be missed.
+static void
+rings_rx_thread(uint32_t arg)
+{
+	struct ns_rings *nr = (struct ns_rings *) arg;
+	struct Nsring *ring = &nr->rings->nrs_rx;
+	int s = nr - ring_socks;
+	uint32_t head = 0, tail;
+	fd_set readset;
+	int n, r = 0;
+
+	while (!(nr->stopping & RINGS_RX)) {
+		tail = ring->nr_tail;
+		if (tail >= NSRING_SIZE) {
+			r = -E_INVAL;
+			break;
+		}
+		if (tail > head)
+			n = tail - head - 1;
+		else
+			n = NSRING_SIZE - head - (tail == 0);
+		if (n == 0) {
+			rings_sleep(nr, RINGS_RX, &ring->nr_pwait,
+				    &ring->nr_tail, tail);
+			continue;
+		}
+		r = lwip_recv(s, ring->nr_buf + head, n, MSG_DONTWAIT);
+		if (r < 0 && errno == EWOULDBLOCK) {
+			FD_ZERO(&readset);
+			FD_SET(s, &readset);
+			lwip_select(s + 1, &readset, NULL, NULL, NULL);
+			continue;
+		}
+		// 0 is the end of the stream
+		if (r <= 0)
+			break;
+		head = (head + r) % NSRING_SIZE;
+		ring->nr_head = head;
+		if (xchg(&ring->nr_cwait, 0))
+			rings_wake(ring);
+	}
+	if (nr->stopping & RINGS_RX)
+		r = 0;
+	rings_done(nr, RINGS_RX, ring, &ring->nr_cwait, r);
+}
+
+// Stop socket s's ring threads in 'dirs' (RINGS_TX, RINGS_RX), the
+// transmit one once its ring has drained.  The client then reads 0 from
+// a stopped receive ring.  Called before the socket is shut down.
+static void
+rings_stop(int s, int dirs)
+{
+	struct ns_rings *nr;
+	uint32_t n;
+
+	if (s < 0 || s >= MEMP_NUM_NETCONN || !ring_socks[s].rings)
 		return;
+	nr = &ring_socks[s];
+	nr->stopping |= dirs;
+	if (dirs & RINGS_TX)
+		thread_wakeup(&nr->rings->nrs_tx.nr_head);
+	if (dirs & RINGS_RX) {
+		thread_wakeup(&nr->rings->nrs_rx.nr_tail);
+		lwip_select_wake(s);
 	}
+	while ((n = nr->running) & dirs)
+		thread_wait(&nr->running, n, (uint32_t) ~0);
+}
 
-	start = sys_time_msec();
-	thread_yield();
-	now = sys_time_msec();
+// Stop both of socket s's ring threads and drop its ring page.  Called
+// before the socket is closed.
+static void
+rings_close(int s)
+{
+	if (s < 0 || s >= MEMP_NUM_NETCONN || !ring_socks[s].rings)
+		return;
+	rings_stop(s, RINGS_TX | RINGS_RX);
+	sys_page_unmap(0, (void *) (NSRINGVA + s * PGSIZE));
+	ring_socks[s].rings = NULL;
+}
 
-	to = TIMER_INTERVAL - (now - start);
-	ipc_send(envid, to, 0, 0);
+// Keep the ring page req for its socket and start pumping it.
+static int
+rings_start(union Nsipc *req)
+{
+	int s = req->rings.nrs_sock;
+	struct ns_rings *nr;
+	socklen_t len;
+	int r, type;
+
+	static_assert(sizeof(struct Nsrings) <= PGSIZE);
+	if (s < 0 || s >= MEMP_NUM_NETCONN || ring_socks[s].rings)
+		return -E_INVAL;
+	len = sizeof(type);
+	if (lwip_getsockopt(s, SOL_SOCKET, SO_TYPE, &type, &len) < 0
+	    || type != SOCK_STREAM)
+		return -E_NOT_SUPP;
+
+	nr = &ring_socks[s];
+	nr->rings = (struct Nsrings *) (NSRINGVA + s * PGSIZE);
+	if ((r = sys_page_map(0, req, 0, nr->rings, PTE_P|PTE_U|PTE_W)) < 0) {
+		nr->rings = NULL;
+		return r;
+	}
+	nr->stopping = 0;
+	nr->running = 0;
+	if ((r = thread_create(0, "rings tx", rings_tx_thread, (uint32_t) nr)) < 0)
+		goto fail;
+	nr->running |= RINGS_TX;
+	if ((r = thread_create(0, "rings rx", rings_rx_thread, (uint32_t) nr)) < 0)
+		goto fail;
+	nr->running |= RINGS_RX;
+	return 0;
+
+fail:
+	rings_close(s);
+	return r;
+}
+
+// A client has changed a ring; it does not say which, so look at them
+// all.
+static void
+rings_doorbell(void)
+{
+	int s;
+
+	for (s = 0; s < MEMP_NUM_NETCONN; s++)
+		if (ring_socks[s].rings) {
+			thread_wakeup(&ring_socks[s].rings->nrs_tx.nr_head);
+			thread_wakeup(&ring_socks[s].rings->nrs_rx.nr_tail);
+		}
 }
 
 struct st_args {
@@ -183,11 +366,28 @@ struct st_args {
 	union Nsipc *req;
 };
 
+// Requests waiting for a worker, from reqq_head up to reqq_tail.  At
+// most QUEUE_SIZE are outstanding, one per request buffer, so the queue
+// cannot overflow.
+static struct st_args reqq[QUEUE_SIZE];
+static volatile uint32_t reqq_head;
+static volatile uint32_t reqq_tail;
+static int nworkers;
+static int nidle;
+
+static struct {
+	uint32_t requests;	// queued for a worker
+	uint32_t inputs;	// frames taken off the receive train
+	uint32_t busy;		// requests that found no idle worker
+	uint32_t depth_sum;	// queue depth seen by each request
+	uint32_t depth_max;
+	uint32_t next_msec;	// when to print next
+} ns_stats;
+
 static void
-serve_thread(uint32_t a) {
-	struct st_args *args = (struct st_args *)a;
+serve_request(struct st_args *args) {
 	union Nsipc *req = args->req;
-	int r;
+	int r, how;
 
 	switch (args->reqno) {
 	case NSREQ_ACCEPT:
@@ -203,9 +403,16 @@ serve_thread(uint32_t a) {
 			      req->bind.req_namelen);
 		break;
 	case NSREQ_SHUTDOWN:
-		r = lwip_shutdown(req->shutdown.req_s, req->shutdown.req_how);
+		// Stop only the directions being shut down: after SHUT_WR
+		// the peer's data still comes in through the receive ring.
+		how = req->shutdown.req_how;
+		rings_stop(req->shutdown.req_s,
+			   (how == SHUT_RD ? 0 : RINGS_TX)
+			   | (how == SHUT_WR ? 0 : RINGS_RX));
+		r = lwip_shutdown(req->shutdown.req_s, how);
 		break;
 	case NSREQ_CLOSE:
+		rings_close(req->close.req_s);
 		r = lwip_close(req->close.req_s);
 		break;
 	case NSREQ_CONNECT:
@@ -229,9 +436,26 @@ serve_thread(uint32_t a) {
 		r = lwip_socket(req->socket.req_domain, req->socket.req_type,
 				req->socket.req_protocol);
 		break;
-	case NSREQ_INPUT:
-		jif_input(&nif, (void *)&req->pkt);
-		r = 0;
+	case NSREQ_SETSOCKOPT:
+		r = lwip_setsockopt(req->setsockopt.req_s,
+				    req->setsockopt.req_level,
+				    req->setsockopt.req_optname,
+				    req->setsockopt.req_optval,
+				    MIN(req->setsockopt.req_optlen, NSSOCKOPT_MAX));
+		break;
+	case NSREQ_GETSOCKOPT:
+	{
+		struct Nsret_getsockopt ret;
+		ret.ret_optlen = MIN(req->getsockopt.req_optlen, NSSOCKOPT_MAX);
+		r = lwip_getsockopt(req->getsockopt.req_s,
+				    req->getsockopt.req_level,
+				    req->getsockopt.req_optname,
+				    ret.ret_optval, &ret.ret_optlen);
+		memmove(req, &ret, sizeof ret);
+		break;
+	}
+	case NSREQ_RING:
+		r = rings_start(req);
 		break;
 	default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
@@ -245,38 +469,149 @@ serve_thread(uint32_t a) {
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
-		ipc_send(args->whom, r, 0, 0);
+	ipc_send(args->whom, r, 0, 0);
 
 	put_buffer(args->req);
 	sys_page_unmap(0, (void*) args->req);
-	free(args);
+}
+
+// Serve queued requests forever.  Workers never exit, so their contexts
+// and stacks are allocated once.
+static void
+serve_worker(uint32_t arg) {
+	struct st_args args;
+	uint32_t tail;
+
+	while (1) {
+		while ((tail = reqq_tail) == reqq_head) {
+			nidle++;
+			thread_wait(&reqq_tail, tail, (uint32_t)~0);
+			nidle--;
+		}
+		args = reqq[reqq_head % QUEUE_SIZE];
+		reqq_head++;
+		serve_request(&args);
+	}
+}
+
+static int
+serve_start_worker(void) {
+	int r;
+
+	if ((r = thread_create(0, "serve_worker", serve_worker, 0)) < 0)
+		return r;
+	nworkers++;
+	return 0;
+}
+
+static void
+serve_enqueue(int32_t reqno, uint32_t whom, void *va) {
+	uint32_t depth;
+
+	reqq[reqq_tail % QUEUE_SIZE] = (struct st_args) { reqno, whom, va };
+	reqq_tail++;
+	thread_wakeup(&reqq_tail);
+
+	depth = reqq_tail - reqq_head;
+	ns_stats.requests++;
+	ns_stats.depth_sum += depth;
+	ns_stats.depth_max = MAX(ns_stats.depth_max, depth);
+
+	// Some socket calls block for long, so a busy pool may never get
+	// to this request; start another worker for it.
+	if (depth > nidle) {
+		ns_stats.busy++;
+		if (nworkers < QUEUE_SIZE && serve_start_worker() < 0)
+			cprintf("ns: cannot start another worker\n");
+	}
+}
+
+static void
+serve_print_stats(void) {
+	uint32_t now;
+
+	if (!NS_STATS || (now = sys_time_msec()) < ns_stats.next_msec)
+		return;
+	ns_stats.next_msec = now + NS_STATS;
+	cprintf("ns: %u requests, queue depth avg %u max %u, "
+		"%u found no idle worker, %u workers, %u frames in / %u doorbells\n",
+		ns_stats.requests,
+		ns_stats.requests ? ns_stats.depth_sum / ns_stats.requests : 0,
+		ns_stats.depth_max, ns_stats.busy, nworkers, ns_stats.inputs,
+		NSTRAIN_RX->nt_doorbells);
+#if MEMP_STATS && MEM_USE_POOLS
+	memp_t i;
+	for (i = MEMP_POOL_FIRST; i <= MEMP_POOL_LAST; i++)
+		cprintf("ns: mem_malloc %u-byte class: %u of %u used, "
+			"max %u, %u failed\n", memp_sizes[i],
+			lwip_stats.memp[i].used, lwip_stats.memp[i].avail,
+			lwip_stats.memp[i].max, lwip_stats.memp[i].err);
+#endif
+}
+
+// Hand lwIP the frames ns_input has put on the receive train.  The
+// train is armed first, so a frame pushed after we look is rung for and
+// wakes ipc_recv; frames pushed while we drain wait for the next loop,
+// so that a flood cannot keep the clients' requests waiting.
+static void
+serve_input(void) {
+	struct Nstrain *t = NSTRAIN_RX;
+	struct jif_pkt *pkt;
+	uint32_t head;
+
+	nstrain_arm(t);
+	head = t->nt_head;
+	if (t->nt_tail == head)
+		return;
+	lwip_core_lock();
+	while ((int32_t) (head - t->nt_tail) > 0 && (pkt = nstrain_peek(t))) {
+		jif_input(&nif, t, pkt);
+		nstrain_pop(t, pkt);
+		ns_stats.inputs++;
+	}
+	lwip_core_unlock();
 }
 
 void
 serve(void) {
 	int32_t reqno;
-	uint32_t whom;
-	int i, perm;
+	uint32_t whom, until;
+	int i, n, perm, r;
 	void *va;
-	
+
+	for (i = 0; i < NS_WORKERS; i++)
+		if ((r = serve_start_worker()) < 0)
+			panic("cannot create worker thread: %e", r);
+
 	while (1) {
+		serve_input();
+
 		// ipc_recv will block the entire process, so we flush
 		// all pending work from other threads.  We limit the
 		// number of yields in case there's a rogue thread.
-		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
+		for (i = 0; (n = thread_wakeups_pending()) && i < 32; ++i)
 			thread_yield();
+		serve_print_stats();
 
+		// Sleep until a request comes or the first thread deadline
+		// (an lwIP timeout, or a wait with a time limit) passes.  A
+		// thread still runnable gets the CPU back at the next tick.
+		until = n ? sys_time_msec() : thread_next_deadline();
 		perm = 0;
 		va = get_buffer();
-		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		reqno = ipc_recv_timed((int32_t *) &whom, (void *) va, &perm, until);
 		if (debug) {
 			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
+		// A doorbell from ns_input: serve_input takes the frames
+		if (reqno == -E_TIMEOUT || reqno == NSREQ_INPUT) {
+			put_buffer(va);
+			continue;
+		}
 
 		// first take care of requests that do not contain an argument page
-		if (reqno == NSREQ_TIMER) {
-			process_timer(whom);
+		if (reqno == NSREQ_DOORBELL) {
+			rings_doorbell();
 			put_buffer(va);
 			continue;
 		}
@@ -287,18 +622,10 @@ serve(void) {
 			continue; // just leave it hanging...
 		}
 
-		// Since some lwIP socket calls will block, create a thread and
-		// process the rest of the request in the thread.
-		struct st_args *args = malloc(sizeof(struct st_args));
-		if (!args)
-			panic("could not allocate thread args structure");
-
-		args->reqno = reqno;
-		args->whom = whom;
-		args->req = va;
-
-		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
-		thread_yield(); // let the thread created run
+		// Since some lwIP socket calls will block, a worker thread
+		// processes the rest of the request.
+		serve_enqueue(reqno, whom, va);
+		thread_yield(); // let a worker run
 	}
 }
 
@@ -314,17 +641,20 @@ void
 umain(void)
 {
 	envid_t ns_envid = sys_getenvid();
+	int r;
 
 	binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
+	// Before the forks, so that ns_input and ns_output share the trains
+	train_alloc(NSTRAIN_RX);
+	train_alloc(NSTRAIN_TX);
+
+#ifdef NS_USER_DRIVER
+	// Before the forks, so that ns_input and ns_output share the rings
+	// and agree on who drives the device
+	if ((r = e100u_init()) < 0)
+		cprintf("ns: no user-space driver: %e\n", r);
+#endif
 
 	// fork off the input thread which will poll the NIC driver for input
 	// packets
@@ -0,0 +1,87 @@
+// Small-packet flood.  Send FLOOD_COUNT minimum-size frames, first one
+// sys_net_send per frame and then through sys_net_send_batch with
+// growing batches, and report each rate as one line
+//	testflood <test> <value> frames/s
+// for grade-netbench.sh.  Run without the network server, like
+// testoutput; the frames are broadcast with an experimental EtherType.
+
+#include "ns.h"
+#include <inc/x86.h>
+
+#ifndef FLOOD_COUNT
+#define FLOOD_COUNT 20000
+#endif
+
+#define FLOOD_LEN	60		// smallest Ethernet frame, less the CRC
+
+static char frames[NET_MAXBATCH][FLOOD_LEN];
+static uint64_t tsc_per_ms;
+
+static void
+make_frames(void)
+{
+	static const uint8_t src[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+	int i;
+
+	for (i = 0; i < NET_MAXBATCH; i++) {
+		memset(frames[i], 0xff, 6);
+		memcpy(frames[i] + 6, src, 6);
+		frames[i][12] = 0x88;
+		frames[i][13] = 0xb5;
+		snprintf(frames[i] + 14, FLOOD_LEN - 14, "flood %d", i);
+	}
+}
+
+// Send FLOOD_COUNT frames, batch at a time, or with sys_net_send if
+// batch is 0.
+static void
+flood(int batch)
+{
+	struct net_sg sg[NET_MAXBATCH];
+	char test[32];
+	uint64_t start, cycles;
+	int i, n, r;
+
+	for (i = 0; i < NET_MAXBATCH; i++) {
+		sg[i].sg_va = frames[i];
+		sg[i].sg_len = FLOOD_LEN;
+	}
+
+	start = read_tsc();
+	for (n = 0; n < FLOOD_COUNT; n += r) {
+		if (batch == 0)
+			r = sys_net_send(frames[0], FLOOD_LEN) ? -E_RETRY : 1;
+		else
+			r = sys_net_send_batch(sg, MIN(batch, FLOOD_COUNT - n));
+		if (r == -E_RETRY) {
+			r = 0;
+			if (sys_net_wait(NET_WAIT_TX) < 0)
+				sys_yield();
+		} else if (r < 0)
+			panic("testflood: %e", r);
+	}
+	cycles = read_tsc() - start;
+
+	if (batch == 0)
+		snprintf(test, sizeof test, "send");
+	else
+		snprintf(test, sizeof test, "batch-%d", batch);
+	cprintf("testflood %s %d frames/s\n", test,
+		(uint32_t) ((uint64_t) FLOOD_COUNT * 1000 * tsc_per_ms / cycles));
+}
+
+void
+umain(void)
+{
+	binaryname = "testflood";
+
+	tsc_per_ms = tsc_calibrate();
+	make_frames();
+
+	flood(0);
+	flood(1);
+	flood(8);
+	flood(NET_MAXBATCH);
+
+	cprintf("testflood done\n");
+}
@@ -4,8 +4,6 @@
 static envid_t output_envid;
 static envid_t input_envid;
 
-static struct jif_pkt *pkt = (struct jif_pkt*)REQVA;
-
 
 static void
 announce(void)
@@ -19,13 +17,14 @@ announce(void)
 	uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
 	uint32_t myip = inet_addr(IP);
 	uint32_t gwip = inet_addr(DEFAULT);
-	int r;
+	struct jif_pkt *pkt;
 
-	if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
-		panic("sys_page_map: %e", r);
+	if ((pkt = nstrain_reserve(NSTRAIN_TX, sizeof(struct etharp_hdr))) == NULL)
+		panic("announce: transmit train full");
 
 	struct etharp_hdr *arp = (struct etharp_hdr*)pkt->jp_data;
 	pkt->jp_len = sizeof(*arp);
+	pkt->jp_flags = 0;
 
 	memset(arp->ethhdr.dest.addr, 0xff, ETHARP_HWADDR_LEN);
 	memcpy(arp->ethhdr.src.addr,  mac,  ETHARP_HWADDR_LEN);
@@ -39,8 +38,9 @@ announce(void)
 	memset(arp->dhwaddr.addr,  0x00,  ETHARP_HWADDR_LEN);
 	memcpy(arp->dipaddr.addrw, &gwip, 4);
 
-	ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
-	sys_page_unmap(0, pkt);
+	nstrain_push(NSTRAIN_TX, pkt);
+	if (nstrain_ring(NSTRAIN_TX))
+		ipc_send(output_envid, NSREQ_OUTPUT, 0, 0);
 }
 
 static void
@@ -68,10 +68,13 @@ void
 umain(void)
 {
 	envid_t ns_envid = sys_getenvid();
-	int i, r;
+	struct jif_pkt *pkt;
 
 	binaryname = "testinput";
 
+	train_alloc(NSTRAIN_RX);
+	train_alloc(NSTRAIN_TX);
+
 	output_envid = fork();
 	if (output_envid < 0)
 		panic("error forking");
@@ -95,17 +98,22 @@ umain(void)
 	cprintf("Waiting for packets...\n");
 	while (1) {
 		envid_t whom;
-		int perm;
 
-		int32_t req = ipc_recv((int32_t *)&whom, pkt, &perm);
+		if ((pkt = nstrain_peek(NSTRAIN_RX)) != NULL) {
+			hexdump("input: ", pkt->jp_data, pkt->jp_len);
+			cprintf("\n");
+			nstrain_pop(NSTRAIN_RX, pkt);
+			continue;
+		}
+		if (!nstrain_idle(NSTRAIN_RX))
+			continue;
+
+		int32_t req = ipc_recv((int32_t *)&whom, NULL, NULL);
 		if (req < 0)
 			panic("ipc_recv: %e", req);
 		if (whom != input_envid)
 			panic("IPC from unexpected environment %08x", whom);
 		if (req != NSREQ_INPUT)
 			panic("Unexpected IPC %d", req);
-
-		hexdump("input: ", pkt->jp_data, pkt->jp_len);
-		cprintf("\n");
 	}
 }
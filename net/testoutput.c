@@ -6,17 +6,17 @@
 
 static envid_t output_envid;
 
-static struct jif_pkt *pkt = (struct jif_pkt*)REQVA;
-
 
 void
 umain(void)
 {
 	envid_t ns_envid = sys_getenvid();
-	int i, r;
+	struct jif_pkt *pkt;
+	int i;
 
 	binaryname = "testoutput";
 
+	train_alloc(NSTRAIN_TX);
 	output_envid = fork();
 	if (output_envid < 0)
 		panic("error forking");
@@ -26,14 +26,14 @@ umain(void)
 	}
 
 	for (i = 0; i < TESTOUTPUT_COUNT; i++) {
-		if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
-			panic("sys_page_alloc: %e", r);
-		pkt->jp_len = snprintf(pkt->jp_data,
-				       PGSIZE - sizeof(pkt->jp_len),
-				       "Packet %02d", i);
+		while ((pkt = nstrain_reserve(NSTRAIN_TX, 16)) == NULL)
+			sys_yield();
+		pkt->jp_len = snprintf(pkt->jp_data, 16, "Packet %02d", i);
+		pkt->jp_flags = 0;
 		cprintf("Transmitting packet %d\n", i);
-		ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
-		sys_page_unmap(0, pkt);
+		nstrain_push(NSTRAIN_TX, pkt);
+		if (nstrain_ring(NSTRAIN_TX))
+			ipc_send(output_envid, NSREQ_OUTPUT, 0, 0);
 	}
 
 	// Spin for a while, just in case IPC's or packets need to be flushed
@@ -0,0 +1,15 @@
+#include "ns.h"
+
+// Allocate the pages of train t, to be shared with the environments
+// forked after.
+void
+train_alloc(struct Nstrain *t)
+{
+	uintptr_t va;
+	int r;
+
+	for (va = (uintptr_t) t; va < (uintptr_t) (t + 1); va += PGSIZE)
+		if ((r = sys_page_alloc(0, (void *) va,
+					PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+			panic("train_alloc: %e", r);
+}
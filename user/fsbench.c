@@ -0,0 +1,249 @@
+// File system benchmark.  Each result is one line
+//	fsbench <test> <value> <unit>
+// so that grade-fsbench.sh can compare a run against a saved baseline.
+// The "cold" tests empty the file server's block cache first; the
+// "warm" tests repeat the same work with everything cached.
+//
+// Times come from the TSC, calibrated against sys_time_msec, because
+// the clock only ticks every 10ms.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define BENCHFILE	"/fsbench.dat"
+#define MAXREQ		(32 * 1024)
+
+uint32_t filesize = 256 * 1024;	// -s: size of the data file, in KB
+int nfiles = 128;		// -n: small files for the metadata tests
+int nrand = 256;		// -r: random reads per pass
+
+uint32_t reqsizes[] = { 512, 4096, MAXREQ };
+char buf[MAXREQ];
+uint64_t tsc_per_ms;
+
+// Microseconds since TSC value 'start'.
+uint32_t
+elapsed_us(uint64_t start)
+{
+	uint32_t us = (read_tsc() - start) * 1000 / tsc_per_ms;
+
+	return us ? us : 1;
+}
+
+void
+report(const char *test, uint32_t value, const char *unit)
+{
+	cprintf("fsbench %s %d %s\n", test, value, unit);
+}
+
+// Report 'bytes' transferred in 'us' microseconds as KB/s.
+void
+report_rate(const char *test, uint32_t bytes, uint32_t us)
+{
+	report(test, (uint64_t) bytes * 1000000 / 1024 / us, "KB/s");
+}
+
+// Report 'n' operations in 'us' microseconds as operations per second.
+void
+report_ops(const char *test, uint32_t n, uint32_t us)
+{
+	report(test, (uint64_t) n * 1000000 / us, "ops/s");
+}
+
+void
+dropcache(void)
+{
+	int r;
+
+	if ((r = fsdropcache()) < 0)
+		panic("fsdropcache: %e", r);
+}
+
+int
+xopen(const char *path, int mode)
+{
+	int fd;
+
+	if ((fd = open(path, mode)) < 0)
+		panic("open %s: %e", path, fd);
+	return fd;
+}
+
+void
+seqwrite(uint32_t reqsize)
+{
+	char test[32];
+	uint64_t start;
+	uint32_t off;
+	int fd, r;
+
+	memset(buf, reqsize & 0xFF, reqsize);
+	start = read_tsc();
+	fd = xopen(BENCHFILE, O_WRONLY | O_CREAT | O_TRUNC);
+	for (off = 0; off < filesize; off += reqsize)
+		if ((r = write(fd, buf, reqsize)) != reqsize)
+			panic("write %s: %e", BENCHFILE, r < 0 ? r : -E_NO_DISK);
+	close(fd);
+	sync();
+	snprintf(test, sizeof test, "seqwrite-%d", reqsize);
+	report_rate(test, filesize, elapsed_us(start));
+}
+
+void
+seqread(uint32_t reqsize, bool cold)
+{
+	char test[32];
+	uint64_t start;
+	uint32_t off;
+	int fd, r;
+
+	if (cold)
+		dropcache();
+	start = read_tsc();
+	fd = xopen(BENCHFILE, O_RDONLY);
+	for (off = 0; off < filesize; off += reqsize)
+		if ((r = readn(fd, buf, reqsize)) != reqsize)
+			panic("read %s: %e", BENCHFILE, r < 0 ? r : -E_INVAL);
+	close(fd);
+	snprintf(test, sizeof test, "seqread-%s-%d", cold ? "cold" : "warm",
+		 reqsize);
+	report_rate(test, filesize, elapsed_us(start));
+}
+
+// Read 4KB blocks at pseudo-random block offsets.  The same seed
+// gives the same offsets, so the warm pass hits what the cold pass
+// loaded.
+void
+randread(bool cold)
+{
+	uint32_t i, seed = 1, nblocks = filesize / BLKSIZE;
+	uint64_t start;
+	int fd, r;
+
+	if (cold)
+		dropcache();
+	fd = xopen(BENCHFILE, O_RDONLY);
+	start = read_tsc();
+	for (i = 0; i < nrand; i++) {
+		seed = seed * 1103515245 + 12345;
+		seek(fd, (seed >> 16) % nblocks * BLKSIZE);
+		if ((r = readn(fd, buf, BLKSIZE)) != BLKSIZE)
+			panic("read %s: %e", BENCHFILE, r < 0 ? r : -E_INVAL);
+	}
+	report_ops(cold ? "randread-cold-4096" : "randread-warm-4096",
+		   nrand, elapsed_us(start));
+	close(fd);
+}
+
+void
+smallname(char *path, int i)
+{
+	snprintf(path, MAXPATHLEN, "/fsbench.%d", i);
+}
+
+void
+metadata(void)
+{
+	char path[MAXPATHLEN];
+	struct Stat st;
+	struct File f;
+	uint64_t start;
+	int i, fd, n, r;
+
+	memset(buf, 'x', 100);
+	start = read_tsc();
+	for (i = 0; i < nfiles; i++) {
+		smallname(path, i);
+		fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC);
+		if ((r = write(fd, buf, 100)) != 100)
+			panic("write %s: %e", path, r < 0 ? r : -E_NO_DISK);
+		close(fd);
+	}
+	report_ops("create", nfiles, elapsed_us(start));
+
+	start = read_tsc();
+	for (i = 0; i < nfiles; i++) {
+		smallname(path, i);
+		close(xopen(path, O_RDONLY));
+	}
+	report_ops("open", nfiles, elapsed_us(start));
+
+	start = read_tsc();
+	for (i = 0; i < nfiles; i++) {
+		smallname(path, i);
+		if ((r = stat(path, &st)) < 0)
+			panic("stat %s: %e", path, r);
+	}
+	report_ops("stat", nfiles, elapsed_us(start));
+
+	// Scan the root directory, which now holds the small files too
+	for (i = 0; i < 2; i++) {
+		if (i == 0)
+			dropcache();
+		start = read_tsc();
+		fd = xopen("/", O_RDONLY);
+		n = 0;
+		while ((r = readn(fd, &f, sizeof f)) == sizeof f)
+			n += f.f_name[0] != 0;
+		close(fd);
+		if (r != 0)
+			panic("reading /: %e", r < 0 ? r : -E_INVAL);
+		report(i == 0 ? "dirscan-cold" : "dirscan-warm",
+		       elapsed_us(start), "us");
+	}
+	report("dirscan-entries", n, "files");
+
+	start = read_tsc();
+	for (i = 0; i < nfiles; i++) {
+		smallname(path, i);
+		if ((r = remove(path)) < 0)
+			panic("remove %s: %e", path, r);
+	}
+	report_ops("remove", nfiles, elapsed_us(start));
+}
+
+void
+usage(void)
+{
+	cprintf("usage: fsbench [-s file-KB] [-n small-files] [-r random-reads]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 's':
+		filesize = strtol(ARGF(), 0, 0) * 1024;
+		break;
+	case 'n':
+		nfiles = strtol(ARGF(), 0, 0);
+		break;
+	case 'r':
+		nrand = strtol(ARGF(), 0, 0);
+		break;
+	}ARGEND
+
+	if (argc != 0 || filesize < MAXREQ || filesize % MAXREQ)
+		usage();
+
+	tsc_per_ms = tsc_calibrate();
+	report("tsc", tsc_per_ms, "cycles/ms");
+
+	for (i = 0; i < sizeof(reqsizes) / sizeof(reqsizes[0]); i++) {
+		seqwrite(reqsizes[i]);
+		seqread(reqsizes[i], 1);
+		seqread(reqsizes[i], 0);
+	}
+	randread(1);
+	randread(0);
+	if ((i = remove(BENCHFILE)) < 0)
+		panic("remove %s: %e", BENCHFILE, i);
+	metadata();
+
+	cprintf("fsbench done\n");
+}
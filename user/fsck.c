@@ -0,0 +1,207 @@
+// Check the file system's block allocation: every block reachable from
+// the root must be in range, marked in use, and used only once, and
+// every block marked in use should be reachable.
+// With -f, also report per-file fragmentation and how free space is
+// spread over the disk.  (fs/fsdefrag rewrites an image offline.)
+
+#include <inc/lib.h>
+
+int flag[256];
+
+uint32_t nblocks;
+uint32_t *bitmap;	// copy of the free-block bitmap (1 = free)
+uint8_t *nref;		// references to each block found in the tree
+int nerrors;
+
+char path[MAXPATHLEN];
+
+// Fragmentation totals
+int nfiles, nfragmented, nextents;
+
+bool
+isfree(uint32_t blockno)
+{
+	return (bitmap[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+void
+useblock(uint32_t blockno, const char *what)
+{
+	if (blockno >= nblocks) {
+		printf("%s: %s block %d out of range\n", path, what, blockno);
+		nerrors++;
+		return;
+	}
+	if (isfree(blockno)) {
+		printf("%s: %s block %d is marked free\n", path, what, blockno);
+		nerrors++;
+	}
+	if (nref[blockno]++) {
+		printf("%s: %s block %d is used more than once\n", path, what, blockno);
+		nerrors++;
+	}
+}
+
+// Account for the blocks of the open file fd and count its extents,
+// the runs of blocks that are consecutive both in the file and on disk.
+void
+checkfile(int fd, off_t size, bool isdir)
+{
+	uint32_t i, n, prev = 0;
+	int r, extents = 0;
+
+	if ((r = fbmap(fd, FSBMAP_INDIRECT)) < 0)
+		panic("bmap %s: %e", path, r);
+	if (r)
+		useblock(r, "indirect");
+
+	n = ROUNDUP(size, BLKSIZE) / BLKSIZE;
+	for (i = 0; i < n; i++) {
+		if ((r = fbmap(fd, i)) < 0)
+			panic("bmap %s: %e", path, r);
+		if (r == 0)
+			continue;
+		useblock(r, "data");
+		if (extents == 0 || r != prev + 1)
+			extents++;
+		prev = r;
+	}
+
+	nfiles++;
+	nextents += extents;
+	if (extents > 1) {
+		nfragmented++;
+		if (flag['f'])
+			printf("%6d blocks %4d extents  %s%s\n",
+			       n, extents, path, isdir ? "/" : "");
+	}
+}
+
+// Check the file at 'path' and, if it is a directory, everything
+// below it.  'path' is extended in place as we descend.
+void
+walk(void)
+{
+	int fd, n, len;
+	struct File f;
+	struct Stat st;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		panic("open %s: %e", path, fd);
+	if ((n = fstat(fd, &st)) < 0)
+		panic("stat %s: %e", path, n);
+	checkfile(fd, st.st_size, st.st_isdir);
+
+	len = strlen(path);
+	while (st.st_isdir && (n = readn(fd, &f, sizeof f)) == sizeof f) {
+		if (!f.f_name[0])
+			continue;
+		if (len + 1 + strlen(f.f_name) >= MAXPATHLEN) {
+			printf("%s: path too long\n", path);
+			nerrors++;
+			continue;
+		}
+		snprintf(path + len, MAXPATHLEN - len, "%s%s",
+			 path[len - 1] == '/' ? "" : "/", f.f_name);
+		walk();
+		path[len] = 0;
+	}
+	if (st.st_isdir && n != 0)
+		panic("reading directory %s: %e", path, n < 0 ? n : -E_INVAL);
+	close(fd);
+}
+
+// Report blocks marked in use that nothing refers to, and, with -f,
+// a histogram of the lengths of the free runs.
+void
+checkfree(uint32_t first)
+{
+	uint32_t b, run = 0, nfree = 0, nruns = 0, largest = 0;
+	int hist[32], i, leaked = 0;
+
+	memset(hist, 0, sizeof(hist));
+	for (b = first; b <= nblocks; b++) {
+		if (b < nblocks && isfree(b)) {
+			run++;
+			continue;
+		}
+		if (b < nblocks && !nref[b]) {
+			if (leaked++ < 10)
+				printf("block %d is marked in use but unreferenced\n", b);
+		}
+		if (run) {
+			for (i = 0; (2 << i) <= run; i++)
+				;
+			hist[i]++;
+			nruns++;
+			nfree += run;
+			largest = MAX(largest, run);
+		}
+		run = 0;
+	}
+	if (leaked)
+		printf("%d blocks leaked\n", leaked);
+
+	if (!flag['f'])
+		return;
+	printf("free: %d blocks in %d extents, largest %d\n",
+	       nfree, nruns, largest);
+	for (i = 0; i < 32; i++)
+		if (hist[i])
+			printf("  %6d..%d: %d\n", 1 << i, (2 << i) - 1, hist[i]);
+}
+
+void
+usage(void)
+{
+	printf("usage: fsck [-f]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t i, nbitblocks;
+	int r;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'f':
+		flag[(uint8_t)ARGC()]++;
+		break;
+	}ARGEND
+
+	if (argc != 0)
+		usage();
+
+	if ((bitmap = malloc(BLKSIZE)) == NULL
+	    || (r = fsbitmap(0, bitmap)) < 0)
+		panic("reading bitmap: %e", bitmap ? r : -E_NO_MEM);
+	nblocks = r;
+	nbitblocks = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+	free(bitmap);
+	if ((bitmap = malloc(nbitblocks * BLKSIZE)) == NULL
+	    || (nref = malloc(nblocks)) == NULL)
+		panic("fsck: %e", -E_NO_MEM);
+	for (i = 0; i < nbitblocks; i++)
+		if ((r = fsbitmap(i, (char *) bitmap + i * BLKSIZE)) < 0)
+			panic("reading bitmap: %e", r);
+	memset(nref, 0, nblocks);
+
+	// The boot block, superblock and bitmap are always in use
+	strcpy(path, "(reserved)");
+	for (i = 0; i < 2 + nbitblocks; i++)
+		useblock(i, "reserved");
+
+	strcpy(path, "/");
+	walk();
+	checkfree(2 + nbitblocks);
+
+	if (flag['f'] && nfiles)
+		printf("%d of %d files fragmented, %d.%02d extents per file\n",
+		       nfragmented, nfiles, nextents / nfiles,
+		       nextents * 100 / nfiles % 100);
+	printf("fsck: %d files, %d blocks, %d errors\n",
+	       nfiles, nblocks, nerrors);
+}
@@ -0,0 +1,129 @@
+// Print the file server's statistics.  With an interval (in ms), print
+// what changed during each interval instead of the totals since boot.
+
+#include <inc/lib.h>
+
+const char *reqnames[NFSREQ] = {
+	[FSREQ_OPEN] =		"open",
+	[FSREQ_SET_SIZE] =	"set_size",
+	[FSREQ_READ] =		"read",
+	[FSREQ_WRITE] =		"write",
+	[FSREQ_STAT] =		"stat",
+	[FSREQ_FLUSH] =		"flush",
+	[FSREQ_REMOVE] =	"remove",
+	[FSREQ_SYNC] =		"sync",
+	[FSREQ_BMAP] =		"bmap",
+	[FSREQ_BITMAP] =	"bitmap",
+	[FSREQ_STATS] =		"stats",
+	[FSREQ_DROP_CACHE] =	"drop_cache",
+};
+
+struct Fsstats prev, cur;
+
+// Return the latency bucket below which 'pct' percent of the requests
+// in histogram 'lat' fall.
+int
+percentile(const uint32_t *lat, uint32_t n, int pct)
+{
+	uint32_t seen = 0;
+	int i;
+
+	for (i = 0; i < FSSTAT_NLAT; i++) {
+		seen += lat[i];
+		if (seen * 100 >= n * pct)
+			break;
+	}
+	return i;
+}
+
+// Print 'num' / 'den' with one decimal.
+void
+ratio(uint32_t num, uint32_t den)
+{
+	if (den == 0)
+		printf("-");
+	else
+		printf("%d.%d", num / den, num * 10 / den % 10);
+}
+
+void
+show(const struct Fsstats *a, const struct Fsstats *b)
+{
+	uint32_t lat[FSSTAT_NLAT], n, hits, misses;
+	int i, j;
+
+	printf("request     count  p50 cycles p99 cycles\n");
+	for (i = 1; i < NFSREQ; i++) {
+		if ((n = a->fs_nreq[i] - b->fs_nreq[i]) == 0)
+			continue;
+		for (j = 0; j < FSSTAT_NLAT; j++)
+			lat[j] = a->fs_lat[i][j] - b->fs_lat[i][j];
+		printf("%-10s %6d     < 2^%2d     < 2^%2d\n",
+		       reqnames[i] ? reqnames[i] : "?", n,
+		       percentile(lat, n, 50) + 1, percentile(lat, n, 99) + 1);
+	}
+
+	hits = a->fs_bc_hits - b->fs_bc_hits;
+	misses = a->fs_bc_misses - b->fs_bc_misses;
+	printf("bcache: %d hits, %d misses, ", hits, misses);
+	ratio(hits * 100, hits + misses);
+	printf("%% hit\n");
+	printf("blocks: %d read, %d written\n",
+	       a->fs_blocks_read - b->fs_blocks_read,
+	       a->fs_blocks_written - b->fs_blocks_written);
+	n = a->fs_disk_reads - b->fs_disk_reads;
+	printf("disk: %d reads (", n);
+	ratio(a->fs_sectors_read - b->fs_sectors_read, n);
+	n = a->fs_disk_writes - b->fs_disk_writes;
+	printf(" sectors/call), %d writes (", n);
+	ratio(a->fs_sectors_written - b->fs_sectors_written, n);
+	printf(" sectors/call)\n");
+	printf("now: %d blocks cached, %d dirty, %d files open\n",
+	       a->fs_cached_blocks, a->fs_dirty_blocks, a->fs_open_files);
+}
+
+void
+usage(void)
+{
+	printf("usage: fsstat [-n count] [interval-ms]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r, count = -1;
+	unsigned interval, next;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'n':
+		count = strtol(ARGF(), 0, 0);
+		break;
+	}ARGEND
+
+	if (argc > 1)
+		usage();
+
+	if ((r = fsgetstats(&cur)) < 0)
+		panic("fsgetstats: %e", r);
+	if (argc == 0) {
+		show(&cur, &prev);
+		return;
+	}
+
+	interval = strtol(argv[0], 0, 0);
+	next = sys_time_msec() + interval;
+	while (count < 0 || count-- > 0) {
+		while (sys_time_msec() < next)
+			sys_yield();
+		next += interval;
+
+		prev = cur;
+		if ((r = fsgetstats(&cur)) < 0)
+			panic("fsgetstats: %e", r);
+		show(&cur, &prev);
+		printf("\n");
+	}
+}
@@ -305,7 +305,7 @@ handle_client(int sock)
 int
 umain(void)
 {
-	int serversock, clientsock;
+	int serversock, clientsock, one;
 	struct sockaddr_in server, client;
 
 	binaryname = "jhttpd";
@@ -314,6 +314,12 @@ umain(void)
 	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
 		die("Failed to create socket");
 
+	// Rebind the port even while our last connections are in TIME-WAIT
+	one = 1;
+	if (setsockopt(serversock, SOL_SOCKET, SO_REUSEADDR, &one,
+		       sizeof(one)) < 0)
+		cprintf("httpd: cannot set SO_REUSEADDR\n");
+
 	// Construct the server sockaddr_in structure
 	memset(&server, 0, sizeof(server));		// Clear struct
 	server.sin_family = AF_INET;			// Internet/IP
@@ -342,6 +348,10 @@ umain(void)
 		{
 			die("Failed to accept client connection");
 		}
+		// The response goes out in several small writes; Nagle
+		// would hold each behind the ACK of the one before.
+		setsockopt(clientsock, IPPROTO_TCP, TCP_NODELAY, &one,
+			   sizeof(one));
 		handle_client(clientsock);
 	}
 
@@ -0,0 +1,253 @@
+// Kernel microbenchmarks.  Each operation is timed with the TSC and
+// reported as percentiles, one result per line:
+//	kbench <test>.<percentile> <value> <unit>
+// so that grade-kbench.sh can compare a run against a saved baseline.
+// Timer interrupts land in some samples; they show up in the high
+// percentiles, so compare medians for small changes.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSAMPLES	1000
+#define NFORK		32
+#define NSPAWN		16
+#define NCOW		128		// pages written in the COW test
+#define PIPEBYTES	(256 * 1024)
+
+// Scratch address range for the page and COW tests
+#define BENCHVA		((char *) 0x20000000)
+
+uint32_t samples[NSAMPLES];
+char buf[PGSIZE];
+
+// Sort the first n samples and report their percentiles.
+void
+report(const char *test, int n)
+{
+	static const int pcts[] = { 50, 90, 99 };
+	uint32_t v;
+	int i, j, gap;
+
+	for (gap = n / 2; gap > 0; gap /= 2)
+		for (i = gap; i < n; i++) {
+			v = samples[i];
+			for (j = i; j >= gap && samples[j - gap] > v; j -= gap)
+				samples[j] = samples[j - gap];
+			samples[j] = v;
+		}
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+		cprintf("kbench %s.p%d %d cycles\n",
+			test, pcts[i], samples[(n - 1) * pcts[i] / 100]);
+}
+
+void
+bench_syscall(void)
+{
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < NSAMPLES; i++) {
+		start = read_tsc();
+		sys_getenvid();
+		samples[i] = read_tsc() - start;
+	}
+	report("null-syscall", NSAMPLES);
+}
+
+// The idle environment is always runnable, so each sys_yield switches
+// away and back.
+void
+bench_yield(void)
+{
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < NSAMPLES; i++) {
+		start = read_tsc();
+		sys_yield();
+		samples[i] = read_tsc() - start;
+	}
+	report("yield", NSAMPLES);
+}
+
+// Time round trips to a child that sends every value (and page) back.
+void
+bench_ipc(bool withpage)
+{
+	uint64_t start;
+	envid_t child;
+	int i, r, perm = withpage ? PTE_P | PTE_U | PTE_W : 0;
+	void *pg = withpage ? BENCHVA : NULL;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		for (i = 0; i < NSAMPLES; i++) {
+			r = ipc_recv(NULL, pg, NULL);
+			ipc_send(env->env_parent_id, r, pg, perm);
+		}
+		exit();
+	}
+
+	// Allocate the page after the fork: a copy-on-write page is not
+	// writable, so it could not be sent with PTE_W.
+	if (withpage && (r = sys_page_alloc(0, BENCHVA, perm)) < 0)
+		panic("sys_page_alloc: %e", r);
+	for (i = 0; i < NSAMPLES; i++) {
+		start = read_tsc();
+		ipc_send(child, i, pg, perm);
+		ipc_recv(NULL, pg, NULL);
+		samples[i] = read_tsc() - start;
+	}
+	wait(child);
+	if (withpage)
+		sys_page_unmap(0, BENCHVA);
+	report(withpage ? "ipc-page" : "ipc", NSAMPLES);
+}
+
+void
+bench_pages(void)
+{
+	static uint32_t alloc[NSAMPLES], map[NSAMPLES], unmap[NSAMPLES];
+	int i, r, perm = PTE_P | PTE_U | PTE_W;
+	uint64_t t0, t1, t2, t3;
+
+	for (i = 0; i < NSAMPLES; i++) {
+		t0 = read_tsc();
+		r = sys_page_alloc(0, BENCHVA, perm);
+		t1 = read_tsc();
+		if (r < 0 || (r = sys_page_map(0, BENCHVA, 0, BENCHVA + PGSIZE, perm)) < 0)
+			panic("page alloc/map: %e", r);
+		t2 = read_tsc();
+		sys_page_unmap(0, BENCHVA + PGSIZE);
+		t3 = read_tsc();
+		sys_page_unmap(0, BENCHVA);
+		alloc[i] = t1 - t0;
+		map[i] = t2 - t1;
+		unmap[i] = t3 - t2;
+	}
+	memmove(samples, alloc, sizeof alloc);
+	report("page-alloc", NSAMPLES);
+	memmove(samples, map, sizeof map);
+	report("page-map", NSAMPLES);
+	memmove(samples, unmap, sizeof unmap);
+	report("page-unmap", NSAMPLES);
+}
+
+// Write to pages that a fork left copy-on-write, timing the whole
+// fault: trap, upcall to pgfault, copy, remap and return.
+void
+bench_cow(void)
+{
+	uint64_t start;
+	envid_t child;
+	int i, r;
+
+	for (i = 0; i < NCOW; i++)
+		if ((r = sys_page_alloc(0, BENCHVA + i * PGSIZE,
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		ipc_recv(NULL, NULL, NULL);
+		exit();
+	}
+
+	for (i = 0; i < NCOW; i++) {
+		start = read_tsc();
+		BENCHVA[i * PGSIZE] = 1;
+		samples[i] = read_tsc() - start;
+	}
+	ipc_send(child, 0, NULL, 0);
+	wait(child);
+	for (i = 0; i < NCOW; i++)
+		sys_page_unmap(0, BENCHVA + i * PGSIZE);
+	report("cow-fault", NCOW);
+}
+
+void
+bench_fork(void)
+{
+	uint64_t start;
+	envid_t child;
+	int i;
+
+	for (i = 0; i < NFORK; i++) {
+		start = read_tsc();
+		if ((child = fork()) < 0)
+			panic("fork: %e", child);
+		if (child == 0)
+			exit();
+		samples[i] = read_tsc() - start;
+		wait(child);
+	}
+	report("fork", NFORK);
+}
+
+// Spawn this program with -x, which exits at once, and wait for it.
+void
+bench_spawn(void)
+{
+	uint64_t start;
+	envid_t child;
+	int i;
+
+	for (i = 0; i < NSPAWN; i++) {
+		start = read_tsc();
+		if ((child = spawnl("/kbench", "kbench", "-x", 0)) < 0)
+			panic("spawn /kbench: %e", child);
+		wait(child);
+		samples[i] = read_tsc() - start;
+	}
+	report("spawn-wait", NSPAWN);
+}
+
+// Stream PIPEBYTES through a pipe to a child and report cycles per KB.
+void
+bench_pipe(void)
+{
+	uint64_t start;
+	envid_t child;
+	int p[2], r, n;
+
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		close(p[1]);
+		while ((r = read(p[0], buf, sizeof buf)) > 0)
+			;
+		exit();
+	}
+
+	close(p[0]);
+	start = read_tsc();
+	for (n = 0; n < PIPEBYTES; n += sizeof buf)
+		if ((r = write(p[1], buf, sizeof buf)) != sizeof buf)
+			panic("pipe write: %e", r < 0 ? r : -E_INVAL);
+	close(p[1]);
+	wait(child);
+	cprintf("kbench pipe %d cycles/KB\n",
+		(uint32_t) ((read_tsc() - start) / (PIPEBYTES / 1024)));
+}
+
+void
+umain(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "-x") == 0)
+		return;
+
+	bench_syscall();
+	bench_yield();
+	bench_ipc(0);
+	bench_ipc(1);
+	bench_pages();
+	bench_cow();
+	bench_fork();
+	bench_spawn();
+	bench_pipe();
+
+	cprintf("kbench done\n");
+}
@@ -0,0 +1,64 @@
+// Set SO_RCVBUF, SO_SNDBUF and TCP_NODELAY on a TCP socket through the
+// network server (NSREQ_SETSOCKOPT) and read each back
+// (NSREQ_GETSOCKOPT).  Prints "testsockopt: OK" if every value
+// round-trips, and a receive buffer too large for the window is cut
+// down rather than taken or refused.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+
+static int nfail;
+
+// Set level/optname to val on sock, and return what it reads back as,
+// or -1 if either call fails.
+static int
+setget(int sock, int level, int optname, const char *name, int val)
+{
+	socklen_t len = sizeof(int);
+	int got = 0, r;
+
+	if ((r = setsockopt(sock, level, optname, &val, sizeof(val))) < 0) {
+		cprintf("testsockopt: setsockopt %s %d: %d\n", name, val, r);
+		return -1;
+	}
+	if ((r = getsockopt(sock, level, optname, &got, &len)) < 0
+	    || len != sizeof(int)) {
+		cprintf("testsockopt: getsockopt %s: %d, length %d\n", name, r, len);
+		return -1;
+	}
+	return got;
+}
+
+static void
+expect(const char *what, int ok)
+{
+	if (!ok) {
+		cprintf("testsockopt: %s: wrong\n", what);
+		nfail++;
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	int sock, r;
+
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		panic("testsockopt: socket: %e", sock);
+
+	r = setget(sock, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", 8192);
+	expect("SO_RCVBUF 8192", r == 8192);
+	r = setget(sock, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", 4096);
+	expect("SO_SNDBUF 4096", r == 4096);
+	r = setget(sock, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1);
+	expect("TCP_NODELAY on", r > 0);
+	r = setget(sock, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 0);
+	expect("TCP_NODELAY off", r == 0);
+	// Clamped to the largest window lwIP offers
+	r = setget(sock, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", 1 << 24);
+	expect("SO_RCVBUF 1<<24", r > 8192 && r < (1 << 24));
+
+	close(sock);
+	if (nfail == 0)
+		cprintf("testsockopt: OK\n");
+}